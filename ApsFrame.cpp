@@ -0,0 +1,49 @@
+#include "ApsFrame.h"
+
+#include <cstring>
+
+namespace {
+
+std::atomic<uint64_t> aps_frames{0}, aps_copies{0}, aps_bytes{0};
+
+}
+
+PooledImagePtr makeApsImage(const std_msgs::Header &hd, const cv::Mat &img)
+{
+    // message, control block and pixels all come from BufferPool
+    std::shared_ptr<PooledImage> msg = std::allocate_shared<PooledImage>(PoolAllocator<PooledImage>());
+    msg->header.seq = hd.seq;
+    msg->header.stamp = hd.stamp;
+    msg->height = img.rows;
+    msg->width = img.cols;
+    msg->encoding = "mono16";
+    msg->is_bigendian = 0;
+    msg->step = img.cols * img.elemSize();
+    // PoolAllocator leaves bytes uninitialized, they are all written below
+    msg->data.resize((size_t)msg->step * img.rows);
+    uint8_t *dst = msg->data.data();
+    if (img.isContinuous()) {
+        memcpy(dst, img.data, msg->data.size());
+    } else {
+        for (int r = 0; r < img.rows; r++)
+            memcpy(dst + (size_t)r * msg->step, img.ptr(r), msg->step);
+    }
+    aps_frames.fetch_add(1, std::memory_order_relaxed);
+    aps_copies.fetch_add(1, std::memory_order_relaxed);
+    aps_bytes.fetch_add(msg->data.size(), std::memory_order_relaxed);
+    return msg;
+}
+
+cv::Mat apsImageView(const PooledImage &msg)
+{
+    return cv::Mat(msg.height, msg.width, CV_16UC1, (void *)msg.data.data(), msg.step);
+}
+
+ApsCopyStats apsCopyStats()
+{
+    ApsCopyStats s;
+    s.frames = aps_frames.load(std::memory_order_relaxed);
+    s.copies = aps_copies.load(std::memory_order_relaxed);
+    s.bytes = aps_bytes.load(std::memory_order_relaxed);
+    return s;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include <opencv2/core/core.hpp>
+#include <sensor_msgs/Image.h>
+
+#include "EventPool.h"
+
+// APS frame message with its pixels in BufferPool memory. Serializes exactly
+// like sensor_msgs/Image (same generated template), so the bag sees no
+// difference. Shared read-only between the bag writer and the preview.
+typedef sensor_msgs::Image_<PoolAllocator<void> > PooledImage;
+typedef std::shared_ptr<const PooledImage> PooledImagePtr;
+
+// Builds the mono16 message for one frame. This is the only copy of the
+// pixels out of SDK memory on the way to the bag.
+PooledImagePtr makeApsImage(const std_msgs::Header &hd, const cv::Mat &img);
+
+// The message's pixels as a Mat, without copying. Valid while msg lives.
+cv::Mat apsImageView(const PooledImage &msg);
+
+// Frames made, pixel copies and bytes copied by makeApsImage.
+struct ApsCopyStats {
+    uint64_t frames = 0;
+    uint64_t copies = 0;
+    uint64_t bytes = 0;
+};
+ApsCopyStats apsCopyStats();
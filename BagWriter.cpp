@@ -0,0 +1,508 @@
+#include "BagWriter.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+
+#include "EventCodec.h"
+#include "Telemetry.h"
+#include "MemoryBudget.h"
+#include "Startup.h"
+
+using namespace std::chrono;
+
+static double secondsSince(steady_clock::time_point t)
+{
+    return duration_cast<duration<double> >(steady_clock::now() - t).count();
+}
+
+BagWriter::BagWriter(size_t evt_queue_size, OverflowPolicy evt_policy,
+                     size_t batch_bytes, milliseconds batch_time)
+    : events_(evt_queue_size, evt_policy),
+      batch_bytes_(batch_bytes),
+      batch_time_(batch_time)
+{
+}
+
+BagWriter::~BagWriter()
+{
+    stop();
+}
+
+static void addStats(CompressedBagWriter::Stats &to, const CompressedBagWriter::Stats &s)
+{
+    to.messages += s.messages;
+    to.chunks += s.chunks;
+    to.raw_bytes += s.raw_bytes;
+    to.stored_bytes += s.stored_bytes;
+    to.compress_sec += s.compress_sec;
+    to.blocked_sec += s.blocked_sec;
+    to.commits += s.commits;
+    to.sync_sec += s.sync_sec;
+    to.sync_max_sec = std::max(to.sync_max_sec, s.sync_max_sec);
+}
+
+void BagWriter::Output::close()
+{
+    if (zbag) zbag->close();
+    else if (bag) bag->close();
+    if (evt_sink) evt_sink->close();
+    if (!journal || journal_path.empty()) return;
+    // the journal goes once the files it stands for are on disk
+    for (const std::string &f : files)
+        fsyncPath(f);
+    journal->close();
+    unlink(journal_path.c_str());
+    journal_path.clear();
+}
+
+void BagWriter::setJournal(const JournalConfig &cfg, std::function<void()> thread_init)
+{
+    journal_ = cfg;
+    jthread_init_ = thread_init;
+    // wake often enough to commit on time
+    if (cfg.max_ms > 0)
+        batch_time_ = std::min(batch_time_, milliseconds(std::max(1, cfg.max_ms / 2)));
+}
+
+bool BagWriter::openJournal(Output &out, int segment)
+{
+    CompressedBagWriter::Options opts;
+    opts.codec = chunkCodecAvailable(CHUNK_LZ4) ? CHUNK_LZ4 : CHUNK_RAW;
+    opts.threads = 1;
+    out.journal_path = segmentPath(path_, segment) + ".journal";
+    out.journal.reset(new CompressedBagWriter(opts));
+    out.journal->setThreadInit(jthread_init_);
+    if (!out.journal->open(out.journal_path)) {
+        out.journal.reset();
+        return false;
+    }
+    return true;
+}
+
+bool BagWriter::setRotation(const RotateConfig &cfg, const std::string &manifest_path,
+                            std::function<void()> thread_init)
+{
+    rotate_ = cfg;
+    if (!rotate_.enabled()) return true;
+    return closer_.start(manifest_path, thread_init);
+}
+
+// segment -1: not rotating
+bool BagWriter::openOutput(Output &out, int segment)
+{
+    const std::string path = segmentPath(path_, segment);
+    if (compressed_) {
+        out.zbag.reset(new CompressedBagWriter(zopts_));
+        out.zbag->setThreadInit(zthread_init_);
+        if (!out.zbag->open(path)) {
+            out.zbag.reset();
+            return false;
+        }
+    } else {
+        out.bag.reset(new rosbag::Bag);
+        try {
+            out.bag->open(path, rosbag::bagmode::Write);
+        } catch (std::exception &e) {
+            printf(" * ERROR! cannot open %s: %s\n", path.c_str(), e.what());
+            out.bag.reset();
+            return false;
+        }
+    }
+    segment_ = SegmentInfo();
+    segment_.index = segment;
+    segment_.files.push_back(path);
+    if (out.evt_sink) {
+        const std::string evt_path = segmentPath(evt_path_, segment);
+        if (!out.evt_sink->open(evt_path)) {
+            printf(" * ERROR! cannot open %s\n", evt_path.c_str());
+            return false;
+        }
+        segment_.files.push_back(evt_path);
+    }
+    out.files = segment_.files;
+    // a .bagz with everything in it commits itself
+    if (journal_.enabled() && (!compressed_ || out.evt_sink))
+        return openJournal(out, segment);
+    return true;
+}
+
+bool BagWriter::open(const std::string &path)
+{
+    path_ = path;
+    compressed_ = false;
+    return openOutput(out_, rotate_.enabled() ? 0 : -1);
+}
+
+bool BagWriter::openCompressed(const std::string &path, const CompressedBagWriter::Options &opts,
+                               std::function<void()> thread_init)
+{
+    path_ = path;
+    compressed_ = true;
+    zopts_ = opts;
+    zthread_init_ = thread_init;
+    return openOutput(out_, rotate_.enabled() ? 0 : -1);
+}
+
+bool BagWriter::setEventSink(EventSink *sink, const std::string &path)
+{
+    out_.evt_sink.reset(sink);
+    evt_path_ = path;
+    const std::string seg_path = segmentPath(path, rotate_.enabled() ? 0 : -1);
+    if (!sink->open(seg_path)) {
+        printf(" * ERROR! cannot open %s\n", seg_path.c_str());
+        return false;
+    }
+    segment_.files.push_back(seg_path);
+    out_.files.push_back(seg_path);
+    if (journal_.enabled() && !out_.journal)
+        return openJournal(out_, rotate_.enabled() ? 0 : -1);
+    return true;
+}
+
+// Writer thread, between batches. Opening the next files is quick; closing
+// the old ones (rosbag index, compressor threads, fsync) is left to closer_.
+void BagWriter::rotate()
+{
+    auto t0 = steady_clock::now();
+    // the old segment stays covered until the closer has synced it
+    if (journal_.enabled()) commit();
+    std::shared_ptr<Output> old = std::make_shared<Output>(std::move(out_));
+    const SegmentInfo finished = segment_;
+    out_ = Output();
+    if (old->evt_sink) out_.evt_sink.reset(old->evt_sink->create());
+    if (!openOutput(out_, finished.index + 1)) {
+        // keep writing into the current segment
+        printf(" * WARNING! cannot open segment %d, no more rotation\n", finished.index + 1);
+        out_ = std::move(*old);
+        segment_ = finished;
+        rotate_failed_ = true;
+        return;
+    }
+    closer_.push(finished, [this, old] {
+        old->close();
+        std::lock_guard<std::mutex> lck(m_stats_);
+        if (old->zbag) addStats(zstats_closed_, old->zbag->stats());
+        if (old->journal) addStats(jstats_closed_, old->journal->stats());
+    });
+    const double dt = secondsSince(t0);
+    std::lock_guard<std::mutex> lck(m_stats_);
+    stats_.segments++;
+    stats_.rotate_max_sec = std::max(stats_.rotate_max_sec, dt);
+}
+
+void BagWriter::setRebatch(const RebatchConfig &cfg)
+{
+    if (!cfg.enabled()) {
+        rebatch_.reset();
+        return;
+    }
+    rebatch_.reset(new EventRebatcher(cfg));
+    // wake often enough to honour the latency bound
+    batch_time_ = std::min(batch_time_, milliseconds(std::max<uint32_t>(1, cfg.max_latency_ms / 2)));
+}
+
+// Group commit of what the writer has written, see JournalConfig.
+void BagWriter::commit()
+{
+    if (out_.journal) out_.journal->commit();
+    else if (out_.zbag) out_.zbag->commit();
+    uncommitted_ = 0;
+    last_commit_ = steady_clock::now();
+    std::lock_guard<std::mutex> lck(m_stats_);
+    stats_.commits++;
+}
+
+void BagWriter::start()
+{
+    stop_ = false;
+    t_start_ = steady_clock::now();
+    last_commit_ = t_start_;
+    thread_ = std::thread(&BagWriter::run, this);
+}
+
+void BagWriter::stop()
+{
+    if (!thread_.joinable()) return;
+    stop_ = true;
+    wake_.notify_one();
+    thread_.join();
+    out_.close();
+    if (rotate_.enabled()) {
+        // the last segment is closed already; fsync and manifest
+        closer_.push(segment_, nullptr);
+        closer_.stop();
+    }
+    std::lock_guard<std::mutex> lck(m_stats_);
+    stats_.elapsed_sec = secondsSince(t_start_);
+    if (rotate_.enabled()) stats_.segments++;
+}
+
+bool BagWriter::pushEvents(PooledEventArray &&msg)
+{
+    size_t bytes = ros::serialization::serializationLength(msg);
+    if (!events_.push(std::move(msg))) return false;
+    telemetry::depth(telemetry::EVENTS, events_.size());
+    addPending(bytes);
+    return true;
+}
+
+void BagWriter::pushImu(sensor_msgs::Imu &&msg)
+{
+    {
+        std::lock_guard<std::mutex> lck(m_imu_);
+        imu_buf_.emplace_back(std::move(msg));
+        telemetry::depth(telemetry::IMU, imu_buf_.size());
+        membudget::setBytes(telemetry::IMU, imu_buf_.size() * sizeof(sensor_msgs::Imu));
+    }
+    addPending(sizeof(sensor_msgs::Imu));
+}
+
+void BagWriter::pushImage(PooledImagePtr msg)
+{
+    size_t bytes = msg->data.size();
+    {
+        std::lock_guard<std::mutex> lck(m_img_);
+        img_buf_.emplace_back(std::move(msg));
+        telemetry::depth(telemetry::APS, img_buf_.size());
+    }
+    addPending(bytes);
+}
+
+void BagWriter::addPending(size_t bytes)
+{
+    // Only the push that crosses the threshold wakes the writer. A notify that
+    // races with the writer going to sleep is picked up by the batch timeout.
+    size_t before = pending_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    if (before < batch_bytes_ && before + bytes >= batch_bytes_)
+        wake_.notify_one();
+}
+
+void BagWriter::run()
+{
+    if (thread_init_) thread_init_();
+    for (;;) {
+        auto t_wait = steady_clock::now();
+        {
+            std::unique_lock<std::mutex> lck(m_wake_);
+            wake_.wait_for(lck, batch_time_, [this] {
+                return stop_ || pending_bytes_.load(std::memory_order_relaxed) >= batch_bytes_;
+            });
+        }
+        double idle = secondsSince(t_wait);
+        {
+            std::lock_guard<std::mutex> lck(m_stats_);
+            stats_.idle_sec += idle;
+        }
+
+        bool wrote = writeAll(stop_);
+        if (stop_ && !wrote) {
+            logWriteGap();
+            break;
+        }
+        if (!stop_ && rotate_.enabled() && !rotate_failed_ && segment_.messages &&
+            rotate_.due(segment_.bytes, segment_.opened))
+            rotate();
+        if (!stop_ && journal_.enabled() && uncommitted_ > 0 &&
+            ((journal_.max_bytes > 0 && uncommitted_ >= journal_.max_bytes) ||
+             (journal_.max_ms > 0 && secondsSince(last_commit_) * 1e3 >= journal_.max_ms)))
+            commit();
+    }
+}
+
+bool BagWriter::writeAll(bool flush)
+{
+    // Everything queued so far is written below; later pushes count anew.
+    pending_bytes_.store(0, std::memory_order_relaxed);
+
+    std::vector<sensor_msgs::Imu> &imu = imu_out_;
+    std::vector<PooledImagePtr> &img = img_out_;
+    imu.clear();
+    {
+        std::lock_guard<std::mutex> lck(m_imu_);
+        imu.swap(imu_buf_);
+        membudget::setBytes(telemetry::IMU, 0);
+    }
+    {
+        std::lock_guard<std::mutex> lck(m_img_);
+        img.swap(img_buf_);
+    }
+
+    uint64_t n = 0, bytes = 0;
+    auto t_write = steady_clock::now();
+
+    PooledEventArray event_msgs;
+    while (events_.pop(event_msgs)) {
+        logQueueGap(event_msgs);
+        if (!rebatch_) {
+            bytes += writeEvents(event_msgs);
+            n++;
+            continue;
+        }
+        rebatch_->add(std::move(event_msgs), steady_clock::now(), rebatched_);
+        for (auto &m : rebatched_) {
+            bytes += writeEvents(m);
+            n++;
+        }
+        rebatched_.clear();
+    }
+    if (rebatch_) {
+        if (flush)
+            rebatch_->flush(rebatched_);
+        else
+            rebatch_->poll(steady_clock::now(), rebatched_);
+        for (auto &m : rebatched_) {
+            bytes += writeEvents(m);
+            n++;
+        }
+        rebatched_.clear();
+    }
+    for (auto &m : imu) {
+        writeMsg("/dvs/imu", m.header.stamp, m);
+        uint64_t len = ros::serialization::serializationLength(m);
+        segment_.add(timeToUs(m.header.stamp), len);
+        telemetry::latency(telemetry::IMU, telemetry::WRITTEN, timeToUs(m.header.stamp));
+        telemetry::written(telemetry::IMU, 1, len);
+        bytes += len;
+        n++;
+    }
+    for (auto &p : img) {
+        const PooledImage &m = *p;
+        writeMsg("/dvs/image_raw", m.header.stamp, m);
+        uint64_t len = ros::serialization::serializationLength(m);
+        segment_.add(timeToUs(m.header.stamp), len);
+        telemetry::latency(telemetry::APS, telemetry::WRITTEN, timeToUs(m.header.stamp));
+        telemetry::written(telemetry::APS, 1, len);
+        bytes += len;
+        n++;
+    }
+    img.clear();    // hand the frames back to the pool now, not next batch
+    SPSCQueueStats qs = events_.stats();
+    telemetry::setDropped(telemetry::EVENTS, qs.dropped_oldest + qs.dropped_newest);
+
+    if (n == 0) return false;
+    uncommitted_ += bytes;
+
+    std::lock_guard<std::mutex> lck(m_stats_);
+    stats_.write_sec += secondsSince(t_write);
+    stats_.messages += n;
+    stats_.bytes += bytes;
+    stats_.batches++;
+    return true;
+}
+
+// Packets the event queue dropped since the last one popped: the gap lies
+// between that packet and this one.
+void BagWriter::logQueueGap(const PooledEventArray &msg)
+{
+    SPSCQueueStats qs = events_.stats();
+    uint64_t lost = qs.dropped_oldest + qs.dropped_newest;
+    uint64_t first = msg.events.empty() ? timeToUs(msg.header.stamp) : timeToUs(msg.events.front().ts);
+    if (lost != evt_lost_)
+        membudget::logGap(telemetry::EVENTS, "queue_overflow", last_evt_us_, first, lost - evt_lost_);
+    evt_lost_ = lost;
+    last_evt_us_ = msg.events.empty() ? first : timeToUs(msg.events.back().ts);
+}
+
+// A run of failed writes becomes one gap, logged once the output recovers
+// or at stop.
+void BagWriter::logWriteGap()
+{
+    if (fail_n_ == 0) return;
+    membudget::logGap(telemetry::EVENTS, "write_failed", fail_first_us_, fail_last_us_, fail_n_);
+    fail_n_ = 0;
+}
+
+uint64_t BagWriter::writeEvents(const PooledEventArray &msg)
+{
+    uint64_t len;
+    if (out_.evt_sink) {
+        uint64_t before = out_.evt_sink->bytes();
+        if (!out_.evt_sink->write(msg)) {
+            uint64_t first = msg.events.empty() ? timeToUs(msg.header.stamp) : timeToUs(msg.events.front().ts);
+            if (fail_n_++ == 0) fail_first_us_ = first;
+            fail_last_us_ = msg.events.empty() ? first : timeToUs(msg.events.back().ts);
+            uint64_t failures;
+            {
+                std::lock_guard<std::mutex> lck(m_stats_);
+                failures = ++stats_.sink_failures;
+            }
+            if (failures == 1)
+                printf(" * WARNING! event packet %u could not be written, disk full?\n", msg.header.seq);
+            return 0;
+        }
+        logWriteGap();
+        len = out_.evt_sink->bytes() - before;
+        if (out_.journal) out_.journal->write("/dvs/events", msg.header.stamp, msg);
+    } else {
+        writeMsg("/dvs/events", msg.header.stamp, msg);
+        len = ros::serialization::serializationLength(msg);
+    }
+    segment_.add(timeToUs(msg.header.stamp), len);
+    telemetry::latency(telemetry::EVENTS, telemetry::WRITTEN, timeToUs(msg.header.stamp));
+    telemetry::written(telemetry::EVENTS, 1, len);
+    if (!first_written_ && !msg.events.empty()) {
+        first_written_ = true;
+        startup::mark("DVS first event written");
+    }
+    return len;
+}
+
+BagWriter::Stats BagWriter::stats() const
+{
+    std::lock_guard<std::mutex> lck(m_stats_);
+    Stats s = stats_;
+    if (thread_.joinable())
+        s.elapsed_sec = secondsSince(t_start_);
+    return s;
+}
+
+void BagWriter::printStats() const
+{
+    Stats s = stats();
+    double t = s.elapsed_sec > 0 ? s.elapsed_sec : 1;
+    printf("Bag writer: %lu msgs in %lu batches, %.1f MB in %.1f s (%.2f MB/s, %.0f msg/s)\n",
+        s.messages, s.batches, s.bytes / 1e6, s.elapsed_sec, s.bytes / 1e6 / t, s.messages / t);
+    printf("Bag writer: %.2f s blocked in bag.write (%.1f%%), %.2f s waiting for data\n",
+        s.write_sec, 100.0 * s.write_sec / t, s.idle_sec);
+    if (s.sink_failures)
+        printf(" * WARNING! %lu event packets could not be written\n", s.sink_failures);
+    if (s.segments)
+        printf("Bag writer: %d segments, at most %.1f ms to switch, at most %.0f ms to close one in the background\n",
+            s.segments, 1e3 * s.rotate_max_sec, 1e3 * closer_.maxCloseSec());
+    if (out_.zbag) {
+        CompressedBagWriter::Stats zs = out_.zbag->stats();
+        {
+            std::lock_guard<std::mutex> lck(m_stats_);
+            addStats(zs, zstats_closed_);
+        }
+        printf("Bag compression (%d threads): %lu chunks, %.1f MB -> %.1f MB (ratio %.2f), %.2f s compressing, %.2f s waiting for a free slot\n",
+            out_.zbag->threads(), zs.chunks, zs.raw_bytes / 1e6, zs.stored_bytes / 1e6,
+            zs.stored_bytes ? (double)zs.raw_bytes / zs.stored_bytes : 0.0, zs.compress_sec, zs.blocked_sec);
+    }
+    if (journal_.enabled()) {
+        CompressedBagWriter::Stats js;
+        {
+            std::lock_guard<std::mutex> lck(m_stats_);
+            js = jstats_closed_;
+        }
+        CompressedBagWriter *w = out_.journal ? out_.journal.get() : out_.zbag.get();
+        if (w) addStats(js, w->stats());
+        printf("Group commit: %lu commits, %lu fsyncs (%.1f ms avg, %.1f ms max)",
+            s.commits, js.commits, js.commits ? 1e3 * js.sync_sec / js.commits : 0.0, 1e3 * js.sync_max_sec);
+        if (out_.journal)
+            printf(", journal %.1f MB -> %.1f MB, removed after close", js.raw_bytes / 1e6, js.stored_bytes / 1e6);
+        printf("\n");
+    }
+
+    SPSCQueueStats qs = events_.stats();
+    printf("Event queue (%s, %lu slots): pushed %lu, written %lu, dropped oldest %lu, dropped newest %lu, blocked %lu, max depth %lu\n",
+        overflowPolicyName(events_.policy()), events_.capacity(), qs.pushed, qs.popped,
+        qs.dropped_oldest, qs.dropped_newest, qs.blocked, qs.high_water);
+    if (rebatch_) {
+        // only read once the writer thread has stopped
+        const EventRebatcher::Stats &rs = rebatch_->stats();
+        printf("Event rebatching: %lu packets -> %lu messages (%.0f events/msg), %lu packets split, %lu closed by latency bound\n",
+            rs.in_msgs, rs.out_msgs, rs.out_msgs ? (double)rs.events / rs.out_msgs : 0.0, rs.splits, rs.latency_flushes);
+    }
+}
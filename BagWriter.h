@@ -0,0 +1,165 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <rosbag/bag.h>
+#include <sensor_msgs/Imu.h>
+
+#include "SPSCQueue.h"
+#include "ApsFrame.h"
+#include "EventPool.h"
+#include "EventSink.h"
+#include "EventRebatcher.h"
+#include "CompressedBag.h"
+#include "Segments.h"
+
+// Crash safety by group commit: at least every max_ms, or after max_bytes of
+// messages, whatever was written becomes durable with one fdatasync. A .bagz
+// is committed in place (CompressedBag.h). Otherwise every message also goes
+// to <bag>.journal, a .bagz of its own that is deleted once the outputs are
+// closed and synced; after a crash, evb2bag turns it into a bag.
+struct JournalConfig {
+    int max_ms = 0;             // 0: no time limit
+    uint64_t max_bytes = 0;     // 0: no size limit
+    bool enabled() const { return max_ms > 0 || max_bytes > 0; }
+};
+
+// Background rosbag writer for the DVS streams. Callbacks hand messages over
+// and return immediately; the writer thread wakes once a batch worth of bytes
+// is pending (or the batch time runs out) and writes everything queued.
+class BagWriter
+{
+public:
+    struct Stats {
+        uint64_t messages = 0;
+        uint64_t bytes = 0;
+        uint64_t batches = 0;
+        double elapsed_sec = 0;
+        double write_sec = 0; // blocked inside bag.write
+        double idle_sec = 0;  // waiting for data
+        int segments = 0;     // with rotation
+        double rotate_max_sec = 0;  // longest stop of the writer to rotate
+        uint64_t commits = 0;       // with a journal
+        uint64_t sink_failures = 0; // event packets the events output failed to write
+    };
+
+    BagWriter(size_t evt_queue_size, OverflowPolicy evt_policy,
+              size_t batch_bytes, std::chrono::milliseconds batch_time);
+    ~BagWriter();
+
+    // Split the output into numbered segments, see Segments.h; thread_init
+    // runs on the closer thread. Call before open(); paths given later are
+    // those of the whole session.
+    bool setRotation(const RotateConfig &cfg, const std::string &manifest_path,
+                     std::function<void()> thread_init);
+    // Group commit, see JournalConfig; thread_init runs on the journal's
+    // compression thread. Call before open().
+    void setJournal(const JournalConfig &cfg, std::function<void()> thread_init);
+    bool open(const std::string &path);
+    // Chunks compressed on a thread pool (<folder>-dvs.bagz) instead of a
+    // rosbag, see CompressedBag.h. Instead of open().
+    bool openCompressed(const std::string &path, const CompressedBagWriter::Options &opts,
+                        std::function<void()> thread_init);
+    // Send /dvs/events to `sink` (opened here at `path`, then owned by the
+    // writer) instead of the bag. Call before start().
+    bool setEventSink(EventSink *sink, const std::string &path);
+    // Merge/split event packets into fixed windows before writing, see
+    // EventRebatcher.h. Call before start().
+    void setRebatch(const RebatchConfig &cfg);
+    // Runs first thing on the writer thread (pinning, priority).
+    void setThreadInit(std::function<void()> fn) { thread_init_ = fn; }
+    void start();
+    // Writes whatever is still queued, then closes the bag.
+    void stop();
+
+    // Event packets come from a single SDK thread (lock-free hand-off).
+    bool pushEvents(PooledEventArray &&msg);
+    void pushImu(sensor_msgs::Imu &&msg);
+    // Shared with the preview; the pixels are serialized straight from it.
+    void pushImage(PooledImagePtr msg);
+
+    Stats stats() const;
+    SPSCQueueStats eventQueueStats() const { return events_.stats(); }
+    void printStats() const;
+
+private:
+    // the files of one segment
+    struct Output {
+        std::unique_ptr<rosbag::Bag> bag;
+        std::unique_ptr<CompressedBagWriter> zbag;
+        std::unique_ptr<EventSink> evt_sink;
+        std::unique_ptr<CompressedBagWriter> journal;
+        std::string journal_path;
+        std::vector<std::string> files;
+        void close();
+    };
+
+    bool openOutput(Output &out, int segment);
+    bool openJournal(Output &out, int segment);
+    void rotate();
+    void commit();
+    void run();
+    void addPending(size_t bytes);
+    // flush also closes a partly filled rebatched message (at stop)
+    bool writeAll(bool flush);
+    uint64_t writeEvents(const PooledEventArray &msg);
+    void logQueueGap(const PooledEventArray &msg);
+    void logWriteGap();
+    template <class M>
+    void writeMsg(const std::string &topic, const ros::Time &t, const M &msg)
+    {
+        if (out_.zbag) out_.zbag->write(topic, t, msg);
+        else out_.bag->write(topic, t, msg);
+        if (out_.journal) out_.journal->write(topic, t, msg);
+    }
+
+    Output out_;
+    std::string path_, evt_path_;
+    bool compressed_ = false;
+    CompressedBagWriter::Options zopts_;
+    std::function<void()> zthread_init_;
+    RotateConfig rotate_;
+    SegmentCloser closer_;
+    SegmentInfo segment_;           // writer thread
+    bool rotate_failed_ = false;    // writer thread
+    CompressedBagWriter::Stats zstats_closed_;  // finished segments, m_stats_
+    JournalConfig journal_;
+    std::function<void()> jthread_init_;
+    uint64_t uncommitted_ = 0;                  // writer thread
+    std::chrono::steady_clock::time_point last_commit_;
+    CompressedBagWriter::Stats jstats_closed_;  // finished segments, m_stats_
+    std::function<void()> thread_init_;
+    std::unique_ptr<EventRebatcher> rebatch_;
+    std::vector<PooledEventArray> rebatched_;
+    SPSCQueue<PooledEventArray> events_;
+    std::mutex m_imu_, m_img_;
+    std::vector<sensor_msgs::Imu> imu_buf_;
+    std::vector<PooledImagePtr> img_buf_;
+    // writer-side halves of the swaps, kept so the buffers keep their capacity
+    std::vector<sensor_msgs::Imu> imu_out_;
+    std::vector<PooledImagePtr> img_out_;
+    uint64_t evt_lost_ = 0, last_evt_us_ = 0;   // writer thread
+    // packets the events output failed on since the last good write, writer thread
+    uint64_t fail_n_ = 0, fail_first_us_ = 0, fail_last_us_ = 0;
+    bool first_written_ = false;                // writer thread
+
+    const size_t batch_bytes_;
+    std::chrono::milliseconds batch_time_;
+    std::mutex m_wake_;
+    std::condition_variable wake_;
+    std::atomic<size_t> pending_bytes_{0};
+    std::atomic_bool stop_{false};
+    std::thread thread_;
+
+    mutable std::mutex m_stats_;
+    Stats stats_;
+    std::chrono::steady_clock::time_point t_start_;
+};
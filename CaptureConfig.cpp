@@ -0,0 +1,102 @@
+#include "CaptureConfig.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <sys/stat.h>
+#include <opencv2/core/core.hpp>
+
+CaptureConfig capture_cfg;
+
+template <class T>
+static void readOpt(const cv::FileNode &root, const char *name, T &val)
+{
+    cv::FileNode n = root[name];
+    if (!n.empty()) n >> val;
+}
+
+static void readOpt(const cv::FileNode &root, const char *name, bool &val)
+{
+    cv::FileNode n = root[name];
+    if (!n.empty()) val = (int)n != 0;
+}
+
+bool loadCaptureConfig(const std::string &path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        printf("No %s, using default capture settings\n", path.c_str());
+        return true;
+    }
+
+    try {
+        cv::FileStorage fs(path, cv::FileStorage::READ);
+        if (!fs.isOpened()) return false;
+        cv::FileNode root = fs.root();
+        CaptureConfig &c = capture_cfg;
+
+        readOpt(root, "evt_output", c.evt_output);
+        readOpt(root, "evc_chunk_mb", c.evc_chunk_mb);
+        readOpt(root, "evc_extent_mb", c.evc_extent_mb);
+        readOpt(root, "evt_batch_us", c.evt_batch_us);
+        readOpt(root, "evt_batch_events", c.evt_batch_events);
+        readOpt(root, "evt_batch_max_latency_ms", c.evt_batch_max_latency_ms);
+        readOpt(root, "noise_filter_us", c.noise_filter_us);
+        readOpt(root, "roi", c.roi);
+        readOpt(root, "hot_pixel_file", c.hot_pixel_file);
+        readOpt(root, "hot_pixel_calib_sec", c.hot_pixel_calib_sec);
+        readOpt(root, "hot_pixel_factor", c.hot_pixel_factor);
+        readOpt(root, "bag_codec", c.bag_codec);
+        readOpt(root, "bag_codec_level", c.bag_codec_level);
+        readOpt(root, "bag_codec_threads", c.bag_codec_threads);
+        readOpt(root, "bag_chunk_mb", c.bag_chunk_mb);
+        readOpt(root, "d435_encoder_threads", c.d435_encoder_threads);
+        readOpt(root, "d435_queue_size", c.d435_queue_size);
+        readOpt(root, "d435_png_level", c.d435_png_level);
+        readOpt(root, "d435_output", c.d435_output);
+        readOpt(root, "d435_codec", c.d435_codec);
+        readOpt(root, "d435_depth", c.d435_depth);
+        readOpt(root, "rotate_mb", c.rotate_mb);
+        readOpt(root, "rotate_min", c.rotate_min);
+        readOpt(root, "journal_ms", c.journal_ms);
+        readOpt(root, "journal_mb", c.journal_mb);
+        readOpt(root, "capture_dvs", c.capture_dvs);
+        readOpt(root, "capture_d435", c.capture_d435);
+        readOpt(root, "start_ae_tolerance_percent", c.start_ae_tolerance_percent);
+        readOpt(root, "start_max_wait_ms", c.start_max_wait_ms);
+        readOpt(root, "sync_output", c.sync_output);
+        readOpt(root, "sync_max_dt_ms", c.sync_max_dt_ms);
+        readOpt(root, "sync_evt_window_ms", c.sync_evt_window_ms);
+        readOpt(root, "sync_queue_size", c.sync_queue_size);
+        readOpt(root, "sync_d435_offset_us", c.sync_d435_offset_us);
+        readOpt(root, "cpu_sdk_callback", c.cpu_sdk_callback);
+        readOpt(root, "cpu_d435_grab", c.cpu_d435_grab);
+        readOpt(root, "cpu_encoder", c.cpu_encoder);
+        readOpt(root, "cpu_writer", c.cpu_writer);
+        readOpt(root, "cpu_compressor", c.cpu_compressor);
+        readOpt(root, "cpu_preview", c.cpu_preview);
+        readOpt(root, "rt_priority", c.rt_priority);
+        readOpt(root, "mem_budget_mb", c.mem_budget_mb);
+        readOpt(root, "shed_events", c.shed_events);
+        readOpt(root, "shed_evt_decimate", c.shed_evt_decimate);
+        readOpt(root, "shed_evt_roi_percent", c.shed_evt_roi_percent);
+        readOpt(root, "shm_name", c.shm_name);
+        readOpt(root, "shm_mb", c.shm_mb);
+        readOpt(root, "replay", c.replay);
+        readOpt(root, "replay_speed", c.replay_speed);
+        readOpt(root, "stats_period_ms", c.stats_period_ms);
+        readOpt(root, "telemetry_port", c.telemetry_port);
+    } catch (cv::Exception &e) {
+        printf(" * ERROR! bad capture config %s: %s\n", path.c_str(), e.what());
+        return false;
+    }
+    printf("Loaded capture settings from %s\n", path.c_str());
+    return true;
+}
+
+RotateConfig rotateConfig()
+{
+    RotateConfig r;
+    r.max_bytes = (uint64_t)std::max(capture_cfg.rotate_mb, 0) << 20;
+    r.max_sec = 60.0 * std::max(capture_cfg.rotate_min, 0);
+    return r;
+}
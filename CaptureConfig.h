@@ -0,0 +1,134 @@
+#pragma once
+
+#include <string>
+
+#include "Segments.h"
+
+// Runtime options, read from capture_config.yaml next to the executable's
+// working directory. Anything missing keeps the default below.
+struct CaptureConfig {
+    // DVS polarity events: "bag" (/dvs/events EventArray), "compact"
+    // (delta-encoded blocks in <folder>-dvs.evb, see EventCodec.h) or
+    // "chunked" (same blocks in a preallocated, indexed <folder>-dvs.evc,
+    // see ChunkedEventFile.h)
+    std::string evt_output = "bag";
+    int evc_chunk_mb = 4;
+    int evc_extent_mb = 256;
+    // Rebatch event packets into messages of evt_batch_us of event time
+    // and/or at most evt_batch_events events (0 = off for each; both 0 keeps
+    // one message per SDK packet). No message is held longer than
+    // evt_batch_max_latency_ms. See EventRebatcher.h.
+    int evt_batch_us = 0;
+    int evt_batch_events = 0;
+    int evt_batch_max_latency_ms = 50;
+    // Drop events without a neighbour event within noise_filter_us
+    // (background activity and hot pixels), 0 = off. See NoiseFilter.h.
+    int noise_filter_us = 0;
+    // Events outside roi ("x,y,w,h", empty = whole sensor) or on hot pixels
+    // are rejected before a message is built. Hot pixels come from
+    // hot_pixel_file and/or are learned over the first hot_pixel_calib_sec
+    // (pixels above hot_pixel_factor x the mean rate), then saved to
+    // <folder>-hotpixels.txt. See PixelMask.h.
+    std::string roi;
+    std::string hot_pixel_file;
+    int hot_pixel_calib_sec = 0;
+    int hot_pixel_factor = 20;
+
+    // DVS recording: "none" writes <folder>-dvs.bag; "lz4" or "zstd" writes
+    // the same messages to <folder>-dvs.bagz in bag_chunk_mb chunks,
+    // compressed by bag_codec_threads threads (0 = half the cores), see
+    // CompressedBag.h. Convert back with evb2bag.
+    std::string bag_codec = "none";
+    int bag_codec_level = 1;
+    int bag_codec_threads = 0;
+    int bag_chunk_mb = 4;
+
+    // D435 infrared frames are encoded off the grab thread. Threads <= 0 uses
+    // half the cores; frames arriving while the queue is full are dropped.
+    int d435_encoder_threads = 0;
+    int d435_queue_size = 8;
+    int d435_png_level = 3;     // cv::IMWRITE_PNG_COMPRESSION, 0-9
+    // "png" (D435_Img/%05d.png) or "container" (one append-only
+    // D435_ir.frames, see FrameContainer.h) with d435_codec "raw" or "lz4"
+    std::string d435_output = "png";
+    std::string d435_codec = "lz4";
+    // Also record the depth stream (D435_depth.frames, 16-bit, lossless
+    // DepthCodec.h) on its own encoder pool. Off: depth is not even enabled.
+    bool d435_depth = false;
+
+    // Start a new numbered segment of every output file (DVS bag/bagz/evb/
+    // evc, D435 frames) after rotate_mb of data or rotate_min minutes; 0 =
+    // no limit, both 0 = one file per session. See Segments.h.
+    int rotate_mb = 0;
+    int rotate_min = 0;
+
+    // Crash safety for the DVS output: group commit (one fsync) at least
+    // every journal_ms, or after journal_mb of messages; both 0 = off. See
+    // JournalConfig in BagWriter.h.
+    int journal_ms = 0;
+    int journal_mb = 0;
+
+    // Sensors recorded concurrently; the main thread runs the preview.
+    bool capture_dvs = true;
+    bool capture_d435 = true;
+    // DVS data is recorded once timestamps run steadily and the APS mean
+    // brightness changes by less than start_ae_tolerance_percent over 3
+    // frames (auto exposure settled), or start_max_wait_ms after the
+    // timestamps settled. See ReadinessGate in Startup.h.
+    int start_ae_tolerance_percent = 2;
+    int start_max_wait_ms = 3000;
+
+    // With both sensors: map DVS and D435 time to the host clock online and
+    // pair every D435 frame with the nearest APS frame (within
+    // sync_max_dt_ms) and an event window of sync_evt_window_ms, one line
+    // per pair in <folder>-sync.txt. See SensorSync.h.
+    bool sync_output = true;
+    int sync_max_dt_ms = 20;
+    int sync_evt_window_ms = 10;
+    int sync_queue_size = 16;
+    int sync_d435_offset_us = 0;    // see SensorSync::Options
+
+    // Cores per thread role as "2" or "0-1,4"; empty = not pinned. See
+    // ThreadAffinity.h. rt_priority > 0 runs the SDK callback and D435 grab
+    // threads under SCHED_FIFO with that priority.
+    std::string cpu_sdk_callback;
+    std::string cpu_d435_grab;
+    std::string cpu_encoder;
+    std::string cpu_writer;
+    std::string cpu_compressor;
+    std::string cpu_preview;
+    int rt_priority = 0;
+
+    // Budget for capture data in flight, 0 = unlimited. When the writers lag,
+    // preview, then APS/D435 frames, then events are shed (events by
+    // shed_events "decimate": every shed_evt_decimate-th event, or "roi": the
+    // centred shed_evt_roi_percent of the sensor); IMU never. Gaps are
+    // logged to <folder>-shed.txt. See MemoryBudget.h.
+    int mem_budget_mb = 1024;
+    std::string shed_events = "decimate";
+    int shed_evt_decimate = 4;
+    int shed_evt_roi_percent = 50;
+
+    // Live output for local processes: /dev/shm/<shm_name>.events, .imu,
+    // .aps, .d435 rings of shm_mb each (IMU 1 MB); empty = off. See LiveFeed.h.
+    std::string shm_name;
+    int shm_mb = 64;
+
+    // Replay instead of the devices: a recorded "Capture-<ts>" is fed through
+    // the same pipeline into a new recording, at replay_speed times the
+    // recorded pace (0 = as fast as it goes). See ReplaySource.h.
+    std::string replay;
+    double replay_speed = 1.0;
+
+    // Telemetry (if built with CAPTURE_TELEMETRY): a JSON line per period in
+    // <folder>-stats.jsonl, 0 = off; Prometheus text on 127.0.0.1:port, 0 = off.
+    int stats_period_ms = 1000;
+    int telemetry_port = 0;
+};
+
+extern CaptureConfig capture_cfg;
+
+// Returns false if the file exists but cannot be parsed.
+bool loadCaptureConfig(const std::string &path);
+// rotate_mb / rotate_min
+RotateConfig rotateConfig();
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+
+#include <opencv2/core/core.hpp>
+#include <sensor_msgs/Imu.h>
+
+#include "EventConvert.h"
+#include "EventPool.h"
+#include "FrameEncoderPool.h"
+
+// Receives what a DVS source produces. Events, IMU and frames may come from
+// different threads, but each kind only ever from one thread at a time.
+class DvsHandler
+{
+public:
+    virtual ~DvsHandler() {}
+    // A polarity packet as read from the device, before its message is
+    // built; may remove events. Same thread as onEvents.
+    virtual void onRawEvents(EventSoA &soa, int width, int height) {}
+    virtual void onEvents(PooledEventArray &&msg) = 0;
+    virtual void onImu(sensor_msgs::Imu &&msg) = 0;
+    // APS frame, mono16
+    virtual void onFrame(uint64_t ts_us, const cv::Mat &img) = 0;
+};
+
+// Event camera: the SEES device, or a generator for benchmarks.
+class DvsSource
+{
+public:
+    virtual ~DvsSource() {}
+    virtual bool start(DvsHandler *handler) = 0;
+    virtual void stop() = 0;
+    virtual int width() const = 0;
+    virtual int height() const = 0;
+};
+
+// Infrared camera, optionally with depth, pulled by the D435 grab loop.
+class D435Source
+{
+public:
+    virtual ~D435Source() {}
+    virtual bool start() = 0;
+    virtual void stop() = 0;
+    // Waits for the next frame and fills index-less f (stamp, expo, image,
+    // depth if enabled, hold) plus the device frame number. False on timeout
+    // or end of data.
+    virtual bool next(IRFrame &f, unsigned long long &frame_number) = 0;
+    // Meters per depth unit, valid after start().
+    virtual double depthScale() const { return 0.001; }
+};
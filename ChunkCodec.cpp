@@ -0,0 +1,117 @@
+#include "ChunkCodec.h"
+
+#include <cstring>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+const char *chunkCodecName(ChunkCodec c)
+{
+    switch (c) {
+    case CHUNK_LZ4: return "lz4";
+    case CHUNK_ZSTD: return "zstd";
+    default: return "raw";
+    }
+}
+
+bool parseChunkCodec(const std::string &name, ChunkCodec &c)
+{
+    if (name == "none" || name == "raw") c = CHUNK_RAW;
+    else if (name == "lz4") c = CHUNK_LZ4;
+    else if (name == "zstd") c = CHUNK_ZSTD;
+    else return false;
+    return true;
+}
+
+bool chunkCodecAvailable(ChunkCodec c)
+{
+    switch (c) {
+#ifdef HAVE_LZ4
+    case CHUNK_LZ4: return true;
+#endif
+#ifdef HAVE_ZSTD
+    case CHUNK_ZSTD: return true;
+#endif
+    case CHUNK_RAW: return true;
+    default: return false;
+    }
+}
+
+#ifdef HAVE_ZSTD
+namespace {
+
+// one context per thread, reused for every chunk
+struct ZstdContexts {
+    ZSTD_CCtx *c = nullptr;
+    ZSTD_DCtx *d = nullptr;
+    ~ZstdContexts()
+    {
+        ZSTD_freeCCtx(c);
+        ZSTD_freeDCtx(d);
+    }
+};
+thread_local ZstdContexts zstd_ctx;
+
+}
+#endif
+
+bool compressChunk(ChunkCodec c, int level, const uint8_t *src, size_t n, std::vector<uint8_t> &out)
+{
+    (void)level;    // unused without LZ4 and zstd
+    switch (c) {
+    case CHUNK_RAW:
+        out.assign(src, src + n);
+        return true;
+#ifdef HAVE_LZ4
+    case CHUNK_LZ4: {
+        int bound = LZ4_compressBound((int)n);
+        out.resize(bound);
+        int len = level >= 2 ? LZ4_compress_HC((const char *)src, (char *)out.data(), (int)n, bound, level)
+                             : LZ4_compress_default((const char *)src, (char *)out.data(), (int)n, bound);
+        if (len <= 0) return false;
+        out.resize(len);
+        return true;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case CHUNK_ZSTD: {
+        if (!zstd_ctx.c) zstd_ctx.c = ZSTD_createCCtx();
+        out.resize(ZSTD_compressBound(n));
+        size_t len = ZSTD_compressCCtx(zstd_ctx.c, out.data(), out.size(), src, n, level);
+        if (ZSTD_isError(len)) return false;
+        out.resize(len);
+        return true;
+    }
+#endif
+    default:
+        return false;
+    }
+}
+
+bool decompressChunk(ChunkCodec c, const uint8_t *src, size_t n, uint8_t *dst, size_t raw_n)
+{
+    switch (c) {
+    case CHUNK_RAW:
+        if (n != raw_n) return false;
+        memcpy(dst, src, n);
+        return true;
+#ifdef HAVE_LZ4
+    case CHUNK_LZ4:
+        return LZ4_decompress_safe((const char *)src, (char *)dst, (int)n, (int)raw_n) == (int)raw_n;
+#endif
+#ifdef HAVE_ZSTD
+    case CHUNK_ZSTD: {
+        if (!zstd_ctx.d) zstd_ctx.d = ZSTD_createDCtx();
+        size_t len = ZSTD_decompressDCtx(zstd_ctx.d, dst, raw_n, src, n);
+        return !ZSTD_isError(len) && len == raw_n;
+    }
+#endif
+    default:
+        return false;
+    }
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Block compressors for recorded chunks. LZ4 and zstd are optional at build
+// time (HAVE_LZ4 / HAVE_ZSTD); raw always works.
+enum ChunkCodec : uint32_t { CHUNK_RAW = 0, CHUNK_LZ4 = 1, CHUNK_ZSTD = 2 };
+
+const char *chunkCodecName(ChunkCodec c);
+bool parseChunkCodec(const std::string &name, ChunkCodec &c);
+bool chunkCodecAvailable(ChunkCodec c);
+
+// level: lz4 1 = fast (default), 2-12 = HC; zstd as zstd (1-19, <= 0 fast).
+// Thread-safe, each thread keeps its own compression context. Returns false
+// on codec error; out then holds nothing useful.
+bool compressChunk(ChunkCodec c, int level, const uint8_t *src, size_t n, std::vector<uint8_t> &out);
+// dst must hold exactly raw_n bytes.
+bool decompressChunk(ChunkCodec c, const uint8_t *src, size_t n, uint8_t *dst, size_t raw_n);
@@ -0,0 +1,319 @@
+#include "ChunkedEventFile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char EVC_MAGIC[4] = {'E', 'V', 'C', '1'};
+static const char EVC_INDEX_MAGIC[4] = {'E', 'V', 'C', 'I'};
+static const uint32_t EVC_VERSION = 1;
+
+static size_t roundUp(size_t v, size_t to)
+{
+    return (v + to - 1) / to * to;
+}
+
+ChunkedEventFile::ChunkedEventFile(size_t chunk_size, size_t extent)
+{
+    const size_t page = sysconf(_SC_PAGESIZE);
+    chunk_size_ = roundUp(std::max(chunk_size, page), page);
+    extent_ = roundUp(std::max(extent, chunk_size_), chunk_size_);
+    header_size_ = page;
+}
+
+ChunkedEventFile::~ChunkedEventFile()
+{
+    close();
+}
+
+bool ChunkedEventFile::open(const std::string &path)
+{
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) {
+        printf(" * ERROR! cannot open %s\n", path.c_str());
+        return false;
+    }
+
+    std::vector<uint8_t> page(header_size_, 0);
+    ChunkedFileHeader hd;
+    memcpy(hd.magic, EVC_MAGIC, 4);
+    hd.version = EVC_VERSION;
+    hd.chunk_size = (uint32_t)chunk_size_;
+    hd.header_size = (uint32_t)header_size_;
+    hd.created_unix = (uint64_t)time(nullptr);
+    memcpy(page.data(), &hd, sizeof(hd));
+    if (pwrite(fd_, page.data(), page.size(), 0) != (ssize_t)page.size()) {
+        printf(" * ERROR! cannot write %s\n", path.c_str());
+        close();
+        return false;
+    }
+
+    allocated_ = header_size_;
+    chunk_off_ = header_size_;
+    used_ = 0;
+    return mapNextChunk();
+}
+
+bool ChunkedEventFile::mapNextChunk()
+{
+    const uint64_t end = chunk_off_ + chunk_size_;
+    if (end > allocated_) {
+        // grow by a whole extent so the filesystem can keep it contiguous
+        int err = posix_fallocate(fd_, allocated_, extent_);
+        if (err != 0) {
+            printf(" * ERROR! fallocate failed: %s\n", strerror(err));
+            return false;
+        }
+        allocated_ += extent_;
+    }
+
+    void *p = mmap(nullptr, chunk_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, chunk_off_);
+    if (p == MAP_FAILED) {
+        printf(" * ERROR! mmap failed: %s\n", strerror(errno));
+        return false;
+    }
+    map_ = (uint8_t *)p;
+    madvise(map_, chunk_size_, MADV_SEQUENTIAL);
+    used_ = 0;
+    memset(&cur_, 0, sizeof(cur_));
+    cur_.offset = chunk_off_;
+    return true;
+}
+
+void ChunkedEventFile::finishChunk()
+{
+    if (!map_) return;
+    if (used_ > 0) {
+        cur_.used_bytes = (uint32_t)used_;
+        index_.push_back(cur_);
+    }
+    // start write-back now, the chunk is never touched again
+    msync(map_, chunk_size_, MS_ASYNC);
+    munmap(map_, chunk_size_);
+    map_ = nullptr;
+    if (used_ > 0) chunk_off_ += chunk_size_;
+}
+
+bool ChunkedEventFile::place(const uint8_t *block, size_t len, uint64_t first_us, uint64_t last_us)
+{
+    if (len > chunk_size_) return false;
+    if (used_ + len > chunk_size_) {
+        finishChunk();
+        if (!mapNextChunk()) return false;
+    }
+    memcpy(map_ + used_, block, len);
+    if (cur_.blocks == 0) cur_.first_us = first_us;
+    cur_.last_us = std::max(cur_.last_us, last_us);
+    cur_.blocks++;
+    used_ += len;
+    bytes_ += len;
+    return true;
+}
+
+bool ChunkedEventFile::write(const PooledEventArray &msg)
+{
+    if (!map_) return false;
+    const size_t n = msg.events.size();
+    if (n == 0) return true;
+
+    // Split oversized messages so every block fits into one chunk.
+    std::vector<size_t> ends;
+    for (size_t pieces = 1; ; pieces *= 2) {
+        const size_t per = (n + pieces - 1) / pieces;
+        bool fits = true;
+        buf_.clear();
+        ends.clear();
+        for (size_t first = 0; first < n && fits; first += per) {
+            fits = encodeEventBlock(msg, buf_, first, std::min(per, n - first)) <= chunk_size_;
+            ends.push_back(buf_.size());
+        }
+        if (fits) break;
+        if (per == 1) return false;
+    }
+
+    const size_t per = (n + ends.size() - 1) / ends.size();
+    size_t start = 0, first = 0;
+    for (size_t end : ends) {
+        const size_t cnt = std::min(per, n - first);
+        if (!place(buf_.data() + start, end - start, timeToUs(msg.events[first].ts),
+                   timeToUs(msg.events[first + cnt - 1].ts)))
+            return false;
+        start = end;
+        first += cnt;
+    }
+    events_ += n;
+    return true;
+}
+
+void ChunkedEventFile::close()
+{
+    if (fd_ < 0) return;
+    finishChunk();
+
+    // Index and footer go right after the used part of the last chunk; the
+    // rest of the preallocated extent is cut off.
+    uint64_t end = header_size_;
+    if (!index_.empty())
+        end = index_.back().offset + index_.back().used_bytes;
+
+    ChunkedFileFooter ft;
+    memcpy(ft.magic, EVC_INDEX_MAGIC, 4);
+    ft.n_chunks = (uint32_t)index_.size();
+    ft.index_offset = end;
+    ft.events = events_;
+    ft.chunk_size = (uint32_t)chunk_size_;
+    ft.reserved = 0;
+
+    size_t index_bytes = index_.size() * sizeof(ChunkIndexEntry);
+    bool ok = pwrite(fd_, index_.data(), index_bytes, end) == (ssize_t)index_bytes &&
+              pwrite(fd_, &ft, sizeof(ft), end + index_bytes) == (ssize_t)sizeof(ft);
+    if (!ok || ftruncate(fd_, end + index_bytes + sizeof(ft)) != 0)
+        printf(" * ERROR! cannot write chunk index: %s\n", strerror(errno));
+    fsync(fd_);
+    ::close(fd_);
+    fd_ = -1;
+}
+
+ChunkedEventReader::~ChunkedEventReader()
+{
+    close();
+}
+
+bool ChunkedEventReader::open(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ChunkedFileHeader)) {
+        ::close(fd);
+        return false;
+    }
+    size_ = st.st_size;
+    void *p = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return false;
+    data_ = (const uint8_t *)p;
+    recovered_ = false;
+
+    ChunkedFileHeader hd;
+    memcpy(&hd, data_, sizeof(hd));
+    if (memcmp(hd.magic, EVC_MAGIC, 4) != 0 || hd.version != EVC_VERSION || hd.chunk_size == 0 ||
+        hd.header_size < sizeof(hd)) {
+        close();
+        return false;
+    }
+
+    index_.clear();
+    ChunkedFileFooter ft;
+    bool have_footer = false;
+    if (size_ >= hd.header_size + sizeof(ft)) {
+        memcpy(&ft, data_ + size_ - sizeof(ft), sizeof(ft));
+        have_footer = memcmp(ft.magic, EVC_INDEX_MAGIC, 4) == 0 && ft.index_offset >= hd.header_size &&
+                      ft.index_offset <= size_ - sizeof(ft) &&
+                      (uint64_t)ft.n_chunks * sizeof(ChunkIndexEntry) == size_ - sizeof(ft) - ft.index_offset;
+    }
+    if (have_footer) {
+        index_.resize(ft.n_chunks);
+        memcpy(index_.data(), data_ + ft.index_offset, ft.n_chunks * sizeof(ChunkIndexEntry));
+        // every chunk must lie between the file header and the index
+        for (const ChunkIndexEntry &e : index_)
+            if (e.offset < hd.header_size || e.offset > ft.index_offset ||
+                e.used_bytes > ft.index_offset - e.offset) {
+                have_footer = false;
+                break;
+            }
+        if (!have_footer) index_.clear();
+    }
+    if (!have_footer && !rebuildIndex(hd)) {
+        close();
+        return false;
+    }
+    chunk_ = 0;
+    pos_ = 0;
+    return true;
+}
+
+bool ChunkedEventReader::rebuildIndex(const ChunkedFileHeader &hd)
+{
+    recovered_ = true;
+    dvs_msgs::EventArray msg;
+    for (uint64_t off = hd.header_size; off + sizeof(EventBlockHeader) <= size_; off += hd.chunk_size) {
+        ChunkIndexEntry e;
+        memset(&e, 0, sizeof(e));
+        e.offset = off;
+        const size_t avail = std::min<uint64_t>(hd.chunk_size, size_ - off);
+        size_t pos = 0;
+        for (;;) {
+            size_t len = decodeEventBlock(data_ + off + pos, avail - pos, msg);
+            if (len == 0) break;
+            if (e.blocks == 0) e.first_us = timeToUs(msg.header.stamp);
+            if (!msg.events.empty())
+                e.last_us = std::max(e.last_us, timeToUs(msg.events.back().ts));
+            e.blocks++;
+            pos += len;
+        }
+        if (e.blocks == 0) break;
+        e.used_bytes = (uint32_t)pos;
+        index_.push_back(e);
+    }
+    return true;
+}
+
+void ChunkedEventReader::close()
+{
+    if (data_) munmap((void *)data_, size_);
+    data_ = nullptr;
+    size_ = 0;
+    index_.clear();
+}
+
+bool ChunkedEventReader::blockAt(size_t ci, size_t pos, EventBlockHeader &bh) const
+{
+    if (ci >= index_.size() || pos >= index_[ci].used_bytes) return false;
+    const ChunkIndexEntry &e = index_[ci];
+    return readEventBlockHeader(data_ + e.offset + pos, e.used_bytes - pos, bh, false);
+}
+
+bool ChunkedEventReader::seek(uint64_t t_us)
+{
+    // last chunk whose first block starts at or before t
+    auto it = std::upper_bound(index_.begin(), index_.end(), t_us,
+        [](uint64_t t, const ChunkIndexEntry &e) { return t < e.first_us; });
+    chunk_ = it == index_.begin() ? 0 : (it - index_.begin()) - 1;
+    pos_ = 0;
+    if (chunk_ < index_.size() && index_[chunk_].last_us < t_us && chunk_ + 1 < index_.size()) {
+        chunk_++;
+        return true;
+    }
+
+    // skip blocks that end before t: block i ends where block i + 1 starts
+    EventBlockHeader cur, nxt;
+    while (blockAt(chunk_, pos_, cur)) {
+        size_t next_pos = pos_ + sizeof(cur) + cur.payload_bytes;
+        if (!blockAt(chunk_, next_pos, nxt) || nxt.base_us >= t_us) break;
+        pos_ = next_pos;
+    }
+    return chunk_ < index_.size();
+}
+
+bool ChunkedEventReader::next(dvs_msgs::EventArray &msg)
+{
+    while (chunk_ < index_.size()) {
+        const ChunkIndexEntry &e = index_[chunk_];
+        if (pos_ < e.used_bytes) {
+            size_t len = decodeEventBlock(data_ + e.offset + pos_, e.used_bytes - pos_, msg);
+            if (len == 0) return false;
+            pos_ += len;
+            return true;
+        }
+        chunk_++;
+        pos_ = 0;
+    }
+    return false;
+}
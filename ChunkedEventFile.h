@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "EventCodec.h"
+#include "EventSink.h"
+
+// Event file made of fixed-size chunks of compact event blocks (EventCodec.h).
+//
+//   [header page][chunk 0][chunk 1]...[chunk n-1][index][footer]
+//
+// Space is reserved with fallocate() in large extents so the file grows in
+// few, contiguous pieces. Chunks are filled through a shared mmap window,
+// one chunk at a time. A block never straddles two chunks; the tail of a
+// chunk is left zeroed. The index holds one entry per chunk (sparse
+// timestamp -> offset), so a reader finds the chunk holding any time with a
+// binary search. If the footer is missing (crash), the reader rebuilds the
+// index by walking the chunks.
+struct ChunkedFileHeader {
+    char magic[4];          // "EVC1"
+    uint32_t version;
+    uint32_t chunk_size;
+    uint32_t header_size;   // offset of chunk 0
+    uint64_t created_unix;
+};
+
+struct ChunkIndexEntry {
+    uint64_t first_us;      // base time of the first block
+    uint64_t last_us;       // timestamp of the last event
+    uint64_t offset;
+    uint32_t used_bytes;
+    uint32_t blocks;
+};
+static_assert(sizeof(ChunkIndexEntry) == 32, "ChunkIndexEntry must stay packed");
+
+struct ChunkedFileFooter {
+    char magic[4];          // "EVCI"
+    uint32_t n_chunks;
+    uint64_t index_offset;
+    uint64_t events;
+    uint32_t chunk_size;
+    uint32_t reserved;
+};
+
+class ChunkedEventFile : public EventSink
+{
+public:
+    // chunk_size and extent are rounded up to whole pages / chunks.
+    ChunkedEventFile(size_t chunk_size = 4 << 20, size_t extent = 256 << 20);
+    ~ChunkedEventFile();
+
+    bool open(const std::string &path) override;
+    void close() override;
+
+    bool write(const PooledEventArray &msg) override;
+    uint64_t bytes() const override { return bytes_; }
+    EventSink *create() const override { return new ChunkedEventFile(chunk_size_, extent_); }
+    uint64_t events() const { return events_; }
+    size_t chunks() const { return index_.size(); }
+
+private:
+    bool place(const uint8_t *block, size_t len, uint64_t first_us, uint64_t last_us);
+    bool mapNextChunk();
+    void finishChunk();
+
+    size_t chunk_size_;
+    size_t extent_;
+    size_t header_size_;
+    int fd_ = -1;
+    uint8_t *map_ = nullptr;
+    uint64_t chunk_off_ = 0;
+    size_t used_ = 0;
+    uint64_t allocated_ = 0;
+    ChunkIndexEntry cur_;
+    std::vector<ChunkIndexEntry> index_;
+    std::vector<uint8_t> buf_;
+    uint64_t bytes_ = 0;
+    uint64_t events_ = 0;
+};
+
+class ChunkedEventReader
+{
+public:
+    ~ChunkedEventReader();
+    bool open(const std::string &path);
+    void close();
+
+    // Positions the reader at the first block that may hold events at or
+    // after t_us. O(log chunks) plus a walk over block headers of one chunk.
+    bool seek(uint64_t t_us);
+    // Returns false at end of data.
+    bool next(dvs_msgs::EventArray &msg);
+
+    const std::vector<ChunkIndexEntry> &index() const { return index_; }
+    bool recovered() const { return recovered_; }
+
+private:
+    bool rebuildIndex(const ChunkedFileHeader &hd);
+    // Header of the block at `pos` in chunk `ci`, false if there is none.
+    bool blockAt(size_t ci, size_t pos, EventBlockHeader &bh) const;
+
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+    std::vector<ChunkIndexEntry> index_;
+    bool recovered_ = false;
+    size_t chunk_ = 0;
+    size_t pos_ = 0;
+};
@@ -0,0 +1,490 @@
+#include "CompressedBag.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+
+#include "Crc32.h"
+
+using namespace std::chrono;
+
+static const char BGZ_MAGIC[4] = {'B', 'G', 'Z', '1'};
+static const char BGZ_CHUNK_MAGIC[4] = {'B', 'G', 'Z', 'C'};
+static const char BGZ_INDEX_MAGIC[4] = {'B', 'G', 'Z', 'I'};
+static const uint32_t BGZ_VERSION = 2;
+
+static uint64_t stampUs(const ros::Time &t)
+{
+    return (uint64_t)t.sec * 1000000 + t.nsec / 1000;
+}
+
+static uint32_t chunkCrc(uint32_t version, const BagzChunkHeader &ch, const uint8_t *data)
+{
+    if (version < 2) return crc32(data, ch.stored_bytes);
+    BagzChunkHeader h = ch;
+    h.crc = 0;
+    return crc32(data, ch.stored_bytes, crc32((const uint8_t *)&h, sizeof(h)));
+}
+
+CompressedBagWriter::CompressedBagWriter(const Options &opts)
+    : opts_(opts)
+{
+    if (opts_.codec != CHUNK_RAW && !chunkCodecAvailable(opts_.codec)) {
+        printf(" * WARNING! built without %s, bag chunks are stored raw\n", chunkCodecName(opts_.codec));
+        opts_.codec = CHUNK_RAW;
+    }
+    n_threads_ = opts_.threads;
+    if (n_threads_ <= 0) {
+        n_threads_ = std::thread::hardware_concurrency() / 2;
+        if (n_threads_ < 1) n_threads_ = 1;
+    }
+}
+
+CompressedBagWriter::~CompressedBagWriter()
+{
+    close();
+}
+
+bool CompressedBagWriter::open(const std::string &path)
+{
+    fp_ = fopen(path.c_str(), "wb");
+    if (!fp_) {
+        printf(" * ERROR! cannot open %s\n", path.c_str());
+        return false;
+    }
+    BagzFileHeader hd;
+    memset(&hd, 0, sizeof(hd));
+    memcpy(hd.magic, BGZ_MAGIC, 4);
+    hd.version = BGZ_VERSION;
+    hd.codec = opts_.codec;
+    hd.level = opts_.level;
+    hd.chunk_size = (uint32_t)opts_.chunk_size;
+    hd.created_unix = (uint64_t)time(nullptr);
+    fwrite(&hd, sizeof(hd), 1, fp_);
+    offset_ = sizeof(hd);
+
+    cur_.raw.resize(opts_.chunk_size);
+    stop_ = false;
+    for (int i = 0; i < n_threads_; i++)
+        workers_.emplace_back(&CompressedBagWriter::worker, this);
+    return true;
+}
+
+void CompressedBagWriter::appendConnection(std::vector<uint8_t> &buf, uint16_t id, const BagzConnection &c)
+{
+    BagzRecordHeader rh;
+    rh.len = (uint32_t)(c.topic.size() + c.datatype.size() + c.md5.size() + c.definition.size() + 4);
+    rh.conn = id;
+    rh.op = BAGZ_CONN;
+    rh.sec = rh.nsec = 0;
+    const uint8_t *p = (const uint8_t *)&rh;
+    buf.insert(buf.end(), p, p + sizeof(rh));
+    for (const std::string *s : {&c.topic, &c.datatype, &c.md5, &c.definition})
+        buf.insert(buf.end(), s->c_str(), s->c_str() + s->size() + 1);
+}
+
+uint16_t CompressedBagWriter::connection(const std::string &topic, const char *datatype, const char *md5, const char *def)
+{
+    auto it = conn_ids_.find(topic);
+    if (it != conn_ids_.end()) return it->second;
+
+    uint16_t id = (uint16_t)conns_.size();
+    BagzConnection c;
+    c.topic = topic;
+    c.datatype = datatype;
+    c.md5 = md5;
+    c.definition = def;
+    conn_ids_[topic] = id;
+    conns_.push_back(c);
+
+    // into the chunk, so a file without footer is still readable
+    std::vector<uint8_t> rec;
+    appendConnection(rec, id, c);
+    uint8_t *p = beginRecord(BAGZ_CONN, id, ros::Time(), (uint32_t)(rec.size() - sizeof(BagzRecordHeader)));
+    memcpy(p, rec.data() + sizeof(BagzRecordHeader), rec.size() - sizeof(BagzRecordHeader));
+    return id;
+}
+
+void CompressedBagWriter::writeSerialized(const BagzConnection &c, const ros::Time &t, const uint8_t *data, uint32_t len)
+{
+    uint16_t conn = connection(c.topic, c.datatype.c_str(), c.md5.c_str(), c.definition.c_str());
+    memcpy(beginRecord(BAGZ_MSG, conn, t, len), data, len);
+}
+
+uint8_t *CompressedBagWriter::beginRecord(BagzOp op, uint16_t conn, const ros::Time &t, uint32_t len)
+{
+    const size_t need = sizeof(BagzRecordHeader) + len;
+    if (cur_.raw_n > 0 && cur_.raw_n + need > opts_.chunk_size)
+        submit();
+    if (cur_.raw_n + need > cur_.raw.size())
+        cur_.raw.resize(cur_.raw_n + need);     // message larger than a chunk
+
+    BagzRecordHeader rh;
+    rh.len = len;
+    rh.conn = conn;
+    rh.op = op;
+    rh.sec = t.sec;
+    rh.nsec = t.nsec;
+    uint8_t *p = cur_.raw.data() + cur_.raw_n;
+    memcpy(p, &rh, sizeof(rh));
+    cur_.raw_n += need;
+
+    if (op == BAGZ_MSG) {
+        uint64_t us = stampUs(t);
+        if (cur_.records == 0 || us < cur_.first_us) cur_.first_us = us;
+        if (cur_.records == 0 || us > cur_.last_us) cur_.last_us = us;
+        cur_.records++;
+        messages_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return p + sizeof(rh);
+}
+
+void CompressedBagWriter::commit()
+{
+    if (!fp_ || (cur_.raw_n == 0 && !unsynced_)) return;
+    // an empty job only carries the fsync for chunks already in flight
+    cur_.sync = true;
+    submit();
+}
+
+void CompressedBagWriter::submit()
+{
+    if (cur_.raw_n == 0 && !cur_.sync) return;
+    unsynced_ = !cur_.sync;
+    auto t0 = steady_clock::now();
+    std::unique_lock<std::mutex> lck(m_queue_);
+    // bounded: a slow disk or codec holds up the writer, nothing is dropped
+    not_full_.wait(lck, [this] { return in_flight_ < (size_t)n_threads_ * 2; });
+    double blocked = duration_cast<duration<double> >(steady_clock::now() - t0).count();
+
+    cur_.seq = next_seq_++;
+    queue_.push_back(std::move(cur_));
+    in_flight_++;
+    cur_ = Job();
+    if (!spare_.empty()) {
+        cur_.raw.swap(spare_.back());
+        spare_.pop_back();
+    }
+    lck.unlock();
+    not_empty_.notify_one();
+
+    if (cur_.raw.size() < opts_.chunk_size) cur_.raw.resize(opts_.chunk_size);
+    std::lock_guard<std::mutex> lck_stats(m_stats_);
+    stats_.blocked_sec += blocked;
+}
+
+void CompressedBagWriter::worker()
+{
+    if (thread_init_) thread_init_();
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lck(m_queue_);
+            not_empty_.wait(lck, [this] { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) return;
+            job = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        auto t0 = steady_clock::now();
+        job.ok = job.raw_n == 0 || compressChunk(opts_.codec, opts_.level, job.raw.data(), job.raw_n, job.out);
+        double dt = duration_cast<duration<double> >(steady_clock::now() - t0).count();
+        {
+            std::lock_guard<std::mutex> lck(m_stats_);
+            stats_.compress_sec += dt;
+        }
+        complete(std::move(job));
+    }
+}
+
+// m_commit_ held; returns the bytes stored
+size_t CompressedBagWriter::append(const Job &j)
+{
+    if (!j.ok && !failed_) {
+        printf(" * ERROR! %s compression failed, chunk %lu stored raw\n", chunkCodecName(opts_.codec), j.seq);
+    }
+    const uint8_t *data = j.ok ? j.out.data() : j.raw.data();
+    const size_t n = j.ok ? j.out.size() : j.raw_n;
+
+    BagzChunkHeader ch;
+    memcpy(ch.magic, BGZ_CHUNK_MAGIC, 4);
+    ch.codec = j.ok ? opts_.codec : CHUNK_RAW;
+    ch.raw_bytes = (uint32_t)j.raw_n;
+    ch.stored_bytes = (uint32_t)n;
+    ch.records = j.records;
+    ch.first_us = j.first_us;
+    ch.last_us = j.last_us;
+    ch.crc = chunkCrc(BGZ_VERSION, ch, data);
+    if (fp_ && !failed_ &&
+        (fwrite(&ch, sizeof(ch), 1, fp_) != 1 || fwrite(data, 1, n, fp_) != n)) {
+        printf(" * ERROR! writing the compressed bag failed, disk full?\n");
+        failed_ = true;
+    }
+    if (!failed_) {
+        BagzIndexEntry e;
+        e.offset = offset_;
+        e.first_us = j.first_us;
+        e.last_us = j.last_us;
+        e.raw_bytes = ch.raw_bytes;
+        e.records = j.records;
+        index_.push_back(e);
+        offset_ += sizeof(ch) + n;
+        max_raw_ = std::max(max_raw_, ch.raw_bytes);
+    }
+    return sizeof(ch) + n;
+}
+
+void CompressedBagWriter::complete(Job &&job)
+{
+    std::vector<std::vector<uint8_t> > freed;
+    uint64_t chunks = 0, raw = 0, stored = 0;
+    int sync_fd = -1;
+    {
+        std::lock_guard<std::mutex> lck(m_commit_);
+        done_[job.seq] = std::move(job);
+        // append every chunk that is next in line
+        for (auto it = done_.find(next_commit_); it != done_.end(); it = done_.find(next_commit_)) {
+            Job &j = it->second;
+            if (j.raw_n > 0) {
+                stored += append(j);
+                chunks++;
+                raw += j.raw_n;
+            }
+            if (j.sync && fp_ && !failed_) {
+                fflush(fp_);
+                sync_fd = fileno(fp_);
+            }
+            freed.push_back(std::move(j.raw));
+            done_.erase(it);
+            next_commit_++;
+        }
+    }
+    // outside the lock: the next chunks can be appended meanwhile
+    if (sync_fd >= 0) {
+        auto t0 = steady_clock::now();
+        fdatasync(sync_fd);
+        const double dt = duration_cast<duration<double> >(steady_clock::now() - t0).count();
+        std::lock_guard<std::mutex> lck(m_stats_);
+        stats_.commits++;
+        stats_.sync_sec += dt;
+        stats_.sync_max_sec = std::max(stats_.sync_max_sec, dt);
+    }
+    if (freed.empty()) return;
+    {
+        std::lock_guard<std::mutex> lck(m_queue_);
+        in_flight_ -= freed.size();
+        for (auto &b : freed) spare_.push_back(std::move(b));
+    }
+    not_full_.notify_one();
+    std::lock_guard<std::mutex> lck(m_stats_);
+    stats_.chunks += chunks;
+    stats_.raw_bytes += raw;
+    stats_.stored_bytes += stored;
+}
+
+void CompressedBagWriter::close()
+{
+    if (!fp_) return;
+    submit();
+    {
+        std::lock_guard<std::mutex> lck(m_queue_);
+        stop_ = true;
+    }
+    not_empty_.notify_all();
+    for (auto &t : workers_) t.join();
+    workers_.clear();
+
+    std::vector<uint8_t> conn_buf;
+    for (size_t i = 0; i < conns_.size(); i++)
+        appendConnection(conn_buf, (uint16_t)i, conns_[i]);
+
+    BagzFooter ft;
+    memset(&ft, 0, sizeof(ft));
+    memcpy(ft.magic, BGZ_INDEX_MAGIC, 4);
+    ft.n_chunks = (uint32_t)index_.size();
+    ft.index_offset = offset_;
+    ft.conn_offset = offset_ + index_.size() * sizeof(BagzIndexEntry);
+    ft.n_conns = (uint32_t)conns_.size();
+    ft.max_raw_bytes = max_raw_;
+    ft.messages = stats().messages;
+    fwrite(index_.data(), sizeof(BagzIndexEntry), index_.size(), fp_);
+    fwrite(conn_buf.data(), 1, conn_buf.size(), fp_);
+    fwrite(&ft, sizeof(ft), 1, fp_);
+    fclose(fp_);
+    fp_ = nullptr;
+}
+
+CompressedBagWriter::Stats CompressedBagWriter::stats() const
+{
+    std::lock_guard<std::mutex> lck(m_stats_);
+    Stats s = stats_;
+    s.messages = messages_.load(std::memory_order_relaxed);
+    return s;
+}
+
+CompressedBagReader::~CompressedBagReader()
+{
+    close();
+}
+
+void CompressedBagReader::close()
+{
+    if (fp_) fclose(fp_);
+    fp_ = nullptr;
+    index_.clear();
+    conns_.clear();
+}
+
+bool CompressedBagReader::open(const std::string &path)
+{
+    close();
+    fp_ = fopen(path.c_str(), "rb");
+    if (!fp_) return false;
+    if (fread(&hd_, sizeof(hd_), 1, fp_) != 1 || memcmp(hd_.magic, BGZ_MAGIC, 4) != 0 ||
+        hd_.version < 1 || hd_.version > BGZ_VERSION || fseeko(fp_, 0, SEEK_END) != 0) {
+        close();
+        return false;
+    }
+    file_size_ = (uint64_t)ftello(fp_);
+    max_raw_ = hd_.chunk_size;
+
+    BagzFooter ft;
+    bool have_footer = fseeko(fp_, -(off_t)sizeof(ft), SEEK_END) == 0 &&
+                       fread(&ft, sizeof(ft), 1, fp_) == 1 && memcmp(ft.magic, BGZ_INDEX_MAGIC, 4) == 0;
+    // a footer that does not describe this file is treated as missing:
+    // index, then connections, back to back between the chunks and the footer
+    const uint64_t end = have_footer ? (uint64_t)ftello(fp_) - sizeof(ft) : 0;
+    have_footer = have_footer && ft.index_offset >= sizeof(BagzFileHeader) &&
+                  ft.index_offset <= ft.conn_offset && ft.conn_offset <= end &&
+                  ft.conn_offset - ft.index_offset == (uint64_t)ft.n_chunks * sizeof(BagzIndexEntry);
+    if (have_footer) {
+        index_.resize(ft.n_chunks);
+        std::vector<uint8_t> conn_buf(end - ft.conn_offset);
+        have_footer = fseeko(fp_, ft.index_offset, SEEK_SET) == 0 &&
+                      fread(index_.data(), sizeof(BagzIndexEntry), index_.size(), fp_) == index_.size() &&
+                      fread(conn_buf.data(), 1, conn_buf.size(), fp_) == conn_buf.size();
+        for (size_t pos = 0; have_footer && pos + sizeof(BagzRecordHeader) <= conn_buf.size();) {
+            BagzRecordHeader rh;
+            memcpy(&rh, conn_buf.data() + pos, sizeof(rh));
+            if (rh.len > conn_buf.size() - pos - sizeof(rh)) {
+                have_footer = false;
+                break;
+            }
+            addConnection(rh.conn, conn_buf.data() + pos + sizeof(rh), rh.len);
+            pos += sizeof(rh) + rh.len;
+        }
+        if (have_footer) max_raw_ = std::max(max_raw_, ft.max_raw_bytes);
+    }
+    if (!have_footer) {
+        recovered_ = true;
+        conns_.clear();
+        if (!rebuildIndex()) {
+            close();
+            return false;
+        }
+    }
+    chunk_ = 0;
+    pos_ = raw_n_ = 0;
+    return true;
+}
+
+bool CompressedBagReader::rebuildIndex()
+{
+    index_.clear();
+    off_t off = sizeof(BagzFileHeader);
+    BagzChunkHeader ch;
+    while (fseeko(fp_, off, SEEK_SET) == 0 && fread(&ch, sizeof(ch), 1, fp_) == 1 &&
+           memcmp(ch.magic, BGZ_CHUNK_MAGIC, 4) == 0) {
+        // a chunk cut short by the crash is left out
+        if (fseeko(fp_, off + (off_t)sizeof(ch) + ch.stored_bytes - 1, SEEK_SET) != 0 || fgetc(fp_) == EOF)
+            break;
+        BagzIndexEntry e;
+        e.offset = off;
+        e.first_us = ch.first_us;
+        e.last_us = ch.last_us;
+        e.raw_bytes = ch.raw_bytes;
+        e.records = ch.records;
+        index_.push_back(e);
+        off += sizeof(ch) + ch.stored_bytes;
+    }
+    return true;
+}
+
+void CompressedBagReader::addConnection(uint16_t id, const uint8_t *p, uint32_t len)
+{
+    if (id < conns_.size() && !conns_[id].topic.empty()) return;
+    if (id >= conns_.size()) conns_.resize(id + 1);
+    const char *s = (const char *)p, *end = s + len;
+    std::string *fields[] = {&conns_[id].topic, &conns_[id].datatype, &conns_[id].md5, &conns_[id].definition};
+    for (std::string *f : fields) {
+        const char *z = (const char *)memchr(s, 0, end - s);
+        if (!z) return;
+        f->assign(s, z);
+        s = z + 1;
+    }
+}
+
+bool CompressedBagReader::loadChunk(size_t i)
+{
+    const BagzIndexEntry &e = index_[i];
+    BagzChunkHeader ch;
+    if (fseeko(fp_, e.offset, SEEK_SET) != 0 || fread(&ch, sizeof(ch), 1, fp_) != 1 ||
+        memcmp(ch.magic, BGZ_CHUNK_MAGIC, 4) != 0 || ch.stored_bytes > file_size_ - e.offset - sizeof(ch))
+        return false;
+    // a message larger than a chunk gets a chunk of its own; without a
+    // footer its size is only trusted once the CRC has checked the header
+    const bool single = hd_.version >= 2 && ch.records == 1;
+    if (ch.raw_bytes > max_raw_ && !single) return false;
+    stored_.resize(ch.stored_bytes);
+    if (fread(stored_.data(), 1, ch.stored_bytes, fp_) != ch.stored_bytes ||
+        chunkCrc(hd_.version, ch, stored_.data()) != ch.crc)
+        return false;
+    raw_.resize(ch.raw_bytes);
+    if (!decompressChunk((ChunkCodec)ch.codec, stored_.data(), ch.stored_bytes, raw_.data(), ch.raw_bytes))
+        return false;
+    raw_n_ = ch.raw_bytes;
+    pos_ = 0;
+    return true;
+}
+
+bool CompressedBagReader::next(Message &m)
+{
+    for (;;) {
+        if (pos_ + sizeof(BagzRecordHeader) > raw_n_) {
+            if (chunk_ >= index_.size()) return false;
+            if (!loadChunk(chunk_)) {
+                // without footer, a torn chunk is where the last commit ends
+                if (recovered_) {
+                    printf(" * WARNING! chunk %lu at offset %lu is incomplete, the data ends before it\n",
+                        chunk_, index_[chunk_].offset);
+                    index_.resize(chunk_);
+                    return false;
+                }
+                printf(" * ERROR! damaged chunk %lu at offset %lu\n", chunk_, index_[chunk_].offset);
+                error_ = true;
+                return false;
+            }
+            chunk_++;
+            continue;
+        }
+        BagzRecordHeader rh;
+        memcpy(&rh, raw_.data() + pos_, sizeof(rh));
+        const uint8_t *payload = raw_.data() + pos_ + sizeof(rh);
+        if (pos_ + sizeof(rh) + rh.len > raw_n_) {
+            error_ = true;
+            return false;
+        }
+        pos_ += sizeof(rh) + rh.len;
+        if (rh.op == BAGZ_CONN) {
+            addConnection(rh.conn, payload, rh.len);
+            continue;
+        }
+        m.conn = rh.conn;
+        m.stamp.sec = rh.sec;
+        m.stamp.nsec = rh.nsec;
+        m.data = payload;
+        m.size = rh.len;
+        return true;
+    }
+}
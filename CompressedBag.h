@@ -0,0 +1,235 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ros/serialization.h>
+#include <ros/message_traits.h>
+
+#include "ChunkCodec.h"
+
+// The bag's messages in fixed-size chunks, compressed in parallel:
+//
+//   [header][chunk 0][chunk 1]...[chunk n-1][index][connections][footer]
+//
+// The writer thread serializes messages (ROS wire format) into the current
+// chunk. Full chunks go to a pool of compression threads; whichever thread
+// finishes the next chunk in sequence appends it, so chunks land in order.
+// A chunk holds records: a connection record (topic, type, md5, definition)
+// the first time a topic appears, then message records. The index has one
+// entry per chunk; without a footer (crash) the reader walks the chunks.
+// evb2bag turns the file back into a rosbag.
+//
+// commit() makes the file crash safe up to that point: the partial chunk is
+// sent off as it is and the file is fdatasync'ed once it is appended, one
+// fsync per group of messages. After a crash or power loss the reader keeps
+// every chunk up to the first damaged one.
+//
+// A chunk's CRC covers its header (with the crc field zeroed) and the stored
+// bytes; version 1 files only checked the stored bytes and are still read.
+struct BagzFileHeader {
+    char magic[4];          // "BGZ1"
+    uint32_t version;
+    uint32_t codec;         // ChunkCodec
+    int32_t level;
+    uint32_t chunk_size;
+    uint32_t reserved;
+    uint64_t created_unix;
+};
+
+struct BagzChunkHeader {
+    char magic[4];          // "BGZC"
+    uint32_t codec;
+    uint32_t raw_bytes;
+    uint32_t stored_bytes;
+    uint32_t crc;           // of the header and the stored bytes
+    uint32_t records;
+    uint64_t first_us;      // message stamps
+    uint64_t last_us;
+};
+
+enum BagzOp : uint16_t { BAGZ_MSG = 0, BAGZ_CONN = 1 };
+
+struct BagzRecordHeader {
+    uint32_t len;           // payload bytes after this header
+    uint16_t conn;
+    uint16_t op;            // BagzOp
+    uint32_t sec, nsec;
+};
+static_assert(sizeof(BagzRecordHeader) == 16, "BagzRecordHeader must stay packed");
+
+struct BagzIndexEntry {
+    uint64_t offset;        // of the chunk header
+    uint64_t first_us;
+    uint64_t last_us;
+    uint32_t raw_bytes;
+    uint32_t records;
+};
+static_assert(sizeof(BagzIndexEntry) == 32, "BagzIndexEntry must stay packed");
+
+struct BagzFooter {
+    char magic[4];          // "BGZI"
+    uint32_t n_chunks;
+    uint64_t index_offset;
+    uint64_t conn_offset;   // connection records, same layout as in chunks
+    uint32_t n_conns;
+    uint32_t max_raw_bytes; // largest chunk, above chunk_size for a large message
+    uint64_t messages;
+};
+
+struct BagzConnection {
+    std::string topic, datatype, md5, definition;
+};
+
+class CompressedBagWriter
+{
+public:
+    struct Options {
+        ChunkCodec codec = CHUNK_LZ4;
+        int level = 1;
+        int threads = 0;                // <= 0: half the cores
+        size_t chunk_size = 4 << 20;
+    };
+    struct Stats {
+        uint64_t messages = 0;
+        uint64_t chunks = 0;
+        uint64_t raw_bytes = 0;
+        uint64_t stored_bytes = 0;
+        double compress_sec = 0;        // summed over threads
+        double blocked_sec = 0;         // writer waiting for a free slot
+        uint64_t commits = 0;           // fdatasync calls
+        double sync_sec = 0;
+        double sync_max_sec = 0;
+    };
+
+    explicit CompressedBagWriter(const Options &opts);
+    ~CompressedBagWriter();
+
+    // Runs first thing on every compression thread. Call before open().
+    void setThreadInit(std::function<void()> fn) { thread_init_ = fn; }
+    bool open(const std::string &path);
+    // Compresses what is left, then writes index and footer.
+    void close();
+
+    // Writer thread only.
+    template <class M>
+    void write(const std::string &topic, const ros::Time &t, const M &msg)
+    {
+        namespace mt = ros::message_traits;
+        uint16_t conn = connection(topic, mt::datatype<M>(), mt::md5sum<M>(), mt::definition<M>());
+        uint32_t len = ros::serialization::serializationLength(msg);
+        ros::serialization::OStream s(beginRecord(BAGZ_MSG, conn, t, len), len);
+        ros::serialization::serialize(s, msg);
+    }
+
+    // Already serialized message, e.g. copied from another recording.
+    void writeSerialized(const BagzConnection &c, const ros::Time &t, const uint8_t *data, uint32_t len);
+    // Group commit of everything written so far, see above. Writer thread;
+    // does not wait for the disk.
+    void commit();
+
+    Stats stats() const;
+    int threads() const { return n_threads_; }
+    bool failed() const { return failed_; }
+
+private:
+    struct Job {
+        uint64_t seq = 0;
+        std::vector<uint8_t> raw;
+        size_t raw_n = 0;
+        uint32_t records = 0;
+        uint64_t first_us = 0, last_us = 0;
+        std::vector<uint8_t> out;
+        bool ok = false;
+        bool sync = false;          // fdatasync once appended
+    };
+
+    uint16_t connection(const std::string &topic, const char *datatype, const char *md5, const char *def);
+    uint8_t *beginRecord(BagzOp op, uint16_t conn, const ros::Time &t, uint32_t len);
+    void submit();
+    void worker();
+    size_t append(const Job &j);
+    void complete(Job &&job);
+    void appendConnection(std::vector<uint8_t> &buf, uint16_t id, const BagzConnection &c);
+
+    Options opts_;
+    int n_threads_;
+    std::function<void()> thread_init_;
+    FILE *fp_ = nullptr;
+    uint64_t offset_ = 0;
+
+    // chunk being filled by the writer thread
+    Job cur_;
+    uint64_t next_seq_ = 0;
+    std::atomic<uint64_t> messages_{0};
+    bool unsynced_ = false;         // chunks submitted since the last commit
+    std::map<std::string, uint16_t> conn_ids_;
+    std::vector<BagzConnection> conns_;
+
+    std::mutex m_queue_;
+    std::condition_variable not_empty_, not_full_;
+    std::deque<Job> queue_;
+    size_t in_flight_ = 0;          // submitted, not yet on disk
+    bool stop_ = false;
+    std::vector<std::thread> workers_;
+    std::vector<std::vector<uint8_t> > spare_;  // recycled chunk buffers
+
+    std::mutex m_commit_;
+    std::map<uint64_t, Job> done_;
+    uint64_t next_commit_ = 0;
+    std::vector<BagzIndexEntry> index_;
+    uint32_t max_raw_ = 0;
+    bool failed_ = false;
+
+    mutable std::mutex m_stats_;
+    Stats stats_;
+};
+
+class CompressedBagReader
+{
+public:
+    struct Message {
+        uint16_t conn;
+        ros::Time stamp;
+        const uint8_t *data;    // serialized, valid until the next call
+        uint32_t size;
+    };
+
+    ~CompressedBagReader();
+    bool open(const std::string &path);
+    void close();
+
+    // Returns false at end of data (or on a damaged chunk, see error()).
+    bool next(Message &m);
+
+    const std::vector<BagzConnection> &connections() const { return conns_; }
+    const std::vector<BagzIndexEntry> &index() const { return index_; }
+    bool recovered() const { return recovered_; }
+    bool error() const { return error_; }
+
+private:
+    bool rebuildIndex();
+    bool loadChunk(size_t i);
+    void addConnection(uint16_t id, const uint8_t *p, uint32_t len);
+
+    FILE *fp_ = nullptr;
+    BagzFileHeader hd_;
+    uint64_t file_size_ = 0;
+    uint32_t max_raw_ = 0;          // larger chunks are damaged
+    std::vector<BagzIndexEntry> index_;
+    std::vector<BagzConnection> conns_;
+    bool recovered_ = false;
+    bool error_ = false;
+    size_t chunk_ = 0;
+    std::vector<uint8_t> stored_, raw_;
+    size_t pos_ = 0, raw_n_ = 0;
+};
@@ -0,0 +1,28 @@
+#include "Crc32.h"
+
+namespace {
+
+struct Crc32Table {
+    uint32_t t[256];
+    Crc32Table()
+    {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+    }
+};
+
+}
+
+uint32_t crc32(const uint8_t *data, size_t len, uint32_t crc)
+{
+    static const Crc32Table tab;
+    const uint32_t *table = tab.t;
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32 (IEEE), chainable through `crc`.
+uint32_t crc32(const uint8_t *data, size_t len, uint32_t crc = 0);
@@ -1,82 +1,177 @@
 
-#include <librealsense2/rs.hpp>
 #include <opencv2/opencv.hpp>
 
 #include <iostream>
 #include <experimental/filesystem>
-#include <sys/stat.h>
+#include <thread>
 
+#include "FrameEncoderPool.h"
+#include "FrameContainer.h"
+#include "CaptureConfig.h"
+#include "Preview.h"
+#include "ThreadAffinity.h"
+#include "D435Capture.h"
+#include "CaptureSource.h"
+#include "Telemetry.h"
+#include "SensorSync.h"
+#include "MemoryBudget.h"
+#include "Startup.h"
+#include "LiveFeed.h"
 
 using namespace cv;
 using namespace std;
 
-int D435Main(const string folder)
+int D435Main(const string folder, D435Source &source, SensorSync *sync)
 {
-    // came init
-    rs2::pipeline pipe;
-    rs2::config cfg;
-    cfg.enable_stream(RS2_STREAM_DEPTH);
-    cfg.enable_stream(RS2_STREAM_INFRARED);
-    auto profile = pipe.start(cfg);
-    rs2::device dev = profile.get_device();
-    auto sensors = dev.query_sensors();
-    auto stereo = sensors[0];
-    // 自动曝光
-    stereo.set_option(rs2_option::RS2_OPTION_ENABLE_AUTO_EXPOSURE, 1);
-    stereo.set_option(rs2_option::RS2_OPTION_EMITTER_ENABLED, 0);
-
-	// get intrinsic
-	// 425.061 425.061 424.694 244.09
-	cout << "D435 intrinsic (fx, fy, cx, cy): " ;
-	auto const K = pipe.get_active_profile().get_stream(RS2_STREAM_INFRARED).as<rs2::video_stream_profile>().get_intrinsics();
-	cout << K.fx << " " << K.fy << " " << K.ppx << " " << K.ppy << endl;
+    // pipe.start() takes a second or more; the writer is set up meanwhile
+    bool source_ok = false;
+    thread source_start([&] {
+        double t = startup::now();
+        source_ok = source.start();
+        startup::step("D435 device started", t);
+    });
+    double t_open = startup::now();
 
     // writer
-	string folder_img = (folder + "/D435_Img");
-    mkdir(folder_img.c_str(), ACCESSPERMS);
-    ofstream of(string(folder)+"/D435_time.txt");
+    unique_ptr<FrameSink> sink;
+    string time_path = string(folder) + "/D435_time.txt";
+    if (capture_cfg.d435_output == "container") {
+        FrameCodec codec = capture_cfg.d435_codec == "raw" ? FRAME_RAW : FRAME_LZ4;
+        sink.reset(new ContainerFrameSink(folder + "/D435_ir.frames", time_path, codec));
+        printf("D435 frames -> %s/D435_ir.frames (%s)\n", folder.c_str(),
+            codec == FRAME_LZ4 && frameLz4Available() ? "lz4" : "raw");
+    } else {
+        if (capture_cfg.d435_output != "png")
+            printf(" * WARNING! unknown d435_output '%s', writing png\n", capture_cfg.d435_output.c_str());
+        sink.reset(new PngFrameSink(folder + "/D435_Img", time_path, capture_cfg.d435_png_level));
+    }
+    const RotateConfig rotate = rotateConfig();
+    auto closer_init = [] { applyThreadRole(ThreadRole::Writer); };
+    sink->setRotation(rotate, closer_init);
+    FrameEncoderPool encoder(sink.get(), capture_cfg.d435_encoder_threads, capture_cfg.d435_queue_size);
+    encoder.setThreadInit([] { applyThreadRole(ThreadRole::Encoder); });
+    bool encoder_ok = encoder.start();
+
+    // depth: lossless 16-bit codec on a pool of its own
+    unique_ptr<ContainerFrameSink> depth_sink;
+    unique_ptr<FrameEncoderPool> depth_encoder;
+    if (capture_cfg.d435_depth) {
+        depth_sink.reset(new ContainerFrameSink(folder + "/D435_depth.frames", folder + "/D435_depth_time.txt", FRAME_DEPTH));
+        depth_sink->setRotation(rotate, closer_init);
+        depth_encoder.reset(new FrameEncoderPool(depth_sink.get(), capture_cfg.d435_encoder_threads,
+            capture_cfg.d435_queue_size, telemetry::DEPTH));
+        depth_encoder->setThreadInit([] { applyThreadRole(ThreadRole::Encoder); });
+        encoder_ok = depth_encoder->start() && encoder_ok;
+    }
+    startup::step("D435 writer ready", t_open);
+    source_start.join();
+    if (!encoder_ok || !source_ok) {
+        source.stop();
+        encoder.stop();
+        if (depth_encoder) depth_encoder->stop();
+        return -1;
+    }
+    printf("D435 encoder: %d threads, queue %d, png level %d\n",
+        encoder.threads(), capture_cfg.d435_queue_size, capture_cfg.d435_png_level);
+    if (depth_encoder) {
+        char scale[64];
+        sprintf(scale, "# depth_scale %g", source.depthScale());
+        depth_sink->setTimeHeader(scale);
+        printf("D435 depth -> %s/D435_depth.frames, %d threads\n", folder.c_str(), depth_encoder->threads());
+    }
+
+    // only now: threads inherit the creator's cores and SCHED_FIFO
+    applyThreadRole(ThreadRole::D435Grab);
 
     // S.T.A.R.T
     printf("D435 is running ...\n");
-    int cnt = 0;
-    while (1)
+    uint64_t cnt = 0, depth_cnt = 0;
+    unsigned long long last_fn = 0, late = 0;
+    while (!is_shutdown)
     {
-        // get image
-        rs2::frameset data = pipe.wait_for_frames(); // Wait for next set of frames from the camera
-        rs2::frame infrared = data.get_infrared_frame();
-        const int w = infrared.as<rs2::video_frame>().get_width();
-        const int h = infrared.as<rs2::video_frame>().get_height();
-        Mat image(Size(w, h), CV_8UC1, (void *)infrared.get_data(), Mat::AUTO_STEP);
+        IRFrame f;
+        unsigned long long fn = 0;
+        if (!source.next(f, fn))
+            continue;
+        int64_t arrival = hostNowUs();
+        if (last_fn == 0)
+            startup::mark("D435 first frame");
+        telemetry::latency(telemetry::D435, telemetry::CALLBACK, f.stamp);
 
-        // get expo and stamp
-        double expo = 0;
-        long long stamp = 0;
-        try{
-            expo = infrared.get_frame_metadata(rs2_frame_metadata_value::RS2_FRAME_METADATA_ACTUAL_EXPOSURE) / 1000.0;
-        }
-        catch (std::exception &e){
-            cout << e.what() << endl;
+        // frames the source dropped before we got to them
+        if (last_fn != 0 && fn > last_fn + 1)
+            late += fn - last_fn - 1;
+        last_fn = fn;
+        if (!membudget::keepFrame(telemetry::D435, f.stamp)) {
+            telemetry::dropped(telemetry::D435, 1);
+            continue;
         }
-        stamp = infrared.get_frame_metadata(rs2_frame_metadata_value::RS2_FRAME_METADATA_FRAME_TIMESTAMP);
 
-        // write
-        char msg[100] = "";
-        sprintf(msg, "%05d %lld %.5f", cnt, stamp, expo);
-        of << msg << endl;
-
-        char img_idx[10] = "";
-        sprintf(img_idx, "%05d", cnt);
-        imwrite(folder_img + "/" + string(img_idx) + ".png", image);
-        cnt++;
+        // write: the pool encodes the frame, `hold` keeps its memory alive
+        f.index = cnt;
+        live::d435(f);
+        long long stamp = f.stamp;
+        Mat image = f.image;
+        IRFrame depth;
+        if (depth_encoder && !f.depth.empty()) {
+            depth.index = depth_cnt;
+            depth.stamp = f.stamp;
+            depth.expo = f.expo;
+            depth.image = f.depth;
+            depth.hold = f.hold;
+            telemetry::latency(telemetry::DEPTH, telemetry::CALLBACK, f.stamp);
+        }
+        f.depth.release();
+        IRFrame synced;
+        if (sync) {
+            synced.index = f.index;
+            synced.stamp = f.stamp;
+            synced.expo = f.expo;
+            synced.image = f.image;
+            synced.hold = f.hold;
+        }
+        if (encoder.push(std::move(f))) {
+            cnt++;
+            if (sync)
+                sync->pushD435(synced, arrival);
+            telemetry::latency(telemetry::D435, telemetry::QUEUED, stamp);
+        } else {
+            telemetry::dropped(telemetry::D435, 1);
+        }
+        telemetry::depth(telemetry::D435, encoder.depth());
+        membudget::setBytes(telemetry::D435, encoder.depth() * image.total() * image.elemSize());
+        if (!depth.image.empty()) {
+            const size_t depth_bytes = depth.image.total() * depth.image.elemSize();
+            if (depth_encoder->push(std::move(depth))) {
+                depth_cnt++;
+                telemetry::latency(telemetry::DEPTH, telemetry::QUEUED, stamp);
+            } else {
+                telemetry::dropped(telemetry::DEPTH, 1);
+            }
+            telemetry::depth(telemetry::DEPTH, depth_encoder->depth());
+            membudget::setBytes(telemetry::DEPTH, depth_encoder->depth() * depth_bytes);
+        }
 
         // show
-        Mat image_show;
-        cv::resize(image, image_show, Size(), 0.25, 0.25);
-        cv::imshow("D435", image_show);
-        int key = waitKey(1);
-        if (key == 'q')
-            return 0;
-
+        if (membudget::keepPreview()) {
+            Mat image_show;
+            cv::resize(image, image_show, Size(), 0.25, 0.25);
+            previewPost("D435", image_show);
+        }
+    }
+    source.stop();
+    encoder.stop();
+    if (depth_encoder) depth_encoder->stop();
+    FrameEncoderPool::Stats st = encoder.stats();
+    printf("D435: %lu frames written, %lu dropped (encoder queue full), %llu late (skipped by librealsense), %lu failed, max queue %lu, %.1f ms/frame encode\n",
+        st.written, st.dropped, late, st.failed, st.high_water,
+        st.queued ? 1e3 * st.encode_sec / st.queued : 0.0);
+    if (depth_encoder) {
+        st = depth_encoder->stats();
+        printf("D435 depth: %lu frames written, %lu dropped, %lu failed, max queue %lu, %.2f ms/frame encode (max %.2f), %.1f MB -> %.1f MB (%.2fx)\n",
+            st.written, st.dropped, st.failed, st.high_water,
+            st.queued ? 1e3 * st.encode_sec / st.queued : 0.0, 1e3 * st.encode_max_sec,
+            st.raw_bytes / 1e6, st.bytes / 1e6, st.bytes ? (double)st.raw_bytes / st.bytes : 0.0);
     }
     return 0;
-}
\ No newline at end of file
+}
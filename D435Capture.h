@@ -1,4 +1,14 @@
 #pragma once
 
+#include <atomic>
 #include <string>
-int D435Main(const std::string folder);
\ No newline at end of file
+
+// Set from main (preview 'q' or a failed sensor); capture loops return.
+extern std::atomic_bool is_shutdown;
+
+class D435Source;
+class SensorSync;
+
+// Records infrared frames from `source` into <folder> until is_shutdown.
+// Saved frames also go to `sync` if given.
+int D435Main(const std::string folder, D435Source &source, SensorSync *sync = nullptr);
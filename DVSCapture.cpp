@@ -1,5 +1,4 @@
-#include <iness_common/device/sees/sees.hpp>
-
+#include <algorithm>
 #include <atomic>
 #include <iostream>
 #include <memory>
@@ -7,226 +6,369 @@
 #include <signal.h>
 #include <ostream>
 #include <thread>
+#include <ctime>
 #include <chrono>
 #include <sys/stat.h>
 #include <deque>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 
 #include <rosbag/bag.h>
 #include <sensor_msgs/Imu.h>
 #include <sensor_msgs/Image.h>
 #include <dvs_msgs/EventArray.h>
-#include <cv_bridge/cv_bridge.h>
 #include <atomic>
 
-std::atomic_bool is_shutdown;
-std::vector<sensor_msgs::Image> msg_img_buf;
-std::vector<sensor_msgs::Imu> msg_imu_buf;
-dvs_msgs::EventArray msg_event_buf[1000];
-int n_event_buf = 0;
-std::mutex m_img, m_imu, m_evt;
-u_int32_t t0 = 0;
-std::chrono::high_resolution_clock::time_point tp0;
-
-int dvs_height;
-int dvs_width;
-const unsigned int DVS_START_CAP = 5e6; // 1 sec
-
-inline uint32_t utc_us_in_a_day(void){
-    using namespace std;
-    auto tp1 = chrono::high_resolution_clock().now();
-    double dt = chrono::duration_cast<chrono::milliseconds>(tp1-tp0).count();
-    uint32_t ts = t0 + (uint32_t) (dt);
-    return ts;
-}
+#include "SPSCQueue.h"
+#include "ApsFrame.h"
+#include "EventPool.h"
+#include "BagWriter.h"
+#include "Preview.h"
+#include "EventCodec.h"
+#include "ChunkedEventFile.h"
+#include "CaptureConfig.h"
+#include "ThreadAffinity.h"
+#include "DVSCapture.h"
+#include "CaptureSource.h"
+#include "Telemetry.h"
+#include "SensorSync.h"
+#include "MemoryBudget.h"
+#include "NoiseFilter.h"
+#include "PixelMask.h"
+#include "Startup.h"
+#include "LiveFeed.h"
 
-void ImuPacketCallback(iness::Imu6EventPacket &_packet)
+// source callback -> bag writer, one EventArray per packet
+const size_t EVT_QUEUE_SIZE = 4096;
+const OverflowPolicy EVT_QUEUE_POLICY = OverflowPolicy::DropOldest;
+// writer wakes when this much is pending, or after WRITER_BATCH_MS at the latest
+const size_t WRITER_BATCH_BYTES = 4 << 20;
+const int WRITER_BATCH_MS = 20;
+// pre-filled pool blocks for full packets; other sizes fill up after warm-up
+const size_t EVT_POOL_PACKET_EVENTS = 8192;
+const size_t EVT_POOL_PREALLOC = 64;
+
+// Hands source data to the bag writer.
+class DvsPipeline : public DvsHandler
 {
-    static int last_sec = -1;
-    static unsigned int imu_seq = 0;
+public:
+    DvsPipeline(const std::string &folder, BagWriter &writer, SensorSync *sync, int noise_us,
+                const ReadinessConfig &ready)
+        : folder_(folder), writer_(writer), sync_(sync), noise_us_(noise_us), gate_(ready) {}
 
-    std::lock_guard<std::mutex> lck(m_imu);
-    for(auto& event : _packet)
+    void onRawEvents(EventSoA &soa, int width, int height) override
     {
-        // Get the timestamp of the event.
-        iness::time::TimeUs ts = event.getTimestampUs(_packet.header().event_ts_overflow);
-        if(ts < DVS_START_CAP) continue;
-        sensor_msgs::Imu imu;
-        imu.header.seq = imu_seq++;
-        imu.header.stamp = ros::Time(ts/1e6);
-        imu.linear_acceleration.x = event.getAccelerationX() * 9.81;
-        imu.linear_acceleration.y = event.getAccelerationY() * 9.81;
-        imu.linear_acceleration.z = event.getAccelerationZ() * 9.81;
-        imu.angular_velocity.x = event.getGyroX() / 180.0 * M_PI;
-        imu.angular_velocity.y = event.getGyroY() / 180.0 * M_PI;
-        imu.angular_velocity.z = event.getGyroZ() / 180.0 * M_PI;;
-        msg_imu_buf.emplace_back(imu);
-
-        if(ts / 1000000 != last_sec){
-            last_sec = ts / 1000000;
-            printf("Capture imu %d second\n", last_sec);
+        // nothing is recorded until the device is ready, see Startup.h
+        const size_t n = soa.size();
+        if (n == 0)
+            return;
+        if (!gate_.ready()) {
+            gate_.timestamp(soa.ts_us[0]);
+            soa.resize(0);
+            return;
         }
+        if (soa.ts_us[0] < gate_.readyUs()) {
+            size_t first = 0;
+            while (first < n && soa.ts_us[first] < gate_.readyUs()) first++;
+            for (size_t i = first; i < n; i++) {
+                soa.ts_us[i - first] = soa.ts_us[i];
+                soa.x[i - first] = soa.x[i];
+                soa.y[i - first] = soa.y[i];
+                soa.p[i - first] = soa.p[i];
+            }
+            soa.resize(n - first);
+        }
+        if (!mask_ready_)
+            setupMask(width, height);
+        if (calib_ && !calib_->done() && calib_->add(soa)) {
+            for (const HotPixel &p : calib_->hot())
+                mask_->clear(p.x, p.y);
+            const std::string path = folder_ + "-hotpixels.txt";
+            if (!saveHotPixels(path, calib_->hot(), width, height, calib_->seconds()))
+                printf(" * WARNING! cannot write %s\n", path.c_str());
+            printf("Hot pixels: %lu found in the first %.1f s, masked from now on, saved to %s\n",
+                calib_->hot().size(), calib_->seconds(), path.c_str());
+        }
+        // one bit test per event, before the message is built
+        if (mask_)
+            mask_->apply(soa);
     }
-}
 
+    void onEvents(PooledEventArray &&msg) override
+    {
+        msg.header.seq = evt_seq_++;
+        size_t n = msg.events.size();
+        uint64_t ts = timeToUs(msg.header.stamp);
+        // the packet is delivered after its last event
+        if (sync_ && n)
+            sync_->dvsTime(timeToUs(msg.events[n - 1].ts), hostNowUs());
+        // sized from the first packet: the SEES reports its size once started
+        if (noise_us_ > 0 && n && !filter_)
+            filter_.reset(new NoiseFilter(msg.width, msg.height, noise_us_));
+        if (filter_ && n && filter_->filter(msg) == 0)
+            return;
+        // over the memory budget: thinned or dropped, see MemoryBudget.h
+        if (!membudget::admitEvents(msg))
+            return;
+        n = msg.events.size();
+        live::events(msg, ts);
+        if (writer_.pushEvents(std::move(msg))){
+            events_ += n;
+            telemetry::latency(telemetry::EVENTS, telemetry::QUEUED, ts);
+        }
+        // printf("e(%lu) ", n);
+    }
 
-void FrameCallback(iness::FrameEventPacket &_packet)
-{
-    using namespace cv;
-    static unsigned int frame_seq = 0;
-
-    std::lock_guard<std::mutex> lck(m_img);
-    for(auto& frm : _packet)
+    void onImu(sensor_msgs::Imu &&imu) override
     {
-        iness::time::TimeUs ts = frm.getTimestampUs(_packet.header().event_ts_overflow);
-        uint32_t utc = utc_us_in_a_day();
+        uint64_t ts = timeToUs(imu.header.stamp);
+        if (!gate_.timestamp(ts))
+            return;
+        imu.header.seq = imu_seq_++;
+        uint32_t sec = (uint32_t)imu.header.stamp.toSec();
+        if (sync_)
+            sync_->dvsTime(ts, hostNowUs());
+        live::imu(imu, ts);
+        writer_.pushImu(std::move(imu));
+        telemetry::latency(telemetry::IMU, telemetry::QUEUED, ts);
 
-        Mat img = frm.getImage();
-        if(img.empty()) {
-            printf(" * WARNING! empty frame\n");
-            continue;
+        if((int)sec != last_sec_){
+            last_sec_ = sec;
+            printf("Capture imu %d second\n", last_sec_);
         }
+    }
 
-        if(ts < DVS_START_CAP) {
-            putText(img, std::to_string(ts/1e6), {100, 100}, FONT_HERSHEY_PLAIN, 3.0, 65535);
+    void onFrame(uint64_t ts, const cv::Mat &img) override
+    {
+        if (!gate_.frame(ts, img)) {
+            if (!gate_.ready() && !img.empty()) {
+                cv::Mat img_show = img.clone();
+                cv::putText(img_show, "starting " + std::to_string(ts / 1e6), {20, 40}, cv::FONT_HERSHEY_PLAIN, 2.0, 65535);
+                previewPost("img", img_show);
+            }
+            return;
         }
-
+        if (!membudget::keepFrame(telemetry::APS, ts))
+            return;
         std_msgs::Header hd;
-        hd.seq = frame_seq++;
+        hd.seq = frame_seq_++;
         hd.stamp = ros::Time(ts / 1e6);
-        hd.seq = utc; //TODO 这样对齐不太好
-        
-        cv_bridge::CvImage img_tmp(hd, "mono16", img);
-        sensor_msgs::Image img_msg;
-        img_tmp.toImageMsg(img_msg);
-        msg_img_buf.emplace_back(img_msg);
-    }
-}
+        live::aps(ts, hd.seq, img);
 
-void polarityEventPacketCallback(iness::PolarityEventPacket &_packet)
-{
-    static unsigned int evt_seq = 0;
-    std::lock_guard<std::mutex> lck(m_evt);
-    iness::time::TimeUs ts = _packet.first().getTimestampUs(_packet.tsOverflowCount());
-    if(ts < DVS_START_CAP) return;
-
-    std_msgs::Header hd;
-    hd.seq = evt_seq++;
-    hd.stamp = ros::Time(ts / 1e6);
-    dvs_msgs::EventArray &event_msgs = msg_event_buf[n_event_buf];
-    event_msgs.header = hd;
-    event_msgs.height = dvs_height;
-    event_msgs.width = dvs_width;
-
-    dvs_msgs::Event evts[5000];
-    int i = 0;
-
-    for (auto &evt : _packet) {
-        // Get the timestamp of the event.
-        iness::time::TimeUs ts = evt.getTimestampUs(_packet.tsOverflowCount());
-        evts[i].ts = ros::Time(ts / 1e6);
-        evts[i].polarity = (uint8_t)(evt.getPolarity());
-        evts[i].x = evt.getX();
-        evts[i].y = evt.getY();
-        i++; 
-    }
-    int packet_size = _packet.size();
-    std::vector<dvs_msgs::Event> tmp(begin(evts), begin(evts)+packet_size);
-    event_msgs.events = std::move(tmp);
-    n_event_buf++;
-    // printf("e(%lu) ", _packet.size());
+        // one copy out of SDK memory; writer, preview and sync share the result
+        PooledImagePtr msg = makeApsImage(hd, img);
+        if (membudget::keepPreview())
+            previewPost("img", apsImageView(*msg), msg);
+        if (sync_)
+            sync_->pushAps(msg, ts);
+        writer_.pushImage(std::move(msg));
+        telemetry::latency(telemetry::APS, telemetry::QUEUED, ts);
+    }
 
-}
+    uint64_t events() const { return events_; }
+    uint64_t imu() const { return imu_seq_; }
+    uint64_t frames() const { return frame_seq_; }
+    const NoiseFilter *noiseFilter() const { return filter_.get(); }
+    const PixelMask *pixelMask() const { return mask_.get(); }
 
+private:
+    // ROI and hot pixels from capture_cfg; no mask if there are neither
+    void setupMask(int width, int height)
+    {
+        mask_ready_ = true;
+        std::vector<HotPixel> hot;
+        const std::string &hot_file = capture_cfg.hot_pixel_file;
+        if (!hot_file.empty() && !loadHotPixels(hot_file, hot))
+            printf(" * WARNING! cannot read hot pixel file %s\n", hot_file.c_str());
+        int x0 = 0, y0 = 0, w = width, h = height;
+        const bool roi = !capture_cfg.roi.empty();
+        if (roi && !parseRoi(capture_cfg.roi, x0, y0, w, h)) {
+            printf(" * WARNING! roi '%s' is not x,y,w,h, recording the whole sensor\n", capture_cfg.roi.c_str());
+            x0 = y0 = 0;
+            w = width;
+            h = height;
+        }
+        const bool calib = capture_cfg.hot_pixel_calib_sec > 0;
+        if (!roi && hot.empty() && !calib)
+            return;
 
+        mask_.reset(new PixelMask(width, height));
+        mask_->setRoi(x0, y0, w, h);
+        for (const HotPixel &p : hot)
+            mask_->clear(p.x, p.y);
+        if (calib)
+            calib_.reset(new HotPixelCalibrator(width, height, capture_cfg.hot_pixel_calib_sec,
+                                                capture_cfg.hot_pixel_factor));
+        printf("Pixel mask: ROI %d,%d %dx%d, %lu hot pixels from %s, %lu of %d pixels masked%s\n",
+            x0, y0, w, h, hot.size(), hot_file.empty() ? "-" : hot_file.c_str(), mask_->cleared(),
+            width * height, calib ? ", learning hot pixels" : "");
+    }
 
-int DVSMain(const std::string folder){
+    std::string folder_;
+    BagWriter &writer_;
+    SensorSync *sync_;
+    int noise_us_;
+    ReadinessGate gate_;
+    std::unique_ptr<NoiseFilter> filter_;
+    bool mask_ready_ = false;
+    std::unique_ptr<PixelMask> mask_;
+    std::unique_ptr<HotPixelCalibrator> calib_;
+    unsigned int evt_seq_ = 0, imu_seq_ = 0, frame_seq_ = 0;
+    std::atomic<uint64_t> events_{0};
+    int last_sec_ = -1;
+};
 
-    std::chrono::milliseconds slp(100);
-    for(int i=0; i<10; i++){
-        std::this_thread::sleep_for(slp);
-        auto tp0_tmp = std::chrono::high_resolution_clock().now();
-        tp0 = std::chrono::high_resolution_clock::from_time_t(std::chrono::high_resolution_clock::to_time_t(tp0_tmp));
-        t0 = (std::chrono::high_resolution_clock::to_time_t(tp0) % (60*60*24)) * 1e3;
+// Event destination other than the bag, per capture_cfg.evt_output, not
+// opened yet. Returns nullptr for "bag".
+EventSink *newEventSink(const std::string &folder, std::string &path)
+{
+    const std::string &mode = capture_cfg.evt_output;
+    if (mode == "compact"){
+        path = folder + "-dvs.evb";
+        printf("Writing events to %s\n", path.c_str());
+        return new CompactEventFile;
     }
+    if (mode == "chunked"){
+        path = folder + "-dvs.evc";
+        printf("Writing events to %s\n", path.c_str());
+        return new ChunkedEventFile((size_t)capture_cfg.evc_chunk_mb << 20,
+                                    (size_t)capture_cfg.evc_extent_mb << 20);
+    }
+    if (mode != "bag"){
+        printf(" * WARNING! unknown evt_output '%s', writing events to the bag\n", mode.c_str());
+    }
+    return nullptr;
+}
+
+int DVSMain(const std::string folder, DvsSource &source, DvsRunStats *run_stats, SensorSync *sync){
+
+    const u_int32_t t0 = (time(nullptr) % (60*60*24)) * 1000;
     printf("UTC: %d sec (%d:%d:%d)\n", t0/1000, 8+(t0/1000/3600), (t0/1000%3600/60), (t0/1000%3600%60));
 
-    rosbag::Bag bag;
-    bag.open(folder + "-dvs.bag", rosbag::bagmode::Write);
-
-    // Set up the device and processing callbacks.
-    iness::device::Sees sees;
-    sees.resetDeviceTime();
-    sees.setImuEnabled(true);
-    sees.setApsEnabled(true);
-    sees.setDvsEnabled(true);
-    sees.setAutoExposureEnabled(true);
-    // sees.setAutoExposureMedianBrightness(0.6);
-    sees.setEventThreshold(55);
-
-    sees.registerCallback(std::bind(polarityEventPacketCallback, std::placeholders::_1));
-    sees.registerCallback(std::bind(ImuPacketCallback, std::placeholders::_1));
-    sees.registerCallback(std::bind(FrameCallback, std::placeholders::_1));
-
-    // Start the device driver.
-    if (!sees.start()){
+    BagWriter writer(EVT_QUEUE_SIZE, EVT_QUEUE_POLICY,
+                     WRITER_BATCH_BYTES, std::chrono::milliseconds(WRITER_BATCH_MS));
+    // the noise filter runs on the source callback thread, ahead of the queue
+    if (capture_cfg.noise_filter_us > 0){
+        printf("Background-activity filter: %d µs window\n", capture_cfg.noise_filter_us);
+    }
+    ReadinessConfig ready;
+    ready.ready_at_start = !capture_cfg.replay.empty();
+    ready.ae_tolerance_percent = std::max(capture_cfg.start_ae_tolerance_percent, 0);
+    ready.max_wait_ms = std::max(capture_cfg.start_max_wait_ms, 0);
+    DvsPipeline pipeline(folder, writer, sync, capture_cfg.noise_filter_us, ready);
+
+    // Device reset and start take the longest and do not need the bag: they
+    // run meanwhile. Data delivered before the writer runs waits in its
+    // queues, and nothing is recorded before the device is ready anyway.
+    bool source_ok = false;
+    std::thread source_start([&] {
+        double t = startup::now();
+        source_ok = source.start(&pipeline);
+        startup::step("DVS device started", t);
+    });
+    auto fail = [&] {
+        source_start.join();
+        source.stop();
         return EXIT_FAILURE;
+    };
+
+    double t_open = startup::now();
+    BufferPool::global().reserve(EVT_POOL_PACKET_EVENTS * sizeof(PooledEvent), EVT_POOL_PREALLOC);
+
+    RotateConfig rotate = rotateConfig();
+    if (rotate.enabled()){
+        printf("DVS output rotates every %d MB / %d min, segments listed in %s-dvs.manifest\n",
+            capture_cfg.rotate_mb, capture_cfg.rotate_min, folder.c_str());
+    }
+    if (!writer.setRotation(rotate, folder + "-dvs.manifest", [] { applyThreadRole(ThreadRole::Writer); })){
+        return fail();
+    }
+    JournalConfig journal;
+    journal.max_ms = std::max(capture_cfg.journal_ms, 0);
+    journal.max_bytes = (uint64_t)std::max(capture_cfg.journal_mb, 0) << 20;
+    if (journal.enabled()){
+        printf("DVS output committed every %d ms / %d MB\n", capture_cfg.journal_ms, capture_cfg.journal_mb);
+    }
+    writer.setJournal(journal, [] { applyThreadRole(ThreadRole::Compressor); });
+    CompressedBagWriter::Options zopts;
+    if (!parseChunkCodec(capture_cfg.bag_codec, zopts.codec)){
+        printf(" * WARNING! unknown bag_codec '%s', writing a plain bag\n", capture_cfg.bag_codec.c_str());
+        zopts.codec = CHUNK_RAW;
     }
+    if (zopts.codec != CHUNK_RAW){
+        zopts.level = capture_cfg.bag_codec_level;
+        zopts.threads = capture_cfg.bag_codec_threads;
+        zopts.chunk_size = (size_t)std::max(capture_cfg.bag_chunk_mb, 1) << 20;
+        printf("Writing DVS messages to %s-dvs.bagz (%s)\n", folder.c_str(), chunkCodecName(zopts.codec));
+        if (!writer.openCompressed(folder + "-dvs.bagz", zopts, [] { applyThreadRole(ThreadRole::Compressor); })){
+            return fail();
+        }
+    } else if (!writer.open(folder + "-dvs.bag")){
+        return fail();
+    }
+    std::string evt_path;
+    EventSink *evt_sink = newEventSink(folder, evt_path);
+    if (evt_sink && !writer.setEventSink(evt_sink, evt_path)){
+        return fail();
+    }
+    RebatchConfig rebatch;
+    rebatch.window_us = std::max(capture_cfg.evt_batch_us, 0);
+    rebatch.max_events = std::max(capture_cfg.evt_batch_events, 0);
+    rebatch.max_latency_ms = std::max(capture_cfg.evt_batch_max_latency_ms, 1);
+    writer.setRebatch(rebatch);
+    writer.setThreadInit([] { applyThreadRole(ThreadRole::Writer); });
+    writer.start();
+    startup::step("DVS writer ready", t_open);
 
-    // Initialize the event image creator.
-    dvs_height = sees.dvsHeight();
-    dvs_width = sees.dvsWidth();
-    cv::namedWindow("img");
+    source_start.join();
+    if (!source_ok){
+        source.stop();
+        writer.stop();
+        return EXIT_FAILURE;
+    }
     
-    printf("DVS is running ...\n");
-    is_shutdown = false;
+    printf("DVS is running (%dx%d) ...\n", source.width(), source.height());
+    // SDK threads capture, the writer thread writes, main shows the preview
     while (!is_shutdown)
     {
-        {
-            std::lock_guard<std::mutex> lck(m_evt);
-            // printf("evtBuf: size = %d\n", n_event_buf);
-            for(int i=0; i<n_event_buf; i++){
-                auto &event_msgs = msg_event_buf[i];
-                bag.write("/dvs/events", event_msgs.header.stamp, event_msgs);
-            }
-            n_event_buf = 0;
-        }
-        {
-            std::lock_guard<std::mutex> lck(m_imu);
-            for(auto & imu : msg_imu_buf) 
-                bag.write("/dvs/imu",imu.header.stamp, imu);
-            msg_imu_buf.clear();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    source.stop();
+    writer.stop();
 
-        }
-        {
-            std::lock_guard<std::mutex> lck(m_img);
-            for(auto &img_msg : msg_img_buf){
-                if(img_msg.header.stamp.toSec() < DVS_START_CAP/1e6){
-                    printf("skippppppppp a image at %f\n", img_msg.header.stamp.toSec() );
-                    continue;
-                }
-                bag.write("/dvs/image_raw", img_msg.header.stamp, img_msg);
-            }
-            
-            if(!msg_img_buf.empty()){
-                cv_bridge::CvImageConstPtr cv_ptr;
-                cv_ptr = cv_bridge::toCvCopy((msg_img_buf.back()), "mono16");
-                cv::imshow("img", cv_ptr->image);
-                if(cv::waitKey(1) == 'q'){
-                    is_shutdown = true;
-                }
-                msg_img_buf.clear();
-            }        
-        }
-        std::chrono::milliseconds dur(30);
-        std::this_thread::sleep_for(dur);
+    writer.printStats();
+    const NoiseFilter *filter = pipeline.noiseFilter();
+    if (filter)
+        filter->printStats();
+    const PixelMask *mask = pipeline.pixelMask();
+    if (mask){
+        const uint64_t total = mask->passed() + mask->rejected();
+        printf("Pixel mask: %lu of %lu events rejected (%.1f%%), %lu pixels masked\n",
+            mask->rejected(), total, total ? 100.0 * mask->rejected() / total : 0.0, mask->cleared());
+    }
+    if (run_stats){
+        BagWriter::Stats ws = writer.stats();
+        SPSCQueueStats qs = writer.eventQueueStats();
+        run_stats->packets = qs.pushed + qs.dropped_newest;
+        run_stats->events = pipeline.events();
+        run_stats->packets_dropped = qs.dropped_oldest + qs.dropped_newest;
+        run_stats->imu = pipeline.imu();
+        run_stats->frames = pipeline.frames();
+        run_stats->bytes = ws.bytes;
+        run_stats->elapsed_sec = ws.elapsed_sec;
+        run_stats->noise_dropped = filter ? filter->dropped() : 0;
+        run_stats->mask_rejected = mask ? mask->rejected() : 0;
+        run_stats->pixels_masked = mask ? mask->cleared() : 0;
     }
-    bag.close();
-    sees.stop();
+    BufferPool::Stats ps = BufferPool::global().stats();
+    printf("Event pool: %lu allocations, %lu recycled, %lu from heap, %.1f MB cached\n",
+        ps.requests, ps.recycled, ps.heap_allocs, ps.cached_bytes / 1e6);
+    ApsCopyStats as = apsCopyStats();
+    if (as.frames)
+        printf("APS frames: %lu, %.2f pixel copies per frame\n", as.frames, (double)as.copies / as.frames);
     std::cout << "Shutdown successful.\n";
-    cv::destroyAllWindows();
 
     return EXIT_SUCCESS;
 }
\ No newline at end of file
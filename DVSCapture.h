@@ -1,4 +1,31 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <string>
-int DVSMain(const std::string folder);
\ No newline at end of file
+
+// Set from main (preview 'q' or a failed sensor); capture loops return.
+extern std::atomic_bool is_shutdown;
+
+class DvsSource;
+class SensorSync;
+
+// Counters of one DVSMain run, for capture_bench.
+struct DvsRunStats {
+    uint64_t packets = 0;       // event packets from the source
+    uint64_t events = 0;
+    uint64_t packets_dropped = 0;  // event queue overflow
+    uint64_t noise_dropped = 0;    // events removed by the noise filter
+    uint64_t mask_rejected = 0;    // events on masked pixels (ROI, hot pixels)
+    uint64_t pixels_masked = 0;
+    uint64_t imu = 0;
+    uint64_t frames = 0;
+    uint64_t bytes = 0;         // written by the bag writer / event sink
+    double elapsed_sec = 0;
+};
+
+// Records events, IMU and APS frames from `source` into <folder>-dvs.bag
+// (events optionally to an EventSink) until is_shutdown. APS frames and DVS
+// clock samples also go to `sync` if given.
+int DVSMain(const std::string folder, DvsSource &source, DvsRunStats *run_stats = nullptr,
+            SensorSync *sync = nullptr);
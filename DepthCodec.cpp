@@ -0,0 +1,209 @@
+#include "DepthCodec.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+const int N_CONTEXTS = 18;      // bit length of the gradient, 0-17
+const int ESCAPE = 20;          // unary length that means "17 raw bits follow"
+
+struct Context {
+    uint32_t a = 4;     // sum of mapped residuals
+    uint32_t n = 1;     // count, both halved at 64
+
+    // smallest k with n * 2^k >= a
+    int k() const
+    {
+        if (a <= n) return 0;
+        int k = __builtin_clz(n) - __builtin_clz(a);
+        k += (n << k) < a;
+        return k < 16 ? k : 16;
+    }
+    void update(uint32_t m)
+    {
+        a += m;
+        if (++n == 64) {
+            a >>= 1;
+            n >>= 1;
+        }
+    }
+};
+
+// Median edge detector; also picks the context.
+inline uint16_t predict(int a, int b, int c, int &ctx)
+{
+    const unsigned g = (unsigned)(std::abs(a - c) + std::abs(b - c));
+    ctx = g ? 32 - __builtin_clz(g) : 0;
+    // selects, not branches: with sensor noise they are coin flips
+    const int lo = a < b ? a : b, hi = a < b ? b : a;
+    int p = a + b - c;
+    p = c >= hi ? lo : p;
+    p = c <= lo ? hi : p;
+    return (uint16_t)p;
+}
+
+// Neighbours of (r, c): the first row only has its left neighbour, the
+// first column only the pixel above.
+inline uint16_t predictAt(const uint16_t *cur, const uint16_t *up, int c, int &ctx)
+{
+    if (!up) {
+        ctx = 0;
+        return c ? cur[c - 1] : 0;
+    }
+    if (c == 0) {
+        ctx = 0;
+        return up[0];
+    }
+    return predict(cur[c - 1], up[c], up[c - 1], ctx);
+}
+
+// 0 is a hole, anything else the zigzag mapped residual plus one
+inline uint32_t toSymbol(uint16_t x, uint16_t pred)
+{
+    const int16_t s = (int16_t)(uint16_t)(x - pred);
+    return x ? (uint16_t)((s << 1) ^ (s >> 15)) + 1u : 0;
+}
+
+inline uint16_t fromSymbol(uint32_t m, uint16_t pred)
+{
+    if (m == 0) return 0;
+    m--;
+    const int16_t s = (int16_t)((m >> 1) ^ -(int)(m & 1));
+    return (uint16_t)(pred + s);
+}
+
+// LSB first. Stores 8 bytes and advances by the whole bytes written, so the
+// output needs 8 bytes of slack.
+struct BitWriter {
+    uint8_t *p;
+    uint64_t acc = 0;
+    int n = 0;
+
+    // bits <= 56
+    void put(uint64_t v, int bits)
+    {
+        acc |= v << n;
+        n += bits;
+        memcpy(p, &acc, 8);
+        p += n >> 3;
+        acc >>= n & ~7;
+        n &= 7;
+    }
+    void flush()
+    {
+        for (; n > 0; n -= 8, acc >>= 8)
+            *p++ = (uint8_t)acc;
+        n = 0;
+    }
+};
+
+struct BitReader {
+    const uint8_t *src;
+    size_t size, pos = 0;
+    uint64_t acc = 0;
+    int n = 0;
+
+    void refill()
+    {
+        if (pos + 8 <= size) {
+            uint64_t w;
+            memcpy(&w, src + pos, 8);
+            acc |= w << n;
+            pos += (63 - n) >> 3;
+            n |= 56;
+            return;
+        }
+        while (n <= 56) {
+            acc |= (uint64_t)(pos < size ? src[pos] : 0) << n;
+            pos++;
+            n += 8;
+        }
+    }
+    void skip(int bits)
+    {
+        acc >>= bits;
+        n -= bits;
+    }
+    bool overrun() const { return pos > size && (pos - size) * 8 > (size_t)n; }
+};
+
+}
+
+size_t depthEncodeBound(size_t pixels)
+{
+    return pixels * (ESCAPE + 17) / 8 + 16;
+}
+
+size_t depthEncode(const cv::Mat &depth, std::vector<uint8_t> &out)
+{
+    if (depth.type() != CV_16UC1) return 0;
+    const size_t start = out.size();
+    out.resize(start + depthEncodeBound(depth.total()));
+    BitWriter bw;
+    bw.p = out.data() + start;
+    Context ctxs[N_CONTEXTS];
+    std::vector<uint16_t> filled(2 * depth.cols);
+
+    for (int r = 0; r < depth.rows; r++) {
+        const uint16_t *src = depth.ptr<uint16_t>(r);
+        uint16_t *cur = filled.data() + (r & 1) * depth.cols;
+        const uint16_t *up = r ? filled.data() + ((r - 1) & 1) * depth.cols : nullptr;
+        for (int c = 0; c < depth.cols; c++) {
+            int ci;
+            const uint16_t pred = predictAt(cur, up, c, ci);
+            const uint32_t m = toSymbol(src[c], pred);
+            cur[c] = src[c] ? src[c] : pred;
+            Context &ctx = ctxs[ci];
+            const int k = ctx.k();
+            const uint32_t q = m >> k;
+            // q ones, a zero, the low k bits
+            if (q < (uint32_t)ESCAPE)
+                bw.put(((1ull << q) - 1) | (uint64_t)(m & ((1u << k) - 1)) << (q + 1), q + 1 + k);
+            else
+                bw.put(((1ull << ESCAPE) - 1) | (uint64_t)m << ESCAPE, ESCAPE + 17);
+            ctx.update(m);
+        }
+    }
+    bw.flush();
+    const size_t n = bw.p - (out.data() + start);
+    out.resize(start + n);
+    return n;
+}
+
+bool depthDecode(const uint8_t *src, size_t n, cv::Mat &depth)
+{
+    if (depth.type() != CV_16UC1) return false;
+    BitReader br;
+    br.src = src;
+    br.size = n;
+    Context ctxs[N_CONTEXTS];
+    std::vector<uint16_t> filled(2 * depth.cols);
+
+    for (int r = 0; r < depth.rows; r++) {
+        uint16_t *dst = depth.ptr<uint16_t>(r);
+        uint16_t *cur = filled.data() + (r & 1) * depth.cols;
+        const uint16_t *up = r ? filled.data() + ((r - 1) & 1) * depth.cols : nullptr;
+        for (int c = 0; c < depth.cols; c++) {
+            int ci;
+            const uint16_t pred = predictAt(cur, up, c, ci);
+            Context &ctx = ctxs[ci];
+            const int k = ctx.k();
+            br.refill();
+            const int q = __builtin_ctzll(~br.acc);
+            uint32_t m;
+            if (q >= ESCAPE) {
+                m = (uint32_t)(br.acc >> ESCAPE) & 0x1ffff;
+                br.skip(ESCAPE + 17);
+            } else {
+                m = ((uint32_t)q << k) | ((uint32_t)(br.acc >> (q + 1)) & ((1u << k) - 1));
+                br.skip(q + 1 + k);
+            }
+            dst[c] = fromSymbol(m, pred);
+            cur[c] = m ? dst[c] : pred;
+            ctx.update(m);
+        }
+        if (br.overrun()) return false;
+    }
+    return true;
+}
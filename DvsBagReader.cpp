@@ -0,0 +1,492 @@
+#include "DvsBagReader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char BAG_MAGIC[] = "#ROSBAG V2.0\n";
+const size_t BAG_MAGIC_LEN = 13;
+const char BAG_INDEX_MAGIC[4] = {'D', 'V', 'S', 'X'};
+const uint32_t BAG_INDEX_VERSION = 2;
+// dvs_msgs/Event on the wire: x, y (uint16), ts (sec, nsec), polarity
+const size_t EVENT_WIRE_BYTES = 13;
+
+enum BagOp : uint8_t {
+    OP_MSG_DATA = 0x02,
+    OP_BAG_HEADER = 0x03,
+    OP_INDEX_DATA = 0x04,
+    OP_CHUNK = 0x05,
+    OP_CHUNK_INFO = 0x06,
+    OP_CONNECTION = 0x07,
+};
+
+template <class T>
+static T load(const uint8_t *p)
+{
+    T v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t wireTimeUs(const uint8_t *p)
+{
+    return (uint64_t)load<uint32_t>(p) * 1000000 + load<uint32_t>(p + 4) / 1000;
+}
+
+// "name=value" fields of a record header (or of a connection's data)
+struct RecordFields {
+    const uint8_t *p;
+    uint32_t len;
+
+    bool find(const char *name, const uint8_t *&val, uint32_t &val_len) const
+    {
+        const size_t nl = strlen(name);
+        uint32_t pos = 0;
+        while (pos + 4 <= len) {
+            uint32_t fl = load<uint32_t>(p + pos);
+            pos += 4;
+            if (fl > len - pos) return false;
+            const uint8_t *f = p + pos;
+            if (fl > nl && f[nl] == '=' && memcmp(f, name, nl) == 0) {
+                val = f + nl + 1;
+                val_len = fl - (uint32_t)nl - 1;
+                return true;
+            }
+            pos += fl;
+        }
+        return false;
+    }
+    template <class T>
+    bool get(const char *name, T &v) const
+    {
+        const uint8_t *val;
+        uint32_t n;
+        if (!find(name, val, n) || n != sizeof(T)) return false;
+        memcpy(&v, val, sizeof(T));
+        return true;
+    }
+    std::string str(const char *name) const
+    {
+        const uint8_t *val;
+        uint32_t n;
+        return find(name, val, n) ? std::string((const char *)val, n) : std::string();
+    }
+};
+
+// One record at `pos`; false if it does not fit in [pos, end).
+static bool readRecord(const uint8_t *base, uint64_t pos, uint64_t end, RecordFields &hd,
+                       uint64_t &data_pos, uint32_t &data_len)
+{
+    if (pos + 4 > end) return false;
+    uint32_t hl = load<uint32_t>(base + pos);
+    if (hl > end - pos - 4 || pos + 4 + hl + 4 > end) return false;
+    hd.p = base + pos + 4;
+    hd.len = hl;
+    data_len = load<uint32_t>(base + pos + 4 + hl);
+    data_pos = pos + 4 + hl + 4;
+    return data_len <= end - data_pos;
+}
+
+DvsBagReader::~DvsBagReader()
+{
+    close();
+}
+
+bool DvsBagReader::open(const std::string &path, bool use_cache)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error_ = "cannot open " + path;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < BAG_MAGIC_LEN) {
+        ::close(fd);
+        error_ = path + " is not a bag";
+        return false;
+    }
+    size_ = st.st_size;
+    mtime_ = st.st_mtime;
+    void *p = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        error_ = "cannot map " + path;
+        return false;
+    }
+    data_ = (const uint8_t *)p;
+    if (memcmp(data_, BAG_MAGIC, BAG_MAGIC_LEN) != 0) {
+        error_ = path + " is not a rosbag 2.0 file";
+        close();
+        return false;
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    const std::string idx_path = path + ".idx";
+    if (use_cache && loadCache(idx_path)) {
+        from_cache_ = true;
+    } else {
+        madvise((void *)data_, size_, MADV_SEQUENTIAL);
+        if (!buildIndex()) {
+            close();
+            return false;
+        }
+        if (use_cache) saveCache(idx_path);
+    }
+    madvise((void *)data_, size_, MADV_RANDOM);
+    index_sec_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return true;
+}
+
+void DvsBagReader::close()
+{
+    if (data_) munmap((void *)data_, size_);
+    data_ = nullptr;
+    size_ = 0;
+    topics_.clear();
+    conn_topic_.clear();
+    from_cache_ = false;
+}
+
+const DvsBagReader::Topic *DvsBagReader::topic(const std::string &name) const
+{
+    for (const Topic &t : topics_)
+        if (t.name == name) return &t;
+    return nullptr;
+}
+
+const DvsBagReader::Topic *DvsBagReader::eventTopic() const
+{
+    for (const Topic &t : topics_)
+        if (t.events) return &t;
+    return nullptr;
+}
+
+// Top level: bag header, chunks with their index records, then connection
+// and chunk info records. A bag that was never closed simply ends early.
+bool DvsBagReader::buildIndex()
+{
+    uint64_t pos = BAG_MAGIC_LEN;
+    RecordFields hd;
+    uint64_t dp;
+    uint32_t dl;
+    while (readRecord(data_, pos, size_, hd, dp, dl)) {
+        uint8_t op = 0;
+        hd.get("op", op);
+        if (op == OP_CHUNK) {
+            std::string comp = hd.str("compression");
+            if (comp != "none") {
+                error_ = "chunks compressed with " + comp + " cannot be mapped, run 'rosbag decompress' first";
+                return false;
+            }
+            if (!parseChunk(dp, dl)) return false;
+        } else if (op == OP_CONNECTION) {
+            uint32_t conn;
+            if (hd.get("conn", conn)) addConnection(conn, data_ + dp, dl);
+        }
+        pos = dp + dl;
+    }
+    for (Topic &t : topics_) {
+        for (size_t i = 1; i < t.entries.size() && t.sorted; i++)
+            t.sorted = t.entries[i].first_us >= t.entries[i - 1].first_us &&
+                       t.entries[i].last_us >= t.entries[i - 1].last_us;
+    }
+    return true;
+}
+
+bool DvsBagReader::parseChunk(uint64_t off, uint64_t len)
+{
+    const uint64_t end = off + len;
+    uint64_t pos = off;
+    RecordFields hd;
+    uint64_t dp;
+    uint32_t dl;
+    while (pos < end && readRecord(data_, pos, end, hd, dp, dl)) {
+        uint8_t op = 0;
+        uint32_t conn;
+        hd.get("op", op);
+        if (op == OP_CONNECTION && hd.get("conn", conn)) {
+            addConnection(conn, data_ + dp, dl);
+        } else if (op == OP_MSG_DATA && hd.get("conn", conn)) {
+            const uint8_t *tv;
+            uint32_t tl;
+            if (hd.find("time", tv, tl) && tl == 8)
+                addMessage(conn, wireTimeUs(tv), dp, dl);
+        }
+        pos = dp + dl;
+    }
+    return true;
+}
+
+void DvsBagReader::addConnection(uint32_t conn, const uint8_t *p, uint32_t len)
+{
+    if (conn < conn_topic_.size() && conn_topic_[conn] >= 0) return;
+    RecordFields f{p, len};
+    Topic t;
+    t.name = f.str("topic");
+    t.datatype = f.str("type");
+    t.md5 = f.str("md5sum");
+    t.definition = f.str("message_definition");
+    t.events = t.datatype == "dvs_msgs/EventArray";
+
+    // several connections may share a topic
+    int ti = -1;
+    for (size_t i = 0; i < topics_.size(); i++)
+        if (topics_[i].name == t.name) ti = (int)i;
+    if (ti < 0) {
+        ti = (int)topics_.size();
+        topics_.push_back(t);
+    }
+    if (conn >= conn_topic_.size()) conn_topic_.resize(conn + 1, -1);
+    conn_topic_[conn] = ti;
+}
+
+void DvsBagReader::addMessage(uint32_t conn, uint64_t t_us, uint64_t off, uint32_t len)
+{
+    if (conn >= conn_topic_.size() || conn_topic_[conn] < 0) return;
+    Topic &t = topics_[conn_topic_[conn]];
+    BagIndexEntry e;
+    e.first_us = e.last_us = t_us;
+    e.offset = off;
+    e.len = len;
+    e.count = 1;
+    e.sorted = 1;
+    e.reserved = 0;
+    if (t.events) {
+        // header (seq, stamp, frame_id), height, width, event count
+        const uint8_t *p = data_ + off;
+        if (len < 16) return;
+        uint32_t id_len = load<uint32_t>(p + 12);
+        uint64_t pos = 16 + (uint64_t)id_len;
+        if (pos + 12 > len) return;
+        uint32_t h = load<uint32_t>(p + pos), w = load<uint32_t>(p + pos + 4), n = load<uint32_t>(p + pos + 8);
+        pos += 12;
+        if ((uint64_t)n * EVENT_WIRE_BYTES > len - pos) return;
+        if (t.entries.empty()) {
+            t.width = (uint16_t)w;
+            t.height = (uint16_t)h;
+        }
+        e.offset = off + pos;
+        e.len = n * EVENT_WIRE_BYTES;
+        e.count = n;
+        if (n) {
+            e.first_us = e.last_us = wireTimeUs(p + pos + 4);
+            for (uint32_t i = 1; i < n; i++) {
+                uint64_t ts = wireTimeUs(p + pos + i * EVENT_WIRE_BYTES + 4);
+                if (ts < e.last_us) e.sorted = 0;
+                e.first_us = std::min(e.first_us, ts);
+                e.last_us = std::max(e.last_us, ts);
+            }
+        }
+    }
+    t.entries.push_back(e);
+}
+
+std::pair<size_t, size_t> DvsBagReader::range(const Topic &t, uint64_t t0_us, uint64_t t1_us) const
+{
+    const std::vector<BagIndexEntry> &v = t.entries;
+    if (!t.sorted) {
+        // out of order (never written that way by BagWriter): scan
+        size_t lo = v.size(), hi = 0;
+        for (size_t i = 0; i < v.size(); i++) {
+            if (v[i].last_us < t0_us || v[i].first_us >= t1_us) continue;
+            lo = std::min(lo, i);
+            hi = i + 1;
+        }
+        return lo < hi ? std::make_pair(lo, hi) : std::make_pair(hi, hi);
+    }
+    auto lo = std::lower_bound(v.begin(), v.end(), t0_us,
+        [](const BagIndexEntry &e, uint64_t t) { return e.last_us < t; });
+    auto hi = std::lower_bound(lo, v.end(), t1_us,
+        [](const BagIndexEntry &e, uint64_t t) { return e.first_us < t; });
+    return std::make_pair((size_t)(lo - v.begin()), (size_t)(hi - v.begin()));
+}
+
+const uint8_t *DvsBagReader::payload(const Topic &t, size_t i, uint32_t &len) const
+{
+    if (!data_ || i >= t.entries.size() || t.events) return nullptr;
+    len = t.entries[i].len;
+    return data_ + t.entries[i].offset;
+}
+
+const uint8_t *DvsBagReader::eventData(const Topic &t, size_t i) const
+{
+    if (!data_ || i >= t.entries.size() || !t.events) return nullptr;
+    return data_ + t.entries[i].offset;
+}
+
+// Calls fn(first event on the wire, count) for each run of events in range.
+// The partial messages at both ends are cut with a binary search when their
+// events are in time order, else filtered one by one.
+template <class F>
+size_t DvsBagReader::forEachEvent(uint64_t t0_us, uint64_t t1_us, F fn) const
+{
+    const Topic *t = eventTopic();
+    if (!t || t0_us >= t1_us) return 0;
+    std::pair<size_t, size_t> r = range(*t, t0_us, t1_us);
+    size_t total = 0;
+    for (size_t i = r.first; i < r.second; i++) {
+        const BagIndexEntry &e = t->entries[i];
+        const uint8_t *ev = data_ + e.offset;
+        if (!e.sorted && (e.first_us < t0_us || e.last_us >= t1_us)) {
+            size_t a = 0;
+            for (size_t j = 0; j <= e.count; j++) {
+                bool in = j < e.count;
+                if (in) {
+                    uint64_t ts = wireTimeUs(ev + j * EVENT_WIRE_BYTES + 4);
+                    in = ts >= t0_us && ts < t1_us;
+                }
+                if (in) continue;
+                if (a < j) {
+                    fn(ev + a * EVENT_WIRE_BYTES, j - a);
+                    total += j - a;
+                }
+                a = j + 1;
+            }
+            continue;
+        }
+        size_t a = 0, b = e.count;
+        if (e.first_us < t0_us) {
+            size_t lo = 0, hi = e.count;
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if (wireTimeUs(ev + mid * EVENT_WIRE_BYTES + 4) < t0_us) lo = mid + 1;
+                else hi = mid;
+            }
+            a = lo;
+        }
+        if (e.last_us >= t1_us) {
+            size_t lo = a, hi = e.count;
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if (wireTimeUs(ev + mid * EVENT_WIRE_BYTES + 4) < t1_us) lo = mid + 1;
+                else hi = mid;
+            }
+            b = lo;
+        }
+        if (a < b) {
+            fn(ev + a * EVENT_WIRE_BYTES, b - a);
+            total += b - a;
+        }
+    }
+    return total;
+}
+
+size_t DvsBagReader::events(uint64_t t0_us, uint64_t t1_us, EventSoA &out) const
+{
+    return forEachEvent(t0_us, t1_us, [&out](const uint8_t *p, size_t n) {
+        size_t base = out.size();
+        out.resize(base + n);
+        for (size_t i = 0; i < n; i++, p += EVENT_WIRE_BYTES) {
+            out.x[base + i] = load<uint16_t>(p);
+            out.y[base + i] = load<uint16_t>(p + 2);
+            out.ts_us[base + i] = wireTimeUs(p + 4);
+            out.p[base + i] = p[12];
+        }
+    });
+}
+
+size_t DvsBagReader::events(uint64_t t0_us, uint64_t t1_us, std::vector<dvs_msgs::Event> &out) const
+{
+    return forEachEvent(t0_us, t1_us, [&out](const uint8_t *p, size_t n) {
+        size_t base = out.size();
+        out.resize(base + n);
+        for (size_t i = 0; i < n; i++, p += EVENT_WIRE_BYTES) {
+            dvs_msgs::Event &e = out[base + i];
+            e.x = load<uint16_t>(p);
+            e.y = load<uint16_t>(p + 2);
+            e.ts.sec = load<uint32_t>(p + 4);
+            e.ts.nsec = load<uint32_t>(p + 8);
+            e.polarity = p[12];
+        }
+    });
+}
+
+static void putString(FILE *fp, const std::string &s)
+{
+    uint32_t n = (uint32_t)s.size();
+    fwrite(&n, 4, 1, fp);
+    fwrite(s.data(), 1, n, fp);
+}
+
+static bool getString(FILE *fp, std::string &s)
+{
+    uint32_t n;
+    if (fread(&n, 4, 1, fp) != 1 || n > (1u << 20)) return false;
+    s.resize(n);
+    return n == 0 || fread(&s[0], 1, n, fp) == n;
+}
+
+void DvsBagReader::saveCache(const std::string &path) const
+{
+    const std::string tmp = path + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp) {
+        printf(" * WARNING! cannot write index cache %s\n", path.c_str());
+        return;
+    }
+    BagIndexFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, BAG_INDEX_MAGIC, 4);
+    h.version = BAG_INDEX_VERSION;
+    h.bag_size = size_;
+    h.bag_mtime = mtime_;
+    h.n_topics = (uint32_t)topics_.size();
+    fwrite(&h, sizeof(h), 1, fp);
+    for (const Topic &t : topics_) {
+        putString(fp, t.name);
+        putString(fp, t.datatype);
+        putString(fp, t.md5);
+        putString(fp, t.definition);
+        uint16_t geom[2] = {t.width, t.height};
+        uint8_t flags[2] = {t.events, t.sorted};
+        uint64_t n = t.entries.size();
+        fwrite(geom, sizeof(geom), 1, fp);
+        fwrite(flags, sizeof(flags), 1, fp);
+        fwrite(&n, sizeof(n), 1, fp);
+        fwrite(t.entries.data(), sizeof(BagIndexEntry), n, fp);
+    }
+    bool ok = fflush(fp) == 0 && !ferror(fp);
+    fclose(fp);
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        printf(" * WARNING! cannot write index cache %s\n", path.c_str());
+        remove(tmp.c_str());
+    }
+}
+
+bool DvsBagReader::loadCache(const std::string &path)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) return false;
+    BagIndexFileHeader h;
+    bool ok = fread(&h, sizeof(h), 1, fp) == 1 && memcmp(h.magic, BAG_INDEX_MAGIC, 4) == 0 &&
+              h.version == BAG_INDEX_VERSION && h.bag_size == size_ && h.bag_mtime == mtime_;
+    std::vector<Topic> topics(ok ? h.n_topics : 0);
+    for (size_t i = 0; ok && i < topics.size(); i++) {
+        Topic &t = topics[i];
+        uint16_t geom[2];
+        uint8_t flags[2];
+        uint64_t n;
+        ok = getString(fp, t.name) && getString(fp, t.datatype) && getString(fp, t.md5) &&
+             getString(fp, t.definition) && fread(geom, sizeof(geom), 1, fp) == 1 &&
+             fread(flags, sizeof(flags), 1, fp) == 1 && fread(&n, sizeof(n), 1, fp) == 1 &&
+             n <= size_ / 8;
+        if (!ok) break;
+        t.width = geom[0];
+        t.height = geom[1];
+        t.events = flags[0];
+        t.sorted = flags[1];
+        t.entries.resize(n);
+        ok = n == 0 || fread(t.entries.data(), sizeof(BagIndexEntry), n, fp) == n;
+        for (const BagIndexEntry &e : t.entries)
+            ok = ok && e.offset + e.len <= size_;
+    }
+    fclose(fp);
+    if (ok) topics_.swap(topics);
+    return ok;
+}
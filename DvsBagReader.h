@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <dvs_msgs/EventArray.h>
+#include <ros/serialization.h>
+
+#include "EventConvert.h"
+
+// Random access by time into a recorded <folder>-dvs.bag.
+//
+// The bag is memory-mapped and walked once (rosbag 2.0 records, chunks
+// stored uncompressed as BagWriter writes them) to build a per-topic index:
+// one entry per message with its time range and where its payload sits in
+// the file. dvs_msgs/EventArray payloads are read in place (events are 13
+// bytes each) to find the earliest and latest event of a message without
+// deserializing it. The index is cached next to the bag as
+// <bag>.idx and reused while the bag's size and mtime match.
+//
+// A query does a binary search over the messages, then over the events of
+// the first and last message in range: O(log n + k). Events are not sorted
+// within every message (EventRebatcher keeps them as the driver delivered
+// them); such messages are filtered event by event.
+struct BagIndexEntry {
+    uint64_t first_us;      // events: earliest event; other topics: record time
+    uint64_t last_us;       // events: latest event
+    uint64_t offset;        // payload in the file (events: first event)
+    uint32_t len;           // payload bytes
+    uint32_t count;         // events in the message, 1 otherwise
+    uint32_t sorted;        // events in time order within the message
+    uint32_t reserved;
+};
+static_assert(sizeof(BagIndexEntry) == 40, "BagIndexEntry must stay packed");
+
+struct BagIndexFileHeader {
+    char magic[4];          // "DVSX"
+    uint32_t version;
+    uint64_t bag_size;
+    int64_t bag_mtime;
+    uint32_t n_topics;
+    uint32_t reserved;
+};
+
+class DvsBagReader
+{
+public:
+    struct Topic {
+        std::string name, datatype, md5, definition;
+        bool events = false;        // dvs_msgs/EventArray
+        bool sorted = true;         // entries in time order as recorded
+        uint16_t width = 0, height = 0;
+        std::vector<BagIndexEntry> entries;
+    };
+
+    ~DvsBagReader();
+
+    // use_cache: load <path>.idx if valid, else build the index and save it.
+    bool open(const std::string &path, bool use_cache = true);
+    void close();
+
+    const std::vector<Topic> &topics() const { return topics_; }
+    const Topic *topic(const std::string &name) const;
+    // The first topic of type dvs_msgs/EventArray, or nullptr.
+    const Topic *eventTopic() const;
+    bool fromCache() const { return from_cache_; }
+    double indexSec() const { return index_sec_; }
+    const std::string &error() const { return error_; }
+
+    // Entries [first, last) of t whose time range overlaps [t0_us, t1_us).
+    std::pair<size_t, size_t> range(const Topic &t, uint64_t t0_us, uint64_t t1_us) const;
+
+    // Appends the events with t0_us <= ts < t1_us.
+    size_t events(uint64_t t0_us, uint64_t t1_us, EventSoA &out) const;
+    size_t events(uint64_t t0_us, uint64_t t1_us, std::vector<dvs_msgs::Event> &out) const;
+
+    // Serialized payload of entry i (mapped memory, valid until close()).
+    const uint8_t *payload(const Topic &t, size_t i, uint32_t &len) const;
+    // Events of entry i of the event topic as on the wire, entries[i].count
+    // of 13 bytes: x, y (uint16), ts sec, nsec (uint32), polarity (uint8).
+    const uint8_t *eventData(const Topic &t, size_t i) const;
+    template <class M>
+    bool read(const Topic &t, size_t i, M &msg) const
+    {
+        uint32_t len = 0;
+        const uint8_t *p = payload(t, i, len);
+        if (!p) return false;
+        ros::serialization::IStream s(const_cast<uint8_t *>(p), len);
+        ros::serialization::deserialize(s, msg);
+        return true;
+    }
+
+private:
+    bool buildIndex();
+    bool parseChunk(uint64_t off, uint64_t len);
+    void addMessage(uint32_t conn, uint64_t t_us, uint64_t off, uint32_t len);
+    void addConnection(uint32_t conn, const uint8_t *p, uint32_t len);
+    bool loadCache(const std::string &path);
+    void saveCache(const std::string &path) const;
+    template <class F>
+    size_t forEachEvent(uint64_t t0_us, uint64_t t1_us, F fn) const;
+
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+    int64_t mtime_ = 0;
+    std::vector<Topic> topics_;
+    std::vector<int> conn_topic_;   // bag connection id -> topics_ index
+    bool from_cache_ = false;
+    double index_sec_ = 0;
+    std::string error_;
+};
@@ -0,0 +1,95 @@
+#include "EventCodec.h"
+
+uint32_t eventBlockChecksum(const EventBlockHeader &hd, const uint8_t *payload)
+{
+    EventBlockHeader h = hd;
+    h.checksum = 0;
+    return crc32(payload, hd.payload_bytes, crc32((const uint8_t *)&h, sizeof(h)));
+}
+
+// everything that can be checked before the payload is read
+static bool headerValid(const EventBlockHeader &hd)
+{
+    if (memcmp(hd.magic, EVB_MAGIC, 4) != 0 || hd.version < 1 || hd.version > EVB_VERSION) return false;
+    if (hd.x_bits == 0 || hd.y_bits == 0 || hd.x_bits + hd.y_bits > 32) return false;
+    if (hd.payload_bytes > EVB_MAX_PAYLOAD) return false;
+    // every event takes its packed xy plus at least one varint byte
+    const uint32_t xy_bytes = (hd.x_bits + hd.y_bits + 1 + 7) / 8;
+    return hd.count <= hd.payload_bytes / (xy_bytes + 1);
+}
+
+bool readEventBlockHeader(const uint8_t *data, size_t len, EventBlockHeader &hd, bool verify_checksum)
+{
+    if (len < sizeof(hd)) return false;
+    memcpy(&hd, data, sizeof(hd));
+    if (!headerValid(hd)) return false;
+    if (len - sizeof(hd) < hd.payload_bytes) return false;
+    if (!verify_checksum) return true;
+    const uint8_t *payload = data + sizeof(hd);
+    if (hd.version == 1) return crc32(payload, hd.payload_bytes) == hd.checksum;
+    return eventBlockChecksum(hd, payload) == hd.checksum;
+}
+
+CompactEventFile::~CompactEventFile()
+{
+    close();
+}
+
+bool CompactEventFile::open(const std::string &path)
+{
+    fp_ = fopen(path.c_str(), "wb");
+    if (!fp_) {
+        printf(" * ERROR! cannot open %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void CompactEventFile::close()
+{
+    if (!fp_) return;
+    fclose(fp_);
+    fp_ = nullptr;
+}
+
+bool CompactEventFile::write(const PooledEventArray &msg)
+{
+    if (!fp_) return false;
+    buf_.clear();
+    encodeEventBlock(msg, buf_);
+    if (fwrite(buf_.data(), 1, buf_.size(), fp_) != buf_.size()) return false;
+    bytes_ += buf_.size();
+    events_ += msg.events.size();
+    return true;
+}
+
+CompactEventReader::~CompactEventReader()
+{
+    close();
+}
+
+bool CompactEventReader::open(const std::string &path)
+{
+    fp_ = fopen(path.c_str(), "rb");
+    return fp_ != nullptr;
+}
+
+void CompactEventReader::close()
+{
+    if (!fp_) return;
+    fclose(fp_);
+    fp_ = nullptr;
+}
+
+bool CompactEventReader::next(dvs_msgs::EventArray &msg)
+{
+    if (!fp_) return false;
+    EventBlockHeader hd;
+    if (fread(&hd, sizeof(hd), 1, fp_) != 1) return false;
+    if (!headerValid(hd)) return false;
+
+    buf_.resize(sizeof(hd) + hd.payload_bytes);
+    memcpy(buf_.data(), &hd, sizeof(hd));
+    if (fread(buf_.data() + sizeof(hd), 1, hd.payload_bytes, fp_) != hd.payload_bytes) return false;
+    return decodeEventBlock(buf_.data(), buf_.size(), msg) != 0;
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <dvs_msgs/EventArray.h>
+
+#include "EventSink.h"
+#include "Crc32.h"
+
+// Compact polarity event blocks, ~4 bytes per event instead of 13.
+//
+// A block is one 40-byte header followed by `count` events. Each event is x, y
+// and polarity bit-packed into ceil((x_bits + y_bits + 1) / 8) bytes (3 for
+// 320x264), then the zigzag LEB128 delta to the previous event's timestamp in
+// microseconds (the first event is relative to base_us). All fields are little
+// endian. Every block carries its own geometry and base time, so any block can
+// be decoded without the ones before it. The checksum covers the header (with
+// the checksum field zeroed) and the payload; version 1 blocks only checked
+// the payload and are still read.
+struct EventBlockHeader {
+    char magic[4];          // "EVB1"
+    uint8_t version;
+    uint8_t flags;
+    uint8_t x_bits;
+    uint8_t y_bits;
+    uint16_t width;
+    uint16_t height;
+    uint32_t seq;           // EventArray header seq
+    uint64_t base_us;       // timestamp of the first event
+    uint32_t count;
+    uint32_t payload_bytes;
+    uint32_t checksum;      // CRC32 of header and payload
+    uint32_t reserved;
+};
+static_assert(sizeof(EventBlockHeader) == 40, "EventBlockHeader must stay packed");
+
+const char EVB_MAGIC[4] = {'E', 'V', 'B', '1'};
+const uint8_t EVB_VERSION = 2;
+// larger blocks are rejected as corrupt, the encoder never gets close
+const uint32_t EVB_MAX_PAYLOAD = 256u << 20;
+
+uint32_t eventBlockChecksum(const EventBlockHeader &hd, const uint8_t *payload);
+
+inline uint64_t timeToUs(const ros::Time &t)
+{
+    return (uint64_t)t.sec * 1000000 + t.nsec / 1000;
+}
+
+inline ros::Time usToTime(uint64_t us)
+{
+    return ros::Time((uint32_t)(us / 1000000), (uint32_t)(us % 1000000) * 1000);
+}
+
+inline uint8_t bitsFor(uint32_t n)
+{
+    uint8_t b = 1;
+    while (b < 16 && (1u << b) < n) b++;
+    return b;
+}
+
+// Appends one block for events [first, first + count) of `msg` to `out`.
+// Returns the number of bytes appended.
+template <class A>
+size_t encodeEventBlock(const dvs_msgs::EventArray_<A> &msg, std::vector<uint8_t> &out,
+                        size_t first = 0, size_t count = (size_t)-1)
+{
+    if (first > msg.events.size()) first = msg.events.size();
+    if (count > msg.events.size() - first) count = msg.events.size() - first;
+
+    EventBlockHeader hd;
+    memcpy(hd.magic, EVB_MAGIC, 4);
+    hd.version = EVB_VERSION;
+    hd.flags = 0;
+    hd.width = (uint16_t)msg.width;
+    hd.height = (uint16_t)msg.height;
+    hd.x_bits = bitsFor(msg.width);
+    hd.y_bits = bitsFor(msg.height);
+    hd.seq = msg.header.seq;
+    hd.base_us = count == 0 ? timeToUs(msg.header.stamp) : timeToUs(msg.events[first].ts);
+    hd.count = (uint32_t)count;
+    hd.reserved = 0;
+
+    const size_t start = out.size();
+    const int xy_bytes = (hd.x_bits + hd.y_bits + 1 + 7) / 8;
+    const int p_shift = hd.x_bits + hd.y_bits;
+    // worst case: packed xy + 10 byte varint per event
+    out.resize(start + sizeof(hd) + count * (xy_bytes + 10));
+    uint8_t *p = out.data() + start + sizeof(hd);
+    uint8_t *const payload = p;
+
+    uint64_t prev = hd.base_us;
+    for (size_t i = first; i < first + count; i++) {
+        const auto &e = msg.events[i];
+        uint64_t packed = (uint64_t)e.x | ((uint64_t)e.y << hd.x_bits) | ((uint64_t)(e.polarity ? 1 : 0) << p_shift);
+        for (int b = 0; b < xy_bytes; b++)
+            *p++ = (uint8_t)(packed >> (8 * b));
+
+        uint64_t us = timeToUs(e.ts);
+        int64_t d = (int64_t)(us - prev);
+        uint64_t z = ((uint64_t)d << 1) ^ (uint64_t)(d >> 63);
+        while (z >= 0x80) {
+            *p++ = (uint8_t)(z | 0x80);
+            z >>= 7;
+        }
+        *p++ = (uint8_t)z;
+        prev = us;
+    }
+
+    hd.payload_bytes = (uint32_t)(p - payload);
+    hd.checksum = eventBlockChecksum(hd, payload);
+    memcpy(out.data() + start, &hd, sizeof(hd));
+    out.resize(start + sizeof(hd) + hd.payload_bytes);
+    return sizeof(hd) + hd.payload_bytes;
+}
+
+// Reads and validates the header at `data`: geometry, sizes, that `count`
+// events fit the payload and, optionally, the checksum. Returns false on a bad
+// or truncated block.
+bool readEventBlockHeader(const uint8_t *data, size_t len, EventBlockHeader &hd, bool verify_checksum = true);
+
+// Decodes one block into `msg` (events replaced). Returns the number of bytes
+// consumed, 0 if the block is invalid.
+template <class A>
+size_t decodeEventBlock(const uint8_t *data, size_t len, dvs_msgs::EventArray_<A> &msg)
+{
+    EventBlockHeader hd;
+    if (!readEventBlockHeader(data, len, hd)) return 0;
+
+    const int xy_bytes = (hd.x_bits + hd.y_bits + 1 + 7) / 8;
+    const int p_shift = hd.x_bits + hd.y_bits;
+    const uint64_t x_mask = (1ull << hd.x_bits) - 1;
+    const uint64_t y_mask = (1ull << hd.y_bits) - 1;
+    const uint8_t *p = data + sizeof(hd);
+    const uint8_t *const end = p + hd.payload_bytes;
+
+    msg.header.seq = hd.seq;
+    msg.header.stamp = usToTime(hd.base_us);
+    msg.width = hd.width;
+    msg.height = hd.height;
+    msg.events.resize(hd.count);
+
+    uint64_t prev = hd.base_us;
+    for (uint32_t i = 0; i < hd.count; i++) {
+        if (end - p < xy_bytes + 1) return 0;
+        uint64_t packed = 0;
+        for (int b = 0; b < xy_bytes; b++)
+            packed |= (uint64_t)*p++ << (8 * b);
+
+        uint64_t z = 0;
+        int shift = 0;
+        for (;;) {
+            if (p == end || shift > 63) return 0;
+            uint8_t c = *p++;
+            z |= (uint64_t)(c & 0x7f) << shift;
+            if (!(c & 0x80)) break;
+            shift += 7;
+        }
+        int64_t d = (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+        prev += d;
+
+        auto &e = msg.events[i];
+        e.x = (uint16_t)(packed & x_mask);
+        e.y = (uint16_t)((packed >> hd.x_bits) & y_mask);
+        e.polarity = (uint8_t)((packed >> p_shift) & 1);
+        e.ts = usToTime(prev);
+    }
+    if (p != end) return 0;
+    return sizeof(hd) + hd.payload_bytes;
+}
+
+// Appends compact blocks to a file, one block per EventArray.
+class CompactEventFile : public EventSink
+{
+public:
+    ~CompactEventFile();
+    bool open(const std::string &path) override;
+    void close() override;
+
+    bool write(const PooledEventArray &msg) override;
+    uint64_t bytes() const override { return bytes_; }
+    EventSink *create() const override { return new CompactEventFile; }
+    uint64_t events() const { return events_; }
+
+private:
+    FILE *fp_ = nullptr;
+    std::vector<uint8_t> buf_;
+    uint64_t bytes_ = 0;
+    uint64_t events_ = 0;
+};
+
+// Reads blocks back in file order.
+class CompactEventReader
+{
+public:
+    ~CompactEventReader();
+    bool open(const std::string &path);
+    void close();
+
+    // Returns false at end of file or on a corrupt block.
+    bool next(dvs_msgs::EventArray &msg);
+
+private:
+    FILE *fp_ = nullptr;
+    std::vector<uint8_t> buf_;
+};
@@ -0,0 +1,176 @@
+#include "EventConvert.h"
+
+#include <cstddef>
+#include <cstring>
+
+#if defined(ENABLE_SSE) && (defined(__x86_64__) || defined(__i386__))
+#define EVENT_CONVERT_SIMD
+#include <immintrin.h>
+#endif
+
+// The kernels store whole 16-byte events: x, y | sec | nsec | polarity + pad.
+static_assert(sizeof(PooledEvent) == 16, "unexpected dvs_msgs::Event layout");
+static_assert(offsetof(PooledEvent, y) == 2 && offsetof(PooledEvent, ts) == 4 &&
+              offsetof(PooledEvent, polarity) == 12, "unexpected dvs_msgs::Event layout");
+
+namespace {
+
+const uint64_t US_PER_SEC = 1000000;
+
+// Events of a packet nearly always share one second, so the division is
+// done once per second rather than per event.
+struct SecBase {
+    uint64_t sec = 0;
+    uint64_t us = 0;
+
+    void reset(uint64_t ts)
+    {
+        sec = ts / US_PER_SEC;
+        us = sec * US_PER_SEC;
+    }
+};
+
+void convertScalar(const EventSoA &in, PooledEvent *out, size_t first, size_t last, SecBase &base)
+{
+    const uint64_t *ts = in.ts_us.data();
+    for (size_t i = first; i < last; i++) {
+        uint64_t d = ts[i] - base.us;
+        if (d >= US_PER_SEC) {  // also catches ts[i] < base.us
+            base.reset(ts[i]);
+            d = ts[i] - base.us;
+        }
+        PooledEvent &e = out[i];
+        e.x = in.x[i];
+        e.y = in.y[i];
+        e.ts.sec = (uint32_t)base.sec;
+        e.ts.nsec = (uint32_t)d * 1000;
+        e.polarity = in.p[i];
+    }
+}
+
+#ifdef EVENT_CONVERT_SIMD
+
+// 4x4 transpose of 32-bit rows (xy, sec, nsec, p) into 4 events.
+inline void storeEvents4(PooledEvent *out, __m128i xy, __m128i sec, __m128i nsec, __m128i p)
+{
+    __m128i t0 = _mm_unpacklo_epi32(xy, sec);
+    __m128i t1 = _mm_unpacklo_epi32(nsec, p);
+    __m128i t2 = _mm_unpackhi_epi32(xy, sec);
+    __m128i t3 = _mm_unpackhi_epi32(nsec, p);
+    _mm_storeu_si128((__m128i *)(out + 0), _mm_unpacklo_epi64(t0, t1));
+    _mm_storeu_si128((__m128i *)(out + 1), _mm_unpackhi_epi64(t0, t1));
+    _mm_storeu_si128((__m128i *)(out + 2), _mm_unpacklo_epi64(t2, t3));
+    _mm_storeu_si128((__m128i *)(out + 3), _mm_unpackhi_epi64(t2, t3));
+}
+
+__attribute__((target("sse4.1")))
+void convertSSE41(const EventSoA &in, PooledEvent *out, size_t n, SecBase &base)
+{
+    const uint64_t *ts = in.ts_us.data();
+    const __m128i lim = _mm_set1_epi32(US_PER_SEC - 1);
+    const __m128i k1000 = _mm_set1_epi32(1000);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128i b = _mm_set1_epi64x((long long)base.us);
+        __m128i d0 = _mm_sub_epi64(_mm_loadu_si128((const __m128i *)(ts + i)), b);
+        __m128i d1 = _mm_sub_epi64(_mm_loadu_si128((const __m128i *)(ts + i + 2)), b);
+        // low halves of the four 64-bit differences
+        __m128i d = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(d0), _mm_castsi128_ps(d1), _MM_SHUFFLE(2, 0, 2, 0)));
+        __m128i hi = _mm_or_si128(_mm_srli_epi64(d0, 32), _mm_srli_epi64(d1, 32));
+        bool same_sec = _mm_testz_si128(hi, hi) &&
+                        _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_max_epu32(d, lim), lim)) == 0xffff;
+        if (!same_sec) {
+            // second boundary (or a jump) inside these four
+            convertScalar(in, out, i, i + 4, base);
+            continue;
+        }
+        __m128i xy = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)(in.x.data() + i)),
+                                        _mm_loadl_epi64((const __m128i *)(in.y.data() + i)));
+        int p4;
+        memcpy(&p4, in.p.data() + i, 4);
+        __m128i p = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(p4));
+        storeEvents4(out + i, xy, _mm_set1_epi32((int)(uint32_t)base.sec), _mm_mullo_epi32(d, k1000), p);
+    }
+    convertScalar(in, out, i, n, base);
+}
+
+__attribute__((target("avx2")))
+void convertAVX2(const EventSoA &in, PooledEvent *out, size_t n, SecBase &base)
+{
+    const uint64_t *ts = in.ts_us.data();
+    const __m256i lim = _mm256_set1_epi32(US_PER_SEC - 1);
+    const __m256i k1000 = _mm256_set1_epi32(1000);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256i b = _mm256_set1_epi64x((long long)base.us);
+        __m256i d0 = _mm256_sub_epi64(_mm256_loadu_si256((const __m256i *)(ts + i)), b);
+        __m256i d1 = _mm256_sub_epi64(_mm256_loadu_si256((const __m256i *)(ts + i + 4)), b);
+        // low halves come out as events 0 1 4 5 | 2 3 6 7, put them in order
+        __m256i d = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(d0), _mm256_castsi256_ps(d1), _MM_SHUFFLE(2, 0, 2, 0)));
+        d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(3, 1, 2, 0));
+        __m256i hi = _mm256_or_si256(_mm256_srli_epi64(d0, 32), _mm256_srli_epi64(d1, 32));
+        bool same_sec = _mm256_testz_si256(hi, hi) &&
+                        _mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_max_epu32(d, lim), lim)) == -1;
+        if (!same_sec) {
+            convertScalar(in, out, i, i + 8, base);
+            continue;
+        }
+        __m256i nsec = _mm256_mullo_epi32(d, k1000);
+        __m128i x = _mm_loadu_si128((const __m128i *)(in.x.data() + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(in.y.data() + i));
+        __m256i p = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(in.p.data() + i)));
+        __m128i sec = _mm_set1_epi32((int)(uint32_t)base.sec);
+        storeEvents4(out + i, _mm_unpacklo_epi16(x, y), sec, _mm256_castsi256_si128(nsec), _mm256_castsi256_si128(p));
+        storeEvents4(out + i + 4, _mm_unpackhi_epi16(x, y), sec, _mm256_extracti128_si256(nsec, 1), _mm256_extracti128_si256(p, 1));
+    }
+    convertScalar(in, out, i, n, base);
+}
+
+#endif
+
+}
+
+const char *simdLevelName(SimdLevel level)
+{
+    switch (level) {
+    case SimdLevel::AVX2: return "avx2";
+    case SimdLevel::SSE41: return "sse4.1";
+    default: return "scalar";
+    }
+}
+
+SimdLevel simdDetect()
+{
+#ifdef EVENT_CONVERT_SIMD
+    static const SimdLevel level = __builtin_cpu_supports("avx2") ? SimdLevel::AVX2 :
+                                   __builtin_cpu_supports("sse4.1") ? SimdLevel::SSE41 : SimdLevel::Scalar;
+    return level;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+void convertEvents(const EventSoA &in, PooledEvent *out)
+{
+    convertEvents(in, out, simdDetect());
+}
+
+void convertEvents(const EventSoA &in, PooledEvent *out, SimdLevel level)
+{
+    const size_t n = in.size();
+    if (n == 0) return;
+    SecBase base;
+    base.reset(in.ts_us[0]);
+#ifdef EVENT_CONVERT_SIMD
+    if (level == SimdLevel::AVX2 && __builtin_cpu_supports("avx2")) {
+        convertAVX2(in, out, n, base);
+        return;
+    }
+    if (level >= SimdLevel::SSE41 && __builtin_cpu_supports("sse4.1")) {
+        convertSSE41(in, out, n, base);
+        return;
+    }
+#endif
+    (void)level;
+    convertScalar(in, out, 0, n, base);
+}
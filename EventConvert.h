@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "EventPool.h"
+
+// One polarity packet unpacked into structure-of-arrays form, as read from
+// the SDK accessors. Reused across packets by the source thread.
+struct EventSoA {
+    std::vector<uint64_t> ts_us;
+    std::vector<uint16_t> x, y;
+    std::vector<uint8_t> p;
+
+    void resize(size_t n)
+    {
+        ts_us.resize(n);
+        x.resize(n);
+        y.resize(n);
+        p.resize(n);
+    }
+    size_t size() const { return ts_us.size(); }
+};
+
+enum class SimdLevel { Scalar, SSE41, AVX2 };
+
+const char *simdLevelName(SimdLevel level);
+// Best kernel this CPU supports. SIMD kernels are only built with
+// ENABLE_SSE (Release) on x86.
+SimdLevel simdDetect();
+
+// Writes in[0, n) to out[0, n) as dvs_msgs events. Timestamps go from us to
+// sec/nsec with integer arithmetic, giving exactly what ros::Time(us / 1e6)
+// gives for any realistic device time.
+void convertEvents(const EventSoA &in, PooledEvent *out);
+void convertEvents(const EventSoA &in, PooledEvent *out, SimdLevel level);
@@ -0,0 +1,122 @@
+#include "EventPool.h"
+
+BufferPool &BufferPool::global()
+{
+    // Never destroyed: messages still queued at exit are freed after statics.
+    static BufferPool *pool = new BufferPool;
+    return *pool;
+}
+
+int BufferPool::sizeClass(size_t bytes)
+{
+    int shift = MIN_SHIFT;
+    while (shift <= MAX_SHIFT && ((size_t)1 << shift) < bytes)
+        shift++;
+    return shift > MAX_SHIFT ? -1 : shift - MIN_SHIFT;
+}
+
+void *BufferPool::allocate(size_t bytes)
+{
+    requests_.fetch_add(1, std::memory_order_relaxed);
+    int c = sizeClass(bytes);
+    if (c < 0) {
+        heap_allocs_.fetch_add(1, std::memory_order_relaxed);
+        in_use_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+        return ::operator new(bytes);
+    }
+    in_use_bytes_.fetch_add((size_t)1 << (c + MIN_SHIFT), std::memory_order_relaxed);
+
+    FreeList &fl = lists_[c];
+    {
+        std::lock_guard<std::mutex> lck(fl.m);
+        if (!fl.blocks.empty()) {
+            void *p = fl.blocks.back();
+            fl.blocks.pop_back();
+            recycled_.fetch_add(1, std::memory_order_relaxed);
+            cached_bytes_.fetch_sub((size_t)1 << (c + MIN_SHIFT), std::memory_order_relaxed);
+            return p;
+        }
+    }
+    heap_allocs_.fetch_add(1, std::memory_order_relaxed);
+    return ::operator new((size_t)1 << (c + MIN_SHIFT));
+}
+
+void BufferPool::deallocate(void *p, size_t bytes)
+{
+    if (!p) return;
+    int c = sizeClass(bytes);
+    if (c < 0) {
+        in_use_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+        ::operator delete(p);
+        return;
+    }
+    in_use_bytes_.fetch_sub((size_t)1 << (c + MIN_SHIFT), std::memory_order_relaxed);
+
+    FreeList &fl = lists_[c];
+    {
+        std::lock_guard<std::mutex> lck(fl.m);
+        if (fl.blocks.size() < MAX_CACHED_PER_CLASS) {
+            fl.blocks.push_back(p);
+            cached_bytes_.fetch_add((size_t)1 << (c + MIN_SHIFT), std::memory_order_relaxed);
+            return;
+        }
+    }
+    ::operator delete(p);
+}
+
+void BufferPool::reserve(size_t bytes, size_t count)
+{
+    int c = sizeClass(bytes);
+    if (c < 0) return;
+
+    const size_t block = (size_t)1 << (c + MIN_SHIFT);
+    FreeList &fl = lists_[c];
+    std::lock_guard<std::mutex> lck(fl.m);
+    fl.blocks.reserve(MAX_CACHED_PER_CLASS);
+    while (fl.blocks.size() < count && fl.blocks.size() < MAX_CACHED_PER_CLASS) {
+        fl.blocks.push_back(::operator new(block));
+        heap_allocs_.fetch_add(1, std::memory_order_relaxed);
+        cached_bytes_.fetch_add(block, std::memory_order_relaxed);
+    }
+}
+
+void BufferPool::clear()
+{
+    for (int c = 0; c <= MAX_SHIFT - MIN_SHIFT; c++) {
+        FreeList &fl = lists_[c];
+        std::lock_guard<std::mutex> lck(fl.m);
+        for (void *p : fl.blocks)
+            ::operator delete(p);
+        cached_bytes_.fetch_sub(fl.blocks.size() << (c + MIN_SHIFT), std::memory_order_relaxed);
+        fl.blocks.clear();
+    }
+}
+
+uint64_t BufferPool::trim(uint64_t keep_bytes)
+{
+    uint64_t freed = 0;
+    for (int c = MAX_SHIFT - MIN_SHIFT; c >= 0; c--) {
+        if (cached_bytes_.load(std::memory_order_relaxed) <= keep_bytes) break;
+        const size_t block = (size_t)1 << (c + MIN_SHIFT);
+        FreeList &fl = lists_[c];
+        std::lock_guard<std::mutex> lck(fl.m);
+        while (!fl.blocks.empty() && cached_bytes_.load(std::memory_order_relaxed) > keep_bytes) {
+            ::operator delete(fl.blocks.back());
+            fl.blocks.pop_back();
+            cached_bytes_.fetch_sub(block, std::memory_order_relaxed);
+            freed += block;
+        }
+    }
+    return freed;
+}
+
+BufferPool::Stats BufferPool::stats() const
+{
+    Stats s;
+    s.requests = requests_.load(std::memory_order_relaxed);
+    s.recycled = recycled_.load(std::memory_order_relaxed);
+    s.heap_allocs = heap_allocs_.load(std::memory_order_relaxed);
+    s.cached_bytes = cached_bytes_.load(std::memory_order_relaxed);
+    s.in_use_bytes = in_use_bytes_.load(std::memory_order_relaxed);
+    return s;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include <dvs_msgs/EventArray.h>
+
+// Recycling pool of power-of-two sized blocks. Blocks freed by the writer after
+// serialization go back on a per-size free list and are handed to the next
+// packet of similar size, so steady-state capture does no heap allocation.
+class BufferPool
+{
+public:
+    struct Stats {
+        uint64_t requests = 0;     // allocate() calls
+        uint64_t recycled = 0;     // served from a free list
+        uint64_t heap_allocs = 0;  // had to call operator new
+        uint64_t cached_bytes = 0; // currently parked on free lists
+        uint64_t in_use_bytes = 0; // handed out and not yet returned
+    };
+
+    static BufferPool &global();
+
+    void *allocate(size_t bytes);
+    void deallocate(void *p, size_t bytes);
+
+    // Pre-fills the free list that serves `bytes`-sized requests.
+    void reserve(size_t bytes, size_t count);
+    void clear();
+    // Frees cached blocks, largest first, until at most keep_bytes stay
+    // parked. Returns the bytes freed.
+    uint64_t trim(uint64_t keep_bytes);
+    Stats stats() const;
+    // Block bytes held by live messages (queued, being written, previewed).
+    uint64_t inUse() const { return in_use_bytes_.load(std::memory_order_relaxed); }
+
+private:
+    static const int MIN_SHIFT = 6;   // 64 B
+    static const int MAX_SHIFT = 26;  // 64 MB, larger goes straight to the heap
+    static const size_t MAX_CACHED_PER_CLASS = 256;
+
+    static int sizeClass(size_t bytes);
+
+    struct FreeList {
+        std::mutex m;
+        std::vector<void *> blocks;
+    };
+    FreeList lists_[MAX_SHIFT - MIN_SHIFT + 1];
+
+    std::atomic<uint64_t> requests_{0};
+    std::atomic<uint64_t> recycled_{0};
+    std::atomic<uint64_t> heap_allocs_{0};
+    std::atomic<uint64_t> cached_bytes_{0};
+    std::atomic<uint64_t> in_use_bytes_{0};
+};
+
+// Stateless allocator over BufferPool::global(), usable as the
+// ContainerAllocator of the generated dvs_msgs / std_msgs templates.
+template <class T>
+struct PoolAllocator
+{
+    typedef T value_type;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+
+    template <class U>
+    struct rebind { typedef PoolAllocator<U> other; };
+
+    PoolAllocator() {}
+    template <class U>
+    PoolAllocator(const PoolAllocator<U> &) {}
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T *>(BufferPool::global().allocate(n * sizeof(T)));
+    }
+    void deallocate(T *p, size_t n)
+    {
+        BufferPool::global().deallocate(p, n * sizeof(T));
+    }
+    // Default construction leaves trivial types uninitialized (as `new U`
+    // does), so sizing a buffer that is overwritten next costs no memset.
+    template <class U>
+    void construct(U *p) { ::new ((void *)p) U; }
+    template <class U, class... Args>
+    void construct(U *p, Args &&... args) { ::new ((void *)p) U(std::forward<Args>(args)...); }
+};
+
+template <class T, class U>
+inline bool operator==(const PoolAllocator<T> &, const PoolAllocator<U> &) { return true; }
+template <class T, class U>
+inline bool operator!=(const PoolAllocator<T> &, const PoolAllocator<U> &) { return false; }
+
+typedef dvs_msgs::Event_<PoolAllocator<void> > PooledEvent;
+typedef dvs_msgs::EventArray_<PoolAllocator<void> > PooledEventArray;
@@ -0,0 +1,90 @@
+#include "EventRebatcher.h"
+
+#include <algorithm>
+
+#include "EventCodec.h"
+
+EventRebatcher::EventRebatcher(const RebatchConfig &cfg)
+    : cfg_(cfg)
+{
+}
+
+void EventRebatcher::begin(const PooledEventArray &in, const PooledEvent &first, TimePoint now)
+{
+    cur_.header.stamp = first.ts;
+    cur_.width = in.width;
+    cur_.height = in.height;
+    if (cfg_.window_us) {
+        uint64_t ts = timeToUs(first.ts);
+        win_end_ = (ts / cfg_.window_us + 1) * cfg_.window_us;
+    }
+    t_first_ = now;
+}
+
+void EventRebatcher::close(std::vector<PooledEventArray> &out)
+{
+    cur_.header.seq = (uint32_t)stats_.out_msgs++;
+    last_size_ = cur_.events.size();
+    out.push_back(std::move(cur_));
+    cur_ = PooledEventArray();
+}
+
+void EventRebatcher::add(PooledEventArray &&in, TimePoint now, std::vector<PooledEventArray> &out)
+{
+    const size_t n = in.events.size();
+    stats_.in_msgs++;
+    stats_.events += n;
+    bool split = false;
+    size_t i = 0;
+    while (i < n) {
+        if (cur_.events.empty())
+            begin(in, in.events[i], now);
+
+        // events [i, j) go into the open message
+        size_t j = n;
+        if (cfg_.max_events)
+            j = std::min(j, i + (cfg_.max_events - cur_.events.size()));
+        if (cfg_.window_us) {
+            // out-of-order events before the window stay in it
+            for (size_t k = i; k < j; k++) {
+                if (timeToUs(in.events[k].ts) >= win_end_) {
+                    j = k;
+                    break;
+                }
+            }
+        }
+
+        if (j > i) {
+            if (i == 0 && j == n && cur_.events.empty()) {
+                // whole packet opens the message: take its buffer
+                cur_.events = std::move(in.events);
+            } else {
+                if (cur_.events.empty())
+                    cur_.events.reserve(std::max(last_size_, j - i));
+                cur_.events.insert(cur_.events.end(), in.events.begin() + i, in.events.begin() + j);
+            }
+        }
+        bool full = cfg_.max_events && cur_.events.size() >= cfg_.max_events;
+        if (j < n || full) {
+            close(out);
+            if (j < n && j > 0) split = true;
+        }
+        i = j;
+    }
+    if (split) stats_.splits++;
+    poll(now, out);
+}
+
+void EventRebatcher::poll(TimePoint now, std::vector<PooledEventArray> &out)
+{
+    if (cur_.events.empty()) return;
+    if (now - t_first_ >= std::chrono::milliseconds(cfg_.max_latency_ms)) {
+        stats_.latency_flushes++;
+        close(out);
+    }
+}
+
+void EventRebatcher::flush(std::vector<PooledEventArray> &out)
+{
+    if (!cur_.events.empty()) close(out);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "EventPool.h"
+
+struct RebatchConfig {
+    uint32_t window_us = 0;     // messages cover aligned windows of event time, 0 = off
+    uint32_t max_events = 0;    // at most this many events per message, 0 = no limit
+    uint32_t max_latency_ms = 50;   // a message is never held longer than this
+
+    bool enabled() const { return window_us > 0 || max_events > 0; }
+};
+
+// Merges and splits SDK event packets into messages of a fixed event-time
+// window and/or event count, independent of how the driver buffers. A message
+// is closed when an event falls past its window, when it is full, or when its
+// first event has been held for max_latency_ms of host time. Runs on the
+// writer thread.
+class EventRebatcher
+{
+public:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    struct Stats {
+        uint64_t in_msgs = 0;
+        uint64_t out_msgs = 0;
+        uint64_t events = 0;
+        uint64_t splits = 0;            // input packets spread over several messages
+        uint64_t latency_flushes = 0;   // closed early by max_latency_ms
+    };
+
+    explicit EventRebatcher(const RebatchConfig &cfg);
+
+    // Appends completed messages to `out`.
+    void add(PooledEventArray &&msg, TimePoint now, std::vector<PooledEventArray> &out);
+    // Closes the open message if it is past the latency bound.
+    void poll(TimePoint now, std::vector<PooledEventArray> &out);
+    // Closes the open message, if any.
+    void flush(std::vector<PooledEventArray> &out);
+
+    bool pending() const { return !cur_.events.empty(); }
+    const Stats &stats() const { return stats_; }
+
+private:
+    void begin(const PooledEventArray &in, const PooledEvent &first, TimePoint now);
+    void close(std::vector<PooledEventArray> &out);
+
+    RebatchConfig cfg_;
+    PooledEventArray cur_;
+    uint64_t win_end_ = 0;      // us, first event time of the next window
+    size_t last_size_ = 0;      // capacity hint for the next message
+    TimePoint t_first_;
+    Stats stats_;
+};
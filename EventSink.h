@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "EventPool.h"
+
+// Destination for /dvs/events other than the bag. Called from the writer
+// thread only.
+class EventSink
+{
+public:
+    virtual ~EventSink() {}
+    virtual bool open(const std::string &path) = 0;
+    virtual bool write(const PooledEventArray &msg) = 0;
+    virtual void close() = 0;
+    virtual uint64_t bytes() const = 0;
+    // An unopened sink with the same settings, for the next segment.
+    virtual EventSink *create() const = 0;
+};
@@ -0,0 +1,315 @@
+#include "FrameContainer.h"
+
+#include <cstring>
+#include <memory>
+#include <ctime>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include "Crc32.h"
+#include "DepthCodec.h"
+
+static const char IRF_MAGIC[4] = {'I', 'R', 'F', '1'};
+static const char IRF_RECORD_MAGIC[4] = {'I', 'R', 'F', 'R'};
+static const char IRF_INDEX_MAGIC[4] = {'I', 'R', 'F', 'I'};
+static const uint32_t IRF_VERSION = 1;
+
+bool frameLz4Available()
+{
+#ifdef HAVE_LZ4
+    return true;
+#else
+    return false;
+#endif
+}
+
+ContainerFrameSink::ContainerFrameSink(const std::string &path, const std::string &time_path, FrameCodec codec)
+    : path_(path), time_path_(time_path), codec_(codec)
+{
+    if (codec_ == FRAME_LZ4 && !frameLz4Available()) {
+        printf(" * WARNING! built without LZ4, D435 frames are stored raw\n");
+        codec_ = FRAME_RAW;
+    }
+}
+
+ContainerFrameSink::~ContainerFrameSink()
+{
+    close();
+}
+
+void ContainerFrameSink::setRotation(const RotateConfig &cfg, std::function<void()> thread_init)
+{
+    rotate_ = cfg;
+    closer_init_ = thread_init;
+}
+
+bool ContainerFrameSink::openFile(int segment)
+{
+    const std::string path = segmentPath(path_, segment);
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (!fp) {
+        printf(" * ERROR! cannot open %s\n", path.c_str());
+        return false;
+    }
+    fp_ = fp;
+    index_.clear();
+    segment_ = SegmentInfo();
+    segment_.index = segment;
+    segment_.files.push_back(path);
+
+    FrameFileHeader hd;
+    memcpy(hd.magic, IRF_MAGIC, 4);
+    hd.version = IRF_VERSION;
+    hd.created_unix = (uint64_t)time(nullptr);
+    fwrite(&hd, sizeof(hd), 1, fp_);
+    offset_ = sizeof(hd);
+    return true;
+}
+
+// index and footer, then close
+static void finishFile(FILE *fp, const std::vector<FrameIndexEntry> &index, uint64_t offset)
+{
+    FrameFileFooter ft;
+    memcpy(ft.magic, IRF_INDEX_MAGIC, 4);
+    ft.reserved = 0;
+    ft.count = index.size();
+    ft.index_offset = offset;
+    fwrite(index.data(), sizeof(FrameIndexEntry), index.size(), fp);
+    fwrite(&ft, sizeof(ft), 1, fp);
+    fclose(fp);
+}
+
+bool ContainerFrameSink::open()
+{
+    if (!openFile(rotate_.enabled() ? 0 : -1)) return false;
+    of_.open(time_path_);
+    if (rotate_.enabled() && !closer_.start(manifestPath(path_), closer_init_)) {
+        fclose(fp_);
+        fp_ = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void ContainerFrameSink::encode(const IRFrame &f, EncodedFrame &out)
+{
+    const cv::Mat &img = f.image;
+    const size_t row_bytes = img.cols * img.elemSize();
+    const size_t raw = row_bytes * img.rows;
+
+    // pack rows (the source may have padding), then compress if asked
+    std::vector<uint8_t> packed;
+    const uint8_t *src = img.data;
+    if (!img.isContinuous() && codec_ != FRAME_DEPTH) {
+        packed.resize(raw);
+        for (int r = 0; r < img.rows; r++)
+            memcpy(packed.data() + r * row_bytes, img.ptr(r), row_bytes);
+        src = packed.data();
+    }
+
+    FrameRecordHeader hd;
+    memcpy(hd.magic, IRF_RECORD_MAGIC, 4);
+    hd.codec = codec_;
+    hd.bytes_per_pixel = (uint8_t)img.elemSize();
+    hd.reserved = 0;
+    hd.index = f.index;
+    hd.stamp = f.stamp;
+    hd.expo = f.expo;
+    hd.width = (uint16_t)img.cols;
+    hd.height = (uint16_t)img.rows;
+    hd.raw_bytes = (uint32_t)raw;
+
+    uint8_t *payload;
+    if (codec_ == FRAME_DEPTH) {
+        out.data.resize(sizeof(hd));
+        if (img.type() != CV_16UC1) {
+            out.ok = false;
+            return;
+        }
+        hd.payload_bytes = (uint32_t)depthEncode(img, out.data);
+        payload = out.data.data() + sizeof(hd);
+    } else
+#ifdef HAVE_LZ4
+    if (codec_ == FRAME_LZ4) {
+        out.data.resize(sizeof(hd) + LZ4_compressBound((int)raw));
+        payload = out.data.data() + sizeof(hd);
+        int n = LZ4_compress_default((const char *)src, (char *)payload, (int)raw, LZ4_compressBound((int)raw));
+        if (n <= 0) {
+            out.ok = false;
+            return;
+        }
+        hd.payload_bytes = (uint32_t)n;
+    } else
+#endif
+    {
+        out.data.resize(sizeof(hd) + raw);
+        payload = out.data.data() + sizeof(hd);
+        memcpy(payload, src, raw);
+        hd.payload_bytes = (uint32_t)raw;
+    }
+    hd.checksum = crc32(payload, hd.payload_bytes);
+    memcpy(out.data.data(), &hd, sizeof(hd));
+    out.data.resize(sizeof(hd) + hd.payload_bytes);
+    out.bytes = out.data.size();
+    out.ok = true;
+}
+
+void ContainerFrameSink::commit(const IRFrame &f, EncodedFrame &out)
+{
+    if (!out.ok || !fp_) return;
+    if (rotate_.enabled() && !rotate_failed_ && segment_.messages && rotate_.due(segment_.bytes, segment_.opened)) {
+        FILE *fp = fp_;
+        const uint64_t offset = offset_;
+        const SegmentInfo finished = segment_;
+        auto index = std::make_shared<std::vector<FrameIndexEntry> >(std::move(index_));
+        if (openFile(finished.index + 1)) {
+            closer_.push(finished, [fp, index, offset] { finishFile(fp, *index, offset); });
+        } else {
+            printf(" * WARNING! %s keeps growing\n", segmentPath(path_, finished.index).c_str());
+            index_ = std::move(*index);
+            rotate_failed_ = true;
+        }
+    }
+    if (fwrite(out.data.data(), 1, out.data.size(), fp_) != out.data.size()) {
+        out.ok = false;
+        return;
+    }
+    FrameIndexEntry e;
+    e.index = f.index;
+    e.stamp = f.stamp;
+    e.offset = offset_;
+    index_.push_back(e);
+    offset_ += out.data.size();
+    segment_.add(f.stamp, out.data.size());
+
+    if (!time_header_.empty()) {
+        of_ << time_header_ << "\n";
+        time_header_.clear();
+    }
+    char msg[100] = "";
+    sprintf(msg, "%05lu %lld %.5f", f.index, f.stamp, f.expo);
+    of_ << msg << "\n";
+}
+
+void ContainerFrameSink::close()
+{
+    if (!fp_) return;
+    finishFile(fp_, index_, offset_);
+    fp_ = nullptr;
+    if (of_.is_open()) of_.close();
+    if (rotate_.enabled()) {
+        closer_.push(segment_, nullptr);
+        closer_.stop();
+        printf("%s: %d segments, %.0f ms max to close one\n", manifestPath(path_).c_str(),
+               closer_.closed(), closer_.maxCloseSec() * 1000);
+    }
+}
+
+FrameContainerReader::~FrameContainerReader()
+{
+    close();
+}
+
+bool FrameContainerReader::open(const std::string &path)
+{
+    fp_ = fopen(path.c_str(), "rb");
+    if (!fp_) return false;
+
+    FrameFileHeader hd;
+    if (fread(&hd, sizeof(hd), 1, fp_) != 1 || memcmp(hd.magic, IRF_MAGIC, 4) != 0) {
+        close();
+        return false;
+    }
+
+    index_.clear();
+    recovered_ = false;
+    FrameFileFooter ft;
+    fseeko(fp_, 0, SEEK_END);
+    const uint64_t size = size_ = ftello(fp_);
+    if (size >= sizeof(hd) + sizeof(ft) &&
+        fseeko(fp_, size - sizeof(ft), SEEK_SET) == 0 &&
+        fread(&ft, sizeof(ft), 1, fp_) == 1 &&
+        memcmp(ft.magic, IRF_INDEX_MAGIC, 4) == 0 &&
+        ft.index_offset + ft.count * sizeof(FrameIndexEntry) + sizeof(ft) == size) {
+        index_.resize(ft.count);
+        fseeko(fp_, ft.index_offset, SEEK_SET);
+        if (fread(index_.data(), sizeof(FrameIndexEntry), ft.count, fp_) == ft.count)
+            return true;
+        index_.clear();
+    }
+    return rebuildIndex();
+}
+
+bool FrameContainerReader::rebuildIndex()
+{
+    recovered_ = true;
+    uint64_t off = sizeof(FrameFileHeader);
+    FrameRecordHeader hd;
+    for (;;) {
+        if (fseeko(fp_, off, SEEK_SET) != 0 || fread(&hd, sizeof(hd), 1, fp_) != 1) break;
+        if (memcmp(hd.magic, IRF_RECORD_MAGIC, 4) != 0) break;
+        // the last record may be cut short
+        if (fseeko(fp_, off + sizeof(hd) + hd.payload_bytes - 1, SEEK_SET) != 0 || fgetc(fp_) == EOF) break;
+        FrameIndexEntry e;
+        e.index = hd.index;
+        e.stamp = hd.stamp;
+        e.offset = off;
+        index_.push_back(e);
+        off += sizeof(hd) + hd.payload_bytes;
+    }
+    return true;
+}
+
+void FrameContainerReader::close()
+{
+    if (fp_) fclose(fp_);
+    fp_ = nullptr;
+}
+
+// Largest payload the writer produces for raw_bytes of pixels; 0 for a codec
+// this build cannot read.
+static uint64_t payloadBound(const FrameRecordHeader &hd)
+{
+    switch (hd.codec) {
+    case FRAME_RAW: return hd.raw_bytes;
+    case FRAME_DEPTH: return hd.bytes_per_pixel == 2 ? depthEncodeBound(hd.raw_bytes / 2) : 0;
+#ifdef HAVE_LZ4
+    case FRAME_LZ4: return LZ4_compressBound((int)hd.raw_bytes);    // 0 if too large for LZ4
+#endif
+    default: return 0;
+    }
+}
+
+bool FrameContainerReader::read(size_t i, FrameRecordHeader &hd, cv::Mat &img)
+{
+    if (!fp_ || i >= index_.size()) return false;
+    const uint64_t off = index_[i].offset;
+    if (fseeko(fp_, off, SEEK_SET) != 0 || fread(&hd, sizeof(hd), 1, fp_) != 1) return false;
+    if (memcmp(hd.magic, IRF_RECORD_MAGIC, 4) != 0) return false;
+    if (hd.bytes_per_pixel != 1 && hd.bytes_per_pixel != 2) return false;
+    // sizes come from the file: check them before allocating
+    if (hd.raw_bytes != (uint64_t)hd.width * hd.height * hd.bytes_per_pixel) return false;
+    if (hd.payload_bytes > payloadBound(hd) || hd.payload_bytes > size_ - off - sizeof(hd)) return false;
+
+    buf_.resize(hd.payload_bytes);
+    if (fread(buf_.data(), 1, hd.payload_bytes, fp_) != hd.payload_bytes) return false;
+    if (crc32(buf_.data(), buf_.size()) != hd.checksum) return false;
+
+    img.create(hd.height, hd.width, hd.bytes_per_pixel == 2 ? CV_16UC1 : CV_8UC1);
+    if (hd.codec == FRAME_DEPTH)
+        return hd.bytes_per_pixel == 2 && depthDecode(buf_.data(), buf_.size(), img);
+    if (hd.codec == FRAME_RAW) {
+        if (hd.payload_bytes != hd.raw_bytes) return false;
+        memcpy(img.data, buf_.data(), hd.raw_bytes);
+        return true;
+    }
+#ifdef HAVE_LZ4
+    if (hd.codec == FRAME_LZ4) {
+        int n = LZ4_decompress_safe((const char *)buf_.data(), (char *)img.data, (int)hd.payload_bytes, (int)hd.raw_bytes);
+        return n == (int)hd.raw_bytes;
+    }
+#endif
+    return false;
+}
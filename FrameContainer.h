@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "FrameEncoderPool.h"
+
+// Append-only file holding all D435 infrared (or depth) frames of a session.
+//
+//   [file header][record 0][record 1]...[index][footer]
+//
+// Each record is a FrameRecordHeader followed by the pixels: 8-bit infrared
+// raw or LZ4 compressed, 16-bit depth raw or DepthCodec.h coded. The index
+// (one entry per frame) and footer are written on close; after a crash the
+// reader rebuilds the index by walking the records.
+enum FrameCodec : uint8_t {
+    FRAME_RAW = 0,
+    FRAME_LZ4 = 1,
+    FRAME_DEPTH = 2
+};
+
+struct FrameFileHeader {
+    char magic[4];          // "IRF1"
+    uint32_t version;
+    uint64_t created_unix;
+};
+
+struct FrameRecordHeader {
+    char magic[4];          // "IRFR"
+    uint8_t codec;
+    uint8_t bytes_per_pixel;
+    uint16_t reserved;
+    uint64_t index;
+    int64_t stamp;          // RS2_FRAME_METADATA_FRAME_TIMESTAMP [us]
+    double expo;            // RS2_FRAME_METADATA_ACTUAL_EXPOSURE [ms]
+    uint16_t width;
+    uint16_t height;
+    uint32_t payload_bytes;
+    uint32_t raw_bytes;
+    uint32_t checksum;      // CRC32 of the payload
+};
+static_assert(sizeof(FrameRecordHeader) == 48, "FrameRecordHeader must stay packed");
+
+struct FrameIndexEntry {
+    uint64_t index;
+    int64_t stamp;
+    uint64_t offset;
+};
+
+struct FrameFileFooter {
+    char magic[4];          // "IRFI"
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t index_offset;
+};
+
+// True if this build can write/read FRAME_LZ4 records.
+bool frameLz4Available();
+
+// FrameSink writing one container file (plus the usual D435_time.txt lines),
+// or one per segment when rotating. Compression runs in encode() on the pool
+// threads, appends in commit(); a finished segment gets its index and footer
+// on the closer thread.
+class ContainerFrameSink : public FrameSink
+{
+public:
+    ContainerFrameSink(const std::string &path, const std::string &time_path, FrameCodec codec);
+    ~ContainerFrameSink();
+    void setRotation(const RotateConfig &cfg, std::function<void()> thread_init) override;
+    bool open() override;
+    void encode(const IRFrame &f, EncodedFrame &out) override;
+    void commit(const IRFrame &f, EncodedFrame &out) override;
+    void close() override;
+    // Written before the first line of the time file, e.g. "# depth_scale ..."
+    void setTimeHeader(const std::string &line) { time_header_ = line; }
+
+private:
+    bool openFile(int segment);
+
+    std::string path_, time_path_, time_header_;
+    FrameCodec codec_;
+    FILE *fp_ = nullptr;
+    uint64_t offset_ = 0;
+    std::vector<FrameIndexEntry> index_;
+    std::ofstream of_;
+    RotateConfig rotate_;
+    std::function<void()> closer_init_;
+    SegmentCloser closer_;
+    SegmentInfo segment_;
+    bool rotate_failed_ = false;
+};
+
+class FrameContainerReader
+{
+public:
+    ~FrameContainerReader();
+    bool open(const std::string &path);
+    void close();
+
+    size_t size() const { return index_.size(); }
+    const std::vector<FrameIndexEntry> &index() const { return index_; }
+    bool recovered() const { return recovered_; }
+
+    // Decodes the i-th frame (in file order); CV_8UC1 or CV_16UC1.
+    bool read(size_t i, FrameRecordHeader &hd, cv::Mat &img);
+
+private:
+    bool rebuildIndex();
+
+    FILE *fp_ = nullptr;
+    uint64_t size_ = 0;
+    std::vector<FrameIndexEntry> index_;
+    std::vector<uint8_t> buf_;
+    bool recovered_ = false;
+};
@@ -0,0 +1,229 @@
+#include "FrameEncoderPool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+
+#include "Telemetry.h"
+
+PngFrameSink::PngFrameSink(const std::string &img_dir, const std::string &time_path, int png_level)
+    : img_dir_(img_dir), time_path_(time_path)
+{
+    params_ = {cv::IMWRITE_PNG_COMPRESSION, png_level};
+}
+
+PngFrameSink::~PngFrameSink()
+{
+    close();
+}
+
+void PngFrameSink::setRotation(const RotateConfig &cfg, std::function<void()> thread_init)
+{
+    rotate_ = cfg;
+    closer_init_ = thread_init;
+}
+
+bool PngFrameSink::openDir(int segment)
+{
+    dir_ = segmentPath(img_dir_, segment);
+    mkdir(dir_.c_str(), ACCESSPERMS);
+    segment_ = SegmentInfo();
+    segment_.index = segment;
+    segment_.files.push_back(dir_);
+    return true;
+}
+
+bool PngFrameSink::open()
+{
+    of_.open(time_path_);
+    if (!of_.is_open()) {
+        printf(" * ERROR! cannot open %s\n", time_path_.c_str());
+        return false;
+    }
+    if (rotate_.enabled() && !closer_.start(manifestPath(img_dir_), closer_init_))
+        return false;
+    return openDir(rotate_.enabled() ? 0 : -1);
+}
+
+void PngFrameSink::encode(const IRFrame &f, EncodedFrame &out)
+{
+    out.ok = cv::imencode(".png", f.image, out.data, params_);
+    out.bytes = out.data.size();
+}
+
+void PngFrameSink::commit(const IRFrame &f, EncodedFrame &out)
+{
+    if (!out.ok) return;
+    if (rotate_.enabled() && !rotate_failed_ && segment_.messages && rotate_.due(segment_.bytes, segment_.opened)) {
+        // the files are written already; the closer makes them durable
+        const SegmentInfo finished = segment_;
+        const std::string dir = dir_;
+        openDir(finished.index + 1);
+        closer_.push(finished, [dir] {
+            int fd = ::open(dir.c_str(), O_RDONLY);
+            if (fd >= 0) {
+                syncfs(fd);
+                ::close(fd);
+            }
+        });
+    }
+    char img_idx[32] = "";
+    sprintf(img_idx, "%05lu", f.index);
+    std::string path = dir_ + "/" + img_idx + ".png";
+    FILE *fp = fopen(path.c_str(), "wb");
+    out.ok = fp && fwrite(out.data.data(), 1, out.data.size(), fp) == out.data.size();
+    if (fp) fclose(fp);
+    if (!out.ok) {
+        printf(" * ERROR! cannot write %s\n", path.c_str());
+        return;
+    }
+    segment_.add(f.stamp, out.bytes);
+    char msg[100] = "";
+    sprintf(msg, "%05lu %lld %.5f", f.index, f.stamp, f.expo);
+    of_ << msg << "\n";
+}
+
+void PngFrameSink::close()
+{
+    if (!of_.is_open()) return;
+    of_.close();
+    if (rotate_.enabled()) {
+        closer_.push(segment_, nullptr);
+        closer_.stop();
+        printf("%s: %d segments, %.0f ms max to close one\n", manifestPath(img_dir_).c_str(),
+               closer_.closed(), closer_.maxCloseSec() * 1000);
+    }
+}
+
+FrameEncoderPool::FrameEncoderPool(FrameSink *sink, int threads, size_t queue_size, telemetry::Stream stream)
+    : sink_(sink), stream_(stream), queue_size_(queue_size)
+{
+    if (threads <= 0) {
+        threads = std::thread::hardware_concurrency() / 2;
+        if (threads < 1) threads = 1;
+    }
+    n_threads_ = threads;
+}
+
+FrameEncoderPool::~FrameEncoderPool()
+{
+    stop();
+}
+
+bool FrameEncoderPool::start()
+{
+    if (!sink_->open()) return false;
+    stop_ = false;
+    for (int i = 0; i < n_threads_; i++)
+        workers_.emplace_back(&FrameEncoderPool::worker, this);
+    return true;
+}
+
+bool FrameEncoderPool::push(IRFrame &&f)
+{
+    {
+        std::lock_guard<std::mutex> lck(m_queue_);
+        if (queue_.size() >= queue_size_) {
+            std::lock_guard<std::mutex> lck_stats(m_stats_);
+            stats_.dropped++;
+            return false;
+        }
+        queue_.emplace_back(std::move(f));
+        std::lock_guard<std::mutex> lck_stats(m_stats_);
+        stats_.queued++;
+        if (queue_.size() > stats_.high_water) stats_.high_water = queue_.size();
+    }
+    not_empty_.notify_one();
+    return true;
+}
+
+void FrameEncoderPool::stop()
+{
+    if (workers_.empty()) return;
+    {
+        std::lock_guard<std::mutex> lck(m_queue_);
+        stop_ = true;
+    }
+    not_empty_.notify_all();
+    for (auto &t : workers_) t.join();
+    workers_.clear();
+    sink_->close();
+}
+
+void FrameEncoderPool::worker()
+{
+    using namespace std::chrono;
+    if (thread_init_) thread_init_();
+    for (;;) {
+        IRFrame f;
+        {
+            std::unique_lock<std::mutex> lck(m_queue_);
+            not_empty_.wait(lck, [this] { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) return;
+            f = std::move(queue_.front());
+            queue_.pop_front();
+        }
+
+        auto t = steady_clock::now();
+        EncodedFrame enc;
+        sink_->encode(f, enc);
+        double dt = duration_cast<duration<double> >(steady_clock::now() - t).count();
+        const uint64_t raw_bytes = f.image.total() * f.image.elemSize();
+
+        // give the buffer back to librealsense as soon as possible
+        f.image.release();
+        f.depth.release();
+        f.hold.reset();
+        {
+            std::lock_guard<std::mutex> lck(m_stats_);
+            stats_.encode_sec += dt;
+            if (dt > stats_.encode_max_sec) stats_.encode_max_sec = dt;
+            if (!enc.ok) stats_.failed++;
+        }
+        complete(std::move(f), std::move(enc), raw_bytes);
+    }
+}
+
+void FrameEncoderPool::complete(IRFrame &&f, EncodedFrame &&enc, uint64_t raw_bytes)
+{
+    std::lock_guard<std::mutex> lck(m_commit_);
+    uint64_t idx = f.index;
+    Done &d = done_[idx];
+    d.frame = std::move(f);
+    d.enc = std::move(enc);
+    d.raw_bytes = raw_bytes;
+
+    uint64_t written = 0, raw = 0, bytes = 0;
+    for (auto it = done_.begin(); it != done_.end() && it->first == next_commit_; it = done_.erase(it)) {
+        sink_->commit(it->second.frame, it->second.enc);
+        if (it->second.enc.ok) {
+            written++;
+            raw += it->second.raw_bytes;
+            bytes += it->second.enc.bytes;
+            telemetry::latency(stream_, telemetry::WRITTEN, it->second.frame.stamp);
+            telemetry::written(stream_, 1, it->second.enc.bytes);
+        }
+        next_commit_++;
+    }
+    if (written) {
+        std::lock_guard<std::mutex> lck_stats(m_stats_);
+        stats_.written += written;
+        stats_.raw_bytes += raw;
+        stats_.bytes += bytes;
+    }
+}
+
+size_t FrameEncoderPool::depth()
+{
+    std::lock_guard<std::mutex> lck(m_queue_);
+    return queue_.size();
+}
+
+FrameEncoderPool::Stats FrameEncoderPool::stats() const
+{
+    std::lock_guard<std::mutex> lck(m_stats_);
+    return stats_;
+}
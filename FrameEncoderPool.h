@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "Segments.h"
+#include "Telemetry.h"
+
+// One infrared frame as handed over by the grab loop. `image` points into
+// memory kept alive by `hold` (the rs2::frameset), so nothing is copied.
+struct IRFrame {
+    uint64_t index = 0;     // sequence number of saved frames
+    long long stamp = 0;    // RS2_FRAME_METADATA_FRAME_TIMESTAMP [us]
+    double expo = 0;        // RS2_FRAME_METADATA_ACTUAL_EXPOSURE [ms]
+    cv::Mat image;
+    cv::Mat depth;          // CV_16UC1 of the same frameset, if depth is on
+    std::shared_ptr<void> hold;
+};
+
+// Output of FrameSink::encode, passed to commit in index order.
+struct EncodedFrame {
+    bool ok = false;
+    std::vector<uint8_t> data;
+    uint64_t bytes = 0;     // on disk
+};
+
+// Where the encoder pool puts frames. encode() runs on any pool thread in
+// parallel; commit() is called for one frame at a time, in index order.
+class FrameSink
+{
+public:
+    virtual ~FrameSink() {}
+    // Numbered segments instead of one output, see Segments.h; thread_init
+    // runs on the closer thread. Call before open().
+    virtual void setRotation(const RotateConfig &cfg, std::function<void()> thread_init) {}
+    virtual bool open() = 0;
+    virtual void encode(const IRFrame &f, EncodedFrame &out) = 0;
+    virtual void commit(const IRFrame &f, EncodedFrame &out) = 0;
+    virtual void close() = 0;
+};
+
+// <dir>/%05d.png per frame plus "<index> <stamp> <expo>" lines in time_path.
+// PNGs are encoded in parallel and written in order by commit(); rotating
+// goes on in <dir>.0001/ and so on.
+class PngFrameSink : public FrameSink
+{
+public:
+    PngFrameSink(const std::string &img_dir, const std::string &time_path, int png_level);
+    ~PngFrameSink();
+    void setRotation(const RotateConfig &cfg, std::function<void()> thread_init) override;
+    bool open() override;
+    void encode(const IRFrame &f, EncodedFrame &out) override;
+    void commit(const IRFrame &f, EncodedFrame &out) override;
+    void close() override;
+
+private:
+    bool openDir(int segment);
+
+    std::string img_dir_, time_path_, dir_;
+    std::vector<int> params_;
+    std::ofstream of_;
+    RotateConfig rotate_;
+    std::function<void()> closer_init_;
+    SegmentCloser closer_;
+    SegmentInfo segment_;
+    bool rotate_failed_ = false;
+};
+
+// Bounded queue in front of a pool of encoder threads. push() never blocks
+// the grab loop: when the queue is full the frame is dropped and counted.
+class FrameEncoderPool
+{
+public:
+    struct Stats {
+        uint64_t queued = 0;
+        uint64_t written = 0;
+        uint64_t dropped = 0;   // queue full
+        uint64_t failed = 0;    // encode/write error
+        size_t high_water = 0;
+        double encode_sec = 0;  // summed over threads
+        double encode_max_sec = 0;
+        uint64_t raw_bytes = 0; // image bytes of the written frames
+        uint64_t bytes = 0;     // what they took on disk
+    };
+
+    // threads <= 0 picks half the cores. Written frames are counted in
+    // telemetry under `stream`.
+    FrameEncoderPool(FrameSink *sink, int threads, size_t queue_size,
+                     telemetry::Stream stream = telemetry::D435);
+    ~FrameEncoderPool();
+
+    // Runs first thing on every worker thread. Call before start().
+    void setThreadInit(std::function<void()> fn) { thread_init_ = fn; }
+    bool start();
+    bool push(IRFrame &&f);
+    // Encodes everything still queued, then closes the sink.
+    void stop();
+
+    Stats stats() const;
+    int threads() const { return n_threads_; }
+    size_t depth();
+
+private:
+    void worker();
+    void complete(IRFrame &&f, EncodedFrame &&enc, uint64_t raw_bytes);
+
+    FrameSink *sink_;
+    telemetry::Stream stream_;
+    int n_threads_;
+    size_t queue_size_;
+    std::function<void()> thread_init_;
+
+    std::mutex m_queue_;
+    std::condition_variable not_empty_;
+    std::deque<IRFrame> queue_;
+    bool stop_ = false;
+    std::vector<std::thread> workers_;
+
+    // frames encoded out of order wait here until their turn to commit
+    struct Done {
+        IRFrame frame;
+        EncodedFrame enc;
+        uint64_t raw_bytes;
+    };
+    std::mutex m_commit_;
+    std::map<uint64_t, Done> done_;
+    uint64_t next_commit_ = 0;
+
+    mutable std::mutex m_stats_;
+    Stats stats_;
+};
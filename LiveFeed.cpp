@@ -0,0 +1,127 @@
+#include "LiveFeed.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+namespace live {
+
+static const size_t IMU_RING_BYTES = 1 << 20;
+
+static_assert(sizeof(PooledEvent) == sizeof(ShmEvent), "ShmEvent must match dvs_msgs::Event");
+
+static ShmPublisher pubs[SHM_STREAMS];
+static std::atomic_bool active{false};
+static std::string base;
+
+bool start(const std::string &name, size_t ring_bytes)
+{
+    active = false;
+    base = name;
+    if (name.empty()) return true;
+    for (int s = 0; s < SHM_STREAMS; s++) {
+        const std::string path = "/" + name + "." + shmStreamName((ShmStream)s);
+        if (!pubs[s].open(path, (ShmStream)s, s == SHM_IMU ? IMU_RING_BYTES : ring_bytes)) {
+            for (int i = 0; i < s; i++) pubs[i].close();
+            return false;
+        }
+    }
+    active = true;
+    printf("Live feed: /dev/shm/%s.{events,imu,aps,d435}, %lu MB rings\n", name.c_str(), ring_bytes >> 20);
+    return true;
+}
+
+void stop()
+{
+    if (!active) return;
+    active = false;
+    for (ShmPublisher &p : pubs)
+        p.close();
+}
+
+bool enabled()
+{
+    return active.load(std::memory_order_relaxed);
+}
+
+void events(const PooledEventArray &msg, uint64_t ts_us)
+{
+    if (!enabled()) return;
+    const size_t n = msg.events.size();
+    uint8_t *p = pubs[SHM_EVENTS].reserve(sizeof(ShmEvents) + n * sizeof(ShmEvent));
+    if (!p) return;
+    ShmEvents hd;
+    hd.count = (uint32_t)n;
+    hd.width = msg.width;
+    hd.height = msg.height;
+    hd.seq = msg.header.seq;
+    memcpy(p, &hd, sizeof(hd));
+    // same layout: the packet goes over in one copy
+    memcpy(p + sizeof(hd), msg.events.data(), n * sizeof(ShmEvent));
+    pubs[SHM_EVENTS].publish(ts_us);
+}
+
+void imu(const sensor_msgs::Imu &m, uint64_t ts_us)
+{
+    if (!enabled()) return;
+    uint8_t *p = pubs[SHM_IMU].reserve(sizeof(ShmImu));
+    if (!p) return;
+    ShmImu s;
+    s.acc[0] = m.linear_acceleration.x;
+    s.acc[1] = m.linear_acceleration.y;
+    s.acc[2] = m.linear_acceleration.z;
+    s.gyro[0] = m.angular_velocity.x;
+    s.gyro[1] = m.angular_velocity.y;
+    s.gyro[2] = m.angular_velocity.z;
+    memcpy(p, &s, sizeof(s));
+    pubs[SHM_IMU].publish(ts_us);
+}
+
+static void image(ShmStream stream, int64_t ts_us, uint64_t index, double expo, const cv::Mat &img)
+{
+    if (img.empty()) return;
+    const size_t row = img.cols * img.elemSize();
+    uint8_t *p = pubs[stream].reserve(sizeof(ShmImage) + row * img.rows);
+    if (!p) return;
+    ShmImage hd;
+    hd.width = img.cols;
+    hd.height = img.rows;
+    hd.bytes_per_pixel = (uint32_t)img.elemSize();
+    hd.reserved = 0;
+    hd.index = index;
+    hd.expo = expo;
+    memcpy(p, &hd, sizeof(hd));
+    p += sizeof(hd);
+    if (img.isContinuous()) {
+        memcpy(p, img.data, row * img.rows);
+    } else {
+        for (int r = 0; r < img.rows; r++, p += row)
+            memcpy(p, img.ptr(r), row);
+    }
+    pubs[stream].publish(ts_us);
+}
+
+void aps(uint64_t ts_us, uint64_t index, const cv::Mat &img)
+{
+    if (enabled()) image(SHM_APS, ts_us, index, 0, img);
+}
+
+void d435(const IRFrame &f)
+{
+    if (enabled()) image(SHM_D435, f.stamp, f.index, f.expo, f.image);
+}
+
+void printSummary()
+{
+    if (base.empty()) return;
+    printf("Live feed %s:", base.c_str());
+    for (int s = 0; s < SHM_STREAMS; s++) {
+        const ShmPublisher &p = pubs[s];
+        printf(" %s %lu (%.1f MB)", shmStreamName((ShmStream)s), p.published(), p.bytes() / 1e6);
+        if (p.tooLarge())
+            printf(" + %lu too large for the ring", p.tooLarge());
+        printf(s + 1 < SHM_STREAMS ? "," : "\n");
+    }
+}
+
+}
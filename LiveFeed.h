@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <opencv2/core/core.hpp>
+#include <sensor_msgs/Imu.h>
+
+#include "EventPool.h"
+#include "FrameEncoderPool.h"
+#include "ShmRing.h"
+
+// Live data for local processes (VIO, monitoring) while recording: every
+// event packet, IMU sample, APS frame and D435 infrared frame that goes to
+// disk is also published to a shared memory ring, see ShmRing.h:
+//
+//   /dev/shm/<name>.events   ShmEvents + ShmEvent[count]
+//   /dev/shm/<name>.imu      ShmImu
+//   /dev/shm/<name>.aps      ShmImage + mono16 pixels
+//   /dev/shm/<name>.d435     ShmImage + 8-bit infrared pixels
+//
+// Publishing is one copy into the ring on the capture thread that has the
+// data, no lock and no syscall unless a subscriber sleeps. Subscribers never
+// slow the capture down: the oldest records are overwritten, and they see
+// how many they missed. shm_subscriber is a sample reader.
+namespace live {
+
+// Creates the rings; ring_bytes each for events, APS and D435, IMU gets a
+// small one. name empty: live output is off and the calls below return at once.
+bool start(const std::string &name, size_t ring_bytes);
+// Removes the rings, after the capture threads are done.
+void stop();
+bool enabled();
+void printSummary();
+
+void events(const PooledEventArray &msg, uint64_t ts_us);
+void imu(const sensor_msgs::Imu &imu, uint64_t ts_us);
+void aps(uint64_t ts_us, uint64_t index, const cv::Mat &img);
+void d435(const IRFrame &f);
+
+}
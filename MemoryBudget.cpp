@@ -0,0 +1,321 @@
+#include "MemoryBudget.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "EventCodec.h"
+
+namespace membudget {
+
+using namespace std::chrono;
+
+// fraction of the budget at which each tier starts
+static const double TIER_AT[N_TIERS] = {0, 0.5, 0.7, 0.85, 1.0};
+static const double HYSTERESIS = 0.1;
+static const int PREVIEW_DECIMATE = 4;
+
+const char *tierName(int t)
+{
+    static const char *names[] = {"normal", "preview", "frames", "events", "over"};
+    return t >= 0 && t < N_TIERS ? names[t] : "?";
+}
+
+// consecutive shed items of one stream and reason
+struct Span {
+    int stream = 0;
+    const char *reason = "";
+    uint64_t first_us = 0, last_us = 0;
+    uint64_t items = 0, events = 0;
+};
+
+struct TierChange {
+    double sec;
+    int tier;
+    size_t bytes;
+};
+
+static Config cfg;
+static std::atomic_bool active{false};
+static std::atomic<int> cur_tier{NORMAL};
+static std::atomic<size_t> gauges[telemetry::N_STREAMS];
+static std::atomic<size_t> peak_bytes{0};
+static std::atomic<int> peak_tier{NORMAL};
+static std::atomic<uint64_t> preview_calls{0}, preview_skipped{0};
+static std::atomic<uint64_t> trimmed_bytes{0};
+static steady_clock::time_point t_start;
+
+// shedding itself is the slow path, one mutex is enough
+static std::mutex m_spans;
+static std::atomic_bool open_flag[telemetry::N_STREAMS];
+static Span open_spans[telemetry::N_STREAMS];
+static std::vector<Span> closed;
+static std::vector<TierChange> tier_changes;
+static uint64_t shed_items[telemetry::N_STREAMS], shed_events[telemetry::N_STREAMS];
+static uint64_t gaps_logged = 0;
+
+static FILE *log_fp = nullptr;
+static std::thread log_thread;
+static std::mutex m_log;
+static std::condition_variable log_cv;
+static bool stop_log = false;
+
+static void writeLog(const std::vector<Span> &spans, const std::vector<TierChange> &tiers)
+{
+    if (!log_fp) return;
+    for (const TierChange &t : tiers)
+        fprintf(log_fp, "tier %.3f %s %.1f\n", t.sec, tierName(t.tier), t.bytes / 1e6);
+    for (const Span &s : spans)
+        fprintf(log_fp, "%s %s %lu %lu %lu %lu\n", telemetry::streamName(s.stream), s.reason,
+            s.first_us, s.last_us, s.items, s.events);
+    if (!spans.empty() || !tiers.empty())
+        fflush(log_fp);
+}
+
+static void takeClosed(std::vector<Span> &spans, std::vector<TierChange> &tiers)
+{
+    std::lock_guard<std::mutex> lck(m_spans);
+    spans.swap(closed);
+    tiers.swap(tier_changes);
+}
+
+// the disk may be the slow part: only this thread writes the log
+static void logLoop()
+{
+    std::vector<Span> spans;
+    std::vector<TierChange> tiers;
+    std::unique_lock<std::mutex> lck(m_log);
+    while (!stop_log) {
+        log_cv.wait_for(lck, seconds(1));
+        lck.unlock();
+        takeClosed(spans, tiers);
+        writeLog(spans, tiers);
+        spans.clear();
+        tiers.clear();
+        lck.lock();
+    }
+}
+
+bool start(const std::string &log_path, const Config &c)
+{
+    cfg = c;
+    cfg.evt_decimate = std::max(cfg.evt_decimate, 2);
+    cfg.evt_roi_percent = std::min(std::max(cfg.evt_roi_percent, 1), 100);
+    for (int s = 0; s < telemetry::N_STREAMS; s++) {
+        gauges[s] = 0;
+        open_flag[s] = false;
+        shed_items[s] = shed_events[s] = 0;
+    }
+    closed.clear();
+    tier_changes.clear();
+    gaps_logged = 0;
+    cur_tier = NORMAL;
+    peak_tier = NORMAL;
+    peak_bytes = 0;
+    preview_calls = preview_skipped = 0;
+    trimmed_bytes = 0;
+    t_start = steady_clock::now();
+    active = cfg.budget_bytes > 0;
+    if (active)
+        printf("Memory budget: %lu MB for capture data in flight, events shed by %s\n",
+            cfg.budget_bytes >> 20, cfg.events.c_str());
+
+    if (log_path.empty()) return true;
+    log_fp = fopen(log_path.c_str(), "w");
+    if (!log_fp) {
+        printf(" * ERROR! cannot open %s\n", log_path.c_str());
+        return false;
+    }
+    fprintf(log_fp, "# <stream> <reason> <first_us> <last_us> <items> <events_dropped> | tier <sec> <tier> <MB in flight>\n");
+    stop_log = false;
+    log_thread = std::thread(logLoop);
+    return true;
+}
+
+void stop()
+{
+    if (log_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lck(m_log);
+            stop_log = true;
+        }
+        log_cv.notify_one();
+        log_thread.join();
+    }
+    std::vector<Span> spans;
+    std::vector<TierChange> tiers;
+    {
+        std::lock_guard<std::mutex> lck(m_spans);
+        for (int s = 0; s < telemetry::N_STREAMS; s++) {
+            if (!open_flag[s]) continue;
+            closed.push_back(open_spans[s]);
+            open_flag[s] = false;
+        }
+    }
+    takeClosed(spans, tiers);
+    writeLog(spans, tiers);
+    if (log_fp) fclose(log_fp);
+    log_fp = nullptr;
+    active = false;
+}
+
+size_t inFlightBytes()
+{
+    size_t n = BufferPool::global().inUse();
+    for (const auto &g : gauges)
+        n += g.load(std::memory_order_relaxed);
+    return n;
+}
+
+Tier tier()
+{
+    if (!active.load(std::memory_order_relaxed)) return NORMAL;
+    const size_t used = inFlightBytes();
+    const double f = (double)used / cfg.budget_bytes;
+    size_t peak = peak_bytes.load(std::memory_order_relaxed);
+    while (used > peak && !peak_bytes.compare_exchange_weak(peak, used, std::memory_order_relaxed)) {
+    }
+
+    int t = cur_tier.load(std::memory_order_relaxed);
+    int want = NORMAL;
+    while (want + 1 < N_TIERS && f >= TIER_AT[want + 1]) want++;
+    int next = t;
+    if (want > t)
+        next = want;
+    else
+        while (next > want && f < TIER_AT[next] - HYSTERESIS) next--;
+    if (next != t && cur_tier.compare_exchange_strong(t, next)) {
+        // idle pool blocks are memory too: keep in flight + cached within budget
+        const size_t room = used < cfg.budget_bytes ? cfg.budget_bytes - used : 0;
+        trimmed_bytes.fetch_add(BufferPool::global().trim(room), std::memory_order_relaxed);
+        int pt = peak_tier.load(std::memory_order_relaxed);
+        if (next > pt) peak_tier.store(next, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lck(m_spans);
+        tier_changes.push_back(TierChange{duration_cast<duration<double> >(steady_clock::now() - t_start).count(), next, used});
+        return (Tier)next;
+    }
+    return (Tier)cur_tier.load(std::memory_order_relaxed);
+}
+
+void setBytes(telemetry::Stream s, size_t bytes)
+{
+    gauges[s].store(bytes, std::memory_order_relaxed);
+}
+
+static void shed(telemetry::Stream s, const char *reason, uint64_t first_us, uint64_t last_us,
+                 uint64_t items, uint64_t events)
+{
+    std::lock_guard<std::mutex> lck(m_spans);
+    shed_items[s] += items;
+    shed_events[s] += events;
+    Span &o = open_spans[s];
+    if (open_flag[s] && strcmp(o.reason, reason) == 0) {
+        o.first_us = std::min(o.first_us, first_us);
+        o.last_us = std::max(o.last_us, last_us);
+        o.items += items;
+        o.events += events;
+        return;
+    }
+    if (open_flag[s]) closed.push_back(o);
+    o.stream = s;
+    o.reason = reason;
+    o.first_us = first_us;
+    o.last_us = last_us;
+    o.items = items;
+    o.events = events;
+    open_flag[s] = true;
+}
+
+// data of stream s flows normally again
+static void resume(telemetry::Stream s)
+{
+    if (!open_flag[s].load(std::memory_order_relaxed)) return;
+    std::lock_guard<std::mutex> lck(m_spans);
+    if (!open_flag[s]) return;
+    closed.push_back(open_spans[s]);
+    open_flag[s] = false;
+}
+
+bool keepPreview()
+{
+    if (tier() < PREVIEW) return true;
+    if (preview_calls.fetch_add(1, std::memory_order_relaxed) % PREVIEW_DECIMATE == 0) return true;
+    preview_skipped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+bool keepFrame(telemetry::Stream s, uint64_t ts_us)
+{
+    if (tier() < FRAMES) {
+        resume(s);
+        return true;
+    }
+    shed(s, "dropped", ts_us, ts_us, 1, 0);
+    return false;
+}
+
+bool admitEvents(PooledEventArray &msg)
+{
+    Tier t = tier();
+    if (t < EVENTS) {
+        resume(telemetry::EVENTS);
+        return true;
+    }
+    const size_t n = msg.events.size();
+    if (n == 0) return true;
+    const uint64_t first = timeToUs(msg.events[0].ts), last = timeToUs(msg.events[n - 1].ts);
+    if (t >= OVER) {
+        shed(telemetry::EVENTS, "dropped", first, last, 1, n);
+        return false;
+    }
+
+    size_t kept = 0;
+    if (cfg.events == "roi") {
+        const uint32_t w = msg.width * cfg.evt_roi_percent / 100, h = msg.height * cfg.evt_roi_percent / 100;
+        const uint32_t x0 = (msg.width - w) / 2, y0 = (msg.height - h) / 2;
+        for (size_t i = 0; i < n; i++) {
+            const PooledEvent &e = msg.events[i];
+            if (e.x - x0 < w && e.y - y0 < h)
+                msg.events[kept++] = e;
+        }
+    } else {
+        for (size_t i = 0; i < n; i += cfg.evt_decimate)
+            msg.events[kept++] = msg.events[i];
+    }
+    msg.events.resize(kept);
+    shed(telemetry::EVENTS, cfg.events == "roi" ? "roi" : "decimated", first, last, 1, n - kept);
+    return kept > 0;
+}
+
+void logGap(telemetry::Stream s, const char *reason, uint64_t first_us, uint64_t last_us, uint64_t items)
+{
+    std::lock_guard<std::mutex> lck(m_spans);
+    Span g;
+    g.stream = s;
+    g.reason = reason;
+    g.first_us = first_us;
+    g.last_us = last_us;
+    g.items = items;
+    closed.push_back(g);
+    gaps_logged += items;
+}
+
+void printSummary()
+{
+    if (cfg.budget_bytes == 0 && gaps_logged == 0) return;
+    std::lock_guard<std::mutex> lck(m_spans);
+    printf("Memory budget %lu MB: peak %.1f MB in flight, highest tier %s, %lu of %lu preview frames skipped, %.1f MB of pool cache freed\n",
+        cfg.budget_bytes >> 20, peak_bytes.load() / 1e6, tierName(peak_tier.load()),
+        preview_skipped.load(), preview_calls.load(), trimmed_bytes.load() / 1e6);
+    printf("Shed: %lu APS frames, %lu D435 frames, %lu event packets (%lu events); %lu items lost in queues or failed writes\n",
+        shed_items[telemetry::APS], shed_items[telemetry::D435], shed_items[telemetry::EVENTS],
+        shed_events[telemetry::EVENTS], gaps_logged);
+}
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "EventPool.h"
+#include "Telemetry.h"
+
+// Global budget for capture data in flight: pooled event packets and APS
+// frames (BufferPool::inUse) plus what the queues outside the pool report
+// (IMU, D435 frames). When the writers fall behind, load is shed in tiers:
+//
+//   preview  >= 50%   only every 4th preview frame is posted
+//   frames   >= 70%   APS and D435 frames are dropped
+//   events   >= 85%   event packets are thinned (every Nth event, or a
+//                     centred ROI)
+//   over     >= 100%  whole event packets are dropped
+//
+// IMU is never shed. A tier is left once usage falls 10% below it. On every
+// tier change the pool's free lists are trimmed so that in-flight plus
+// cached blocks fit the budget again. Every gap in the recorded data goes
+// to a side log as a span of sensor time:
+//
+//   <stream> <reason> <first_us> <last_us> <items> <events_dropped>
+//
+// plus a "tier" line per change. Spans are merged while shedding goes on
+// and written by a background thread, never by the capture threads.
+namespace membudget {
+
+enum Tier { NORMAL, PREVIEW, FRAMES, EVENTS, OVER, N_TIERS };
+
+const char *tierName(int t);
+
+struct Config {
+    size_t budget_bytes = 0;        // 0: no budget, nothing is shed
+    std::string events = "decimate"; // or "roi"
+    int evt_decimate = 4;           // keep every Nth event
+    int evt_roi_percent = 50;       // width and height of the kept centre
+};
+
+// log_path empty: no side log. Resets all counters.
+bool start(const std::string &log_path, const Config &cfg);
+void stop();
+void printSummary();
+
+size_t inFlightBytes();
+// Re-evaluates the tier against the current usage.
+Tier tier();
+// Bytes held outside BufferPool on behalf of stream s (a gauge).
+void setBytes(telemetry::Stream s, size_t bytes);
+
+// Capture threads ask before doing the work; false means skip it.
+bool keepPreview();
+bool keepFrame(telemetry::Stream s, uint64_t ts_us);
+// May thin msg in place; false: drop the whole packet.
+bool admitEvents(PooledEventArray &msg);
+// Data lost elsewhere (e.g. a queue overflow), between first_us and last_us.
+void logGap(telemetry::Stream s, const char *reason, uint64_t first_us, uint64_t last_us, uint64_t items);
+
+}
@@ -0,0 +1,64 @@
+#include "NoiseFilter.h"
+
+#include <algorithm>
+#include <cstdio>
+
+// low 32 bits of the event time in µs
+static inline uint32_t timeToUsLow(const ros::Time &t)
+{
+    return t.sec * 1000000u + t.nsec / 1000;
+}
+
+NoiseFilter::NoiseFilter(int width, int height, uint32_t window_us)
+    : width_(std::max(width, 1)), height_(std::max(height, 1)), stride_(width_ + 2),
+      window_us_(std::min<uint32_t>(std::max<uint32_t>(window_us, 1), 1u << 30)),
+      map_((size_t)(width_ + 2) * (height_ + 2), 0)
+{
+}
+
+size_t NoiseFilter::filter(PooledEventArray &msg)
+{
+    const size_t n = msg.events.size();
+    if (n == 0) return 0;
+    PooledEvent *ev = msg.events.data();
+    uint32_t *map = map_.data();
+    const int stride = stride_;
+    const uint32_t window = window_us_;
+
+    if (!primed_) {
+        // nothing has fired yet: every cell is a window in the past
+        std::fill(map_.begin(), map_.end(), (uint32_t)timeToUsLow(ev[0].ts) - window - 1);
+        primed_ = true;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        const PooledEvent e = ev[i];
+        if (e.x >= width_ || e.y >= height_) {
+            ev[kept++] = e;
+            continue;
+        }
+        const uint32_t t = timeToUsLow(e.ts);
+        uint32_t *c = map + (size_t)(e.y + 1) * stride + (e.x + 1);
+        // |t - *c| <= window; a neighbour a little ahead (events slightly
+        // out of order) counts as well
+        const bool support = t - *c + window <= 2 * window;
+        uint32_t *up = c - stride, *down = c + stride;
+        up[-1] = up[0] = up[1] = t;
+        c[-1] = c[1] = t;
+        down[-1] = down[0] = down[1] = t;
+        ev[kept] = e;
+        kept += support;
+    }
+    msg.events.resize(kept);
+    passed_ += kept;
+    dropped_ += n - kept;
+    return kept;
+}
+
+void NoiseFilter::printStats() const
+{
+    const uint64_t total = passed_ + dropped_;
+    printf("Noise filter (%u µs): %lu of %lu events passed (%.1f%%), %lu dropped\n",
+        window_us_, passed_, total, total ? 100.0 * passed_ / total : 0.0, dropped_);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "EventPool.h"
+
+// Background-activity filter: an event passes only if one of its 8
+// neighbours fired within window_us before it. Uncorrelated noise is
+// isolated in space and time and is dropped; edges of moving objects fire
+// neighbouring pixels together and pass. A pixel alone never supports
+// itself, so hot pixels are dropped too.
+//
+// Each event writes its timestamp into the 8 neighbour cells, so the check
+// is a single read of its own cell. The map is (width + 2) x (height + 2)
+// uint32 (342 KB at 320x264, L2 resident), with a border so that edge
+// pixels need no bounds checks; the 3x3 block touched per event spans three
+// rows of 3 consecutive cells.
+//
+// Timestamps are kept as the low 32 bits of µs: a pixel silent for a
+// multiple of 71.6 minutes could wrongly see support, once.
+class NoiseFilter
+{
+public:
+    NoiseFilter(int width, int height, uint32_t window_us);
+
+    // Compacts msg.events in place, returns the number kept. Events outside
+    // the sensor are kept as they are.
+    size_t filter(PooledEventArray &msg);
+
+    uint32_t windowUs() const { return window_us_; }
+    uint64_t passed() const { return passed_; }
+    uint64_t dropped() const { return dropped_; }
+    void printStats() const;
+
+private:
+    int width_, height_, stride_;
+    uint32_t window_us_;
+    std::vector<uint32_t> map_;
+    bool primed_ = false;
+    uint64_t passed_ = 0, dropped_ = 0;
+};
@@ -0,0 +1,146 @@
+#include "PixelMask.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+PixelMask::PixelMask(int width, int height)
+    : width_(std::max(width, 1)), height_(std::max(height, 1)),
+      bits_(((size_t)width_ * height_ + 63) / 64, ~0ull)
+{
+    // bits past the last pixel stay clear
+    const size_t n = (size_t)width_ * height_;
+    if (n % 64) bits_.back() = (1ull << (n % 64)) - 1;
+}
+
+void PixelMask::setRoi(int x0, int y0, int w, int h)
+{
+    for (int y = 0; y < height_; y++)
+        for (int x = 0; x < width_; x++)
+            if (x < x0 || x >= x0 + w || y < y0 || y >= y0 + h)
+                clear(x, y);
+}
+
+void PixelMask::clear(int x, int y)
+{
+    if ((unsigned)x >= (unsigned)width_ || (unsigned)y >= (unsigned)height_) return;
+    const size_t i = (size_t)y * width_ + x;
+    bits_[i >> 6] &= ~(1ull << (i & 63));
+}
+
+size_t PixelMask::cleared() const
+{
+    size_t set = 0;
+    for (uint64_t w : bits_)
+        set += __builtin_popcountll(w);
+    return (size_t)width_ * height_ - set;
+}
+
+size_t PixelMask::apply(EventSoA &soa)
+{
+    const size_t n = soa.size();
+    const uint64_t *bits = bits_.data();
+    const unsigned w = width_, h = height_;
+    uint64_t *ts = soa.ts_us.data();
+    uint16_t *xs = soa.x.data(), *ys = soa.y.data();
+    uint8_t *ps = soa.p.data();
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        const unsigned x = xs[i], y = ys[i];
+        const size_t b = (size_t)y * w + x;
+        const bool keep = x < w && y < h && ((bits[b >> 6] >> (b & 63)) & 1);
+        ts[kept] = ts[i];
+        xs[kept] = xs[i];
+        ys[kept] = ys[i];
+        ps[kept] = ps[i];
+        kept += keep;
+    }
+    soa.resize(kept);
+    passed_ += kept;
+    rejected_ += n - kept;
+    return kept;
+}
+
+bool parseRoi(const std::string &s, int &x0, int &y0, int &w, int &h)
+{
+    int v[4];
+    if (sscanf(s.c_str(), "%d,%d,%d,%d", &v[0], &v[1], &v[2], &v[3]) != 4 || v[2] <= 0 || v[3] <= 0)
+        return false;
+    x0 = v[0];
+    y0 = v[1];
+    w = v[2];
+    h = v[3];
+    return true;
+}
+
+bool loadHotPixels(const std::string &path, std::vector<HotPixel> &pixels)
+{
+    FILE *fp = fopen(path.c_str(), "r");
+    if (!fp) return false;
+    char line[256];
+    while (fgets(line, sizeof(line), fp)) {
+        char *c = strchr(line, '#');
+        if (c) *c = 0;
+        unsigned x, y;
+        unsigned long n = 0;
+        if (sscanf(line, "%u %u %lu", &x, &y, &n) >= 2)
+            pixels.push_back(HotPixel{(uint16_t)x, (uint16_t)y, n});
+    }
+    fclose(fp);
+    return true;
+}
+
+bool saveHotPixels(const std::string &path, const std::vector<HotPixel> &pixels,
+                   int width, int height, double seconds)
+{
+    FILE *fp = fopen(path.c_str(), "w");
+    if (!fp) return false;
+    fprintf(fp, "# %d %d %.1f\n", width, height, seconds);
+    fprintf(fp, "# <x> <y> <events while learning>\n");
+    for (const HotPixel &p : pixels)
+        fprintf(fp, "%u %u %lu\n", p.x, p.y, p.events);
+    fclose(fp);
+    return true;
+}
+
+HotPixelCalibrator::HotPixelCalibrator(int width, int height, double seconds, double factor)
+    : width_(std::max(width, 1)), height_(std::max(height, 1)), seconds_(seconds),
+      factor_(std::max(factor, 1.0)), counts_((size_t)width_ * height_, 0)
+{
+}
+
+bool HotPixelCalibrator::add(const EventSoA &soa)
+{
+    if (done_ || soa.size() == 0) return done_;
+    if (!started_) {
+        t0_us_ = soa.ts_us[0];
+        started_ = true;
+    }
+    const uint64_t end_us = t0_us_ + (uint64_t)(seconds_ * 1e6);
+    const size_t n = soa.size();
+    for (size_t i = 0; i < n; i++) {
+        if (soa.ts_us[i] >= end_us) {
+            finish();
+            return true;
+        }
+        const unsigned x = soa.x[i], y = soa.y[i];
+        if (x < (unsigned)width_ && y < (unsigned)height_) {
+            counts_[(size_t)y * width_ + x]++;
+            total_++;
+        }
+    }
+    return false;
+}
+
+void HotPixelCalibrator::finish()
+{
+    const double mean = (double)total_ / counts_.size();
+    const uint32_t thr = (uint32_t)std::max(factor_ * mean, 10.0);
+    for (size_t i = 0; i < counts_.size(); i++)
+        if (counts_[i] > thr)
+            hot_.push_back(HotPixel{(uint16_t)(i % width_), (uint16_t)(i / width_), counts_[i]});
+    std::sort(hot_.begin(), hot_.end(), [](const HotPixel &a, const HotPixel &b) { return a.events > b.events; });
+    counts_.clear();
+    counts_.shrink_to_fit();
+    done_ = true;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "EventConvert.h"
+
+// One bit per pixel, set = recorded. Starts with every pixel set; an ROI and
+// hot pixels clear bits. apply() runs on the SDK packet before any message
+// is built, one bit test per event. At 320x264 the mask is 10.6 KB.
+class PixelMask
+{
+public:
+    PixelMask(int width, int height);
+
+    // Clears everything outside [x0, x0 + w) x [y0, y0 + h).
+    void setRoi(int x0, int y0, int w, int h);
+    void clear(int x, int y);
+    bool test(int x, int y) const
+    {
+        if ((unsigned)x >= (unsigned)width_ || (unsigned)y >= (unsigned)height_) return false;
+        const size_t i = (size_t)y * width_ + x;
+        return (bits_[i >> 6] >> (i & 63)) & 1;
+    }
+    size_t cleared() const;
+
+    // Compacts soa to the events on set pixels, returns how many are left.
+    size_t apply(EventSoA &soa);
+
+    uint64_t passed() const { return passed_; }
+    uint64_t rejected() const { return rejected_; }
+
+private:
+    int width_, height_;
+    std::vector<uint64_t> bits_;
+    uint64_t passed_ = 0, rejected_ = 0;
+};
+
+// "x,y,w,h" -> ROI; false if malformed, the outputs are then left alone.
+bool parseRoi(const std::string &s, int &x0, int &y0, int &w, int &h);
+
+// Hot pixel list: "# <width> <height> <seconds>" then "<x> <y> <events>" per
+// line. Anything after '#' is a comment.
+struct HotPixel {
+    uint16_t x, y;
+    uint64_t events;    // seen while learning
+};
+bool loadHotPixels(const std::string &path, std::vector<HotPixel> &pixels);
+bool saveHotPixels(const std::string &path, const std::vector<HotPixel> &pixels,
+                   int width, int height, double seconds);
+
+// Counts events per pixel over the first `seconds` of event time. A pixel
+// firing at more than `factor` times the sensor's mean rate per pixel (and
+// at least 10 events) is hot. Learn on a static scene: pixels on the path of
+// a moving object fire a lot too.
+class HotPixelCalibrator
+{
+public:
+    HotPixelCalibrator(int width, int height, double seconds, double factor);
+
+    // True once the time is up; hot() is valid from then on.
+    bool add(const EventSoA &soa);
+    bool done() const { return done_; }
+    const std::vector<HotPixel> &hot() const { return hot_; }
+    double seconds() const { return seconds_; }
+
+private:
+    void finish();
+
+    int width_, height_;
+    double seconds_, factor_;
+    std::vector<uint32_t> counts_;
+    uint64_t total_ = 0;
+    uint64_t t0_us_ = 0;
+    bool started_ = false, done_ = false;
+    std::vector<HotPixel> hot_;
+};
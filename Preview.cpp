@@ -0,0 +1,73 @@
+#include "Preview.h"
+
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <opencv2/highgui/highgui.hpp>
+
+namespace {
+
+struct Mailbox {
+    cv::Mat img;
+    std::shared_ptr<const void> hold;
+    bool fresh = false;
+};
+
+std::mutex m_preview;
+std::map<std::string, Mailbox> mailboxes;
+
+}
+
+void previewPost(const std::string &window, const cv::Mat &img)
+{
+    previewPost(window, img, nullptr);
+}
+
+void previewPost(const std::string &window, const cv::Mat &img, std::shared_ptr<const void> hold)
+{
+    std::shared_ptr<const void> old;
+    {
+        std::lock_guard<std::mutex> lck(m_preview);
+        Mailbox &mb = mailboxes[window];
+        mb.img = img;
+        old.swap(mb.hold);
+        mb.hold = std::move(hold);
+        mb.fresh = true;
+    }
+    // the replaced frame may be the last reference, free it outside the lock
+}
+
+int previewSpinOnce(int wait_ms)
+{
+    std::map<std::string, cv::Mat> show;
+    std::vector<std::shared_ptr<const void> > holds;  // until imshow has copied
+    bool any_window;
+    {
+        std::lock_guard<std::mutex> lck(m_preview);
+        any_window = !mailboxes.empty();
+        for (auto &kv : mailboxes) {
+            if (!kv.second.fresh) continue;
+            show[kv.first] = kv.second.img;
+            holds.push_back(kv.second.hold);
+            kv.second.fresh = false;
+        }
+    }
+    if (!any_window) {
+        // nothing shown yet, waitKey would return at once
+        std::this_thread::sleep_for(std::chrono::milliseconds(wait_ms));
+        return -1;
+    }
+    for (auto &kv : show)
+        cv::imshow(kv.first, kv.second);
+    return cv::waitKey(wait_ms);
+}
+
+void previewClose()
+{
+    {
+        std::lock_guard<std::mutex> lck(m_preview);
+        mailboxes.clear();
+    }
+    cv::destroyAllWindows();
+}
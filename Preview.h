@@ -0,0 +1,18 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <opencv2/core/core.hpp>
+
+// Latest-frame mailbox per window. Capture threads post frames without ever
+// touching HighGUI; the UI thread shows them from previewSpinOnce().
+void previewPost(const std::string &window, const cv::Mat &img);
+// Same for a Mat over memory owned elsewhere: `hold` keeps it alive until
+// the frame has been replaced, so nothing is copied.
+void previewPost(const std::string &window, const cv::Mat &img, std::shared_ptr<const void> hold);
+
+// Shows frames posted since the last call and pumps the GUI for wait_ms.
+// Returns the key pressed, or -1.
+int previewSpinOnce(int wait_ms);
+
+void previewClose();
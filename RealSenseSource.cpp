@@ -0,0 +1,78 @@
+#include "RealSenseSource.h"
+
+#include <iostream>
+
+using namespace std;
+
+bool RealSenseSource::start()
+{
+    // came init
+    rs2::config cfg;
+    if (depth_)
+        cfg.enable_stream(RS2_STREAM_DEPTH);
+    cfg.enable_stream(RS2_STREAM_INFRARED);
+    rs2::pipeline_profile profile;
+    try {
+        profile = pipe_.start(cfg);
+    } catch (const rs2::error &e) {
+        printf(" * ERROR! cannot start D435: %s\n", e.what());
+        return false;
+    }
+    started_ = true;
+    rs2::device dev = profile.get_device();
+    auto sensors = dev.query_sensors();
+    auto stereo = sensors[0];
+    // 自动曝光
+    stereo.set_option(rs2_option::RS2_OPTION_ENABLE_AUTO_EXPOSURE, 1);
+    stereo.set_option(rs2_option::RS2_OPTION_EMITTER_ENABLED, 0);
+
+	// get intrinsic
+	// 425.061 425.061 424.694 244.09
+	cout << "D435 intrinsic (fx, fy, cx, cy): " ;
+	auto const K = pipe_.get_active_profile().get_stream(RS2_STREAM_INFRARED).as<rs2::video_stream_profile>().get_intrinsics();
+	cout << K.fx << " " << K.fy << " " << K.ppx << " " << K.ppy << endl;
+    if (depth_) {
+        depth_scale_ = dev.first<rs2::depth_sensor>().get_depth_scale();
+        printf("D435 depth scale: %g m/unit\n", depth_scale_);
+    }
+    return true;
+}
+
+void RealSenseSource::stop()
+{
+    if (started_) pipe_.stop();
+    started_ = false;
+}
+
+bool RealSenseSource::next(IRFrame &f, unsigned long long &frame_number)
+{
+    // get image
+    rs2::frameset data;
+    if (!pipe_.try_wait_for_frames(&data, 1000)) // Wait for next set of frames from the camera
+        return false;
+    rs2::frame infrared = data.get_infrared_frame();
+    const int w = infrared.as<rs2::video_frame>().get_width();
+    const int h = infrared.as<rs2::video_frame>().get_height();
+    frame_number = infrared.get_frame_number();
+
+    // get expo and stamp
+    f.expo = 0;
+    try{
+        f.expo = infrared.get_frame_metadata(rs2_frame_metadata_value::RS2_FRAME_METADATA_ACTUAL_EXPOSURE) / 1000.0;
+    }
+    catch (std::exception &e){
+        cout << e.what() << endl;
+    }
+    f.stamp = infrared.get_frame_metadata(rs2_frame_metadata_value::RS2_FRAME_METADATA_FRAME_TIMESTAMP);
+
+    // keep a reference to the frames, the pools encode them without a copy
+    f.hold = std::make_shared<rs2::frameset>(data);
+    f.image = cv::Mat(cv::Size(w, h), CV_8UC1, (void *)infrared.get_data(), cv::Mat::AUTO_STEP);
+    if (depth_) {
+        rs2::depth_frame depth = data.get_depth_frame();
+        if (depth)
+            f.depth = cv::Mat(cv::Size(depth.get_width(), depth.get_height()), CV_16UC1,
+                (void *)depth.get_data(), cv::Mat::AUTO_STEP);
+    }
+    return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <librealsense2/rs.hpp>
+
+#include "CaptureSource.h"
+
+// D435 infrared stream (auto exposure, emitter off), plus the depth stream
+// only if asked for: it costs USB bandwidth and librealsense processing.
+class RealSenseSource : public D435Source
+{
+public:
+    explicit RealSenseSource(bool depth = false) : depth_(depth) {}
+    bool start() override;
+    void stop() override;
+    bool next(IRFrame &f, unsigned long long &frame_number) override;
+    double depthScale() const override { return depth_scale_; }
+
+private:
+    rs2::pipeline pipe_;
+    bool depth_;
+    double depth_scale_ = 0.001;
+    bool started_ = false;
+};
@@ -0,0 +1,667 @@
+#include "ReplaySource.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+#include <sensor_msgs/Imu.h>
+
+#include "CompressedBag.h"
+#include "Crc32.h"
+#include "DvsBagReader.h"
+#include "EventCodec.h"
+#include "Segments.h"
+#include "Telemetry.h"
+#include "ThreadAffinity.h"
+
+using namespace std::chrono;
+typedef ReplayDvsSource::Message Message;
+
+// The writer batches messages a topic at a time, so the file is only in
+// time order to within its queue; this much sensor time is read ahead and
+// put back in order.
+static const uint64_t REORDER_US = 500000;
+static const size_t EVENT_WIRE_BYTES = 13;
+// longest sleep, so stop() is not held up by a gap in the recording
+static const milliseconds MAX_SLEEP(50);
+
+template <class T>
+static T load(const uint8_t *p)
+{
+    T v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static bool exists(const std::string &path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+static bool endsWith(const std::string &s, const char *suffix)
+{
+    const size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+static uint64_t wireTimeUs(const uint8_t *p)
+{
+    return (uint64_t)load<uint32_t>(p) * 1000000 + load<uint32_t>(p + 4) / 1000;
+}
+
+static double msSince(steady_clock::time_point t)
+{
+    return duration<double, std::milli>(steady_clock::now() - t).count();
+}
+
+// when the message was handed over live: an event packet after its last event
+static void setDue(Message &m)
+{
+    if (m.kind == ReplayDvsSource::EVENTS && m.count)
+        m.at_us = wireTimeUs(m.data + (m.count - 1) * EVENT_WIRE_BYTES + 4);
+    else
+        m.at_us = timeToUs(m.stamp);
+}
+
+static int kindOf(const std::string &topic)
+{
+    if (topic == "/dvs/events") return ReplayDvsSource::EVENTS;
+    if (topic == "/dvs/imu") return ReplayDvsSource::IMU;
+    if (topic == "/dvs/image_raw") return ReplayDvsSource::IMAGE;
+    return -1;
+}
+
+// serialized dvs_msgs/EventArray: header (seq, stamp, frame_id), height,
+// width, then the events on the wire
+static bool parseEventArray(Message &m)
+{
+    const uint8_t *p = m.data;
+    const uint64_t len = m.size;
+    if (len < 16) return false;
+    m.stamp = ros::Time(load<uint32_t>(p + 4), load<uint32_t>(p + 8));
+    uint64_t pos = 16 + (uint64_t)load<uint32_t>(p + 12);
+    if (pos + 12 > len) return false;
+    m.height = (uint16_t)load<uint32_t>(p + pos);
+    m.width = (uint16_t)load<uint32_t>(p + pos + 4);
+    m.count = load<uint32_t>(p + pos + 8);
+    pos += 12;
+    if ((uint64_t)m.count * EVENT_WIRE_BYTES > len - pos) return false;
+    m.data = p + pos;
+    m.size = m.count * EVENT_WIRE_BYTES;
+    return true;
+}
+
+class ReplayDvsSource::Reader
+{
+public:
+    virtual ~Reader() {}
+    virtual bool open(const std::string &path) = 0;
+    // the next message of a known topic, in file order
+    virtual bool next(Message &m) = 0;
+    uint64_t skipped = 0;
+};
+
+// <prefix>-dvs.bag, read in place through its index
+class BagMessages : public ReplayDvsSource::Reader
+{
+public:
+    bool open(const std::string &path) override
+    {
+        if (!bag_.open(path)) {
+            printf(" * ERROR! %s\n", bag_.error().c_str());
+            return false;
+        }
+        topics_[ReplayDvsSource::EVENTS] = bag_.topic("/dvs/events");
+        topics_[ReplayDvsSource::IMU] = bag_.topic("/dvs/imu");
+        topics_[ReplayDvsSource::IMAGE] = bag_.topic("/dvs/image_raw");
+        return true;
+    }
+
+    bool next(Message &m) override
+    {
+        for (;;) {
+            // topics interleave in the file; take whichever comes first
+            int k = -1;
+            for (int i = 0; i < 3; i++) {
+                if (!topics_[i] || pos_[i] >= topics_[i]->entries.size()) continue;
+                if (k < 0 || topics_[i]->entries[pos_[i]].offset < topics_[k]->entries[pos_[k]].offset)
+                    k = i;
+            }
+            if (k < 0) return false;
+            const DvsBagReader::Topic &t = *topics_[k];
+            const size_t i = pos_[k]++;
+            const BagIndexEntry &e = t.entries[i];
+            m.kind = (ReplayDvsSource::Kind)k;
+            m.own.clear();
+            if (k == ReplayDvsSource::EVENTS) {
+                m.data = bag_.eventData(t, i);
+                m.count = e.count;
+                m.size = e.count * EVENT_WIRE_BYTES;
+                m.width = t.width;
+                m.height = t.height;
+                // stamped with the first event, as SeesSource does
+                m.stamp = e.count ? ros::Time(load<uint32_t>(m.data + 4), load<uint32_t>(m.data + 8))
+                                  : usToTime(e.first_us);
+            } else {
+                // BagWriter records with the header stamp
+                m.count = 1;
+                m.data = bag_.payload(t, i, m.size);
+                m.stamp = usToTime(e.first_us);
+                if (!m.data) {
+                    skipped++;
+                    continue;
+                }
+            }
+            setDue(m);
+            return true;
+        }
+    }
+
+private:
+    DvsBagReader bag_;
+    const DvsBagReader::Topic *topics_[3] = {};
+    size_t pos_[3] = {};
+};
+
+// <prefix>-dvs.bagz (or a .journal left by a crash), chunk by chunk
+class BagzMessages : public ReplayDvsSource::Reader
+{
+public:
+    bool open(const std::string &path) override
+    {
+        if (!bag_.open(path)) {
+            printf(" * ERROR! cannot read %s\n", path.c_str());
+            return false;
+        }
+        if (bag_.recovered())
+            printf(" * WARNING! %s has no index (not closed), replaying what is readable\n", path.c_str());
+        return true;
+    }
+
+    bool next(Message &m) override
+    {
+        CompressedBagReader::Message msg;
+        while (bag_.next(msg)) {
+            const auto &conns = bag_.connections();
+            const int k = msg.conn < conns.size() ? kindOf(conns[msg.conn].topic) : -1;
+            if (k < 0) {
+                skipped++;
+                continue;
+            }
+            // the chunk buffer is reused by the next call
+            m.kind = (ReplayDvsSource::Kind)k;
+            m.own.assign(msg.data, msg.data + msg.size);
+            m.data = m.own.data();
+            m.size = msg.size;
+            m.count = 1;
+            m.stamp = msg.stamp;
+            if (k == ReplayDvsSource::EVENTS && !parseEventArray(m)) {
+                skipped++;
+                continue;
+            }
+            setDue(m);
+            return true;
+        }
+        if (bag_.error())
+            printf(" * WARNING! damaged chunk, the rest of the file is skipped\n");
+        return false;
+    }
+
+private:
+    CompressedBagReader bag_;
+};
+
+steady_clock::time_point ReplayClock::at(uint64_t since_first_us)
+{
+    std::call_once(started_, [this] { t0_ = steady_clock::now(); });
+    if (speed_ <= 0) return steady_clock::now();
+    return t0_ + microseconds((int64_t)(since_first_us / speed_));
+}
+
+static void addDigest(ReplayStats &st, uint32_t kind, uint64_t at_us, uint64_t size)
+{
+    uint8_t b[20];
+    memcpy(b, &kind, 4);
+    memcpy(b + 4, &at_us, 8);
+    memcpy(b + 12, &size, 8);
+    st.digest = crc32(b, sizeof(b), st.digest);
+}
+
+// min-heap on (at_us, file order)
+static bool later(const Message &a, const Message &b)
+{
+    return a.at_us != b.at_us ? a.at_us > b.at_us : a.order > b.order;
+}
+
+ReplayDvsSource::ReplayDvsSource(const std::string &prefix, ReplayClock &clock)
+    : prefix_(prefix), clock_(clock)
+{
+}
+
+ReplayDvsSource::~ReplayDvsSource()
+{
+    stop();
+}
+
+bool ReplayDvsSource::open()
+{
+    // a file of a session may be given instead of its prefix
+    const std::string base = prefix_ + "-dvs";
+    std::string manifest;
+    if (endsWith(prefix_, ".manifest") && exists(prefix_))
+        manifest = prefix_;
+    else if (exists(base + ".manifest"))
+        manifest = base + ".manifest";
+    if (!manifest.empty()) {
+        std::vector<SegmentInfo> segments;
+        if (!readManifest(manifest, segments)) {
+            printf(" * ERROR! cannot read %s\n", manifest.c_str());
+            return false;
+        }
+        for (const SegmentInfo &s : segments)
+            for (const std::string &f : s.files)
+                if (endsWith(f, ".bag") || endsWith(f, ".bagz"))
+                    files_.push_back(f);
+        path_ = manifest;
+    } else if ((endsWith(prefix_, ".bag") || endsWith(prefix_, ".bagz") || endsWith(prefix_, ".journal")) &&
+               exists(prefix_)) {
+        files_.push_back(prefix_);
+    } else if (exists(base + ".bagz")) {
+        files_.push_back(base + ".bagz");
+    } else if (exists(base + ".bag")) {
+        files_.push_back(base + ".bag");
+    } else if (exists(base + ".bag.journal")) {
+        // journal of a bag left open by a crash
+        files_.push_back(base + ".bag.journal");
+    }
+    if (files_.empty()) return false;
+    if (path_.empty()) path_ = files_[0];
+
+    readers_.resize(files_.size());
+    queued_.assign(files_.size(), 0);
+    file_ = 0;
+    while (!openFile(file_) && file_ + 1 < files_.size())
+        file_++;
+    if (!readers_[file_]) return false;
+    // the sensor size comes with the first event packet
+    while (width_ == 0 && heap_.size() < 10000 && fill())
+        ;
+    if (width_ == 0)
+        printf(" * WARNING! no /dvs/events in %s (written to .evb/.evc?), replaying IMU and APS only\n",
+            path_.c_str());
+    return true;
+}
+
+bool ReplayDvsSource::openFile(size_t i)
+{
+    const std::string &f = files_[i];
+    std::unique_ptr<Reader> &r = readers_[i];
+    if (endsWith(f, ".bag"))
+        r.reset(new BagMessages);
+    else
+        r.reset(new BagzMessages);
+    if (r->open(f)) return true;
+    r.reset();
+    return false;
+}
+
+bool ReplayDvsSource::nextMessage(Message &m)
+{
+    for (;;) {
+        Reader *r = readers_[file_].get();
+        if (r && r->next(m)) {
+            m.file = (uint32_t)file_;
+            return true;
+        }
+        if (r) {
+            std::lock_guard<std::mutex> lck(m_stats_);
+            skipped_ += r->skipped;
+            r->skipped = 0;
+        }
+        if (file_ + 1 >= files_.size()) return false;
+        // its data is in use until the queued messages are delivered
+        if (queued_[file_] == 0) readers_[file_].reset();
+        openFile(++file_);
+    }
+}
+
+bool ReplayDvsSource::fill()
+{
+    Message m;
+    if (!nextMessage(m)) return false;
+    m.order = order_++;
+    queued_[m.file]++;
+    newest_ = std::max(newest_, m.at_us);
+    if (m.kind == EVENTS && width_ == 0) {
+        width_ = m.width;
+        height_ = m.height;
+    }
+    heap_.push_back(std::move(m));
+    std::push_heap(heap_.begin(), heap_.end(), later);
+    return true;
+}
+
+bool ReplayDvsSource::start(DvsHandler *handler)
+{
+    handler_ = handler;
+    stop_ = false;
+    thread_ = std::thread(&ReplayDvsSource::run, this);
+    if (clock_.speed() > 0)
+        printf("Replaying %s at %gx\n", path_.c_str(), clock_.speed());
+    else
+        printf("Replaying %s at full speed\n", path_.c_str());
+    return true;
+}
+
+void ReplayDvsSource::stop()
+{
+    stop_ = true;
+    if (thread_.joinable()) thread_.join();
+}
+
+void ReplayDvsSource::run()
+{
+    applyThreadRole(ThreadRole::SdkCallback);
+    bool eof = false, any = false;
+    uint64_t first = 0, last = 0;
+    while (!stop_) {
+        while (!eof && (heap_.empty() || heap_.front().at_us + REORDER_US > newest_))
+            eof = !fill();
+        if (heap_.empty()) {
+            finished_.store(true, std::memory_order_release);
+            // idle like a device with nothing to send, until stop()
+            while (!stop_)
+                std::this_thread::sleep_for(MAX_SLEEP);
+            break;
+        }
+        std::pop_heap(heap_.begin(), heap_.end(), later);
+        Message m = std::move(heap_.back());
+        heap_.pop_back();
+        const bool release = --queued_[m.file] == 0 && (m.file < file_ || eof);
+        if (!any) {
+            any = true;
+            first = last = m.at_us;
+            t_first_ = steady_clock::now();
+        }
+
+        const steady_clock::time_point due = clock_.at(m.at_us > first ? m.at_us - first : 0);
+        for (steady_clock::time_point now = steady_clock::now(); now < due && !stop_; now = steady_clock::now())
+            std::this_thread::sleep_for(std::min<steady_clock::duration>(due - now, MAX_SLEEP));
+        if (stop_) break;
+        const double behind = clock_.speed() > 0 ? msSince(due) : 0;
+        const bool ok = deliver(m);
+        if (release) readers_[m.file].reset();
+
+        std::lock_guard<std::mutex> lck(m_stats_);
+        if (!ok) {
+            stats_.skipped++;
+            continue;
+        }
+        if (stats_.delivered == 0) stats_.first_us = m.at_us;
+        stats_.delivered++;
+        if (m.at_us < last) stats_.late++;
+        last = std::max(last, m.at_us);
+        stats_.last_us = last;
+        stats_.wall_sec = msSince(t_first_) / 1000;
+        stats_.max_behind_ms = std::max(stats_.max_behind_ms, behind);
+        addDigest(stats_, m.kind, m.at_us, m.kind == EVENTS ? m.count : m.size);
+    }
+}
+
+bool ReplayDvsSource::deliver(const Message &m)
+{
+    try {
+        switch (m.kind) {
+        case EVENTS: {
+            soa_.resize(m.count);
+            const uint8_t *p = m.data;
+            for (uint32_t i = 0; i < m.count; i++, p += EVENT_WIRE_BYTES) {
+                soa_.x[i] = load<uint16_t>(p);
+                soa_.y[i] = load<uint16_t>(p + 2);
+                soa_.ts_us[i] = wireTimeUs(p + 4);
+                soa_.p[i] = p[12];
+            }
+            telemetry::latency(telemetry::EVENTS, telemetry::CALLBACK, timeToUs(m.stamp));
+            PooledEventArray msg;
+            msg.header.stamp = m.stamp;
+            msg.height = m.height;
+            msg.width = m.width;
+            handler_->onRawEvents(soa_, m.width, m.height);
+            if (soa_.size() == 0) return true;
+            msg.events.resize(soa_.size());
+            convertEvents(soa_, msg.events.data());
+            handler_->onEvents(std::move(msg));
+            return true;
+        }
+        case IMU: {
+            sensor_msgs::Imu imu;
+            ros::serialization::IStream s(const_cast<uint8_t *>(m.data), m.size);
+            ros::serialization::deserialize(s, imu);
+            telemetry::latency(telemetry::IMU, telemetry::CALLBACK, timeToUs(imu.header.stamp));
+            handler_->onImu(std::move(imu));
+            return true;
+        }
+        case IMAGE: {
+            ros::serialization::IStream s(const_cast<uint8_t *>(m.data), m.size);
+            ros::serialization::deserialize(s, image_);
+            if (image_.encoding != "mono16" || image_.step < image_.width * 2 ||
+                image_.data.size() < (size_t)image_.step * image_.height)
+                return false;
+            const uint64_t ts = timeToUs(image_.header.stamp);
+            const cv::Mat img(image_.height, image_.width, CV_16UC1, image_.data.data(), image_.step);
+            telemetry::latency(telemetry::APS, telemetry::CALLBACK, ts);
+            handler_->onFrame(ts, img);
+            return true;
+        }
+        }
+    } catch (const std::exception &) {
+        // truncated message
+    }
+    return false;
+}
+
+ReplayStats ReplayDvsSource::stats() const
+{
+    std::lock_guard<std::mutex> lck(m_stats_);
+    ReplayStats st = stats_;
+    st.skipped += skipped_;
+    return st;
+}
+
+ReplayD435Source::ReplayD435Source(const std::string &prefix, ReplayClock &clock)
+    : prefix_(prefix), clock_(clock)
+{
+}
+
+ReplayD435Source::~ReplayD435Source()
+{
+    if (time_fp_) fclose(time_fp_);
+}
+
+// D435_ir.manifest (segments) or D435_ir.frames in dir
+static bool containerFiles(const std::string &dir, const std::string &name, std::vector<std::string> &files,
+                           std::string &path)
+{
+    const std::string manifest = dir + "/" + name + ".manifest";
+    path = manifest;
+    if (exists(manifest)) {
+        std::vector<SegmentInfo> segments;
+        if (readManifest(manifest, segments))
+            for (const SegmentInfo &s : segments)
+                files.insert(files.end(), s.files.begin(), s.files.end());
+        return !files.empty();
+    }
+    if (exists(dir + "/" + name + ".frames")) {
+        path = dir + "/" + name + ".frames";
+        files.push_back(path);
+        return true;
+    }
+    return false;
+}
+
+bool ReplayD435Source::open()
+{
+    const std::string &dir = prefix_;
+    container_ = containerFiles(dir, "D435_ir", ir_.files, path_);
+    if (!container_) {
+        path_ = dir + "/D435_time.txt";
+        time_fp_ = fopen(path_.c_str(), "r");
+        if (!time_fp_) return false;
+        img_dir_ = dir + "/D435_Img";
+    }
+    std::string depth_path;
+    have_depth_ = containerFiles(dir, "D435_depth", depth_.files, depth_path);
+    if (have_depth_) {
+        FILE *fp = fopen((dir + "/D435_depth_time.txt").c_str(), "r");
+        char line[128];
+        if (fp && fgets(line, sizeof(line), fp))
+            sscanf(line, "# depth_scale %lf", &depth_scale_);
+        if (fp) fclose(fp);
+    }
+    return true;
+}
+
+bool ReplayD435Source::start()
+{
+    printf("Replaying %s%s\n", path_.c_str(), have_depth_ ? " with depth" : "");
+    return true;
+}
+
+bool ReplayD435Source::Frames::read(FrameRecordHeader &hd, cv::Mat &img)
+{
+    for (;;) {
+        if (!opened) {
+            if (file >= files.size()) return false;
+            if (!reader.open(files[file])) {
+                printf(" * WARNING! cannot read %s, skipped\n", files[file].c_str());
+                file++;
+                continue;
+            }
+            opened = true;
+            i = 0;
+        }
+        if (i < reader.size()) {
+            if (reader.read(i++, hd, img)) return true;
+            bad++;
+            continue;
+        }
+        reader.close();
+        opened = false;
+        file++;
+    }
+}
+
+bool ReplayD435Source::readIr(IRFrame &f)
+{
+    FrameRecordHeader hd;
+    if (!ir_.read(hd, f.image)) return false;
+    f.stamp = hd.stamp;
+    f.expo = hd.expo;
+    return true;
+}
+
+bool ReplayD435Source::readPng(IRFrame &f)
+{
+    char line[256];
+    while (fgets(line, sizeof(line), time_fp_)) {
+        unsigned long idx = 0;
+        long long stamp = 0;
+        double expo = 0;
+        if (line[0] == '#' || sscanf(line, "%lu %lld %lf", &idx, &stamp, &expo) != 3) continue;
+        char name[32];
+        sprintf(name, "/%05lu.png", idx);
+        // D435_Img/, or with rotation D435_Img.0000/, .0001/ ... in turn
+        f.image = cv::imread(segmentPath(img_dir_, img_segment_) + name, cv::IMREAD_UNCHANGED);
+        if (f.image.empty()) {
+            f.image = cv::imread(segmentPath(img_dir_, img_segment_ + 1) + name, cv::IMREAD_UNCHANGED);
+            if (!f.image.empty()) img_segment_++;
+        }
+        if (f.image.empty()) {
+            png_missing_++;
+            continue;
+        }
+        f.stamp = stamp;
+        f.expo = expo;
+        return true;
+    }
+    return false;
+}
+
+void ReplayD435Source::attachDepth(IRFrame &f)
+{
+    while (have_depth_) {
+        if (!depth_pending_) {
+            depth_img_ = cv::Mat();     // the last one may still be queued for writing
+            if (!depth_.read(depth_hd_, depth_img_)) {
+                have_depth_ = false;
+                return;
+            }
+            depth_pending_ = true;
+        }
+        // depth of a frame that was dropped before writing
+        if (depth_hd_.stamp < f.stamp) {
+            depth_pending_ = false;
+            continue;
+        }
+        if (depth_hd_.stamp == f.stamp) {
+            f.depth = depth_img_;
+            depth_pending_ = false;
+        }
+        return;
+    }
+}
+
+bool ReplayD435Source::next(IRFrame &f, unsigned long long &frame_number)
+{
+    if (finished()) {
+        // D435Main polls until shutdown
+        std::this_thread::sleep_for(milliseconds(10));
+        return false;
+    }
+    if (!(container_ ? readIr(f) : readPng(f))) {
+        std::lock_guard<std::mutex> lck(m_stats_);
+        stats_.skipped = ir_.bad + depth_.bad + png_missing_;
+        finished_.store(true, std::memory_order_release);
+        return false;
+    }
+    attachDepth(f);
+    if (first_stamp_ < 0) {
+        first_stamp_ = f.stamp;
+        t_first_ = steady_clock::now();
+    }
+    const long long since = f.stamp > first_stamp_ ? f.stamp - first_stamp_ : 0;
+    const steady_clock::time_point due = clock_.at((uint64_t)since);
+    std::this_thread::sleep_until(due);
+    const double behind = clock_.speed() > 0 ? msSince(due) : 0;
+    frame_number = ++fn_;
+
+    std::lock_guard<std::mutex> lck(m_stats_);
+    const uint64_t ts = (uint64_t)f.stamp;
+    if (stats_.delivered == 0) stats_.first_us = stats_.last_us = ts;
+    stats_.delivered++;
+    if (ts < stats_.last_us) stats_.late++;
+    stats_.last_us = std::max(stats_.last_us, ts);
+    stats_.wall_sec = msSince(t_first_) / 1000;
+    stats_.max_behind_ms = std::max(stats_.max_behind_ms, behind);
+    stats_.skipped = ir_.bad + depth_.bad + png_missing_;
+    addDigest(stats_, f.depth.empty() ? 0 : 1, ts, (uint64_t)f.image.rows * f.image.cols);
+    return true;
+}
+
+ReplayStats ReplayD435Source::stats() const
+{
+    std::lock_guard<std::mutex> lck(m_stats_);
+    return stats_;
+}
+
+void printReplayStats(const char *what, const std::string &path, const ReplayStats &st)
+{
+    const double span = st.last_us > st.first_us ? (st.last_us - st.first_us) / 1e6 : 0;
+    printf("Replay %s %s: %lu delivered, %.1f s of recording in %.1f s (%.2fx), %lu out of order, "
+           "%lu skipped, at most %.1f ms behind, digest %08x\n",
+        what, path.c_str(), st.delivered, span, st.wall_sec, st.wall_sec > 0 ? span / st.wall_sec : 0,
+        st.late, st.skipped, st.max_behind_ms, st.digest);
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sensor_msgs/Image.h>
+
+#include "CaptureSource.h"
+#include "EventConvert.h"
+#include "FrameContainer.h"
+
+// Replay of a recorded session through the live capture path, for profiling
+// and regression tests without devices. `prefix` is what a capture wrote,
+// "Capture-<ts>":
+//
+//   DVS   <prefix>-dvs.bag, -dvs.bagz or -dvs.manifest (segments of either),
+//         else the -dvs.bag.journal of a crashed capture; or one such file
+//   D435  <prefix>/D435_ir.frames or D435_ir.manifest, else D435_time.txt
+//         with D435_Img/ (or D435_Img.0000/ ...); D435_depth.frames or
+//         D435_depth.manifest if present
+//
+// Every recorded message goes to the handler as it went in live: event
+// packets with their recorded boundaries (through onRawEvents, so the pixel
+// mask and noise filter run again), IMU samples and APS frames, all from
+// one thread in sensor time order, each when the time since the first one
+// has passed at `speed`. speed 0 is as fast as the pipeline takes it. The
+// DVS and D435 streams have different clocks; they are aligned at their
+// first items. The same recording and speed always give the same calls in
+// the same order; ReplayStats::digest sums them up for comparing runs.
+
+// Wall time origin shared by the DVS and D435 replay.
+class ReplayClock
+{
+public:
+    explicit ReplayClock(double speed) : speed_(speed) {}
+    double speed() const { return speed_; }
+    // When an item `since_first_us` of recorded time after the first one of
+    // its stream is due; the first call of either stream starts the clock.
+    // Always now at speed 0.
+    std::chrono::steady_clock::time_point at(uint64_t since_first_us);
+
+private:
+    double speed_;
+    std::once_flag started_;
+    std::chrono::steady_clock::time_point t0_;
+};
+
+struct ReplayStats {
+    uint64_t delivered = 0;     // handler calls
+    uint64_t late = 0;          // found behind the reorder window, sent out of order
+    uint64_t skipped = 0;       // unreadable or of an unknown topic
+    uint64_t first_us = 0, last_us = 0;
+    double wall_sec = 0;
+    double max_behind_ms = 0;   // worst delay behind the recorded timing
+    uint32_t digest = 0;        // CRC of what was delivered, in order
+};
+
+class ReplayDvsSource : public DvsSource
+{
+public:
+    ReplayDvsSource(const std::string &prefix, ReplayClock &clock);
+    ~ReplayDvsSource();
+
+    // Finds and opens the recording; false if there is none.
+    bool open();
+    bool start(DvsHandler *handler) override;
+    void stop() override;
+    int width() const override { return width_; }
+    int height() const override { return height_; }
+
+    // Everything was delivered.
+    bool finished() const { return finished_.load(std::memory_order_acquire); }
+    ReplayStats stats() const;
+    const std::string &path() const { return path_; }
+
+    // A recorded message, in file order.
+    enum Kind { EVENTS, IMU, IMAGE };
+    struct Message {
+        Kind kind;
+        uint64_t at_us;             // when it was delivered live (events: last event)
+        uint64_t order;             // file order, breaks ties
+        ros::Time stamp;            // header
+        uint16_t width = 0, height = 0;
+        uint32_t count = 0;         // events, 13 bytes each on the wire
+        uint32_t file = 0;          // of files_
+        const uint8_t *data = nullptr;  // events: the first one; else the serialized message
+        uint32_t size = 0;
+        std::vector<uint8_t> own;   // data, if the reader's copy does not last
+    };
+    class Reader;
+
+private:
+    bool openFile(size_t i);
+    bool nextMessage(Message &m);
+    bool fill();
+    void run();
+    bool deliver(const Message &m);
+
+    std::string prefix_, path_;
+    ReplayClock &clock_;
+    std::vector<std::string> files_;
+    std::vector<std::unique_ptr<Reader> > readers_;    // open while their messages are queued
+    std::vector<uint64_t> queued_;
+    size_t file_ = 0;
+    std::vector<Message> heap_;     // read ahead, earliest first
+    uint64_t order_ = 0, newest_ = 0, skipped_ = 0;
+    int width_ = 0, height_ = 0;
+    DvsHandler *handler_ = nullptr;
+    EventSoA soa_;
+    sensor_msgs::Image image_;
+    mutable std::mutex m_stats_;
+    ReplayStats stats_;
+    std::chrono::steady_clock::time_point t_first_;
+    std::atomic_bool stop_{false};
+    std::atomic_bool finished_{false};
+    std::thread thread_;
+};
+
+class ReplayD435Source : public D435Source
+{
+public:
+    ReplayD435Source(const std::string &prefix, ReplayClock &clock);
+    ~ReplayD435Source();
+
+    // Finds the frames; false if there are none.
+    bool open();
+    bool start() override;
+    void stop() override {}
+    bool next(IRFrame &f, unsigned long long &frame_number) override;
+    double depthScale() const override { return depth_scale_; }
+    bool hasDepth() const { return !depth_.files.empty(); }
+
+    bool finished() const { return finished_.load(std::memory_order_acquire); }
+    ReplayStats stats() const;
+    const std::string &path() const { return path_; }
+
+private:
+    // frames of one kind in recorded order, over all segments
+    struct Frames {
+        std::vector<std::string> files;
+        size_t file = 0, i = 0;
+        FrameContainerReader reader;
+        bool opened = false;
+        uint64_t bad = 0;
+        bool read(FrameRecordHeader &hd, cv::Mat &img);
+    };
+    bool readIr(IRFrame &f);
+    bool readPng(IRFrame &f);
+    void attachDepth(IRFrame &f);
+
+    std::string prefix_, path_;
+    ReplayClock &clock_;
+    bool container_ = false;
+    Frames ir_, depth_;
+    bool have_depth_ = false;
+    bool depth_pending_ = false;
+    FrameRecordHeader depth_hd_;
+    cv::Mat depth_img_;
+    double depth_scale_ = 0.001;
+    FILE *time_fp_ = nullptr;
+    std::string img_dir_;
+    int img_segment_ = -1;
+    uint64_t png_missing_ = 0;
+    long long first_stamp_ = -1;
+    unsigned long long fn_ = 0;
+    mutable std::mutex m_stats_;
+    ReplayStats stats_;
+    std::chrono::steady_clock::time_point t_first_;
+    std::atomic_bool finished_{false};
+};
+
+// One line: what was delivered, recorded vs wall time, lateness, digest.
+void printReplayStats(const char *what, const std::string &path, const ReplayStats &st);
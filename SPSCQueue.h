@@ -0,0 +1,169 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+
+// What push() does when the ring is full.
+enum class OverflowPolicy {
+    Block,      // spin/yield until the consumer frees a slot
+    DropOldest, // evict the oldest pending item to make room
+    DropNewest  // reject the item being pushed
+};
+
+inline const char *overflowPolicyName(OverflowPolicy p)
+{
+    switch (p) {
+    case OverflowPolicy::Block: return "block";
+    case OverflowPolicy::DropOldest: return "drop-oldest";
+    case OverflowPolicy::DropNewest: return "drop-newest";
+    }
+    return "?";
+}
+
+struct SPSCQueueStats {
+    uint64_t pushed = 0;
+    uint64_t popped = 0;
+    uint64_t dropped_oldest = 0;
+    uint64_t dropped_newest = 0;
+    uint64_t blocked = 0;   // pushes that had to wait for a free slot
+    size_t high_water = 0;  // max depth seen by the producer
+};
+
+// Bounded lock-free ring between one producer (SDK callback) and one consumer
+// (writer). Every slot carries a sequence number, so with DropOldest the
+// producer can safely evict the head while the consumer may be popping it.
+template <class T>
+class SPSCQueue
+{
+public:
+    SPSCQueue(size_t capacity, OverflowPolicy policy = OverflowPolicy::DropOldest)
+        : policy_(policy)
+    {
+        size_t cap = 2;
+        while (cap < capacity) cap <<= 1;
+        mask_ = cap - 1;
+        cells_.reset(new Cell[cap]);
+        for (size_t i = 0; i < cap; i++)
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    SPSCQueue(const SPSCQueue &) = delete;
+    SPSCQueue &operator=(const SPSCQueue &) = delete;
+
+    // Producer only. Returns false if the item was dropped (DropNewest).
+    bool push(T &&v)
+    {
+        const size_t pos = tail_.load(std::memory_order_relaxed);
+        Cell &cell = cells_[pos & mask_];
+        bool waited = false, evicted = false;
+        while (cell.seq.load(std::memory_order_acquire) != pos) {
+            if (policy_ == OverflowPolicy::DropNewest) {
+                dropped_newest_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            // At most one eviction per push: if the slot is still taken after
+            // it, the consumer has claimed it and not yet released it.
+            if (policy_ == OverflowPolicy::DropOldest) {
+                T victim;
+                if (!evicted && take(victim)) {
+                    evicted = true;
+                    dropped_oldest_.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    std::this_thread::yield();
+                }
+                continue;
+            }
+            if (!waited) {
+                waited = true;
+                blocked_.fetch_add(1, std::memory_order_relaxed);
+            }
+            std::this_thread::yield();
+        }
+        cell.value = std::move(v);
+        cell.seq.store(pos + 1, std::memory_order_release);
+        tail_.store(pos + 1, std::memory_order_release);
+        pushed_.fetch_add(1, std::memory_order_relaxed);
+
+        size_t depth = pos + 1 - head_.load(std::memory_order_relaxed);
+        if (depth > high_water_.load(std::memory_order_relaxed))
+            high_water_.store(depth, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Consumer only. Returns false when empty.
+    bool pop(T &out)
+    {
+        if (!take(out)) return false;
+        popped_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    size_t size() const
+    {
+        size_t t = tail_.load(std::memory_order_acquire);
+        size_t h = head_.load(std::memory_order_acquire);
+        return t > h ? t - h : 0;
+    }
+    bool empty() const { return size() == 0; }
+    size_t capacity() const { return mask_ + 1; }
+    OverflowPolicy policy() const { return policy_; }
+
+    SPSCQueueStats stats() const
+    {
+        SPSCQueueStats s;
+        s.pushed = pushed_.load(std::memory_order_relaxed);
+        s.popped = popped_.load(std::memory_order_relaxed);
+        s.dropped_oldest = dropped_oldest_.load(std::memory_order_relaxed);
+        s.dropped_newest = dropped_newest_.load(std::memory_order_relaxed);
+        s.blocked = blocked_.load(std::memory_order_relaxed);
+        s.high_water = high_water_.load(std::memory_order_relaxed);
+        return s;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    // Claims the head slot. Called by the consumer, and by the producer when
+    // evicting under DropOldest, hence the CAS on head_.
+    bool take(T &out)
+    {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell &cell = cells_[pos & mask_];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    out = std::move(cell.value);
+                    cell.seq.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    const OverflowPolicy policy_;
+    size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+
+    alignas(64) std::atomic<uint64_t> pushed_{0};
+    std::atomic<uint64_t> popped_{0};
+    std::atomic<uint64_t> dropped_oldest_{0};
+    std::atomic<uint64_t> dropped_newest_{0};
+    std::atomic<uint64_t> blocked_{0};
+    std::atomic<size_t> high_water_{0};
+};
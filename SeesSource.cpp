@@ -0,0 +1,113 @@
+#include "SeesSource.h"
+
+#include <cmath>
+#include <cstdio>
+
+#include "ThreadAffinity.h"
+#include "Telemetry.h"
+
+bool SeesSource::start(DvsHandler *handler)
+{
+    handler_ = handler;
+    width_.store(0, std::memory_order_release);
+
+    // Set up the device and processing callbacks.
+    sees_.resetDeviceTime();
+    sees_.setImuEnabled(true);
+    sees_.setApsEnabled(true);
+    sees_.setDvsEnabled(true);
+    sees_.setAutoExposureEnabled(true);
+    // sees_.setAutoExposureMedianBrightness(0.6);
+    sees_.setEventThreshold(55);
+
+    sees_.registerCallback(std::bind(&SeesSource::onPolarity, this, std::placeholders::_1));
+    sees_.registerCallback(std::bind(&SeesSource::onImu, this, std::placeholders::_1));
+    sees_.registerCallback(std::bind(&SeesSource::onFrame, this, std::placeholders::_1));
+
+    // Start the device driver.
+    if (!sees_.start())
+        return false;
+    height_.store(sees_.dvsHeight(), std::memory_order_relaxed);
+    width_.store(sees_.dvsWidth(), std::memory_order_release);
+    return true;
+}
+
+void SeesSource::stop()
+{
+    sees_.stop();
+}
+
+void SeesSource::onImu(iness::Imu6EventPacket &_packet)
+{
+    applyThreadRole(ThreadRole::SdkCallback);
+
+    for(auto& event : _packet)
+    {
+        // Get the timestamp of the event.
+        iness::time::TimeUs ts = event.getTimestampUs(_packet.header().event_ts_overflow);
+        telemetry::latency(telemetry::IMU, telemetry::CALLBACK, ts);
+        sensor_msgs::Imu imu;
+        imu.header.stamp = ros::Time(ts/1e6);
+        imu.linear_acceleration.x = event.getAccelerationX() * 9.81;
+        imu.linear_acceleration.y = event.getAccelerationY() * 9.81;
+        imu.linear_acceleration.z = event.getAccelerationZ() * 9.81;
+        imu.angular_velocity.x = event.getGyroX() / 180.0 * M_PI;
+        imu.angular_velocity.y = event.getGyroY() / 180.0 * M_PI;
+        imu.angular_velocity.z = event.getGyroZ() / 180.0 * M_PI;
+        handler_->onImu(std::move(imu));
+    }
+}
+
+void SeesSource::onFrame(iness::FrameEventPacket &_packet)
+{
+    using namespace cv;
+    applyThreadRole(ThreadRole::SdkCallback);
+
+    for(auto& frm : _packet)
+    {
+        iness::time::TimeUs ts = frm.getTimestampUs(_packet.header().event_ts_overflow);
+        Mat img = frm.getImage();
+        if(img.empty()) {
+            printf(" * WARNING! empty frame\n");
+            continue;
+        }
+
+        telemetry::latency(telemetry::APS, telemetry::CALLBACK, ts);
+        handler_->onFrame(ts, img);
+    }
+}
+
+void SeesSource::onPolarity(iness::PolarityEventPacket &_packet)
+{
+    applyThreadRole(ThreadRole::SdkCallback);
+    // the filters and the mask are sized from the first packet handed on
+    const int width = width_.load(std::memory_order_acquire);
+    if (width == 0) return;
+    const int height = height_.load(std::memory_order_relaxed);
+    iness::time::TimeUs ts = _packet.first().getTimestampUs(_packet.tsOverflowCount());
+    telemetry::latency(telemetry::EVENTS, telemetry::CALLBACK, ts);
+
+    PooledEventArray event_msgs;
+    event_msgs.header.stamp = ros::Time(ts / 1e6);
+    event_msgs.height = height;
+    event_msgs.width = width;
+
+    // the SDK event type is opaque: gather the fields once, then convert the
+    // whole packet into pooled storage (returned to the pool after writing)
+    const auto ovf = _packet.tsOverflowCount();
+    soa_.resize(_packet.size());
+    size_t i = 0;
+    for (auto &evt : _packet) {
+        soa_.ts_us[i] = evt.getTimestampUs(ovf);
+        soa_.x[i] = evt.getX();
+        soa_.y[i] = evt.getY();
+        soa_.p[i] = (uint8_t)(evt.getPolarity());
+        i++;
+    }
+    soa_.resize(i);
+    handler_->onRawEvents(soa_, width, height);
+    if (soa_.size() == 0) return;
+    event_msgs.events.resize(soa_.size());
+    convertEvents(soa_, event_msgs.events.data());
+    handler_->onEvents(std::move(event_msgs));
+}
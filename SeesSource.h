@@ -0,0 +1,32 @@
+#pragma once
+
+#include <atomic>
+
+#include <iness_common/device/sees/sees.hpp>
+
+#include "CaptureSource.h"
+#include "EventConvert.h"
+
+// iniVation/iness SEES camera. Converts SDK packets on the SDK callback
+// threads. Device time is reset on start; what is worth recording after
+// that is up to the handler (see ReadinessGate).
+class SeesSource : public DvsSource
+{
+public:
+    bool start(DvsHandler *handler) override;
+    void stop() override;
+    int width() const override { return width_.load(std::memory_order_acquire); }
+    int height() const override { return height_.load(std::memory_order_acquire); }
+
+private:
+    void onPolarity(iness::PolarityEventPacket &packet);
+    void onImu(iness::Imu6EventPacket &packet);
+    void onFrame(iness::FrameEventPacket &packet);
+
+    iness::device::Sees sees_;
+    DvsHandler *handler_ = nullptr;
+    EventSoA soa_;      // polarity packets arrive on one SDK thread
+    // known once sees_.start() returns; packets before that are skipped.
+    // height_ is stored first, width_ publishes both.
+    std::atomic<int> width_{0}, height_{0};
+};
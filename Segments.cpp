@@ -0,0 +1,160 @@
+#include "Segments.h"
+
+#include <fcntl.h>
+#include <sstream>
+#include <unistd.h>
+
+using namespace std::chrono;
+
+bool RotateConfig::due(uint64_t bytes, steady_clock::time_point since) const
+{
+    if (max_bytes > 0 && bytes >= max_bytes) return true;
+    return max_sec > 0 && duration_cast<duration<double> >(steady_clock::now() - since).count() >= max_sec;
+}
+
+// extension: after the last '.' of the file name, if any
+static size_t extensionPos(const std::string &path)
+{
+    const size_t slash = path.rfind('/');
+    const size_t dot = path.rfind('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash) || dot == slash + 1)
+        return path.size();
+    return dot;
+}
+
+std::string segmentPath(const std::string &path, int n)
+{
+    if (n < 0) return path;
+    char num[16];
+    sprintf(num, ".%04d", n);
+    const size_t ext = extensionPos(path);
+    return path.substr(0, ext) + num + path.substr(ext);
+}
+
+std::string manifestPath(const std::string &path)
+{
+    return path.substr(0, extensionPos(path)) + ".manifest";
+}
+
+bool fsyncPath(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    const bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+static std::string dirOf(const std::string &path)
+{
+    const size_t slash = path.rfind('/');
+    return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+}
+
+bool readManifest(const std::string &path, std::vector<SegmentInfo> &segments)
+{
+    FILE *fp = fopen(path.c_str(), "r");
+    if (!fp) return false;
+    const std::string dir = dirOf(path);
+    char line[4096];
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#') continue;
+        std::istringstream ss(line);
+        SegmentInfo s;
+        if (!(ss >> s.index >> s.first_us >> s.last_us >> s.messages >> s.bytes)) continue;
+        std::string f;
+        while (ss >> f)
+            s.files.push_back(dir + f);
+        segments.push_back(s);
+    }
+    fclose(fp);
+    return true;
+}
+
+SegmentCloser::~SegmentCloser()
+{
+    stop();
+}
+
+bool SegmentCloser::start(const std::string &manifest_path, std::function<void()> thread_init)
+{
+    manifest_ = fopen(manifest_path.c_str(), "w");
+    if (!manifest_) {
+        printf(" * ERROR! cannot open %s\n", manifest_path.c_str());
+        return false;
+    }
+    fprintf(manifest_, "# <segment> <first_us> <last_us> <messages> <bytes> <files>\n");
+    fflush(manifest_);
+    dir_ = dirOf(manifest_path);
+    thread_init_ = thread_init;
+    stop_ = false;
+    thread_ = std::thread(&SegmentCloser::run, this);
+    return true;
+}
+
+void SegmentCloser::push(const SegmentInfo &info, std::function<void()> close)
+{
+    {
+        std::lock_guard<std::mutex> lck(m_);
+        jobs_.emplace_back(info, close);
+    }
+    cv_.notify_one();
+}
+
+void SegmentCloser::stop()
+{
+    if (thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lck(m_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+    }
+    if (manifest_) fclose(manifest_);
+    manifest_ = nullptr;
+}
+
+int SegmentCloser::closed() const
+{
+    std::lock_guard<std::mutex> lck(m_);
+    return closed_;
+}
+
+double SegmentCloser::maxCloseSec() const
+{
+    std::lock_guard<std::mutex> lck(m_);
+    return max_close_sec_;
+}
+
+void SegmentCloser::run()
+{
+    if (thread_init_) thread_init_();
+    for (;;) {
+        std::pair<SegmentInfo, std::function<void()> > job;
+        {
+            std::unique_lock<std::mutex> lck(m_);
+            cv_.wait(lck, [this] { return stop_ || !jobs_.empty(); });
+            if (jobs_.empty()) return;
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+        const SegmentInfo &info = job.first;
+        auto t0 = steady_clock::now();
+        if (job.second) job.second();
+        for (const std::string &f : info.files)
+            fsyncPath(f);
+
+        fprintf(manifest_, "%d %lu %lu %lu %lu", info.index, info.first_us, info.last_us, info.messages, info.bytes);
+        for (const std::string &f : info.files)
+            fprintf(manifest_, " %s", f.compare(0, dir_.size(), dir_) == 0 ? f.c_str() + dir_.size() : f.c_str());
+        fprintf(manifest_, "\n");
+        fflush(manifest_);
+        fsync(fileno(manifest_));
+
+        const double dt = duration_cast<duration<double> >(steady_clock::now() - t0).count();
+        std::lock_guard<std::mutex> lck(m_);
+        closed_++;
+        if (dt > max_close_sec_) max_close_sec_ = dt;
+    }
+}
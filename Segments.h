@@ -0,0 +1,91 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Output rotation: a long session is written as numbered segments,
+// "Capture-<ts>-dvs.bag" becoming Capture-<ts>-dvs.0000.bag, .0001.bag ...
+// A segment ends after the message that takes it past max_bytes of data or
+// max_sec of wall time, so no message is ever split. The writer opens the
+// next segment and carries on; closing the old one (index, footer, fsync)
+// runs on a SegmentCloser thread, which then appends it to the manifest:
+//
+//   <base>.manifest   one line per finished segment, in order:
+//   <segment> <first_us> <last_us> <messages> <bytes> <file> [<file> ...]
+//
+// first/last are sensor timestamps (streams written together can overlap
+// by a few ms); files are relative to the manifest. A segment missing from
+// the manifest was still open when the process ended.
+struct RotateConfig {
+    uint64_t max_bytes = 0;     // 0: no size limit
+    double max_sec = 0;         // 0: no time limit
+
+    bool enabled() const { return max_bytes > 0 || max_sec > 0; }
+    bool due(uint64_t bytes, std::chrono::steady_clock::time_point since) const;
+};
+
+// Segment n of path: the number goes before the extension (or is appended
+// if there is none). n < 0 is the plain path, for unrotated output.
+std::string segmentPath(const std::string &path, int n);
+// path without its extension, plus ".manifest"
+std::string manifestPath(const std::string &path);
+// fsync of a file or directory by name
+bool fsyncPath(const std::string &path);
+
+struct SegmentInfo {
+    int index = 0;
+    uint64_t first_us = 0, last_us = 0;
+    uint64_t messages = 0;
+    uint64_t bytes = 0;
+    std::vector<std::string> files;
+    std::chrono::steady_clock::time_point opened = std::chrono::steady_clock::now();
+
+    void add(uint64_t ts_us, uint64_t len)
+    {
+        if (messages == 0 || ts_us < first_us) first_us = ts_us;
+        if (ts_us > last_us) last_us = ts_us;
+        messages++;
+        bytes += len;
+    }
+};
+
+// Segments listed in a manifest, files with the manifest's directory.
+bool readManifest(const std::string &path, std::vector<SegmentInfo> &segments);
+
+// Background closer for finished segments, in the order they were pushed.
+class SegmentCloser
+{
+public:
+    ~SegmentCloser();
+    bool start(const std::string &manifest_path, std::function<void()> thread_init = nullptr);
+    // Runs close (which must release the segment's files), fsyncs the files
+    // and appends the manifest line. Never blocks.
+    void push(const SegmentInfo &info, std::function<void()> close);
+    // Closes everything pushed so far.
+    void stop();
+
+    int closed() const;
+    double maxCloseSec() const;
+
+private:
+    void run();
+
+    std::string dir_;
+    FILE *manifest_ = nullptr;
+    std::function<void()> thread_init_;
+    mutable std::mutex m_;
+    std::condition_variable cv_;
+    std::deque<std::pair<SegmentInfo, std::function<void()> > > jobs_;
+    bool stop_ = false;
+    std::thread thread_;
+    int closed_ = 0;
+    double max_close_sec_ = 0;
+};
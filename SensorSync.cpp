@@ -0,0 +1,314 @@
+#include "SensorSync.h"
+
+#include <algorithm>
+#include <cmath>
+
+// D435 frames without a later APS frame wait this long past max_dt for one
+// (APS frames arrive after the events of the same time)
+const int64_t APS_WAIT_US = 100000;
+// a device time this many bins behind the newest one means the clock was reset
+const uint64_t CLOCK_RESET_BINS = 4;
+
+ClockEstimator::ClockEstimator(uint64_t bin_us, int bins)
+    : bin_us_(bin_us), max_bins_(std::max(bins, 3))
+{
+}
+
+void ClockEstimator::add(uint64_t device_us, int64_t host_us)
+{
+    std::lock_guard<std::mutex> lk(m_);
+    fit_.samples++;
+    const uint64_t id = device_us / bin_us_;
+    const double dev = (double)device_us, host = (double)host_us;
+    if (!bins_.empty() && id + CLOCK_RESET_BINS < bins_.back().id) {
+        bins_.clear();
+        valid_ = false;
+    }
+    if (bins_.empty() || id > bins_.back().id) {
+        bins_.push_back(Bin{id, dev, host});
+        if (bins_.size() > max_bins_)
+            bins_.pop_front();
+        refit();
+        return;
+    }
+    // earliest arrival per bin; packets may be slightly out of order
+    for (auto it = bins_.rbegin(); it != bins_.rend() && it->id >= id; ++it) {
+        if (it->id != id) continue;
+        if (host - fit_.skew * dev < it->host - fit_.skew * it->dev) {
+            it->dev = dev;
+            it->host = host;
+            if (!valid_ || bins_.size() == 1) refit();
+        }
+        break;
+    }
+}
+
+void ClockEstimator::refit()
+{
+    // the newest bin is still filling, leave it out once there are others
+    const size_t n = bins_.size() > 1 ? bins_.size() - 1 : 1;
+    const bool slope = n >= 3 && bins_[n - 1].dev - bins_[0].dev >= 2e6;
+    resid_.resize(n);
+    std::vector<char> inlier(n, 1);
+
+    double md = 0, mh = 0, b = 1;
+    for (int pass = 0; pass < 2; pass++) {
+        int m = 0;
+        md = mh = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (!inlier[i]) continue;
+            md += bins_[i].dev;
+            mh += bins_[i].host;
+            m++;
+        }
+        md /= m;
+        mh /= m;
+        b = 1;
+        if (slope) {
+            double sdd = 0, sdh = 0;
+            for (size_t i = 0; i < n; i++) {
+                if (!inlier[i]) continue;
+                sdd += (bins_[i].dev - md) * (bins_[i].dev - md);
+                sdh += (bins_[i].dev - md) * (bins_[i].host - mh);
+            }
+            if (sdd > 0) b = sdh / sdd;
+        }
+        for (size_t i = 0; i < n; i++)
+            resid_[i] = bins_[i].host - (mh + b * (bins_[i].dev - md));
+        if (pass == 1 || n < 3) break;
+
+        // drop bins far from the line (a stall delayed the whole bin)
+        std::vector<double> r(resid_);
+        std::nth_element(r.begin(), r.begin() + n / 2, r.end());
+        const double med = r[n / 2];
+        for (double &v : r) v = std::fabs(v - med);
+        std::nth_element(r.begin(), r.begin() + n / 2, r.end());
+        const double thr = 3 * 1.4826 * r[n / 2] + 50;
+        int kept = 0;
+        for (size_t i = 0; i < n; i++) {
+            inlier[i] = std::fabs(resid_[i] - med) <= thr;
+            kept += inlier[i];
+        }
+        if (kept == (int)n) break;
+        if (kept < 2) std::fill(inlier.begin(), inlier.end(), 1);
+    }
+
+    double ss = 0;
+    int m = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!inlier[i]) continue;
+        ss += resid_[i] * resid_[i];
+        m++;
+    }
+    fit_.dev0 = md;
+    fit_.host0 = mh;
+    fit_.skew = b;
+    fit_.residual_us = std::sqrt(ss / m);
+    fit_.points = m;
+    fit_.outliers = (int)n - m;
+    valid_ = true;
+}
+
+bool ClockEstimator::valid() const
+{
+    std::lock_guard<std::mutex> lk(m_);
+    return valid_;
+}
+
+int64_t ClockEstimator::toHost(uint64_t device_us) const
+{
+    std::lock_guard<std::mutex> lk(m_);
+    return (int64_t)std::llround(fit_.host0 + fit_.skew * ((double)device_us - fit_.dev0));
+}
+
+uint64_t ClockEstimator::toDevice(int64_t host_us) const
+{
+    std::lock_guard<std::mutex> lk(m_);
+    double d = fit_.dev0 + ((double)host_us - fit_.host0) / fit_.skew;
+    return d > 0 ? (uint64_t)std::llround(d) : 0;
+}
+
+ClockEstimator::Fit ClockEstimator::fit() const
+{
+    std::lock_guard<std::mutex> lk(m_);
+    return fit_;
+}
+
+SensorSync::SensorSync(const Options &opts)
+    : opts_(opts)
+{
+    opts_.queue_size = std::max<size_t>(opts_.queue_size, 2);
+}
+
+SensorSync::~SensorSync()
+{
+    stop();
+}
+
+bool SensorSync::start(const std::string &pairs_path)
+{
+    if (!pairs_path.empty()) {
+        fp_ = fopen(pairs_path.c_str(), "w");
+        if (!fp_) {
+            printf(" * ERROR! cannot create %s\n", pairs_path.c_str());
+            return false;
+        }
+        fprintf(fp_, "# d435_index d435_stamp d435_host_us aps_seq aps_us dt_us evt_begin_us evt_end_us\n");
+    }
+    stop_ = false;
+    thread_ = std::thread(&SensorSync::run, this);
+    return true;
+}
+
+void SensorSync::stop()
+{
+    {
+        std::lock_guard<std::mutex> lk(m_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable())
+        thread_.join();
+    if (fp_) {
+        fclose(fp_);
+        fp_ = nullptr;
+    }
+}
+
+void SensorSync::dvsTime(uint64_t device_us, int64_t host_us)
+{
+    dvs_clock_.add(device_us, host_us);
+    uint64_t cur = dvs_latest_us_.load(std::memory_order_relaxed);
+    while (device_us > cur && !dvs_latest_us_.compare_exchange_weak(cur, device_us, std::memory_order_relaxed)) {
+    }
+}
+
+void SensorSync::pushAps(const PooledImagePtr &img, uint64_t device_us)
+{
+    std::lock_guard<std::mutex> lk(m_);
+    if (aps_.size() >= opts_.queue_size) {
+        aps_.pop_front();
+        stats_.dropped++;
+    }
+    aps_.push_back(Aps{img, device_us, false});
+}
+
+void SensorSync::pushD435(const IRFrame &f, int64_t host_us)
+{
+    d435_clock_.add((uint64_t)f.stamp, host_us);
+    {
+        std::lock_guard<std::mutex> lk(m_);
+        if (d435_.size() >= opts_.queue_size) {
+            d435_.pop_front();
+            stats_.dropped++;
+        }
+        d435_.push_back(f);
+    }
+    cv_.notify_one();
+}
+
+// m_ held. Both buffers are in time order: APS frames older than the current
+// D435 frame's nearest neighbour can never be nearest to a later one.
+void SensorSync::match(std::vector<SyncPair> &out)
+{
+    if (!dvs_clock_.valid() || !d435_clock_.valid())
+        return;
+    const int64_t max_dt = opts_.max_dt_ms * 1000LL;
+    const int64_t half_win = opts_.evt_window_ms * 500LL;
+    const int64_t dvs_now = dvs_clock_.toHost(dvs_latest_us_.load(std::memory_order_relaxed));
+    while (!d435_.empty()) {
+        IRFrame &f = d435_.front();
+        const int64_t t = d435_clock_.toHost((uint64_t)f.stamp) - opts_.d435_offset_us;
+        const bool later_aps = !aps_.empty() && dvs_clock_.toHost(aps_.back().device_us) > t;
+        if (!stop_ && !later_aps && dvs_now < t + max_dt + APS_WAIT_US)
+            break;
+
+        while (aps_.size() >= 2 && dvs_clock_.toHost(aps_[1].device_us) <= t) {
+            if (!aps_.front().used) stats_.aps_unused++;
+            aps_.pop_front();
+        }
+        SyncPair p;
+        p.d435_index = f.index;
+        p.d435_stamp = f.stamp;
+        p.d435_host_us = t;
+        p.d435_image = f.image;
+        p.d435_hold = std::move(f.hold);
+        int best = -1;
+        int64_t best_dt = 0;
+        for (int i = 0; i < (int)std::min<size_t>(aps_.size(), 2); i++) {
+            int64_t dt = dvs_clock_.toHost(aps_[i].device_us) - t;
+            if (std::llabs(dt) <= max_dt && (best < 0 || std::llabs(dt) < std::llabs(best_dt))) {
+                best = i;
+                best_dt = dt;
+            }
+        }
+        if (best >= 0) {
+            Aps &a = aps_[best];
+            a.used = true;
+            p.aps = a.img;
+            p.aps_seq = a.img->header.seq;
+            p.aps_us = a.device_us;
+            p.dt_us = best_dt;
+            stats_.max_abs_dt_us = std::max(stats_.max_abs_dt_us, (double)std::llabs(best_dt));
+        } else {
+            stats_.d435_unmatched++;
+        }
+        const uint64_t t_dev = dvs_clock_.toDevice(t);
+        p.evt_begin_us = t_dev > (uint64_t)half_win ? t_dev - half_win : 0;
+        p.evt_end_us = t_dev + half_win;
+        stats_.pairs++;
+        out.push_back(std::move(p));
+        d435_.pop_front();
+    }
+}
+
+void SensorSync::run()
+{
+    std::vector<SyncPair> pairs;
+    std::unique_lock<std::mutex> lk(m_);
+    for (;;) {
+        const bool last = stop_;
+        match(pairs);
+        if (!pairs.empty()) {
+            lk.unlock();
+            for (const SyncPair &p : pairs) {
+                if (consumer_) consumer_(p);
+                if (fp_) {
+                    fprintf(fp_, "%05lu %lld %ld %ld %lu %ld %lu %lu\n", p.d435_index, p.d435_stamp, p.d435_host_us,
+                        p.aps ? (long)p.aps_seq : -1L, p.aps_us, p.dt_us, p.evt_begin_us, p.evt_end_us);
+                }
+            }
+            pairs.clear();
+            lk.lock();
+        }
+        if (last) break;
+        cv_.wait_for(lk, std::chrono::milliseconds(10));
+    }
+}
+
+SensorSync::Stats SensorSync::stats() const
+{
+    std::lock_guard<std::mutex> lk(m_);
+    return stats_;
+}
+
+static void printClock(const char *name, const ClockEstimator &c)
+{
+    ClockEstimator::Fit f = c.fit();
+    if (!c.valid()) {
+        printf("%s clock: no data\n", name);
+        return;
+    }
+    printf("%s clock: skew %+.1f ppm vs host, residual %.0f µs over %d bins (%d outliers), %lu samples\n",
+        name, (f.skew - 1) * 1e6, f.residual_us, f.points, f.outliers, f.samples);
+}
+
+void SensorSync::printStats() const
+{
+    Stats s = stats();
+    printClock("DVS", dvs_clock_);
+    printClock("D435", d435_clock_);
+    printf("Sync: %lu D435 frames paired, %lu without an APS frame within %d ms, max |dt| %.1f ms, "
+        "%lu APS frames unused, %lu dropped (buffer full)\n",
+        s.pairs, s.d435_unmatched, opts_.max_dt_ms, s.max_abs_dt_us / 1e3, s.aps_unused, s.dropped);
+}
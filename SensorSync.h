@@ -0,0 +1,155 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "ApsFrame.h"
+#include "FrameEncoderPool.h"
+
+// Host steady clock in µs, the common time base of all sensors.
+inline int64_t hostNowUs()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Maps a device clock to the host clock from (device stamp, host arrival)
+// pairs: host = host0 + skew * (device - dev0).
+//
+// Arrival is the true time plus a transfer/scheduling delay that is never
+// negative and has a long tail. Samples are binned by device time and each
+// bin keeps its earliest arrival (the lower envelope). The line is a least
+// squares fit through the last `bins` bin minima, refit without outliers
+// (MAD) whenever a bin closes. Until the bins span two seconds the skew is
+// taken as 1. add() from one thread; the mapping from any.
+class ClockEstimator
+{
+public:
+    struct Fit {
+        double dev0 = 0, host0 = 0;
+        double skew = 1;
+        double residual_us = 0;     // RMS over the inliers
+        int points = 0;             // bins used
+        int outliers = 0;
+        uint64_t samples = 0;
+    };
+
+    explicit ClockEstimator(uint64_t bin_us = 250000, int bins = 120);
+
+    void add(uint64_t device_us, int64_t host_us);
+    bool valid() const;
+    int64_t toHost(uint64_t device_us) const;
+    uint64_t toDevice(int64_t host_us) const;
+    Fit fit() const;
+
+private:
+    struct Bin {
+        uint64_t id;
+        double dev, host;
+    };
+    void refit();
+
+    const uint64_t bin_us_;
+    const size_t max_bins_;
+    mutable std::mutex m_;
+    std::deque<Bin> bins_;
+    Fit fit_;
+    bool valid_ = false;
+    std::vector<double> resid_;     // refit scratch
+};
+
+// One D435 infrared frame with the DVS data closest to it in host time: the
+// nearest APS frame and the event time window around the D435 stamp, both in
+// DVS device time (look the events up in the bag / .evc by time).
+struct SyncPair {
+    uint64_t d435_index = 0;        // as in D435_time.txt
+    long long d435_stamp = 0;       // device time [us]
+    int64_t d435_host_us = 0;
+    cv::Mat d435_image;
+    std::shared_ptr<void> d435_hold;
+    PooledImagePtr aps;
+    uint32_t aps_seq = 0;           // header.seq in the bag
+    uint64_t aps_us = 0;
+    int64_t dt_us = 0;              // APS host time - D435 host time
+    uint64_t evt_begin_us = 0, evt_end_us = 0;
+};
+
+// Streaming DVS/D435 matcher. Capture threads hand in APS frames, D435
+// frames and DVS clock samples; a sync thread maps everything to host time
+// and pairs each D435 frame with the nearest APS frame once the DVS stream
+// has moved past it, by walking both time-ordered buffers (no search per
+// frame). Buffers are bounded: the oldest entry is dropped and counted.
+class SensorSync
+{
+public:
+    struct Options {
+        int max_dt_ms = 20;         // farther apart is no match
+        int evt_window_ms = 10;     // events around the D435 stamp
+        size_t queue_size = 16;     // per buffer; D435 entries hold rs2 frames
+        // Fixed D435 transport delay beyond the DVS one. Arrival times only
+        // show the delay's variation; measure this once (e.g. a flashing LED).
+        int d435_offset_us = 0;
+    };
+    struct Stats {
+        uint64_t pairs = 0;
+        uint64_t d435_unmatched = 0;
+        uint64_t aps_unused = 0;    // never nearest to any D435 frame
+        uint64_t dropped = 0;       // buffer full
+        double max_abs_dt_us = 0;
+    };
+
+    explicit SensorSync(const Options &opts);
+    ~SensorSync();
+
+    // Called on the sync thread for every pair. Set before start().
+    void setConsumer(std::function<void(const SyncPair &)> fn) { consumer_ = fn; }
+    // pairs_path: one text line per pair, empty = none.
+    bool start(const std::string &pairs_path);
+    void stop();
+
+    // DVS: device time of data that just arrived (events, IMU), and APS frames.
+    void dvsTime(uint64_t device_us, int64_t host_us);
+    void pushAps(const PooledImagePtr &img, uint64_t device_us);
+    // D435 grab thread, after the frame got its index. host_us: arrival.
+    void pushD435(const IRFrame &f, int64_t host_us);
+
+    const ClockEstimator &dvsClock() const { return dvs_clock_; }
+    const ClockEstimator &d435Clock() const { return d435_clock_; }
+    Stats stats() const;
+    void printStats() const;
+
+private:
+    struct Aps {
+        PooledImagePtr img;
+        uint64_t device_us;
+        bool used;
+    };
+    void run();
+    void match(std::vector<SyncPair> &out);
+
+    Options opts_;
+    ClockEstimator dvs_clock_, d435_clock_;
+    std::atomic<uint64_t> dvs_latest_us_{0};
+    std::function<void(const SyncPair &)> consumer_;
+    FILE *fp_ = nullptr;
+
+    mutable std::mutex m_;
+    std::condition_variable cv_;
+    std::deque<Aps> aps_;
+    std::deque<IRFrame> d435_;
+    bool stop_ = false;
+    std::thread thread_;
+    Stats stats_;
+};
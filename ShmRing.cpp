@@ -0,0 +1,244 @@
+#include "ShmRing.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const char SHM_MAGIC[8] = {'D', 'V', 'S', 'R', 'I', 'N', 'G', '1'};
+static const uint32_t SHM_VERSION = 2;
+static const size_t PAGE_BYTES = 4096;
+static const size_t HEADER_BYTES = 2 * PAGE_BYTES;     // header page, control page
+static_assert(sizeof(ShmRingHeader) <= PAGE_BYTES, "ring header too large");
+static_assert(sizeof(std::atomic<uint32_t>) == 4, "the futex word must be 32 bits");
+
+const char *shmStreamName(ShmStream s)
+{
+    static const char *names[] = {"events", "imu", "aps", "d435"};
+    return s < SHM_STREAMS ? names[s] : "?";
+}
+
+int64_t shmNowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint64_t recordBytes(uint64_t payload)
+{
+    return (sizeof(ShmRecordHeader) + payload + 63) & ~63ull;
+}
+
+static long futex(std::atomic<uint32_t> *word, int op, uint32_t val, const timespec *timeout)
+{
+    return syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), op, val, timeout, nullptr, 0);
+}
+
+ShmPublisher::~ShmPublisher()
+{
+    close();
+}
+
+bool ShmPublisher::open(const std::string &name, ShmStream stream, size_t capacity)
+{
+    capacity = (capacity + 63) & ~(size_t)63;
+    shm_unlink(name.c_str());   // left over from a crash
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (fd < 0) {
+        printf(" * ERROR! cannot create shared memory %s: %s\n", name.c_str(), strerror(errno));
+        return false;
+    }
+    fchmod(fd, 0666);           // subscribers of any user may wait on the futex
+    map_bytes_ = HEADER_BYTES + capacity;
+    void *p = MAP_FAILED;
+    if (ftruncate(fd, map_bytes_) == 0)
+        // populated now, so the capture threads never take the page faults
+        p = mmap(nullptr, map_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        printf(" * ERROR! cannot map %lu MB of shared memory for %s\n", map_bytes_ >> 20, name.c_str());
+        shm_unlink(name.c_str());
+        return false;
+    }
+    name_ = name;
+    hd_ = static_cast<ShmRingHeader *>(p);
+    ctl_ = reinterpret_cast<ShmRingControl *>(static_cast<uint8_t *>(p) + PAGE_BYTES);
+    data_ = static_cast<uint8_t *>(p) + HEADER_BYTES;
+    memcpy(hd_->magic, SHM_MAGIC, sizeof(SHM_MAGIC));
+    hd_->version = SHM_VERSION;
+    hd_->stream = stream;
+    hd_->capacity = capacity;
+    cap_ = capacity;
+    head_ = 0;
+    seq_ = bytes_ = too_large_ = 0;
+    hd_->alive.store(1, std::memory_order_release);
+    return true;
+}
+
+void ShmPublisher::close()
+{
+    if (!hd_) return;
+    hd_->alive.store(0, std::memory_order_release);
+    ctl_->futex.fetch_add(1);
+    futex(&ctl_->futex, FUTEX_WAKE, INT_MAX, nullptr);
+    munmap(hd_, map_bytes_);
+    shm_unlink(name_.c_str());
+    hd_ = nullptr;
+}
+
+uint8_t *ShmPublisher::reserve(size_t bytes)
+{
+    const uint64_t cap = cap_;
+    need_ = recordBytes(bytes);
+    if (need_ > cap / 4) {
+        too_large_++;
+        return nullptr;
+    }
+    const uint64_t off = head_ % cap;
+    const bool wrap = off + need_ > cap;
+    pos_ = wrap ? head_ + (cap - off) : head_;
+
+    // Readers must see the new tail before any byte of what it covers
+    // changes (the seqlock write side).
+    if (pos_ + need_ > cap) {
+        hd_->tail.store(pos_ + need_ - cap, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+    if (wrap) {
+        ShmRecordHeader *pad = reinterpret_cast<ShmRecordHeader *>(data_ + off);
+        pad->bytes = (uint32_t)(cap - off - sizeof(ShmRecordHeader));
+        pad->type = SHM_PAD;
+        pad->seq = seq_;
+    }
+    ShmRecordHeader *rh = reinterpret_cast<ShmRecordHeader *>(data_ + pos_ % cap);
+    rh->bytes = (uint32_t)bytes;
+    return data_ + pos_ % cap + sizeof(ShmRecordHeader);
+}
+
+void ShmPublisher::publish(int64_t stamp_us)
+{
+    ShmRecordHeader *rh = reinterpret_cast<ShmRecordHeader *>(data_ + pos_ % cap_);
+    rh->type = SHM_DATA;
+    rh->seq = seq_;
+    rh->stamp_us = stamp_us;
+    rh->publish_ns = shmNowNs();
+    bytes_ += rh->bytes;
+    seq_++;
+    hd_->last.store(pos_, std::memory_order_relaxed);
+    hd_->seq.store(seq_, std::memory_order_relaxed);
+    head_ = pos_ + need_;
+    hd_->head.store(head_, std::memory_order_release);
+    ctl_->futex.fetch_add(1);
+    // the syscall only while someone sleeps
+    if (ctl_->waiters.load())
+        futex(&ctl_->futex, FUTEX_WAKE, INT_MAX, nullptr);
+}
+
+ShmSubscriber::~ShmSubscriber()
+{
+    close();
+}
+
+bool ShmSubscriber::open(const std::string &name)
+{
+    close();
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) return false;
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size > HEADER_BYTES)
+        p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // the futex words are all this side may change
+    void *c = p == MAP_FAILED ? MAP_FAILED :
+        mmap(static_cast<uint8_t *>(p) + PAGE_BYTES, PAGE_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, PAGE_BYTES);
+    ::close(fd);
+    if (c == MAP_FAILED) {
+        if (p != MAP_FAILED) munmap(p, st.st_size);
+        return false;
+    }
+    map_bytes_ = st.st_size;
+    hd_ = static_cast<const ShmRingHeader *>(p);
+    ctl_ = static_cast<ShmRingControl *>(c);
+    data_ = static_cast<const uint8_t *>(p) + HEADER_BYTES;
+    if (memcmp(hd_->magic, SHM_MAGIC, sizeof(SHM_MAGIC)) != 0 || hd_->version != SHM_VERSION ||
+        hd_->capacity == 0 || HEADER_BYTES + hd_->capacity > map_bytes_) {
+        close();
+        return false;
+    }
+    pos_ = hd_->head.load(std::memory_order_acquire);
+    expect_seq_ = UINT64_MAX;
+    lost_ = 0;
+    return true;
+}
+
+void ShmSubscriber::close()
+{
+    if (hd_) munmap(const_cast<ShmRingHeader *>(hd_), map_bytes_);
+    hd_ = nullptr;
+}
+
+bool ShmSubscriber::next(Record &r)
+{
+    const uint64_t cap = hd_->capacity;
+    for (;;) {
+        if (pos_ == hd_->head.load(std::memory_order_acquire))
+            return false;
+        // too slow: what is left of the old records is being overwritten,
+        // carry on with the newest
+        if (pos_ < hd_->tail.load(std::memory_order_acquire))
+            pos_ = hd_->last.load(std::memory_order_acquire);
+
+        const uint64_t off = pos_ % cap;
+        ShmRecordHeader rh;
+        memcpy(&rh, data_ + off, sizeof(rh));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (pos_ < hd_->tail.load(std::memory_order_relaxed))
+            continue;
+        if (rh.type == SHM_PAD) {
+            pos_ += cap - off;
+            continue;
+        }
+        if (expect_seq_ != UINT64_MAX && rh.seq > expect_seq_)
+            lost_ += rh.seq - expect_seq_;
+        expect_seq_ = rh.seq + 1;
+        r.hd = reinterpret_cast<const ShmRecordHeader *>(data_ + off);
+        r.data = data_ + off + sizeof(ShmRecordHeader);
+        r.bytes = rh.bytes;
+        r.pos = pos_;
+        pos_ += recordBytes(rh.bytes);
+        return true;
+    }
+}
+
+bool ShmSubscriber::valid(const Record &r) const
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return r.pos >= hd_->tail.load(std::memory_order_relaxed);
+}
+
+bool ShmSubscriber::wait(int timeout_ms)
+{
+    ctl_->waiters.fetch_add(1);
+    const uint32_t v = ctl_->futex.load();
+    if (pos_ == hd_->head.load(std::memory_order_acquire) && alive()) {
+        timespec ts;
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+        futex(&ctl_->futex, FUTEX_WAIT, v, &ts);
+    }
+    ctl_->waiters.fetch_sub(1);
+    return pos_ != hd_->head.load(std::memory_order_acquire);
+}
+
+bool ShmSubscriber::alive() const
+{
+    return hd_->alive.load(std::memory_order_acquire) != 0;
+}
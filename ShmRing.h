@@ -0,0 +1,169 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Live data for other processes on this machine. Each stream is a POSIX
+// shared memory object (/dev/shm/<name>.events, .imu, .aps, .d435) holding
+// a ring that one publisher thread appends records to and any number of
+// subscribers read in place:
+//
+//   [ShmRingHeader, 4 KB][ShmRingControl, 4 KB][data, capacity bytes]
+//   record: [ShmRecordHeader][payload], 64-byte aligned, never wrapped
+//
+// Subscribers map everything but the control page read-only. The publisher
+// keeps the capacity and its write position to itself and only stores them
+// to the header, so nothing another process writes there can move its writes
+// outside the ring.
+//
+// The publisher never waits for readers; new records overwrite the oldest.
+// Records carry sequence numbers, so a reader that fell behind knows how
+// many it lost. Reading is optimistic, as with a seqlock: use the record in
+// place, then valid() tells whether the publisher started to overwrite it
+// meanwhile. Idle subscribers sleep on a futex in the control page; the publisher
+// only makes the wake call while someone is waiting.
+enum ShmStream {
+    SHM_EVENTS = 0,
+    SHM_IMU,
+    SHM_APS,
+    SHM_D435,
+    SHM_STREAMS
+};
+
+const char *shmStreamName(ShmStream s);
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "the ring header needs lock-free atomics");
+
+struct ShmRingHeader {
+    char magic[8];                      // "DVSRING1"
+    uint32_t version;
+    uint32_t stream;                    // ShmStream
+    uint64_t capacity;                  // data bytes, a multiple of 64
+    std::atomic<uint64_t> head;         // end of the newest record, in bytes ever written
+    std::atomic<uint64_t> tail;         // data before this may be overwritten
+    std::atomic<uint64_t> last;         // start of the newest record
+    std::atomic<uint64_t> seq;          // records published
+    std::atomic<uint32_t> alive;        // 0 once the publisher has closed
+};
+
+// The only words subscribers write.
+struct ShmRingControl {
+    std::atomic<uint32_t> futex;        // bumped on every publish
+    std::atomic<uint32_t> waiters;
+};
+
+enum ShmRecordType {
+    SHM_PAD = 0,                        // rest of the ring is unused, go to its start
+    SHM_DATA = 1
+};
+
+struct ShmRecordHeader {
+    uint32_t bytes;                     // payload
+    uint32_t type;                      // ShmRecordType
+    uint64_t seq;
+    int64_t stamp_us;                   // sensor time
+    int64_t publish_ns;                 // CLOCK_MONOTONIC when published
+};
+static_assert(sizeof(ShmRecordHeader) == 32, "ShmRecordHeader must stay packed");
+
+// Payloads. SHM_EVENTS: ShmEvents then count ShmEvent, the dvs_msgs::Event
+// memory layout.
+struct ShmEvent {
+    uint16_t x, y;
+    uint32_t sec, nsec;
+    uint8_t polarity;
+    uint8_t pad[3];
+};
+static_assert(sizeof(ShmEvent) == 16, "ShmEvent must stay packed");
+
+struct ShmEvents {
+    uint32_t count;
+    uint32_t width, height;
+    uint32_t seq;                       // message header.seq
+};
+
+// SHM_IMU: accelerometer [m/s^2], gyroscope [rad/s]
+struct ShmImu {
+    double acc[3];
+    double gyro[3];
+};
+
+// SHM_APS (mono16) and SHM_D435 (8-bit infrared): ShmImage then rows of
+// width * bytes_per_pixel, packed.
+struct ShmImage {
+    uint32_t width, height;
+    uint32_t bytes_per_pixel;
+    uint32_t reserved;
+    uint64_t index;
+    double expo;                        // [ms], D435 only
+};
+
+// CLOCK_MONOTONIC in ns, the clock of ShmRecordHeader::publish_ns
+int64_t shmNowNs();
+
+class ShmPublisher
+{
+public:
+    ~ShmPublisher();
+    // Creates (or replaces) the shared memory object `name` ("/dvs.events").
+    bool open(const std::string &name, ShmStream stream, size_t capacity);
+    // Wakes the subscribers for the last time and removes the object.
+    void close();
+
+    // Room for a payload of `bytes`, to be filled before publish(); nullptr
+    // if the payload is larger than a quarter of the ring. Publisher only.
+    uint8_t *reserve(size_t bytes);
+    void publish(int64_t stamp_us);
+
+    uint64_t published() const { return seq_; }
+    uint64_t bytes() const { return bytes_; }
+    uint64_t tooLarge() const { return too_large_; }
+
+private:
+    std::string name_;
+    ShmRingHeader *hd_ = nullptr;
+    ShmRingControl *ctl_ = nullptr;
+    uint8_t *data_ = nullptr;
+    size_t map_bytes_ = 0;
+    uint64_t cap_ = 0, head_ = 0;       // never read back from the header
+    uint64_t pos_ = 0, need_ = 0;       // the reserved record
+    uint64_t seq_ = 0, bytes_ = 0, too_large_ = 0;
+};
+
+class ShmSubscriber
+{
+public:
+    struct Record {
+        const ShmRecordHeader *hd;
+        const uint8_t *data;            // payload
+        uint32_t bytes;                 // its size as next() found it; keep reads within it
+        uint64_t pos;
+    };
+
+    ~ShmSubscriber();
+    // Starts with the next record published.
+    bool open(const std::string &name);
+    void close();
+
+    // Next record, in place; false if there is none yet. Records the
+    // publisher overwrote before they were read count as lost.
+    bool next(Record &r);
+    // After using r: false if it was (partly) overwritten meanwhile.
+    bool valid(const Record &r) const;
+    // Sleeps until something is published; false on timeout.
+    bool wait(int timeout_ms);
+    bool alive() const;
+
+    ShmStream stream() const { return (ShmStream)hd_->stream; }
+    uint64_t lost() const { return lost_; }
+
+private:
+    const ShmRingHeader *hd_ = nullptr;
+    ShmRingControl *ctl_ = nullptr;
+    const uint8_t *data_ = nullptr;
+    size_t map_bytes_ = 0;
+    uint64_t pos_ = 0, expect_seq_ = 0, lost_ = 0;
+};
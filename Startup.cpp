@@ -0,0 +1,170 @@
+#include "Startup.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace startup {
+
+using namespace std::chrono;
+
+struct Entry {
+    std::string what;
+    double begin_ms, end_ms;
+};
+
+static std::mutex m;
+static steady_clock::time_point t0 = steady_clock::now();
+static std::vector<Entry> entries;
+
+void begin()
+{
+    std::lock_guard<std::mutex> lck(m);
+    t0 = steady_clock::now();
+    entries.clear();
+}
+
+double now()
+{
+    return duration<double, std::milli>(steady_clock::now() - t0).count();
+}
+
+static void add(const char *what, double begin_ms, double end_ms)
+{
+    {
+        std::lock_guard<std::mutex> lck(m);
+        for (const Entry &e : entries)
+            if (e.what == what) return;
+        entries.push_back(Entry{what, begin_ms, end_ms});
+    }
+    if (end_ms > begin_ms)
+        printf("Startup +%7.1f ms  %s (%.1f ms)\n", end_ms, what, end_ms - begin_ms);
+    else
+        printf("Startup +%7.1f ms  %s\n", end_ms, what);
+}
+
+void mark(const char *what)
+{
+    const double t = now();
+    add(what, t, t);
+}
+
+void step(const char *what, double since_ms)
+{
+    add(what, since_ms, now());
+}
+
+double at(const char *what)
+{
+    std::lock_guard<std::mutex> lck(m);
+    for (const Entry &e : entries)
+        if (e.what == what) return e.end_ms;
+    return -1;
+}
+
+void printSummary()
+{
+    std::vector<Entry> v;
+    {
+        std::lock_guard<std::mutex> lck(m);
+        v = entries;
+    }
+    if (v.empty()) return;
+    std::sort(v.begin(), v.end(), [](const Entry &a, const Entry &b) { return a.end_ms < b.end_ms; });
+    printf("Startup timeline (ms since launch):\n");
+    for (const Entry &e : v) {
+        if (e.end_ms > e.begin_ms)
+            printf("  %7.1f - %7.1f  %s\n", e.begin_ms, e.end_ms, e.what.c_str());
+        else
+            printf("  %7.1f            %s\n", e.end_ms, e.what.c_str());
+    }
+}
+
+}
+
+// mean of every 4th pixel of every 4th row, mono8 or mono16
+static double meanBrightness(const cv::Mat &img)
+{
+    double sum = 0;
+    size_t n = 0;
+    for (int r = 0; r < img.rows; r += 4) {
+        if (img.type() == CV_16UC1) {
+            const uint16_t *p = img.ptr<uint16_t>(r);
+            for (int c = 0; c < img.cols; c += 4, n++) sum += p[c];
+        } else {
+            const uint8_t *p = img.ptr<uint8_t>(r);
+            for (int c = 0; c < img.cols; c += 4, n++) sum += p[c];
+        }
+    }
+    return n ? sum / n : 0;
+}
+
+bool ReadinessGate::timestamp(uint64_t ts_us)
+{
+    const uint64_t ready = ready_us_.load(std::memory_order_acquire);
+    if (ready != NOT_READY) return ts_us >= ready;
+
+    std::lock_guard<std::mutex> lck(m_);
+    if (ready_us_ != NOT_READY) return ts_us >= ready_us_;
+    startup::mark("DVS first packet");
+    const uint64_t jump = cfg_.max_jump_ms * 1000ull;
+    // events and IMU come from different threads, allow a little disorder
+    const bool ok = stable_ == 0 || (ts_us + jump / 10 >= last_us_ && ts_us <= last_us_ + jump);
+    if (!ok) {
+        stable_ = 0;
+        ts_stable_ = false;
+        last_us_ = ts_us;
+        return false;
+    }
+    last_us_ = std::max(last_us_, ts_us);
+    if (++stable_ >= cfg_.stable_packets && !ts_stable_) {
+        ts_stable_ = true;
+        ts_stable_us_ = ts_us;
+        startup::mark("DVS timestamps stable");
+    }
+    checkReady(ts_us);
+    return false;
+}
+
+bool ReadinessGate::frame(uint64_t ts_us, const cv::Mat &img)
+{
+    const uint64_t ready = ready_us_.load(std::memory_order_acquire);
+    if (ready != NOT_READY) return ts_us >= ready;
+
+    std::lock_guard<std::mutex> lck(m_);
+    if (ready_us_ != NOT_READY) return ts_us >= ready_us_;
+    // frames before the timestamps settle may be stale
+    if (!ts_stable_ || ts_us < ts_stable_us_ || img.empty()) return false;
+    const double mean = meanBrightness(img);
+    if (mean <= 0) return false;
+    if (!got_frame_) {
+        got_frame_ = true;
+        startup::mark("DVS first APS frame");
+    }
+    if (last_mean_ > 0 && std::fabs(mean - last_mean_) <= last_mean_ * cfg_.ae_tolerance_percent / 100.0)
+        steady_frames_++;
+    else
+        steady_frames_ = 0;
+    last_mean_ = mean;
+    if (steady_frames_ >= cfg_.ae_frames && !ae_settled_) {
+        ae_settled_ = true;
+        startup::mark("DVS exposure settled");
+    }
+    checkReady(ts_us);
+    return false;
+}
+
+// m_ held
+void ReadinessGate::checkReady(uint64_t ts_us)
+{
+    if (!ts_stable_) return;
+    if (!ae_settled_ && ts_us < ts_stable_us_ + cfg_.max_wait_ms * 1000ull) return;
+    if (!ae_settled_)
+        printf(" * WARNING! %s after %d ms, recording anyway\n",
+            got_frame_ ? "exposure still changing" : "no APS frame", cfg_.max_wait_ms);
+    ready_us_.store(ts_us + 1, std::memory_order_release);
+    startup::mark("DVS recording");
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+#include <opencv2/core/core.hpp>
+
+// Startup timeline: when each step began and ended, in ms since begin()
+// (the launch). Steps are logged as they complete and summarised at exit.
+namespace startup {
+
+void begin();
+double now();
+// An instant; only the first call per name counts.
+void mark(const char *what);
+// A step that started at since_ms (from now()) and ends now.
+void step(const char *what, double since_ms);
+// End of a mark or step in ms since begin(), -1 if not reached.
+double at(const char *what);
+void printSummary();
+
+}
+
+// Decides when DVS data is worth recording, instead of discarding a fixed
+// span of device time after the reset:
+//
+//   timestamps  stable_packets packets in a row move forward by less than
+//               max_jump_ms (stale pre-reset packets jump back)
+//   frames      a non-black APS frame, then ae_frames frames whose mean
+//               brightness changes by less than ae_tolerance_percent (auto
+//               exposure settled), or max_wait_ms of device time after the
+//               timestamps became stable
+//
+// Data stamped before the ready time is dropped, on every stream. Called
+// from the source callback threads; cheap once ready. A replay was gated
+// when it was recorded and is ready from the start.
+struct ReadinessConfig {
+    bool ready_at_start = false;
+    int stable_packets = 20;
+    int max_jump_ms = 1000;
+    int ae_frames = 3;
+    int ae_tolerance_percent = 2;
+    int max_wait_ms = 3000;
+};
+
+class ReadinessGate
+{
+public:
+    explicit ReadinessGate(const ReadinessConfig &cfg)
+        : cfg_(cfg), ready_us_(cfg.ready_at_start ? 0 : NOT_READY) {}
+
+    // True if data stamped ts_us is to be recorded. timestamp() is for event
+    // and IMU packets (first timestamp), frame() for APS frames.
+    bool timestamp(uint64_t ts_us);
+    bool frame(uint64_t ts_us, const cv::Mat &img);
+
+    bool ready() const { return ready_us_.load(std::memory_order_acquire) != NOT_READY; }
+    uint64_t readyUs() const { return ready_us_.load(std::memory_order_acquire); }
+
+private:
+    static const uint64_t NOT_READY = ~0ull;
+    void checkReady(uint64_t ts_us);
+
+    ReadinessConfig cfg_;
+    std::atomic<uint64_t> ready_us_;
+    std::mutex m_;
+    uint64_t last_us_ = 0;
+    int stable_ = 0;
+    bool ts_stable_ = false;
+    uint64_t ts_stable_us_ = 0;
+    bool got_frame_ = false;
+    double last_mean_ = -1;
+    int steady_frames_ = 0;
+    bool ae_settled_ = false;
+};
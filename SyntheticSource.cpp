@@ -0,0 +1,224 @@
+#include "SyntheticSource.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "ThreadAffinity.h"
+#include "Telemetry.h"
+
+using namespace std::chrono;
+
+// stream time starts a few seconds in, as device time would
+static const uint64_t SYNTH_T0_US = 5000000;
+
+enum { DIST_UNIFORM, DIST_GAUSSIAN, DIST_BAR };
+
+static inline uint64_t xorshift(uint64_t &s)
+{
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+SyntheticDvsSource::SyntheticDvsSource(const SyntheticDvsConfig &cfg)
+    : cfg_(cfg)
+{
+    if (cfg_.distribution == "gaussian") dist_ = DIST_GAUSSIAN;
+    else if (cfg_.distribution == "bar") dist_ = DIST_BAR;
+    else {
+        if (cfg_.distribution != "uniform")
+            printf(" * WARNING! unknown distribution '%s', using uniform\n", cfg_.distribution.c_str());
+        dist_ = DIST_UNIFORM;
+    }
+    cfg_.packet_us = std::max(cfg_.packet_us, 1);
+    uint64_t rng = 0x5851f42d4c957f2dull;
+    for (int k = 0; k < cfg_.hot_pixels; k++)
+        hot_.push_back(std::make_pair((uint16_t)(xorshift(rng) % cfg_.width), (uint16_t)(xorshift(rng) % cfg_.height)));
+    if (!hot_.empty())
+        hot_share_ = std::min(1.0, hot_.size() * cfg_.hot_pixel_hz / cfg_.event_rate);
+}
+
+SyntheticDvsSource::~SyntheticDvsSource()
+{
+    stop();
+}
+
+bool SyntheticDvsSource::start(DvsHandler *handler)
+{
+    handler_ = handler;
+    stop_ = false;
+    std::this_thread::sleep_for(milliseconds(cfg_.start_ms));
+    thread_ = std::thread(&SyntheticDvsSource::run, this);
+    return true;
+}
+
+void SyntheticDvsSource::stop()
+{
+    if (!thread_.joinable()) return;
+    stop_ = true;
+    thread_.join();
+}
+
+void SyntheticDvsSource::fillPacket(PooledEventArray &msg, uint64_t t_us, size_t n)
+{
+    const int w = cfg_.width, h = cfg_.height;
+    const double dt = n ? (double)cfg_.packet_us / n : 0;
+    // the bar crosses the sensor in 0.5 s
+    const int bar_x = (int)((t_us / 500000.0 - floor(t_us / 500000.0)) * w);
+
+    msg.header.stamp = ros::Time(t_us / 1e6);
+    msg.width = w;
+    msg.height = h;
+    soa_.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        uint64_t r = xorshift(rng_);
+        int x, y;
+        switch (dist_) {
+        case DIST_GAUSSIAN: {
+            // Irwin-Hall: sum of four uniforms, sigma about w/8
+            int sx = (int)(r & 0xff) + (int)((r >> 8) & 0xff) + (int)((r >> 16) & 0xff) + (int)((r >> 24) & 0xff);
+            int sy = (int)((r >> 32) & 0xff) + (int)((r >> 40) & 0xff) + (int)((r >> 48) & 0xff) + (int)((r >> 56) & 0xff);
+            x = std::min(std::max(w / 2 + (sx - 510) * w / 1180, 0), w - 1);
+            y = std::min(std::max(h / 2 + (sy - 510) * h / 1180, 0), h - 1);
+            break;
+        }
+        case DIST_BAR:
+            x = (bar_x + (int)(r & 7)) % w;
+            y = (int)((r >> 8) % h);
+            break;
+        default:
+            x = (int)((r & 0xffff) % w);
+            y = (int)((r >> 16 & 0xffff) % h);
+        }
+        if (hot_share_ > 0) {
+            uint64_t q = xorshift(rng_);
+            if ((q >> 11) * (1.0 / 9007199254740992.0) < hot_share_) {
+                x = hot_[q % hot_.size()].first;
+                y = hot_[q % hot_.size()].second;
+            }
+        }
+        soa_.x[i] = x;
+        soa_.y[i] = y;
+        soa_.p[i] = (r >> 63) & 1;
+        soa_.ts_us[i] = t_us + (uint64_t)(i * dt);
+    }
+    handler_->onRawEvents(soa_, w, h);
+    msg.events.resize(soa_.size());
+    convertEvents(soa_, msg.events.data());
+}
+
+void SyntheticDvsSource::run()
+{
+    applyThreadRole(ThreadRole::SdkCallback);
+
+    const steady_clock::time_point t_start = steady_clock::now();
+    const uint64_t imu_period = cfg_.imu_rate > 0 ? 1000000 / cfg_.imu_rate : 0;
+    const uint64_t frame_period = cfg_.frame_rate > 0 ? (uint64_t)(1e6 / cfg_.frame_rate) : 0;
+    uint64_t next_imu = 0, next_frame = 0;
+    double carry = 0;
+    cv::Mat frame(cfg_.height, cfg_.width, CV_16UC1);
+
+    for (uint64_t t = 0; !stop_; t += cfg_.packet_us) {
+        // a packet covering [t, t + packet_us) is complete at its end
+        std::this_thread::sleep_until(t_start + microseconds(t + cfg_.packet_us));
+        const uint64_t t_us = SYNTH_T0_US + t;
+
+        carry += cfg_.event_rate * cfg_.packet_us / 1e6;
+        size_t n = (size_t)carry;
+        carry -= n;
+        if (n > 0) {
+            telemetry::latency(telemetry::EVENTS, telemetry::CALLBACK, t_us);
+            PooledEventArray msg;
+            fillPacket(msg, t_us, n);
+            if (!msg.events.empty())
+                handler_->onEvents(std::move(msg));
+            generated_.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        for (; imu_period && next_imu < t + cfg_.packet_us; next_imu += imu_period) {
+            const double s = (SYNTH_T0_US + next_imu) / 1e6;
+            telemetry::latency(telemetry::IMU, telemetry::CALLBACK, SYNTH_T0_US + next_imu);
+            sensor_msgs::Imu imu;
+            imu.header.stamp = ros::Time(s);
+            imu.linear_acceleration.x = 0.2 * sin(2 * M_PI * s);
+            imu.linear_acceleration.y = 0;
+            imu.linear_acceleration.z = 9.81;
+            imu.angular_velocity.x = 0;
+            imu.angular_velocity.y = 0.5 * cos(2 * M_PI * s);
+            imu.angular_velocity.z = 0;
+            handler_->onImu(std::move(imu));
+        }
+
+        if (frame_period && next_frame < t + cfg_.packet_us) {
+            const int shift = (int)(next_frame / frame_period);
+            const double gain = cfg_.exposure_settle_ms > 0 ?
+                1 - 0.75 * exp(-4.0 * next_frame / (cfg_.exposure_settle_ms * 1000.0)) : 1;
+            for (int r = 0; r < frame.rows; r++) {
+                uint16_t *p = frame.ptr<uint16_t>(r);
+                for (int c = 0; c < frame.cols; c++)
+                    p[c] = (uint16_t)((((c + shift) & 0xff) << 8 | (r & 0xff)) * gain);
+            }
+            telemetry::latency(telemetry::APS, telemetry::CALLBACK, SYNTH_T0_US + next_frame);
+            handler_->onFrame(SYNTH_T0_US + next_frame, frame);
+            next_frame += frame_period;
+        }
+    }
+}
+
+SyntheticD435Source::SyntheticD435Source(int width, int height, double fps, bool depth)
+    : width_(width), height_(height), depth_(depth), period_((long long)(1e6 / fps))
+{
+}
+
+bool SyntheticD435Source::start()
+{
+    t_next_ = steady_clock::now() + period_;
+    fn_ = 0;
+    return true;
+}
+
+bool SyntheticD435Source::next(IRFrame &f, unsigned long long &frame_number)
+{
+    std::this_thread::sleep_until(t_next_);
+    t_next_ += period_;
+    frame_number = ++fn_;
+
+    // the Mat owns its pixels, nothing else to hold
+    f.image.create(height_, width_, CV_8UC1);
+    for (int r = 0; r < height_; r++) {
+        uint8_t *p = f.image.ptr(r);
+        for (int c = 0; c < width_; c++)
+            p[c] = (uint8_t)((c + r + fn_ * 4) & 0xff);
+    }
+    if (depth_)
+        depthFrame(f.depth, width_, height_, fn_);
+    f.stamp = (long long)(fn_ * period_.count());
+    f.expo = 8.0;
+    f.hold.reset();
+    return true;
+}
+
+void SyntheticD435Source::depthFrame(cv::Mat &depth, int width, int height, unsigned long long fn)
+{
+    depth.create(height, width, CV_16UC1);
+    const int box_w = width / 5, box_x = (int)((fn * 4) % (width + box_w)) - box_w;
+    const int box_y = height / 4, box_h = height / 2;
+    const int shadow = width / 40;
+    uint32_t rnd = 0x9e3779b9u * (uint32_t)(fn + 1);
+    for (int r = 0; r < height; r++) {
+        uint16_t *p = depth.ptr<uint16_t>(r);
+        for (int c = 0; c < width; c++) {
+            rnd ^= rnd << 13;
+            rnd ^= rnd >> 17;
+            rnd ^= rnd << 5;
+            const bool in_box = r >= box_y && r < box_y + box_h && c >= box_x && c < box_x + box_w;
+            const bool in_shadow = r >= box_y && r < box_y + box_h && c >= box_x - shadow && c < box_x;
+            double z = in_box ? 900 + 0.2 * (c - box_x) : 1500 + 2.0 * r + 0.3 * c;
+            // triangular noise, about 0.15% of z at 1.5 m, rising with z^2
+            z += z * z * 1e-6 * (((rnd & 0xff) + ((rnd >> 8) & 0xff)) / 255.0 - 1.0);
+            p[c] = in_shadow || (rnd >> 24) < 3 ? 0 : (uint16_t)z;
+        }
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "CaptureSource.h"
+#include "EventConvert.h"
+
+// Parameters of the generated DVS stream. The defaults match the SEES
+// sensor: 320x264, IMU at 1 kHz, mono16 APS frames.
+struct SyntheticDvsConfig {
+    double event_rate = 2e6;        // events/s
+    // uniform: whole sensor; gaussian: blob in the centre; bar: vertical
+    // edge sweeping across the sensor, like a moving scene
+    std::string distribution = "uniform";
+    int packet_us = 1000;           // one polarity packet per this span
+    int imu_rate = 1000;            // Hz, 0 = off
+    double frame_rate = 25;         // APS frames/s, 0 = off
+    int width = 320;
+    int height = 264;
+    // pixels firing at hot_pixel_hz each, taken out of event_rate
+    int hot_pixels = 0;
+    double hot_pixel_hz = 2000;
+    // like a device: start() takes start_ms, and APS brightness creeps up
+    // to its final level as auto exposure would (about exposure_settle_ms)
+    int start_ms = 0;
+    int exposure_settle_ms = 0;
+};
+
+// Generates events, IMU and APS frames in real time on one thread, which
+// stands in for the SDK callback thread. If generating falls behind the
+// wall clock the stream slows down; generated() shows the achieved rate.
+class SyntheticDvsSource : public DvsSource
+{
+public:
+    explicit SyntheticDvsSource(const SyntheticDvsConfig &cfg);
+    ~SyntheticDvsSource();
+
+    bool start(DvsHandler *handler) override;
+    void stop() override;
+    int width() const override { return cfg_.width; }
+    int height() const override { return cfg_.height; }
+
+    uint64_t generated() const { return generated_.load(std::memory_order_relaxed); }
+
+private:
+    void run();
+    void fillPacket(PooledEventArray &msg, uint64_t t_us, size_t n);
+
+    SyntheticDvsConfig cfg_;
+    int dist_ = 0;
+    double hot_share_ = 0;
+    std::vector<std::pair<uint16_t, uint16_t> > hot_;
+    uint64_t rng_ = 0x9e3779b97f4a7c15ull;
+    EventSoA soa_;
+    DvsHandler *handler_ = nullptr;
+    std::atomic_bool stop_{false};
+    std::atomic<uint64_t> generated_{0};
+    std::thread thread_;
+};
+
+// 8-bit infrared frames with a moving pattern at a fixed frame rate.
+class SyntheticD435Source : public D435Source
+{
+public:
+    SyntheticD435Source(int width = 848, int height = 480, double fps = 30, bool depth = false);
+    bool start() override;
+    void stop() override {}
+    bool next(IRFrame &f, unsigned long long &frame_number) override;
+
+    // Depth in mm of a tilted wall and a box passing in front of it, with
+    // stereo-like noise growing with distance and holes in the box's shadow.
+    static void depthFrame(cv::Mat &depth, int width, int height, unsigned long long fn);
+
+private:
+    int width_, height_;
+    bool depth_;
+    std::chrono::microseconds period_;
+    std::chrono::steady_clock::time_point t_next_;
+    unsigned long long fn_ = 0;
+};
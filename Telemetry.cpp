@@ -0,0 +1,381 @@
+#include "Telemetry.h"
+
+namespace telemetry {
+
+const char *streamName(int s)
+{
+    static const char *names[] = {"events", "imu", "aps", "d435", "depth"};
+    return s >= 0 && s < N_STREAMS ? names[s] : "?";
+}
+
+const char *stageName(int s)
+{
+    static const char *names[] = {"callback", "queued", "written"};
+    return s >= 0 && s < N_STAGES ? names[s] : "?";
+}
+
+}
+
+#ifdef CAPTURE_TELEMETRY
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+namespace telemetry {
+
+using namespace std::chrono;
+
+int LatencyHistogram::bucketOf(uint64_t us)
+{
+    if (us < (1u << SUB_BITS)) return (int)us;
+    int e = 63 - __builtin_clzll(us);
+    int b = ((e - SUB_BITS + 1) << SUB_BITS) + (int)((us >> (e - SUB_BITS)) & ((1 << SUB_BITS) - 1));
+    return b < N_BUCKETS ? b : N_BUCKETS - 1;
+}
+
+uint64_t LatencyHistogram::bucketValue(int b)
+{
+    if (b < (1 << SUB_BITS)) return b;
+    int e = (b >> SUB_BITS) + SUB_BITS - 1;
+    uint64_t sub = b & ((1 << SUB_BITS) - 1);
+    uint64_t lower = ((1ull << SUB_BITS) + sub) << (e - SUB_BITS);
+    return lower + (1ull << (e - SUB_BITS)) - 1;
+}
+
+void LatencyHistogram::record(uint64_t us)
+{
+    counts_[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(us, std::memory_order_relaxed);
+    uint64_t m = max_.load(std::memory_order_relaxed);
+    while (us > m && !max_.compare_exchange_weak(m, us, std::memory_order_relaxed)) {}
+}
+
+void LatencyHistogram::reset()
+{
+    for (auto &c : counts_) c = 0;
+    count_ = 0;
+    sum_ = 0;
+    max_ = 0;
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const
+{
+    Snapshot s;
+    for (int i = 0; i < N_BUCKETS; i++)
+        s.counts[i] = counts_[i].load(std::memory_order_relaxed);
+    s.count = count_.load(std::memory_order_relaxed);
+    s.sum = sum_.load(std::memory_order_relaxed);
+    s.max = max_.load(std::memory_order_relaxed);
+    return s;
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::Snapshot::operator-(const Snapshot &o) const
+{
+    Snapshot d;
+    d.count = 0;
+    d.max = 0;
+    for (int i = 0; i < N_BUCKETS; i++) {
+        d.counts[i] = counts[i] - o.counts[i];
+        d.count += d.counts[i];
+        if (d.counts[i]) d.max = bucketValue(i);
+    }
+    d.sum = sum - o.sum;
+    return d;
+}
+
+uint64_t LatencyHistogram::Snapshot::percentile(double p) const
+{
+    if (count == 0) return 0;
+    uint64_t rank = (uint64_t)(p / 100.0 * count + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < N_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank) return std::min(bucketValue(i), max);
+    }
+    return max;
+}
+
+namespace {
+
+struct StreamStats {
+    LatencyHistogram latency[N_STAGES];
+    std::atomic<int64_t> anchor{LLONG_MAX};
+    std::atomic<uint64_t> items{0}, bytes{0}, dropped{0}, dropped_ext{0};
+    std::atomic<size_t> depth{0}, depth_max{0}, depth_peak{0};
+};
+StreamStats streams[N_STREAMS];
+
+const steady_clock::time_point t_origin = steady_clock::now();
+
+int64_t nowUs()
+{
+    return duration_cast<microseconds>(steady_clock::now() - t_origin).count();
+}
+
+// reporting thread
+std::thread reporter;
+std::mutex m_reporter;
+bool stop_reporter = false;
+FILE *stats_fp = nullptr;
+int listen_fd = -1;
+
+const double PERCENTILES[] = {50, 90, 99, 99.9};
+
+}
+
+void latency(Stream s, Stage st, uint64_t sensor_us)
+{
+    StreamStats &ss = streams[s];
+    int64_t d = nowUs() - (int64_t)sensor_us;
+    int64_t a = ss.anchor.load(std::memory_order_relaxed);
+    if (st == CALLBACK) {
+        while (d < a && !ss.anchor.compare_exchange_weak(a, d, std::memory_order_relaxed)) {}
+        if (d < a) a = d;
+    }
+    if (a == LLONG_MAX) return;
+    ss.latency[st].record(d > a ? (uint64_t)(d - a) : 0);
+}
+
+void written(Stream s, uint64_t items, uint64_t bytes)
+{
+    streams[s].items.fetch_add(items, std::memory_order_relaxed);
+    streams[s].bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void dropped(Stream s, uint64_t items)
+{
+    streams[s].dropped.fetch_add(items, std::memory_order_relaxed);
+}
+
+void setDropped(Stream s, uint64_t total)
+{
+    streams[s].dropped_ext.store(total, std::memory_order_relaxed);
+}
+
+void depth(Stream s, size_t items)
+{
+    StreamStats &ss = streams[s];
+    ss.depth.store(items, std::memory_order_relaxed);
+    size_t m = ss.depth_max.load(std::memory_order_relaxed);
+    while (items > m && !ss.depth_max.compare_exchange_weak(m, items, std::memory_order_relaxed)) {}
+    m = ss.depth_peak.load(std::memory_order_relaxed);
+    while (items > m && !ss.depth_peak.compare_exchange_weak(m, items, std::memory_order_relaxed)) {}
+}
+
+static uint64_t droppedTotal(const StreamStats &ss)
+{
+    return ss.dropped.load(std::memory_order_relaxed) + ss.dropped_ext.load(std::memory_order_relaxed);
+}
+
+// One JSON object per line; latencies over the window since the last line.
+static void writeStatsLine(LatencyHistogram::Snapshot prev[N_STREAMS][N_STAGES])
+{
+    fprintf(stats_fp, "{\"t\":%.3f", nowUs() / 1e6);
+    for (int s = 0; s < N_STREAMS; s++) {
+        StreamStats &ss = streams[s];
+        fprintf(stats_fp, ",\"%s\":{\"items\":%lu,\"bytes\":%lu,\"dropped\":%lu,\"depth\":%lu,\"depth_max\":%lu",
+            streamName(s), ss.items.load(std::memory_order_relaxed), ss.bytes.load(std::memory_order_relaxed),
+            droppedTotal(ss), ss.depth.load(std::memory_order_relaxed),
+            ss.depth_max.exchange(0, std::memory_order_relaxed));
+        for (int st = 0; st < N_STAGES; st++) {
+            LatencyHistogram::Snapshot cur = ss.latency[st].snapshot();
+            LatencyHistogram::Snapshot win = cur - prev[s][st];
+            prev[s][st] = cur;
+            fprintf(stats_fp, ",\"%s_us\":{\"n\":%lu", stageName(st), win.count);
+            for (double p : PERCENTILES)
+                fprintf(stats_fp, ",\"p%g\":%lu", p, win.percentile(p));
+            fprintf(stats_fp, ",\"max\":%lu}", win.max);
+        }
+        fprintf(stats_fp, "}");
+    }
+    fprintf(stats_fp, "}\n");
+    fflush(stats_fp);
+}
+
+static std::string prometheusText()
+{
+    std::string out;
+    char line[256];
+    struct Counter {
+        const char *name;
+        uint64_t (*get)(const StreamStats &);
+    } counters[] = {
+        {"capture_items_total", [](const StreamStats &ss) { return ss.items.load(); }},
+        {"capture_bytes_total", [](const StreamStats &ss) { return ss.bytes.load(); }},
+        {"capture_dropped_total", [](const StreamStats &ss) { return droppedTotal(ss); }},
+    };
+    for (const Counter &c : counters) {
+        snprintf(line, sizeof(line), "# TYPE %s counter\n", c.name);
+        out += line;
+        for (int s = 0; s < N_STREAMS; s++) {
+            snprintf(line, sizeof(line), "%s{stream=\"%s\"} %lu\n", c.name, streamName(s), c.get(streams[s]));
+            out += line;
+        }
+    }
+    out += "# TYPE capture_queue_depth gauge\n";
+    for (int s = 0; s < N_STREAMS; s++) {
+        snprintf(line, sizeof(line), "capture_queue_depth{stream=\"%s\"} %lu\n", streamName(s), streams[s].depth.load());
+        out += line;
+    }
+    out += "# TYPE capture_latency_us summary\n";
+    for (int s = 0; s < N_STREAMS; s++) {
+        for (int st = 0; st < N_STAGES; st++) {
+            LatencyHistogram::Snapshot snap = streams[s].latency[st].snapshot();
+            for (double p : PERCENTILES) {
+                snprintf(line, sizeof(line), "capture_latency_us{stream=\"%s\",stage=\"%s\",quantile=\"%g\"} %lu\n",
+                    streamName(s), stageName(st), p / 100, snap.percentile(p));
+                out += line;
+            }
+            snprintf(line, sizeof(line), "capture_latency_us_sum{stream=\"%s\",stage=\"%s\"} %lu\n"
+                "capture_latency_us_count{stream=\"%s\",stage=\"%s\"} %lu\n",
+                streamName(s), stageName(st), snap.sum, streamName(s), stageName(st), snap.count);
+            out += line;
+        }
+    }
+    return out;
+}
+
+static void serveOne()
+{
+    int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) return;
+    // read (and ignore) the request, any path gets the metrics
+    char req[2048];
+    pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, 200) > 0) {
+        ssize_t n = recv(fd, req, sizeof(req), 0);
+        (void)n;
+    }
+    std::string body = prometheusText();
+    std::string resp = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                       std::to_string(body.size()) + "\r\n\r\n" + body;
+    size_t off = 0;
+    while (off < resp.size()) {
+        ssize_t n = send(fd, resp.data() + off, resp.size() - off, MSG_NOSIGNAL);
+        if (n <= 0) break;
+        off += n;
+    }
+    close(fd);
+}
+
+static void reporterLoop(int period_ms)
+{
+    static LatencyHistogram::Snapshot prev[N_STREAMS][N_STAGES];
+    memset(prev, 0, sizeof(prev));
+    auto next = steady_clock::now() + milliseconds(period_ms > 0 ? period_ms : 1000);
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lck(m_reporter);
+            if (stop_reporter) break;
+        }
+        int wait_ms = (int)duration_cast<milliseconds>(next - steady_clock::now()).count();
+        wait_ms = std::max(0, std::min(wait_ms, 100));
+        if (listen_fd >= 0) {
+            pollfd pfd = {listen_fd, POLLIN, 0};
+            if (poll(&pfd, 1, wait_ms) > 0) serveOne();
+        } else {
+            std::this_thread::sleep_for(milliseconds(wait_ms));
+        }
+        if (steady_clock::now() >= next) {
+            if (stats_fp) writeStatsLine(prev);
+            next += milliseconds(period_ms > 0 ? period_ms : 1000);
+        }
+    }
+    if (stats_fp) writeStatsLine(prev);
+}
+
+bool start(const std::string &stats_path, int period_ms, int port)
+{
+    if (period_ms > 0) {
+        stats_fp = fopen(stats_path.c_str(), "w");
+        if (!stats_fp) {
+            printf(" * ERROR! cannot open %s\n", stats_path.c_str());
+            return false;
+        }
+        printf("Telemetry: stats every %d ms -> %s\n", period_ms, stats_path.c_str());
+    }
+    if (port > 0) {
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 4) != 0) {
+            printf(" * WARNING! telemetry port %d: %s, Prometheus endpoint disabled\n", port, strerror(errno));
+            close(listen_fd);
+            listen_fd = -1;
+        } else {
+            printf("Telemetry: Prometheus metrics on http://127.0.0.1:%d/metrics\n", port);
+        }
+    }
+    if (!stats_fp && listen_fd < 0) return true;
+    stop_reporter = false;
+    reporter = std::thread(reporterLoop, period_ms);
+    return true;
+}
+
+void stop()
+{
+    if (reporter.joinable()) {
+        {
+            std::lock_guard<std::mutex> lck(m_reporter);
+            stop_reporter = true;
+        }
+        reporter.join();
+    }
+    if (stats_fp) fclose(stats_fp);
+    stats_fp = nullptr;
+    if (listen_fd >= 0) close(listen_fd);
+    listen_fd = -1;
+}
+
+void reset()
+{
+    for (StreamStats &ss : streams) {
+        for (LatencyHistogram &h : ss.latency) h.reset();
+        ss.anchor = LLONG_MAX;
+        ss.items = 0;
+        ss.bytes = 0;
+        ss.dropped = 0;
+        ss.dropped_ext = 0;
+        ss.depth = 0;
+        ss.depth_max = 0;
+        ss.depth_peak = 0;
+    }
+}
+
+void printSummary()
+{
+    printf("Latency since sensor timestamp [us] (p50 / p99 / max):\n");
+    for (int s = 0; s < N_STREAMS; s++) {
+        const StreamStats &ss = streams[s];
+        if (ss.latency[CALLBACK].snapshot().count == 0 && ss.items.load() == 0) continue;
+        printf("  %-6s", streamName(s));
+        for (int st = 0; st < N_STAGES; st++) {
+            LatencyHistogram::Snapshot snap = ss.latency[st].snapshot();
+            printf("  %s %lu / %lu / %lu", stageName(st), snap.percentile(50), snap.percentile(99), snap.max);
+        }
+        printf("  | %lu written, %.1f MB, %lu dropped, max depth %lu\n", ss.items.load(), ss.bytes.load() / 1e6,
+            droppedTotal(ss), ss.depth_peak.load());
+    }
+}
+
+}
+
+#endif
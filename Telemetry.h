@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Pipeline telemetry: latency histograms per stream and stage, queue depths,
+// bytes written and drops. Recording is a few relaxed atomic adds; a
+// background thread appends a JSON snapshot to a stats file every period and
+// can serve the same numbers in Prometheus text format on 127.0.0.1.
+//
+// Built only with -DCAPTURE_TELEMETRY (CMake option of the same name);
+// otherwise every call below is an empty inline function.
+namespace telemetry {
+
+enum Stream { EVENTS, IMU, APS, D435, DEPTH, N_STREAMS };
+
+// Latency is measured from the sensor timestamp. Sensor clocks are not the
+// host clock, so each stream is anchored at the smallest (host - sensor)
+// difference seen at CALLBACK; latencies are relative to that best case.
+enum Stage { CALLBACK, QUEUED, WRITTEN, N_STAGES };
+
+const char *streamName(int s);
+const char *stageName(int s);
+
+#ifdef CAPTURE_TELEMETRY
+
+// Log-linear histogram of microsecond values, 16 buckets per power of two
+// (about 6% resolution) up to 2^36 us. Lock-free, any number of writers.
+class LatencyHistogram
+{
+public:
+    static const int SUB_BITS = 4;
+    static const int N_BUCKETS = (36 - SUB_BITS + 1) << SUB_BITS;
+
+    void record(uint64_t us);
+    // Copies the counts; snapshots can be subtracted for a window.
+    struct Snapshot {
+        uint64_t counts[N_BUCKETS];
+        uint64_t count;
+        uint64_t sum;
+        uint64_t max;
+        uint64_t percentile(double p) const;
+        Snapshot operator-(const Snapshot &o) const;
+    };
+    Snapshot snapshot() const;
+    void reset();
+
+    static int bucketOf(uint64_t us);
+    static uint64_t bucketValue(int b);     // upper bound of bucket b
+
+private:
+    std::atomic<uint64_t> counts_[N_BUCKETS] = {};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+void latency(Stream s, Stage st, uint64_t sensor_us);
+void written(Stream s, uint64_t items, uint64_t bytes);
+void dropped(Stream s, uint64_t items);
+// For counters kept elsewhere (e.g. SPSCQueue stats): total so far.
+void setDropped(Stream s, uint64_t total);
+void depth(Stream s, size_t items);
+
+// Starts the reporting thread. period_ms <= 0 disables the stats file,
+// port <= 0 the Prometheus endpoint.
+bool start(const std::string &stats_path, int period_ms, int port);
+void stop();
+// Zeroes all counters; only while nothing is recording.
+void reset();
+void printSummary();
+
+#else
+
+inline void latency(Stream, Stage, uint64_t) {}
+inline void written(Stream, uint64_t, uint64_t) {}
+inline void dropped(Stream, uint64_t) {}
+inline void setDropped(Stream, uint64_t) {}
+inline void depth(Stream, size_t) {}
+inline bool start(const std::string &, int, int) { return true; }
+inline void stop() {}
+inline void reset() {}
+inline void printSummary() {}
+
+#endif
+
+}
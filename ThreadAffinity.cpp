@@ -0,0 +1,216 @@
+#include "ThreadAffinity.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "CaptureConfig.h"
+
+namespace {
+
+const int N_ROLES = (int)ThreadRole::Count;
+
+struct RoleSetup {
+    bool pinned = false;
+    cpu_set_t cpus;
+};
+RoleSetup roles[N_ROLES];
+cpu_set_t all_cpus;     // what the process may run on, for unpinned roles
+
+std::mutex m_threads;
+std::vector<RoleThread> threads;
+
+const std::string &roleCpuList(ThreadRole role)
+{
+    const CaptureConfig &c = capture_cfg;
+    switch (role) {
+    case ThreadRole::SdkCallback: return c.cpu_sdk_callback;
+    case ThreadRole::D435Grab: return c.cpu_d435_grab;
+    case ThreadRole::Encoder: return c.cpu_encoder;
+    case ThreadRole::Writer: return c.cpu_writer;
+    case ThreadRole::Compressor: return c.cpu_compressor;
+    default: return c.cpu_preview;
+    }
+}
+
+bool isGrabRole(ThreadRole role)
+{
+    return role == ThreadRole::SdkCallback || role == ThreadRole::D435Grab;
+}
+
+std::string formatCpus(const cpu_set_t &set)
+{
+    std::string s;
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+        if (!CPU_ISSET(i, &set)) continue;
+        int j = i;
+        while (j + 1 < CPU_SETSIZE && CPU_ISSET(j + 1, &set)) j++;
+        if (!s.empty()) s += ",";
+        s += std::to_string(i);
+        if (j > i) s += "-" + std::to_string(j);
+        i = j;
+    }
+    return s;
+}
+
+}
+
+const char *threadRoleName(ThreadRole role)
+{
+    static const char *names[] = {"sdk_callback", "d435_grab", "encoder", "writer", "compressor", "preview"};
+    return (int)role < N_ROLES ? names[(int)role] : "?";
+}
+
+bool parseCpuList(const std::string &list, std::vector<int> &cpus, std::string &err)
+{
+    cpus.clear();
+    const char *p = list.c_str();
+    while (*p) {
+        char *end;
+        long a = strtol(p, &end, 10);
+        if (end == p || a < 0) {
+            err = "expected a core number at '" + std::string(p) + "'";
+            return false;
+        }
+        long b = a;
+        p = end;
+        if (*p == '-') {
+            b = strtol(p + 1, &end, 10);
+            if (end == p + 1 || b < a) {
+                err = "bad range at '" + std::string(p) + "'";
+                return false;
+            }
+            p = end;
+        }
+        for (long i = a; i <= b; i++) cpus.push_back((int)i);
+        if (*p == ',') p++;
+        else if (*p) {
+            err = "unexpected '" + std::string(p) + "'";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool setupThreadAffinity()
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        printf(" * ERROR! sched_getaffinity: %s\n", strerror(errno));
+        return false;
+    }
+
+    bool ok = true;
+    for (int r = 0; r < N_ROLES; r++) {
+        ThreadRole role = (ThreadRole)r;
+        const std::string &list = roleCpuList(role);
+        roles[r].pinned = false;
+        CPU_ZERO(&roles[r].cpus);
+        if (list.empty()) continue;
+
+        std::vector<int> cpus;
+        std::string err;
+        if (!parseCpuList(list, cpus, err)) {
+            printf(" * ERROR! cpu_%s: %s\n", threadRoleName(role), err.c_str());
+            ok = false;
+            continue;
+        }
+        for (int c : cpus) {
+            if (c >= CPU_SETSIZE || !CPU_ISSET(c, &allowed)) {
+                printf(" * ERROR! cpu_%s: core %d is not available (allowed: %s)\n",
+                    threadRoleName(role), c, formatCpus(allowed).c_str());
+                ok = false;
+                break;
+            }
+            CPU_SET(c, &roles[r].cpus);
+        }
+        roles[r].pinned = !cpus.empty();
+    }
+
+    const int rt = capture_cfg.rt_priority;
+    if (rt < 0 || rt > sched_get_priority_max(SCHED_FIFO)) {
+        printf(" * ERROR! rt_priority must be 0 (off) or 1-%d\n", sched_get_priority_max(SCHED_FIFO));
+        ok = false;
+    }
+    if (!ok) return false;
+    all_cpus = allowed;
+
+    printf("CPU affinity (allowed cores %s):\n", formatCpus(allowed).c_str());
+    for (int r = 0; r < N_ROLES; r++) {
+        ThreadRole role = (ThreadRole)r;
+        printf("  %-12s : %s", threadRoleName(role), roles[r].pinned ? formatCpus(roles[r].cpus).c_str() : "any");
+        if (isGrabRole(role) && rt > 0) printf(", SCHED_FIFO %d", rt);
+        printf("\n");
+    }
+
+    // a grab thread sharing its cores with a busy role defeats the purpose
+    for (int g = 0; g < N_ROLES; g++) {
+        if (!isGrabRole((ThreadRole)g) || !roles[g].pinned) continue;
+        for (int r = 0; r < N_ROLES; r++) {
+            if (r == g || !roles[r].pinned) continue;
+            cpu_set_t both;
+            CPU_AND(&both, &roles[g].cpus, &roles[r].cpus);
+            if (CPU_COUNT(&both) > 0)
+                printf(" * WARNING! %s shares cores %s with %s\n", threadRoleName((ThreadRole)g),
+                    formatCpus(both).c_str(), threadRoleName((ThreadRole)r));
+        }
+    }
+    return true;
+}
+
+void applyThreadRole(ThreadRole role)
+{
+    // SDK callbacks call this per packet; only the first call does anything
+    thread_local unsigned applied = 0;
+    const unsigned bit = 1u << (int)role;
+    if (applied & bit) return;
+    applied |= bit;
+    {
+        std::lock_guard<std::mutex> lck(m_threads);
+        threads.push_back({role, (int)syscall(SYS_gettid)});
+    }
+
+    // A new thread inherits its creator's mask and policy, e.g. an encoder
+    // started from the grab thread: every role sets both explicitly.
+    const RoleSetup &rs = roles[(int)role];
+    const cpu_set_t &mask = rs.pinned ? rs.cpus : all_cpus;
+    if (CPU_COUNT(&mask) > 0) {
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+        if (err != 0)
+            printf(" * WARNING! cannot pin %s thread: %s\n", threadRoleName(role), strerror(err));
+    }
+    if (!isGrabRole(role)) {
+        int policy;
+        sched_param sp;
+        if (pthread_getschedparam(pthread_self(), &policy, &sp) == 0 && policy != SCHED_OTHER) {
+            sp.sched_priority = 0;
+            pthread_setschedparam(pthread_self(), SCHED_OTHER, &sp);
+        }
+    } else if (capture_cfg.rt_priority > 0) {
+        sched_param sp;
+        sp.sched_priority = capture_cfg.rt_priority;
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+        if (err != 0)
+            printf(" * WARNING! no SCHED_FIFO for %s thread: %s (needs CAP_SYS_NICE or an rtprio limit)\n",
+                threadRoleName(role), strerror(err));
+    }
+}
+
+std::vector<RoleThread> roleThreads()
+{
+    std::lock_guard<std::mutex> lck(m_threads);
+    return threads;
+}
+
+void clearRoleThreads()
+{
+    std::lock_guard<std::mutex> lck(m_threads);
+    threads.clear();
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Capture thread roles that can be pinned to cores through capture_config
+// (cpu_<role> lists such as "2" or "0-1,4"; empty: any allowed core).
+enum class ThreadRole {
+    SdkCallback,    // SEES callbacks (DVS events, IMU, APS frames)
+    D435Grab,       // librealsense wait_for_frames loop
+    Encoder,        // D435 frame encoder pool
+    Writer,         // bag / event file writer
+    Compressor,     // bag chunk compression pool
+    Preview,        // HighGUI loop in main
+    Count
+};
+
+const char *threadRoleName(ThreadRole role);
+
+// Parses "0-3,6" into core numbers. Returns false and sets err on bad syntax.
+bool parseCpuList(const std::string &list, std::vector<int> &cpus, std::string &err);
+
+// Validates the configured masks against the cores this process may run on
+// and logs the assignment. Call once after loadCaptureConfig().
+bool setupThreadAffinity();
+
+// Pins the calling thread to its role's cores, or to all allowed cores when
+// the role is not pinned. The grab roles get SCHED_FIFO when rt_priority > 0,
+// the others SCHED_OTHER. Cheap after the first call on a thread.
+void applyThreadRole(ThreadRole role);
+
+// Threads that called applyThreadRole(), for per-stage CPU accounting.
+struct RoleThread {
+    ThreadRole role;
+    int tid;
+};
+std::vector<RoleThread> roleThreads();
+void clearRoleThreads();
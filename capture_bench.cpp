@@ -0,0 +1,1866 @@
+// Headless throughput benchmark: synthetic DVS (and optionally D435) data
+// through the real capture pipeline (pool, queues, writer, event sinks,
+// frame encoders), written to disk. Reports the sustained event rate, disk
+// bandwidth and CPU per pipeline stage; --sweep doubles the event rate until
+// the pipeline drops data. --convert instead times the packet conversion
+// kernels (EventConvert.h) and checks them against the per-event ros::Time
+// conversion they replace, --aps counts copies and heap allocations per
+// APS frame on the way to the bag, and --evt-alloc does the same for event
+// packets, pooled against the std::vector decode they replace. --compress measures compressed bag
+// output (CompressedBag.h) per codec and thread count, --sync checks the
+// online clock fit and DVS/D435 pairing (SensorSync.h) on simulated clocks,
+// --noise times the background-activity filter (NoiseFilter.h) on moving
+// edges mixed with noise and hot pixels, --mask measures hot pixel learning
+// and ROI masking (PixelMask.h) against injected hot pixels, --startup
+// breaks down the time from launch to the first recorded event, and --depth
+// compares the lossless depth codec (DepthCodec.h) with LZ4/zstd and times
+// the depth encoder pool. --shm has a subscriber process read event packets
+// from the live shared memory ring (ShmRing.h), with a fast and a slow
+// reader, for latency, throughput and what the publisher pays. --replay
+// feeds a recorded session (ReplaySource.h) through the pipeline instead of
+// synthetic data and reports the pace it kept. --queue stresses the event
+// queue (SPSCQueue.h) with a producer and a slow consumer thread under each
+// overflow policy and checks ordering and the overflow counters.
+// --evb-check round-trips random packets through the compact event block
+// codec (EventCodec.h) and makes sure corrupt or truncated blocks are
+// rejected.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <ftw.h>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <cv_bridge/cv_bridge.h>
+
+#include "CaptureConfig.h"
+#include "ApsFrame.h"
+#include "BagWriter.h"
+#include "CompressedBag.h"
+#include "DVSCapture.h"
+#include "EventCodec.h"
+#include "EventConvert.h"
+#include "D435Capture.h"
+#include "DepthCodec.h"
+#include "FrameContainer.h"
+#include "LiveFeed.h"
+#include "MemoryBudget.h"
+#include "NoiseFilter.h"
+#include "PixelMask.h"
+#include "Preview.h"
+#include "ReplaySource.h"
+#include "SensorSync.h"
+#include "ShmRing.h"
+#include "SPSCQueue.h"
+#include "Startup.h"
+#include "SyntheticSource.h"
+#include "ThreadAffinity.h"
+#include "Telemetry.h"
+
+std::atomic_bool is_shutdown;
+
+#ifdef __GLIBC__
+// malloc calls made by the current thread, for --aps. Covers operator new
+// and cv::fastMalloc alike.
+static thread_local uint64_t thread_mallocs = 0;
+extern "C" void *__libc_malloc(size_t n);
+extern "C" void *malloc(size_t n)
+{
+    thread_mallocs++;
+    return __libc_malloc(n);
+}
+#endif
+
+using namespace std::chrono;
+
+struct BenchOptions {
+    SyntheticDvsConfig dvs;
+    double seconds = 10;
+    double warmup = 2;
+    bool d435 = false;
+    double sweep_max = 0;
+    bool keep = false;
+    bool convert = false;
+    bool aps = false;
+    bool evt_alloc = false;
+    bool compress = false;
+    bool sync = false;
+    bool noise = false;
+    int noise_us = 0;               // 0: noise_filter_us from the config, else 2000
+    bool mask = false;
+    bool startup = false;
+    bool depth = false;
+    bool shm = false;
+    bool queue = false;
+    bool evb_check = false;
+    std::string live;               // empty: shm_name from the config
+    std::string replay;             // recorded session prefix
+    double speed = 0;               // with replay: 0 = as fast as possible
+    int budget_mb = -1;             // -1: mem_budget_mb from the config
+    std::string codec = "all";
+    int level = 0;                  // 0: lz4 1, zstd 3
+    double compress_mb = 256;
+    std::string input;
+    int max_threads = 0;            // 0: all cores
+    int rotate_mb = -1;             // -1: from the config
+    int rotate_min = -1;
+    int journal_ms = -1;
+    std::string out = "/tmp";
+    std::string config = "capture_config.yaml";
+};
+
+struct BenchResult {
+    double target_rate = 0;
+    double gen_rate = 0;        // events/s achieved by the generator
+    double mb_per_sec = 0;      // written by the DVS writer
+    DvsRunStats run;
+    std::map<ThreadRole, double> cpu;   // % of one core, summed over threads
+    bool ok = false;
+};
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [options]\n"
+           "  --rate R         events/s (default 2e6)\n"
+           "  --dist D         uniform | gaussian | bar (default uniform)\n"
+           "  --packet-us N    µs per polarity packet (default 1000)\n"
+           "  --frame-rate F   APS frames/s, 0 = off (default 25)\n"
+           "  --seconds S      measured time per run (default 10)\n"
+           "  --warmup S       unmeasured time before that (default 2)\n"
+           "  --d435           also record synthetic 848x480 infrared frames at 30 fps (and depth, per d435_depth)\n"
+           "  --sweep MAX      double the rate from --rate up to MAX until data is dropped\n"
+           "  --budget-mb N    memory budget for data in flight (default: mem_budget_mb)\n"
+           "  --out DIR        where the recordings go (default /tmp)\n"
+           "  --keep           keep the recordings\n"
+           "  --convert        benchmark and verify the event conversion kernels only\n"
+           "  --aps            count copies and allocations per APS frame only\n"
+           "  --evt-alloc      count allocations per event packet, pooled vs std::vector (uses --rate, --packet-us), only\n"
+           "  --queue          event queue ordering and overflow counters per policy, two threads, only\n"
+           "  --evb-check      compact event block round trip, corrupt and truncated blocks, only\n"
+           "  --compress       compressed bag MB/s and ratio per codec and thread count only\n"
+           "  --codec C        with --compress: lz4 | zstd | all (default all)\n"
+           "  --level N        with --compress: codec level (default lz4 1, zstd 3)\n"
+           "  --mb N           with --compress: MB of synthetic data (default 256)\n"
+           "  --input F.bagz   with --compress: recorded messages instead of synthetic ones\n"
+           "  --max-threads N  with --compress: thread counts 1, 2, 4 .. N (default: cores)\n"
+           "  --sync           DVS/D435 clock fit and frame pairing on 60 s of simulated clocks only\n"
+           "  --noise          noise filter Mev/s and pass ratio per window only (uses --rate)\n"
+           "  --noise-us N     with --noise: the window to report on (default noise_filter_us or 2000)\n"
+           "  --hot-pixels N   inject N hot pixels (default 0, 16 with --mask)\n"
+           "  --hot-hz F       rate of each hot pixel (default 2000)\n"
+           "  --mask           events/s and MB/s without a mask, with learned hot pixels, and with an ROI only\n"
+           "  --startup        time from launch to the first recorded event, step by step, only\n"
+           "  --start-ms N     simulated device start time (default 0, 800 with --startup)\n"
+           "  --settle-ms N    simulated auto exposure settling (default 0, 300 with --startup)\n"
+           "  --depth          depth codec ratio and ms/frame against lz4/zstd, and encoder pool frames/s only\n"
+           "  --rotate-mb N    rotate the recordings every N MB (default: rotate_mb)\n"
+           "  --rotate-min N   rotate the recordings every N minutes (default: rotate_min)\n"
+           "  --journal-ms N   group commit every N ms (default: journal_ms)\n"
+           "  --shm            live shared memory ring latency and throughput, fast and slow reader, only\n"
+           "  --live NAME      publish the recordings to /dev/shm/NAME.* for shm_subscriber (default: shm_name)\n"
+           "  --replay PREFIX  record a replay of Capture-<ts> (its -dvs.bag/.bagz and D435 frames) instead\n"
+           "  --speed S        with --replay: S x the recorded pace, 0 = as fast as possible (default 0)\n"
+           "  --config FILE    capture config (default capture_config.yaml)\n", prog);
+}
+
+static bool parseArgs(int argc, char **argv, BenchOptions &o)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        bool has_val = i + 1 < argc;
+        if (a == "--rate" && has_val) o.dvs.event_rate = atof(argv[++i]);
+        else if (a == "--dist" && has_val) o.dvs.distribution = argv[++i];
+        else if (a == "--packet-us" && has_val) o.dvs.packet_us = atoi(argv[++i]);
+        else if (a == "--frame-rate" && has_val) o.dvs.frame_rate = atof(argv[++i]);
+        else if (a == "--seconds" && has_val) o.seconds = atof(argv[++i]);
+        else if (a == "--warmup" && has_val) o.warmup = atof(argv[++i]);
+        else if (a == "--sweep" && has_val) o.sweep_max = atof(argv[++i]);
+        else if (a == "--out" && has_val) o.out = argv[++i];
+        else if (a == "--config" && has_val) o.config = argv[++i];
+        else if (a == "--d435") o.d435 = true;
+        else if (a == "--keep") o.keep = true;
+        else if (a == "--convert") o.convert = true;
+        else if (a == "--aps") o.aps = true;
+        else if (a == "--evt-alloc") o.evt_alloc = true;
+        else if (a == "--compress") o.compress = true;
+        else if (a == "--sync") o.sync = true;
+        else if (a == "--noise") o.noise = true;
+        else if (a == "--noise-us" && has_val) o.noise_us = atoi(argv[++i]);
+        else if (a == "--mask") o.mask = true;
+        else if (a == "--startup") o.startup = true;
+        else if (a == "--depth") o.depth = true;
+        else if (a == "--shm") o.shm = true;
+        else if (a == "--queue") o.queue = true;
+        else if (a == "--evb-check") o.evb_check = true;
+        else if (a == "--live" && has_val) o.live = argv[++i];
+        else if (a == "--replay" && has_val) o.replay = argv[++i];
+        else if (a == "--speed" && has_val) o.speed = atof(argv[++i]);
+        else if (a == "--start-ms" && has_val) o.dvs.start_ms = atoi(argv[++i]);
+        else if (a == "--settle-ms" && has_val) o.dvs.exposure_settle_ms = atoi(argv[++i]);
+        else if (a == "--hot-pixels" && has_val) o.dvs.hot_pixels = atoi(argv[++i]);
+        else if (a == "--hot-hz" && has_val) o.dvs.hot_pixel_hz = atof(argv[++i]);
+        else if (a == "--budget-mb" && has_val) o.budget_mb = atoi(argv[++i]);
+        else if (a == "--codec" && has_val) o.codec = argv[++i];
+        else if (a == "--level" && has_val) o.level = atoi(argv[++i]);
+        else if (a == "--mb" && has_val) o.compress_mb = atof(argv[++i]);
+        else if (a == "--input" && has_val) o.input = argv[++i];
+        else if (a == "--max-threads" && has_val) o.max_threads = atoi(argv[++i]);
+        else if (a == "--rotate-mb" && has_val) o.rotate_mb = atoi(argv[++i]);
+        else if (a == "--rotate-min" && has_val) o.rotate_min = atoi(argv[++i]);
+        else if (a == "--journal-ms" && has_val) o.journal_ms = atoi(argv[++i]);
+        else return false;
+    }
+    return o.dvs.event_rate > 0 && o.seconds > 0;
+}
+
+// utime + stime of one thread in clock ticks, -1 if it is gone
+static long threadCpuTicks(int tid)
+{
+    char path[64];
+    sprintf(path, "/proc/self/task/%d/stat", tid);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+    char buf[1024];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[n] = 0;
+    // fields after the command name: state is field 3, utime 14, stime 15
+    const char *p = strrchr(buf, ')');
+    if (!p) return -1;
+    unsigned long utime = 0, stime = 0;
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+        return -1;
+    return (long)(utime + stime);
+}
+
+static std::map<int, long> sampleThreads()
+{
+    std::map<int, long> ticks;
+    for (const RoleThread &t : roleThreads())
+        ticks[t.tid] = threadCpuTicks(t.tid);
+    return ticks;
+}
+
+static int removeEntry(const char *path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+static void removeRecording(const std::string &folder)
+{
+    nftw(folder.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+    for (const char *suffix : {"-dvs.bag", "-dvs.bag.active", "-dvs.bagz", "-dvs.evb", "-dvs.evc", "-shed.txt",
+                               "-hotpixels.txt"})
+        remove((folder + suffix).c_str());
+}
+
+static bool runOnce(const BenchOptions &o, double rate, BenchResult &res)
+{
+    char name[64];
+    sprintf(name, "/bench-%ld-%.0f", (long)time(nullptr), rate);
+    std::string folder = o.out + name;
+    mkdir(folder.c_str(), ACCESSPERMS);
+
+    SyntheticDvsConfig cfg = o.dvs;
+    cfg.event_rate = rate;
+    SyntheticDvsSource dvs(cfg);
+    SyntheticD435Source d435(848, 480, 30, capture_cfg.d435_depth);
+
+    membudget::Config mb;
+    mb.budget_bytes = (size_t)std::max(o.budget_mb >= 0 ? o.budget_mb : capture_cfg.mem_budget_mb, 0) << 20;
+    mb.events = capture_cfg.shed_events;
+    mb.evt_decimate = capture_cfg.shed_evt_decimate;
+    mb.evt_roi_percent = capture_cfg.shed_evt_roi_percent;
+    if (!membudget::start(folder + "-shed.txt", mb))
+        return false;
+    if (!live::start(o.live.empty() ? capture_cfg.shm_name : o.live, (size_t)std::max(capture_cfg.shm_mb, 4) << 20))
+        return false;
+
+    is_shutdown = false;
+    clearRoleThreads();
+    telemetry::reset();
+    startup::begin();
+    int dvs_ret = EXIT_FAILURE;
+    std::thread t_dvs([&] { dvs_ret = DVSMain(folder, dvs, &res.run); });
+    std::thread t_d435;
+    if (o.d435)
+        t_d435 = std::thread([&] { D435Main(folder, d435); });
+
+    std::this_thread::sleep_for(duration<double>(o.warmup));
+    uint64_t ev0 = dvs.generated();
+    std::map<int, long> cpu0 = sampleThreads();
+    auto t0 = steady_clock::now();
+
+    std::this_thread::sleep_for(duration<double>(o.seconds));
+    uint64_t ev1 = dvs.generated();
+    std::map<int, long> cpu1 = sampleThreads();
+    double dt = duration_cast<duration<double> >(steady_clock::now() - t0).count();
+
+    is_shutdown = true;
+    t_dvs.join();
+    if (t_d435.joinable()) t_d435.join();
+    membudget::stop();
+    membudget::printSummary();
+    live::stop();
+    live::printSummary();
+    if (!o.keep) removeRecording(folder);
+    if (dvs_ret != EXIT_SUCCESS) return false;
+
+    res.target_rate = rate;
+    res.gen_rate = (ev1 - ev0) / dt;
+    res.mb_per_sec = res.run.elapsed_sec > 0 ? res.run.bytes / 1e6 / res.run.elapsed_sec : 0;
+    const double hz = sysconf(_SC_CLK_TCK);
+    for (const RoleThread &t : roleThreads()) {
+        auto a = cpu0.find(t.tid), b = cpu1.find(t.tid);
+        if (a == cpu0.end() || b == cpu1.end() || a->second < 0 || b->second < 0) continue;
+        res.cpu[t.role] += 100.0 * (b->second - a->second) / hz / dt;
+    }
+    // keeping up: nothing dropped and the generator was not slowed down
+    res.ok = res.run.packets_dropped == 0 && res.gen_rate >= 0.98 * rate;
+    return true;
+}
+
+static inline uint64_t xorshift(uint64_t &s)
+{
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+// What SeesSource did per event before EventConvert.
+static void convertReference(const EventSoA &in, PooledEvent *out)
+{
+    for (size_t i = 0; i < in.size(); i++) {
+        out[i].ts = ros::Time(in.ts_us[i] / 1e6);
+        out[i].polarity = in.p[i];
+        out[i].x = in.x[i];
+        out[i].y = in.y[i];
+    }
+}
+
+static size_t countMismatches(const EventSoA &in, SimdLevel level)
+{
+    std::vector<PooledEvent> ref(in.size()), out(in.size());
+    convertReference(in, ref.data());
+    convertEvents(in, out.data(), level);
+    size_t bad = 0;
+    for (size_t i = 0; i < in.size(); i++)
+        if (ref[i].x != out[i].x || ref[i].y != out[i].y || ref[i].polarity != out[i].polarity ||
+            ref[i].ts.sec != out[i].ts.sec || ref[i].ts.nsec != out[i].ts.nsec)
+            bad++;
+    return bad;
+}
+
+// Packets that cross second boundaries, go backwards, or are not a multiple
+// of the vector width.
+static std::vector<EventSoA> edgeCasePackets()
+{
+    std::vector<EventSoA> packets;
+    uint64_t rng = 12345;
+    const uint64_t starts[] = {0, 999990, 5000000 - 7, 86399999995ull, 1000000000000ull - 3};
+    for (uint64_t t0 : starts) {
+        for (size_t n = 0; n <= 40; n++) {
+            EventSoA soa;
+            soa.resize(n);
+            for (size_t i = 0; i < n; i++) {
+                uint64_t r = xorshift(rng);
+                soa.ts_us[i] = t0 + i;
+                soa.x[i] = r & 0xffff;
+                soa.y[i] = (r >> 16) & 0xffff;
+                soa.p[i] = (r >> 32) & 1;
+            }
+            if (n > 9 && t0 >= 2000000) soa.ts_us[n / 2] -= 2000000;     // out of order
+            packets.push_back(soa);
+        }
+    }
+    return packets;
+}
+
+static int runConvertBench(const BenchOptions &o)
+{
+    const size_t n = std::max<size_t>(1, (size_t)(o.dvs.event_rate * o.dvs.packet_us / 1e6));
+    const double dt = (double)o.dvs.packet_us / n;
+    std::vector<EventSoA> packets(64);
+    uint64_t rng = 0x9e3779b97f4a7c15ull, t_us = 5000000;
+    for (EventSoA &soa : packets) {
+        soa.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            uint64_t r = xorshift(rng);
+            soa.ts_us[i] = t_us + (uint64_t)(i * dt);
+            soa.x[i] = (r & 0xffff) % o.dvs.width;
+            soa.y[i] = (r >> 16 & 0xffff) % o.dvs.height;
+            soa.p[i] = (r >> 63) & 1;
+        }
+        t_us += o.dvs.packet_us * 4001;  // lands on every phase of the second
+    }
+    std::vector<EventSoA> edges = edgeCasePackets();
+
+    std::vector<SimdLevel> levels = {SimdLevel::Scalar};
+    if (simdDetect() >= SimdLevel::SSE41) levels.push_back(SimdLevel::SSE41);
+    if (simdDetect() >= SimdLevel::AVX2) levels.push_back(SimdLevel::AVX2);
+
+    printf("capture_bench --convert: %lu events per packet, dispatch picks %s\n",
+        n, simdLevelName(simdDetect()));
+    std::vector<PooledEvent> out(n);
+    auto timeIt = [&](std::function<void(const EventSoA &)> fn) {
+        // as many passes as fit in about a second
+        uint64_t events = 0;
+        auto t0 = steady_clock::now();
+        double dt = 0;
+        while (dt < 1.0) {
+            for (const EventSoA &soa : packets) fn(soa);
+            events += packets.size() * n;
+            dt = duration_cast<duration<double> >(steady_clock::now() - t0).count();
+        }
+        return events / dt;
+    };
+
+    double ref = timeIt([&](const EventSoA &soa) { convertReference(soa, out.data()); });
+    printf("%-10s %8.1f Mev/s\n", "ros::Time", ref / 1e6);
+    bool exact = true;
+    for (SimdLevel level : levels) {
+        double rate = timeIt([&](const EventSoA &soa) { convertEvents(soa, out.data(), level); });
+        size_t bad = 0;
+        for (const EventSoA &soa : packets) bad += countMismatches(soa, level);
+        for (const EventSoA &soa : edges) bad += countMismatches(soa, level);
+        printf("%-10s %8.1f Mev/s  x%.1f  %s\n", simdLevelName(level), rate / 1e6, rate / ref,
+            bad ? "MISMATCH" : "bit-exact");
+        if (bad) {
+            printf(" * ERROR! %s: %lu events differ from ros::Time(us / 1e6)\n", simdLevelName(level), bad);
+            exact = false;
+        }
+    }
+    return exact ? 0 : 1;
+}
+
+template <class M>
+static void serializeInto(const M &msg, std::vector<uint8_t> &buf)
+{
+    buf.resize(ros::serialization::serializationLength(msg));
+    ros::serialization::OStream s(buf.data(), buf.size());
+    ros::serialization::serialize(s, msg);
+}
+
+// Event packets from decode to bag serialization, as the SDK callback and
+// the writer see them: the pooled path (resize + convertEvents into a
+// PooledEventArray) against the one it replaced (stack array, per-event
+// ros::Time, copy into a std::vector).
+static int runEvtAllocBench(const BenchOptions &o)
+{
+#ifndef __GLIBC__
+    printf(" * ERROR! --evt-alloc needs glibc to count allocations\n");
+    return 1;
+#else
+    const size_t OLD_MAX = 5000;    // the old stack array, larger packets overflowed it
+    const int packets = 20000, warmup = 1000;
+    size_t n = std::max<size_t>(1, (size_t)(o.dvs.event_rate * o.dvs.packet_us / 1e6));
+    if (n > OLD_MAX) {
+        printf("%lu events per packet do not fit the old %lu event array, using %lu\n", n, OLD_MAX, OLD_MAX);
+        n = OLD_MAX;
+    }
+    EventSoA soa;
+    soa.resize(n);
+    uint64_t rng = 0x9e3779b97f4a7c15ull;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t r = xorshift(rng);
+        soa.x[i] = (r & 0xffff) % o.dvs.width;
+        soa.y[i] = (r >> 16 & 0xffff) % o.dvs.height;
+        soa.p[i] = (r >> 63) & 1;
+    }
+    std::vector<uint8_t> out;
+    auto setTimes = [&](int k) {
+        const uint64_t t0 = 5000000 + (uint64_t)k * o.dvs.packet_us;
+        for (size_t i = 0; i < n; i++)
+            soa.ts_us[i] = t0 + i * o.dvs.packet_us / n;
+    };
+
+    SPSCQueue<dvs_msgs::EventArray> old_q(64);
+    uint64_t m0 = 0;
+    auto t0 = steady_clock::now();
+    for (int k = 0; k < packets; k++) {
+        if (k == warmup) {
+            m0 = thread_mallocs;
+            t0 = steady_clock::now();
+        }
+        setTimes(k);
+        dvs_msgs::EventArray msg;
+        msg.header.seq = k;
+        msg.header.stamp = ros::Time(soa.ts_us[0] / 1e6);
+        msg.width = o.dvs.width;
+        msg.height = o.dvs.height;
+        dvs_msgs::Event evts[OLD_MAX];
+        for (size_t i = 0; i < n; i++) {
+            evts[i].ts = ros::Time(soa.ts_us[i] / 1e6);
+            evts[i].polarity = soa.p[i];
+            evts[i].x = soa.x[i];
+            evts[i].y = soa.y[i];
+        }
+        std::vector<dvs_msgs::Event> tmp(evts, evts + n);
+        msg.events = std::move(tmp);
+        old_q.push(std::move(msg));
+        dvs_msgs::EventArray w;
+        old_q.pop(w);
+        serializeInto(w, out);
+    }
+    const int m = packets - warmup;
+    double old_us = duration_cast<duration<double, std::micro> >(steady_clock::now() - t0).count() / m;
+    double old_mallocs = (double)(thread_mallocs - m0) / m;
+    std::vector<uint8_t> old_bytes = out;
+
+    SPSCQueue<PooledEventArray> new_q(64);
+    BufferPool::Stats p0;
+    for (int k = 0; k < packets; k++) {
+        if (k == warmup) {
+            m0 = thread_mallocs;
+            p0 = BufferPool::global().stats();
+            t0 = steady_clock::now();
+        }
+        setTimes(k);
+        PooledEventArray msg;
+        msg.header.seq = k;
+        msg.header.stamp = ros::Time(soa.ts_us[0] / 1e6);
+        msg.width = o.dvs.width;
+        msg.height = o.dvs.height;
+        msg.events.resize(n);
+        convertEvents(soa, msg.events.data());
+        new_q.push(std::move(msg));
+        PooledEventArray w;
+        new_q.pop(w);
+        serializeInto(w, out);
+    }
+    double new_us = duration_cast<duration<double, std::micro> >(steady_clock::now() - t0).count() / m;
+    double new_mallocs = (double)(thread_mallocs - m0) / m;
+    BufferPool::Stats p1 = BufferPool::global().stats();
+    const bool same_bytes = out == old_bytes;
+
+    printf("capture_bench --evt-alloc: %d packets of %lu events, decode, queue, serialize (after %d packets warm-up)\n",
+        packets, n, warmup);
+    printf("std::vector %6.1f us/packet  %.2f mallocs/packet\n", old_us, old_mallocs);
+    printf("pooled      %6.1f us/packet  %.2f mallocs/packet  %.2f pool heap allocs/packet, %.0f%% of pool requests recycled\n",
+        new_us, new_mallocs, (double)(p1.heap_allocs - p0.heap_allocs) / m,
+        p1.requests > p0.requests ? 100.0 * (p1.recycled - p0.recycled) / (p1.requests - p0.requests) : 0.0);
+    printf("serialized bytes of the last packet match: %s\n", same_bytes ? "yes" : "NO");
+    return same_bytes && new_mallocs < old_mallocs ? 0 : 1;
+#endif
+}
+
+// Set on the consumer: every 8192nd pop stalls between claiming the slot and
+// releasing it, as a preempted consumer would.
+static thread_local bool queue_slow_pop = false;
+static thread_local uint64_t queue_pops = 0;
+
+// Item with a check word, so that a torn or twice-moved slot shows up.
+struct QueueItem {
+    uint64_t seq = 0;
+    uint64_t check = 0;
+
+    QueueItem() {}
+    QueueItem(QueueItem &&o) : seq(o.seq), check(o.check) {}
+    QueueItem &operator=(QueueItem &&o)
+    {
+        if (queue_slow_pop && ++queue_pops % 8192 == 0)
+            std::this_thread::sleep_for(milliseconds(2));
+        seq = o.seq;
+        check = o.check;
+        return *this;
+    }
+};
+
+static uint64_t queueCheck(uint64_t seq)
+{
+    return seq * 0x9e3779b97f4a7c15ull ^ 0x5bd1e995;
+}
+
+// One producer pushes 0..n-1 in bursts into a small queue while the consumer
+// pops with a longer pause every few thousand items, so that the queue
+// overflows again and again. Whatever comes out must be in order and intact,
+// the counters must account for every item, and a push into a full queue
+// may evict only one item, even while the consumer stalls mid-pop.
+static bool runQueueOnce(OverflowPolicy policy, uint64_t n)
+{
+    SPSCQueue<QueueItem> q(256, policy);
+    std::atomic_bool done{false};
+    uint64_t received = 0, bad = 0, last = 0, popped_missing = 0;
+    bool first = true;
+
+    auto t0 = steady_clock::now();
+    std::thread consumer([&] {
+        queue_slow_pop = true;
+        QueueItem it;
+        for (;;) {
+            if (!q.pop(it)) {
+                if (done.load(std::memory_order_acquire) && q.empty()) break;
+                std::this_thread::yield();
+                continue;
+            }
+            if (it.check != queueCheck(it.seq) || (!first && it.seq <= last)) bad++;
+            else if (!first) popped_missing += it.seq - last - 1;
+            else popped_missing += it.seq;
+            first = false;
+            last = it.seq;
+            if (++received % 4096 == 0) std::this_thread::sleep_for(microseconds(200));
+        }
+    });
+    uint64_t rejected = 0, max_evicted = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        QueueItem it;
+        it.seq = i;
+        it.check = queueCheck(i);
+        const uint64_t d0 = q.stats().dropped_oldest;
+        if (!q.push(std::move(it))) rejected++;
+        max_evicted = std::max(max_evicted, q.stats().dropped_oldest - d0);
+        if (i % 1024 == 1023) std::this_thread::sleep_for(microseconds(20));
+    }
+    done.store(true, std::memory_order_release);
+    consumer.join();
+    double sec = duration_cast<duration<double> >(steady_clock::now() - t0).count();
+    if (!first) popped_missing += n - 1 - last;
+
+    const SPSCQueueStats s = q.stats();
+    const uint64_t dropped = s.dropped_oldest + s.dropped_newest;
+    bool ok = bad == 0 && max_evicted <= 1 && received == s.popped && s.popped + s.dropped_oldest == s.pushed &&
+              s.pushed + s.dropped_newest == n && rejected == s.dropped_newest &&
+              popped_missing == dropped && q.empty();
+    switch (policy) {
+    case OverflowPolicy::Block:
+        ok = ok && dropped == 0 && received == n && s.blocked > 0;
+        break;
+    case OverflowPolicy::DropOldest:
+        ok = ok && s.dropped_newest == 0 && s.dropped_oldest > 0 && s.blocked == 0;
+        break;
+    case OverflowPolicy::DropNewest:
+        ok = ok && s.dropped_oldest == 0 && s.dropped_newest > 0 && s.blocked == 0;
+        break;
+    }
+    printf("%-12s %6.1f M/s  pushed %lu, popped %lu, dropped oldest %lu, dropped newest %lu, blocked %lu, max depth %lu, "
+           "missing %lu, out of order or damaged %lu, at most %lu evicted per push  %s\n",
+        overflowPolicyName(policy), n / sec / 1e6, s.pushed, s.popped, s.dropped_oldest, s.dropped_newest,
+        s.blocked, s.high_water, popped_missing, bad, max_evicted, ok ? "ok" : "MISMATCH");
+    return ok;
+}
+
+static int runQueueBench(const BenchOptions &)
+{
+    const uint64_t n = 2000000;
+    printf("capture_bench --queue: %lu items through a 256 slot queue, producer pauses 20 us every 1024 items, consumer 200 us every 4096 and stalls 2 ms mid-pop every 8192\n", n);
+    bool ok = true;
+    for (OverflowPolicy p : {OverflowPolicy::Block, OverflowPolicy::DropOldest, OverflowPolicy::DropNewest})
+        ok = runQueueOnce(p, n) && ok;
+    return ok ? 0 : 1;
+}
+
+// Random geometry, size and timestamps, with backward and large steps.
+static void randomEventPacket(uint64_t &rng, uint32_t seq, PooledEventArray &msg)
+{
+    static const uint16_t dims[][2] = {{320, 264}, {346, 260}, {640, 480}, {1280, 720}, {1, 1}, {65535, 65535}};
+    const uint16_t *wh = dims[xorshift(rng) % 6];
+    msg.width = wh[0];
+    msg.height = wh[1];
+    msg.header.seq = seq;
+    const uint64_t r = xorshift(rng);
+    const size_t n = r % 8 == 0 ? 0 : r % 5 == 0 ? 1 : (size_t)(xorshift(rng) % 20000);
+    msg.events.resize(n);
+    uint64_t t = 1000000 + xorshift(rng) % 4000000000ull;
+    msg.header.stamp = usToTime(t);
+    for (size_t i = 0; i < n; i++) {
+        const uint64_t e = xorshift(rng);
+        switch (e % 16) {
+        case 0: t -= std::min<uint64_t>(t, e >> 40); break;     // backwards, up to 16 s
+        case 1: t += e >> 24; break;                            // forward, up to hours
+        default: t += (e >> 60); break;                         // packed in time
+        }
+        PooledEvent &ev = msg.events[i];
+        ev.x = (uint16_t)((e >> 8) % msg.width);
+        ev.y = (uint16_t)((e >> 24) % msg.height);
+        ev.polarity = (e >> 4) & 1;
+        ev.ts = usToTime(t);
+    }
+}
+
+static bool sameEvents(const PooledEventArray &a, const dvs_msgs::EventArray &b)
+{
+    if (a.header.seq != b.header.seq || a.width != b.width || a.height != b.height ||
+        a.events.size() != b.events.size())
+        return false;
+    const ros::Time base = a.events.empty() ? a.header.stamp : a.events[0].ts;
+    if (b.header.stamp != base) return false;
+    for (size_t i = 0; i < a.events.size(); i++) {
+        const PooledEvent &x = a.events[i];
+        const dvs_msgs::Event &y = b.events[i];
+        if (x.x != y.x || x.y != y.y || (x.polarity != 0) != (y.polarity != 0) || x.ts != y.ts) return false;
+    }
+    return true;
+}
+
+static int runEvbCheck(const BenchOptions &o)
+{
+    const int packets = 2000;
+    uint64_t rng = 0x2545f4914f6cdd1dull;
+    uint64_t events = 0, bytes = 0;
+    int mismatched = 0, corrupt_passed = 0, truncated_passed = 0, oversized_passed = 0, corrupted = 0;
+    dvs_msgs::EventArray back;
+    std::vector<uint8_t> all;
+    std::vector<PooledEventArray> sent;
+
+    for (int k = 0; k < packets; k++) {
+        PooledEventArray msg;
+        randomEventPacket(rng, (uint32_t)xorshift(rng), msg);
+        std::vector<uint8_t> buf;
+        const size_t len = encodeEventBlock(msg, buf);
+        events += msg.events.size();
+        bytes += len;
+        if (decodeEventBlock(buf.data(), buf.size(), back) != len || !sameEvents(msg, back)) mismatched++;
+
+        // one flipped bit anywhere in header or payload
+        std::vector<uint8_t> bad = buf;
+        const size_t bit = xorshift(rng) % (bad.size() * 8);
+        bad[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+        corrupted++;
+        if (decodeEventBlock(bad.data(), bad.size(), back) != 0) corrupt_passed++;
+
+        // cut anywhere before the end
+        const size_t cut = xorshift(rng) % len;
+        if (decodeEventBlock(buf.data(), cut, back) != 0) truncated_passed++;
+
+        // a count no payload can hold must be refused before any allocation
+        bad = buf;
+        EventBlockHeader hd;
+        memcpy(&hd, bad.data(), sizeof(hd));
+        hd.count = 0xffffffffu;
+        hd.checksum = eventBlockChecksum(hd, bad.data() + sizeof(hd));
+        memcpy(bad.data(), &hd, sizeof(hd));
+        if (decodeEventBlock(bad.data(), bad.size(), back) != 0) oversized_passed++;
+
+        if (k < 200) {
+            all.insert(all.end(), buf.begin(), buf.end());
+            sent.push_back(std::move(msg));
+        }
+    }
+
+    // the file reader stops cleanly at a block cut short by a crash
+    const std::string path = o.out + "/evb-check.evb";
+    int file_read = 0, file_bad = 0;
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (fp) {
+        fwrite(all.data(), 1, all.size() - 7, fp);
+        fclose(fp);
+        CompactEventReader reader;
+        if (reader.open(path))
+            while (reader.next(back)) {
+                if (file_read >= (int)sent.size() || !sameEvents(sent[file_read], back)) file_bad++;
+                file_read++;
+            }
+        remove(path.c_str());
+    }
+    const int file_want = (int)sent.size() - 1;
+
+    printf("capture_bench --evb-check: %d random packets, %lu events, %.2f bytes/event\n",
+        packets, events, events ? (double)bytes / events : 0.0);
+    printf("round trip:        %d of %d packets differ\n", mismatched, packets);
+    printf("one bit flipped:   %d of %d blocks accepted\n", corrupt_passed, corrupted);
+    printf("truncated:         %d of %d blocks accepted\n", truncated_passed, packets);
+    printf("count too large:   %d of %d blocks accepted\n", oversized_passed, packets);
+    printf("file cut short:    %d of %d blocks read back before the cut (%d differ)\n", file_read, file_want, file_bad);
+    const bool ok = mismatched == 0 && corrupt_passed == 0 && truncated_passed == 0 && oversized_passed == 0 &&
+                    file_read == file_want && file_bad == 0;
+    printf("%s\n", ok ? "ok" : "MISMATCH");
+    return ok ? 0 : 1;
+}
+
+static std::vector<uint8_t> serialized(const PooledImage &m)
+{
+    std::vector<uint8_t> buf(ros::serialization::serializationLength(m));
+    ros::serialization::OStream s(buf.data(), buf.size());
+    ros::serialization::serialize(s, m);
+    return buf;
+}
+
+static std::vector<uint8_t> serialized(const sensor_msgs::Image &m)
+{
+    std::vector<uint8_t> buf(ros::serialization::serializationLength(m));
+    ros::serialization::OStream s(buf.data(), buf.size());
+    ros::serialization::serialize(s, m);
+    return buf;
+}
+
+// Pushes APS frames through the frame path (message, preview, bag writer)
+// and compares it with the cv_bridge path it replaced.
+static int runApsBench(const BenchOptions &o)
+{
+#ifndef __GLIBC__
+    printf(" * ERROR! --aps needs glibc to count allocations\n");
+    return 1;
+#else
+    const int frames = 2000, warmup = 100;
+    cv::Mat frame(o.dvs.height, o.dvs.width, CV_16UC1);
+    for (int r = 0; r < frame.rows; r++)
+        for (int c = 0; c < frame.cols; c++)
+            frame.at<uint16_t>(r, c) = (uint16_t)(r * 251 + c * 65);
+    std_msgs::Header hd;
+    hd.stamp = ros::Time(5.0);
+
+    // before: cv_bridge message plus a clone for the preview
+    uint64_t m0 = thread_mallocs;
+    auto t0 = steady_clock::now();
+    for (int i = 0; i < frames; i++) {
+        cv_bridge::CvImage tmp(hd, "mono16", frame);
+        sensor_msgs::Image msg;
+        tmp.toImageMsg(msg);
+        previewPost("img", frame.clone());
+    }
+    double old_us = duration_cast<duration<double, std::micro> >(steady_clock::now() - t0).count() / frames;
+    double old_mallocs = (double)(thread_mallocs - m0) / frames;
+
+    std::string path = o.out + "/aps-bench.bag";
+    BagWriter writer(16, OverflowPolicy::DropOldest, 4 << 20, milliseconds(20));
+    if (!writer.open(path)) return 1;
+    writer.start();
+    BufferPool::Stats p0;
+    ApsCopyStats c0;
+    bool shared = true;
+    for (int i = 0; i < frames; i++) {
+        if (i == warmup) {
+            m0 = thread_mallocs;
+            p0 = BufferPool::global().stats();
+            c0 = apsCopyStats();
+            t0 = steady_clock::now();
+        }
+        hd.seq = i;
+        PooledImagePtr msg = makeApsImage(hd, frame);
+        cv::Mat view = apsImageView(*msg);
+        shared = shared && view.data == msg->data.data();
+        previewPost("img", view, msg);
+        writer.pushImage(std::move(msg));
+    }
+    const int n = frames - warmup;
+    double new_us = duration_cast<duration<double, std::micro> >(steady_clock::now() - t0).count() / n;
+    double new_mallocs = (double)(thread_mallocs - m0) / n;
+    BufferPool::Stats p1 = BufferPool::global().stats();
+    ApsCopyStats c1 = apsCopyStats();
+    writer.stop();
+    previewClose();
+    remove(path.c_str());
+
+    // the bag must not be able to tell the difference
+    cv_bridge::CvImage tmp(hd, "mono16", frame);
+    sensor_msgs::Image ref;
+    tmp.toImageMsg(ref);
+    bool same_bytes = serialized(*makeApsImage(hd, frame)) == serialized(ref);
+
+    printf("capture_bench --aps: %d %dx%d mono16 frames\n", frames, frame.cols, frame.rows);
+    printf("cv_bridge   %6.1f us/frame  2 pixel copies  %.1f mallocs/frame\n", old_us, old_mallocs);
+    printf("pooled      %6.1f us/frame  %.1f pixel copies  %.2f mallocs/frame  %.2f pool heap allocs/frame (after %d frames warm-up)\n",
+        new_us, (double)(c1.copies - c0.copies) / n, new_mallocs,
+        (double)(p1.heap_allocs - p0.heap_allocs) / n, warmup);
+    printf("preview shares the message pixels: %s, serialized bytes match sensor_msgs/Image: %s\n",
+        shared ? "yes" : "NO", same_bytes ? "yes" : "NO");
+    return shared && same_bytes ? 0 : 1;
+#endif
+}
+
+// Serialized messages in recording order, replayed into the compressed bag
+// writer so that every run sees the same bytes.
+struct SerializedRecording {
+    std::vector<BagzConnection> conns;
+    struct Rec {
+        uint16_t conn;
+        ros::Time stamp;
+        size_t offset;
+        uint32_t len;
+    };
+    std::vector<Rec> recs;
+    std::vector<uint8_t> bytes;
+
+    template <class M>
+    void add(uint16_t conn, const ros::Time &t, const M &msg)
+    {
+        Rec r;
+        r.conn = conn;
+        r.stamp = t;
+        r.offset = bytes.size();
+        r.len = ros::serialization::serializationLength(msg);
+        bytes.resize(r.offset + r.len);
+        ros::serialization::OStream s(bytes.data() + r.offset, r.len);
+        ros::serialization::serialize(s, msg);
+        recs.push_back(r);
+    }
+    template <class M>
+    uint16_t connection(const char *topic, const M &)
+    {
+        namespace mt = ros::message_traits;
+        BagzConnection c;
+        c.topic = topic;
+        c.datatype = mt::datatype<M>();
+        c.md5 = mt::md5sum<M>();
+        c.definition = mt::definition<M>();
+        conns.push_back(c);
+        return (uint16_t)(conns.size() - 1);
+    }
+};
+
+// Events, 1 kHz IMU and APS frames at the bench rates, as the DVS writer
+// would see them.
+static void synthesizeRecording(const BenchOptions &o, SerializedRecording &rec)
+{
+    const SyntheticDvsConfig &c = o.dvs;
+    const size_t n = std::max<size_t>(1, (size_t)(c.event_rate * c.packet_us / 1e6));
+    const uint64_t frame_period = c.frame_rate > 0 ? (uint64_t)(1e6 / c.frame_rate) : 0;
+    uint64_t rng = 0x9e3779b97f4a7c15ull;
+    uint64_t t_us = 5000000, next_imu = t_us, next_frame = t_us;
+    EventSoA soa;
+    soa.resize(n);
+    PooledEventArray events;
+    events.width = c.width;
+    events.height = c.height;
+    sensor_msgs::Imu imu;
+    cv::Mat frame(c.height, c.width, CV_16UC1);
+    const uint16_t ev_conn = rec.connection("/dvs/events", events);
+    const uint16_t imu_conn = rec.connection("/dvs/imu", imu);
+    const uint16_t img_conn = rec.connection("/dvs/image_raw", PooledImage());
+
+    while (rec.bytes.size() < o.compress_mb * 1e6) {
+        for (size_t i = 0; i < n; i++) {
+            uint64_t r = xorshift(rng);
+            soa.ts_us[i] = t_us + i * c.packet_us / n;
+            soa.x[i] = (r & 0xffff) % c.width;
+            soa.y[i] = (r >> 16 & 0xffff) % c.height;
+            soa.p[i] = (r >> 63) & 1;
+        }
+        events.events.resize(n);
+        convertEvents(soa, events.events.data());
+        events.header.stamp = events.events[0].ts;
+        rec.add(ev_conn, events.header.stamp, events);
+        t_us += c.packet_us;
+
+        for (; next_imu < t_us; next_imu += 1000) {
+            imu.header.stamp = ros::Time(next_imu / 1e6);
+            imu.linear_acceleration.z = 9.81 + (xorshift(rng) & 0xff) / 1e4;
+            imu.angular_velocity.y = (int)(xorshift(rng) & 0xff) / 1e3;
+            rec.add(imu_conn, imu.header.stamp, imu);
+        }
+        for (; frame_period && next_frame < t_us; next_frame += frame_period) {
+            // smooth image plus sensor noise in the low bits
+            for (int r = 0; r < frame.rows; r++)
+                for (int col = 0; col < frame.cols; col++)
+                    frame.at<uint16_t>(r, col) = (uint16_t)((r * 128 + col * 64) ^ (xorshift(rng) & 0x3f));
+            std_msgs::Header hd;
+            hd.stamp = ros::Time(next_frame / 1e6);
+            PooledImagePtr img = makeApsImage(hd, frame);
+            rec.add(img_conn, hd.stamp, *img);
+        }
+    }
+}
+
+static bool loadRecording(const std::string &path, SerializedRecording &rec)
+{
+    CompressedBagReader reader;
+    if (!reader.open(path)) {
+        printf(" * ERROR! cannot open %s\n", path.c_str());
+        return false;
+    }
+    CompressedBagReader::Message m;
+    while (reader.next(m)) {
+        SerializedRecording::Rec r;
+        r.conn = m.conn;
+        r.stamp = m.stamp;
+        r.offset = rec.bytes.size();
+        r.len = m.size;
+        rec.bytes.insert(rec.bytes.end(), m.data, m.data + m.size);
+        rec.recs.push_back(r);
+    }
+    rec.conns = reader.connections();
+    return !reader.error();
+}
+
+// Reads the file back and compares every message.
+static bool verifyRecording(const std::string &path, const SerializedRecording &rec)
+{
+    CompressedBagReader reader;
+    if (!reader.open(path)) return false;
+    CompressedBagReader::Message m;
+    size_t i = 0;
+    while (reader.next(m)) {
+        if (i >= rec.recs.size()) return false;
+        const SerializedRecording::Rec &r = rec.recs[i++];
+        if (m.size != r.len || memcmp(m.data, rec.bytes.data() + r.offset, r.len) != 0 ||
+            m.stamp != r.stamp || reader.connections()[m.conn].topic != rec.conns[r.conn].topic)
+            return false;
+    }
+    return i == rec.recs.size() && !reader.error();
+}
+
+static int runCompressBench(const BenchOptions &o)
+{
+    SerializedRecording rec;
+    if (!o.input.empty() ? !loadRecording(o.input, rec) : (synthesizeRecording(o, rec), false))
+        return 1;
+    printf("capture_bench --compress: %.1f MB in %lu messages (%s)\n", rec.bytes.size() / 1e6,
+        rec.recs.size(), o.input.empty() ? "synthetic" : o.input.c_str());
+
+    std::vector<CompressedBagWriter::Options> codecs;
+    for (ChunkCodec c : {CHUNK_LZ4, CHUNK_ZSTD}) {
+        if (o.codec != "all" && o.codec != chunkCodecName(c)) continue;
+        if (!chunkCodecAvailable(c)) {
+            printf(" * WARNING! built without %s\n", chunkCodecName(c));
+            continue;
+        }
+        CompressedBagWriter::Options opts;
+        opts.codec = c;
+        opts.level = o.level ? o.level : (c == CHUNK_ZSTD ? 3 : 1);
+        codecs.push_back(opts);
+    }
+    std::vector<int> thread_counts;
+    const int max_threads = o.max_threads > 0 ? o.max_threads : std::max(1u, std::thread::hardware_concurrency());
+    for (int t = 1; t < max_threads; t *= 2) thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+
+    const std::string path = o.out + "/compress-bench.bagz";
+    bool ok = true;
+    printf("\ncodec level threads MB_s MB_s_per_thread ratio compress_cpu_s writer_blocked_s\n");
+    for (const CompressedBagWriter::Options &base : codecs) {
+        for (int threads : thread_counts) {
+            CompressedBagWriter::Options opts = base;
+            opts.threads = threads;
+            CompressedBagWriter w(opts);
+            if (!w.open(path)) return 1;
+            auto t0 = steady_clock::now();
+            for (const SerializedRecording::Rec &r : rec.recs)
+                w.writeSerialized(rec.conns[r.conn], r.stamp, rec.bytes.data() + r.offset, r.len);
+            w.close();
+            double dt = duration_cast<duration<double> >(steady_clock::now() - t0).count();
+            CompressedBagWriter::Stats s = w.stats();
+            double mb_s = rec.bytes.size() / 1e6 / dt;
+            printf("%s %d %d %.1f %.1f %.2f %.2f %.2f\n", chunkCodecName(opts.codec), opts.level, threads,
+                mb_s, mb_s / threads, (double)s.raw_bytes / s.stored_bytes, s.compress_sec, s.blocked_sec);
+            if (threads == thread_counts.back() && !verifyRecording(path, rec)) {
+                printf(" * ERROR! %s: read back differs from what was written\n", chunkCodecName(opts.codec));
+                ok = false;
+            }
+            remove(path.c_str());
+        }
+    }
+    return ok ? 0 : 1;
+}
+
+// Simulated device clock for --sync: device = d0 + (1 + skew) * (host - h0).
+struct SimClock {
+    double skew;
+    double d0;
+    int64_t h0;
+    uint64_t device(int64_t host) const { return (uint64_t)(d0 + (1 + skew) * (host - h0)); }
+};
+
+static double uniform01(uint64_t &rng)
+{
+    return (xorshift(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Transfer delay: fixed part, exponential tail and rare long stalls.
+static int64_t simDelay(uint64_t &rng, double base_us, double mean_us, double stall_p)
+{
+    double d = base_us - mean_us * std::log(1 - uniform01(rng));
+    if (uniform01(rng) < stall_p) d += 5000 + 25000 * uniform01(rng);
+    return (int64_t)d;
+}
+
+static void printErrors(const char *name, std::vector<double> &e)
+{
+    if (e.empty()) return;
+    std::sort(e.begin(), e.end());
+    printf("%-22s p50 %7.0f µs  p99 %7.0f µs  max %7.0f µs\n", name,
+        e[e.size() / 2], e[e.size() * 99 / 100], e.back());
+}
+
+// One simulated run; d435_offset_us as set from a one-off measurement.
+static bool runSyncOnce(int d435_offset_us)
+{
+    const double sim_sec = 60;    // as printed by runSyncBench
+    const int64_t h0 = 1000000000000LL;
+    const int64_t aps_period = 40000, d435_period = 33333;
+    SimClock dvs{+80e-6, 7e6, h0}, d435{-35e-6, 4.2e9, h0};
+    uint64_t rng = 0x9e3779b97f4a7c15ull;
+
+    // everything the capture threads would hand over, in arrival order
+    enum Kind { DVS_SAMPLE, APS, D435 };
+    struct Arrival {
+        int64_t host;
+        int kind;
+        int64_t t;          // true time
+        uint64_t k;
+    };
+    std::vector<Arrival> in;
+    const int64_t end = h0 + (int64_t)(sim_sec * 1e6);
+    for (int64_t t = h0, k = 0; t < end; t += 1000, k++)
+        in.push_back(Arrival{t + simDelay(rng, 300, 400, 0.01), DVS_SAMPLE, t, (uint64_t)k});
+    // APS frames are stamped at exposure start and read out afterwards
+    for (int64_t t = h0 + 3000, k = 0; t < end; t += aps_period, k++)
+        in.push_back(Arrival{t + 15000 + simDelay(rng, 300, 400, 0.01), APS, t, (uint64_t)k});
+    for (int64_t t = h0 + 1000, k = 0; t < end; t += d435_period, k++)
+        in.push_back(Arrival{t + simDelay(rng, 2000, 1000, 0.02), D435, t, (uint64_t)k});
+    std::sort(in.begin(), in.end(), [](const Arrival &a, const Arrival &b) { return a.host < b.host; });
+
+    SensorSync::Options so;
+    so.d435_offset_us = d435_offset_us;
+    SensorSync sync(so);
+    std::vector<SyncPair> pairs;
+    sync.setConsumer([&](const SyncPair &p) {
+        pairs.push_back(p);
+        pairs.back().d435_image.release();
+        pairs.back().aps.reset();
+    });
+    sync.start("");
+
+    // 10x real time: the sync thread sees the data as it would live
+    std::vector<int64_t> aps_t, d435_t, aps_arrival, d435_arrival;
+    cv::Mat tiny(2, 2, CV_16UC1);
+    tiny.setTo(0);
+    int64_t paced = h0;
+    for (const Arrival &a : in) {
+        if (a.host - paced >= 10000) {
+            std::this_thread::sleep_for(microseconds(1000));
+            paced = a.host;
+        }
+        if (a.kind == DVS_SAMPLE) {
+            sync.dvsTime(dvs.device(a.t), a.host);
+        } else if (a.kind == APS) {
+            std_msgs::Header hd;
+            hd.seq = (uint32_t)a.k;
+            hd.stamp = ros::Time(dvs.device(a.t) / 1e6);
+            sync.pushAps(makeApsImage(hd, tiny), dvs.device(a.t));
+            aps_t.push_back(a.t);
+            aps_arrival.push_back(a.host);
+        } else {
+            IRFrame f;
+            f.index = a.k;
+            f.stamp = (long long)d435.device(a.t);
+            sync.pushD435(f, a.host);
+            d435_t.push_back(a.t);
+            d435_arrival.push_back(a.host);
+        }
+    }
+    sync.stop();
+
+    printf("\n=== sync_d435_offset_us %d\n", d435_offset_us);
+    sync.printStats();
+
+    // ground truth: the APS frame nearest in true time
+    const int64_t max_dt = so.max_dt_ms * 1000LL;
+    size_t wrong = 0, missed = 0;
+    std::vector<double> err_fit, err_arrival, err_window;
+    for (const SyncPair &p : pairs) {
+        const int64_t td = d435_t[p.d435_index];
+        size_t k = (size_t)std::max<int64_t>(0, (td - h0 - 3000 + aps_period / 2) / aps_period);
+        k = std::min(k, aps_t.size() - 1);
+        const int64_t true_dt = aps_t[k] - td;
+        err_window.push_back(std::fabs((double)(p.evt_begin_us + p.evt_end_us) / 2 - dvs.device(td)));
+        if (std::llabs(true_dt) > max_dt - 1000) continue;     // too close to the limit to call
+        if (p.aps_us == 0) {
+            missed++;
+            continue;
+        }
+        if (p.aps_seq != k) {
+            wrong++;
+            continue;
+        }
+        err_fit.push_back(std::fabs((double)(p.dt_us - true_dt)));
+        err_arrival.push_back(std::fabs((double)(aps_arrival[k] - d435_arrival[p.d435_index] - true_dt)));
+    }
+    printf("\n%lu of %lu D435 frames paired, %lu with the wrong APS frame, %lu missed\n",
+        pairs.size(), d435_t.size(), wrong, missed);
+    printf("APS-D435 time difference error:\n");
+    printErrors("  fitted clocks", err_fit);
+    printErrors("  arrival times", err_arrival);
+    printErrors("event window centre", err_window);
+    // the first D435 frames wait for the DVS clock; a few may be dropped then
+    return wrong == 0 && missed == 0 && pairs.size() + so.queue_size >= d435_t.size();
+}
+
+static int runSyncBench(const BenchOptions &o)
+{
+    printf("capture_bench --sync: 60 s simulated, DVS skew +80 ppm, D435 skew -35 ppm (ms stamps),\n"
+        "APS 25 Hz, D435 30 Hz, heavy-tailed delays with 1-2%% stalls of 5-30 ms;\n"
+        "D435 frames take 1.7 ms longer to arrive than DVS data at best\n");
+    bool ok = runSyncOnce(0);
+    ok = runSyncOnce(1700) && ok;
+    return ok ? 0 : 1;
+}
+
+// Moving edges (signal), uniform background activity at 20% of the events
+// and a few hot pixels, one packet per packet_us. is_noise per event.
+static void noisePackets(const BenchOptions &o, std::vector<std::vector<PooledEvent> > &packets,
+                         std::vector<std::vector<char> > &is_noise)
+{
+    const int w = o.dvs.width, h = o.dvs.height;
+    const int n_hot = 16;
+    const double hot_hz = 500;
+    const size_t n = std::max<size_t>(1, (size_t)(o.dvs.event_rate * o.dvs.packet_us / 1e6));
+    const size_t n_packets = std::max<size_t>(1, (size_t)(2e6 / o.dvs.packet_us));  // 2 s
+    uint64_t rng = 0x2545f4914f6cdd1dull;
+    int hot_x[n_hot], hot_y[n_hot];
+    for (int k = 0; k < n_hot; k++) {
+        hot_x[k] = (int)(xorshift(rng) % w);
+        hot_y[k] = (int)(xorshift(rng) % h);
+    }
+    packets.resize(n_packets);
+    is_noise.resize(n_packets);
+    uint64_t t_us = 5000000;
+    for (size_t p = 0; p < n_packets; p++) {
+        std::vector<PooledEvent> &ev = packets[p];
+        ev.resize(n);
+        is_noise[p].resize(n);
+        for (size_t i = 0; i < n; i++) {
+            const uint64_t t = t_us + i * o.dvs.packet_us / n;
+            const uint64_t r = xorshift(rng);
+            int x, y;
+            const double u = (r & 0xffff) / 65536.0;
+            if (u < hot_hz * n_hot * o.dvs.packet_us / 1e6 / n) {
+                int k = (int)(r >> 16) % n_hot;
+                x = hot_x[k];
+                y = hot_y[k];
+                is_noise[p][i] = 1;
+            } else if (u < 0.2) {
+                x = (int)((r >> 16) % w);
+                y = (int)((r >> 32) % h);
+                is_noise[p][i] = 1;
+            } else {
+                // 4 edges, 1 px/ms, spread over 2 px
+                int k = (int)(r >> 16) & 3;
+                x = (int)((t / 1000 + k * w / 4) % w) + (int)((r >> 18) & 1);
+                x = std::min(x, w - 1);
+                y = (int)((r >> 32) % h);
+                is_noise[p][i] = 0;
+            }
+            ev[i].x = (uint16_t)x;
+            ev[i].y = (uint16_t)y;
+            ev[i].ts = ros::Time(t / 1000000, (t % 1000000) * 1000);
+            ev[i].polarity = (r >> 63) & 1;
+        }
+        t_us += o.dvs.packet_us;
+    }
+}
+
+static int runNoiseBench(const BenchOptions &o)
+{
+    loadCaptureConfig(o.config);
+    const int window = o.noise_us > 0 ? o.noise_us : capture_cfg.noise_filter_us > 0 ? capture_cfg.noise_filter_us : 2000;
+    std::vector<std::vector<PooledEvent> > packets;
+    std::vector<std::vector<char> > is_noise;
+    noisePackets(o, packets, is_noise);
+    uint64_t n_noise = 0, n_total = 0;
+    for (const std::vector<char> &v : is_noise)
+        for (char c : v) {
+            n_noise += c;
+            n_total++;
+        }
+    printf("capture_bench --noise: %dx%d, %.2f Mev/s, %lu events per packet, %.0f%% noise "
+        "(uniform + 16 hot pixels), one core\n", o.dvs.width, o.dvs.height, o.dvs.event_rate / 1e6,
+        packets[0].size(), 100.0 * n_noise / n_total);
+    printf("window_us  Mev/s  signal_kept  noise_dropped\n");
+
+    bool ok = true;
+    for (int win : {window / 4, window / 2, window, window * 2, window * 4}) {
+        if (win <= 0) continue;
+        NoiseFilter filter(o.dvs.width, o.dvs.height, win);
+        PooledEventArray msg;
+        double sec = 0;
+        uint64_t sig_kept = 0, noise_dropped = 0, events = 0;
+        // the first pass warms the map up, the others are timed
+        for (int pass = 0; pass < 4; pass++) {
+            for (size_t p = 0; p < packets.size(); p++) {
+                const std::vector<PooledEvent> &src = packets[p];
+                msg.events.assign(src.begin(), src.end());
+                auto t0 = steady_clock::now();
+                filter.filter(msg);
+                if (pass == 0) continue;
+                sec += duration_cast<duration<double> >(steady_clock::now() - t0).count();
+                events += src.size();
+                if (pass != 1) continue;
+                // the output is a subsequence of the input
+                size_t j = 0;
+                for (size_t i = 0; i < src.size(); i++) {
+                    const bool kept = j < msg.events.size() && msg.events[j].x == src[i].x &&
+                        msg.events[j].y == src[i].y && msg.events[j].ts == src[i].ts;
+                    j += kept;
+                    if (is_noise[p][i]) noise_dropped += !kept;
+                    else sig_kept += kept;
+                }
+            }
+        }
+        const double mev_s = events / sec / 1e6;
+        printf("%9d %6.1f %11.1f%% %13.1f%%%s\n", win, mev_s, 100.0 * sig_kept / (n_total - n_noise),
+            100.0 * noise_dropped / n_noise, win == window ? "  <-" : "");
+        if (win == window && mev_s < 10) ok = false;
+    }
+    if (!ok) printf(" * WARNING! below 10 Mev/s\n");
+    return ok ? 0 : 1;
+}
+
+// PixelMask::apply alone, on uniform events with 16 hot pixels masked.
+static void timeMaskApply(const BenchOptions &o)
+{
+    const int w = o.dvs.width, h = o.dvs.height;
+    const size_t n = std::max<size_t>(1, (size_t)(o.dvs.event_rate * o.dvs.packet_us / 1e6));
+    PixelMask mask(w, h);
+    uint64_t rng = 0x9e3779b97f4a7c15ull;
+    for (int k = 0; k < 16; k++)
+        mask.clear((int)(xorshift(rng) % w), (int)(xorshift(rng) % h));
+    std::vector<EventSoA> packets(64);
+    for (EventSoA &soa : packets) {
+        soa.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            uint64_t r = xorshift(rng);
+            soa.ts_us[i] = 5000000 + i;
+            soa.x[i] = (r & 0xffff) % w;
+            soa.y[i] = (r >> 16 & 0xffff) % h;
+            soa.p[i] = r >> 63;
+        }
+    }
+    EventSoA work;
+    double sec = 0;
+    uint64_t events = 0;
+    while (sec < 0.5) {
+        for (const EventSoA &soa : packets) {
+            work = soa;
+            auto t0 = steady_clock::now();
+            mask.apply(work);
+            sec += duration_cast<duration<double> >(steady_clock::now() - t0).count();
+            events += soa.size();
+        }
+    }
+    printf("PixelMask::apply: %.0f Mev/s on one core (%lu events per packet)\n", events / sec / 1e6, n);
+}
+
+static int runMaskBench(BenchOptions o)
+{
+    if (!loadCaptureConfig(o.config) || !setupThreadAffinity())
+        return 1;
+    if (o.dvs.hot_pixels == 0) o.dvs.hot_pixels = 16;
+    printf("capture_bench --mask: %.2f Mev/s %s events, %d hot pixels at %.0f Hz (%.0f%% of the events)\n",
+        o.dvs.event_rate / 1e6, o.dvs.distribution.c_str(), o.dvs.hot_pixels, o.dvs.hot_pixel_hz,
+        100 * std::min(1.0, o.dvs.hot_pixels * o.dvs.hot_pixel_hz / o.dvs.event_rate));
+    timeMaskApply(o);
+
+    // learning ends within the warm-up, so the measured part is masked
+    const int calib_sec = std::max(1, (int)o.warmup / 2);
+    struct Case {
+        const char *name;
+        std::string roi;
+        int calib_sec;
+    };
+    const Case cases[] = {
+        {"no mask", "", 0},
+        {"hot pixels learned", "", calib_sec},
+        {"hot pixels + centre ROI", "80,66,160,132", calib_sec},
+    };
+    const CaptureConfig saved = capture_cfg;
+    std::vector<BenchResult> results;
+    for (const Case &c : cases) {
+        capture_cfg.roi = c.roi;
+        capture_cfg.hot_pixel_file.clear();
+        capture_cfg.hot_pixel_calib_sec = c.calib_sec;
+        printf("\n--- %s\n", c.name);
+        BenchResult r;
+        if (!runOnce(o, o.dvs.event_rate, r)) {
+            printf(" * ERROR! capture failed\n");
+            return 1;
+        }
+        results.push_back(r);
+    }
+    capture_cfg = saved;
+
+    printf("\n%-26s %10s %8s %8s %14s\n", "", "events/s", "MB/s", "masked", "events rejected");
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult &r = results[i];
+        const double sec = r.run.elapsed_sec > 0 ? r.run.elapsed_sec : 1;
+        printf("%-26s %10.0f %8.1f %8lu %14lu\n", cases[i].name, r.run.events / sec, r.mb_per_sec,
+            r.run.pixels_masked, r.run.mask_rejected);
+    }
+    // every injected hot pixel found, nothing else
+    return results[1].run.pixels_masked == (uint64_t)o.dvs.hot_pixels ? 0 : 1;
+}
+
+static int runStartupBench(BenchOptions o)
+{
+    if (!loadCaptureConfig(o.config) || !setupThreadAffinity())
+        return 1;
+    if (o.dvs.start_ms == 0) o.dvs.start_ms = 800;
+    if (o.dvs.exposure_settle_ms == 0) o.dvs.exposure_settle_ms = 300;
+    printf("capture_bench --startup: device start %d ms, exposure settles in about %d ms%s\n",
+        o.dvs.start_ms, o.dvs.exposure_settle_ms, o.d435 ? ", with D435" : "");
+
+    char name[64];
+    sprintf(name, "/bench-startup-%ld", (long)time(nullptr));
+    const std::string folder = o.out + name;
+    mkdir(folder.c_str(), ACCESSPERMS);
+    membudget::Config mb;
+    if (!membudget::start("", mb))
+        return 1;
+    SyntheticDvsSource dvs(o.dvs);
+    SyntheticD435Source d435;
+
+    is_shutdown = false;
+    clearRoleThreads();
+    telemetry::reset();
+    startup::begin();
+    int dvs_ret = EXIT_FAILURE;
+    std::thread t_dvs([&] { dvs_ret = DVSMain(folder, dvs); });
+    std::thread t_d435;
+    if (o.d435)
+        t_d435 = std::thread([&] { D435Main(folder, d435); });
+    while (startup::now() < 10000 && startup::at("DVS first event written") < 0 &&
+           (!o.d435 || startup::at("D435 first frame") < 0))
+        std::this_thread::sleep_for(milliseconds(5));
+    std::this_thread::sleep_for(milliseconds(100));
+    is_shutdown = true;
+    t_dvs.join();
+    if (t_d435.joinable()) t_d435.join();
+    membudget::stop();
+    if (!o.keep) removeRecording(folder);
+
+    printf("\n");
+    startup::printSummary();
+    const double first = startup::at("DVS first event written");
+    // what the fixed procedure took: 10 x 100 ms, then device start, then 5 s
+    // of device time thrown away
+    printf("\nTime to first recorded event: %.0f ms (fixed warm-up: at least %d ms)\n",
+        first, 1000 + o.dvs.start_ms + 5000);
+    return dvs_ret == EXIT_SUCCESS && first >= 0 ? 0 : 1;
+}
+
+static bool sameImage(const cv::Mat &a, const cv::Mat &b)
+{
+    if (a.rows != b.rows || a.cols != b.cols || a.type() != b.type()) return false;
+    for (int r = 0; r < a.rows; r++)
+        if (memcmp(a.ptr(r), b.ptr(r), a.cols * a.elemSize()) != 0) return false;
+    return true;
+}
+
+static int runDepthBench(const BenchOptions &o)
+{
+    const int w = 848, h = 480, n_frames = 60;
+    std::vector<cv::Mat> frames(n_frames);
+    for (int i = 0; i < n_frames; i++)
+        SyntheticD435Source::depthFrame(frames[i], w, h, i + 1);
+    const double raw_mb = (double)w * h * 2 / 1e6;
+    printf("capture_bench --depth: %d synthetic %dx%d depth frames (wall, moving box, noise, holes), one core\n",
+        n_frames, w, h);
+
+    // per frame, one core: the codec alone
+    bool ok = true;
+    printf("codec  ratio  encode_ms  encode_max_ms  decode_ms\n");
+    for (int c = 0; c < 3; c++) {
+        const ChunkCodec chunk = c == 1 ? CHUNK_LZ4 : CHUNK_ZSTD;
+        if (c > 0 && !chunkCodecAvailable(chunk)) continue;
+        double enc_sec = 0, enc_max = 0, dec_sec = 0;
+        uint64_t bytes = 0;
+        std::vector<uint8_t> buf;
+        cv::Mat back(h, w, CV_16UC1);
+        for (const cv::Mat &f : frames) {
+            buf.clear();
+            auto t0 = steady_clock::now();
+            if (c == 0) depthEncode(f, buf);
+            else compressChunk(chunk, chunk == CHUNK_ZSTD ? 3 : 1, f.ptr(), f.total() * 2, buf);
+            auto t1 = steady_clock::now();
+            const bool dec = c == 0 ? depthDecode(buf.data(), buf.size(), back)
+                                    : decompressChunk(chunk, buf.data(), buf.size(), back.ptr(), back.total() * 2);
+            auto t2 = steady_clock::now();
+            const double e = duration_cast<duration<double> >(t1 - t0).count();
+            enc_sec += e;
+            enc_max = std::max(enc_max, e);
+            dec_sec += duration_cast<duration<double> >(t2 - t1).count();
+            bytes += buf.size();
+            if (!dec || !sameImage(f, back)) ok = false;
+        }
+        printf("%-5s %6.2f %10.2f %14.2f %10.2f\n", c == 0 ? "depth" : chunkCodecName(chunk),
+            raw_mb * n_frames * 1e6 / bytes, 1e3 * enc_sec / n_frames, 1e3 * enc_max, 1e3 * dec_sec / n_frames);
+    }
+    if (!ok) printf(" * ERROR! a codec did not round-trip\n");
+
+    // the recording path: encoder pool into D435_depth.frames, then read back
+    const std::string path = o.out + "/depth-bench.frames", time_path = o.out + "/depth-bench_time.txt";
+    std::vector<int> thread_counts;
+    const int max_threads = o.max_threads > 0 ? o.max_threads : std::max(1u, std::thread::hardware_concurrency());
+    for (int t = 1; t < max_threads; t *= 2) thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+    printf("\nthreads  frames_s  ms_per_frame  ratio\n");
+    for (int threads : thread_counts) {
+        ContainerFrameSink sink(path, time_path, FRAME_DEPTH);
+        FrameEncoderPool pool(&sink, threads, 4 * n_frames, telemetry::DEPTH);
+        if (!pool.start()) return 1;
+        auto t0 = steady_clock::now();
+        for (int rep = 0; rep < 4; rep++)
+            for (int i = 0; i < n_frames; i++) {
+                IRFrame f;
+                f.index = (uint64_t)rep * n_frames + i;
+                f.stamp = (long long)f.index * 33333;
+                f.image = frames[i];
+                pool.push(std::move(f));
+            }
+        pool.stop();
+        const double dt = duration_cast<duration<double> >(steady_clock::now() - t0).count();
+        FrameEncoderPool::Stats st = pool.stats();
+        printf("%7d %9.0f %13.2f %6.2f\n", threads, st.written / dt, 1e3 * st.encode_sec / std::max<uint64_t>(st.queued, 1),
+            st.bytes ? (double)st.raw_bytes / st.bytes : 0.0);
+        if (st.written != 4u * n_frames) ok = false;
+
+        FrameContainerReader reader;
+        FrameRecordHeader hd;
+        cv::Mat img;
+        if (!reader.open(path) || reader.size() != st.written) ok = false;
+        for (size_t i = 0; i < reader.size(); i += 37)
+            if (!reader.read(i, hd, img) || !sameImage(img, frames[i % n_frames])) ok = false;
+        reader.close();
+    }
+    remove(path.c_str());
+    remove(time_path.c_str());
+    if (!ok) printf(" * ERROR! depth frames were lost or differ after reading back\n");
+    return ok ? 0 : 1;
+}
+
+struct ShmReadResult {
+    uint64_t read = 0, lost = 0, overwritten = 0, torn = 0;
+    uint32_t lat_p50_us = 0, lat_p99_us = 0, lat_max_us = 0;
+};
+
+// Subscriber process for --shm: reads event packets in place until the
+// publisher closes, sleeping slow_us after each to play a reader that
+// cannot keep up. A packet carries its number in the first and last event,
+// so one that changed while it was read and still passed valid() is torn.
+static ShmReadResult shmReader(const std::string &name, int slow_us)
+{
+    ShmReadResult res;
+    ShmSubscriber sub;
+    if (!sub.open(name)) return res;
+    std::vector<uint32_t> lat;
+    for (;;) {
+        ShmSubscriber::Record r;
+        if (!sub.next(r)) {
+            if (sub.alive()) {
+                sub.wait(100);
+                continue;
+            }
+            if (!sub.next(r)) break;    // published just before the close
+        }
+        const int64_t now = shmNowNs(), published = r.hd->publish_ns;
+        const uint64_t seq = r.hd->seq;
+        bool same = false;
+        if (r.bytes >= sizeof(ShmEvents)) {
+            ShmEvents hd;
+            memcpy(&hd, r.data, sizeof(hd));
+            const ShmEvent *ev = reinterpret_cast<const ShmEvent *>(r.data + sizeof(hd));
+            same = hd.count > 0 && sizeof(hd) + (uint64_t)hd.count * sizeof(ShmEvent) == r.bytes &&
+                   hd.seq == (uint32_t)seq && ev[0].sec == hd.seq && ev[hd.count - 1].sec == hd.seq;
+        }
+        if (!sub.valid(r)) {
+            res.overwritten++;
+        } else if (!same) {
+            res.torn++;
+        } else {
+            res.read++;
+            lat.push_back((uint32_t)std::max<int64_t>((now - published) / 1000, 0));
+        }
+        if (slow_us > 0) usleep(slow_us);
+    }
+    res.lost = sub.lost();
+    if (!lat.empty()) {
+        std::sort(lat.begin(), lat.end());
+        res.lat_p50_us = lat[lat.size() / 2];
+        res.lat_p99_us = lat[std::min(lat.size() - 1, lat.size() * 99 / 100)];
+        res.lat_max_us = lat.back();
+    }
+    return res;
+}
+
+static int runShmBench(const BenchOptions &o)
+{
+    const size_t n_events = std::max<size_t>(1, (size_t)(o.dvs.event_rate * o.dvs.packet_us / 1e6));
+    std::vector<ShmEvent> packet(n_events);
+    uint64_t rng = 0x9e3779b97f4a7c15ull;
+    for (ShmEvent &e : packet) {
+        const uint64_t r = xorshift(rng);
+        e.x = (uint16_t)(r % 346);
+        e.y = (uint16_t)((r >> 16) % 260);
+        e.sec = 0;
+        e.nsec = (uint32_t)((r >> 32) % 1000000000);
+        e.polarity = (uint8_t)(r >> 63);
+    }
+    const size_t payload = sizeof(ShmEvents) + n_events * sizeof(ShmEvent);
+    printf("capture_bench --shm: %lu-event packets (%.1f KB), one every %d us when paced, %.0f s per run, "
+        "subscriber in a child process\n", n_events, payload / 1e3, o.dvs.packet_us, o.seconds);
+
+    struct Scenario {
+        const char *name;
+        bool paced;
+        int slow_us;        // reader sleep per packet
+        size_t ring_mb;
+    };
+    // the slow reader takes 5 ms per packet, its small ring wraps in well under a second
+    const Scenario scenarios[] = {
+        {"paced", true, 0, 64},
+        {"paced-slow", true, 5000, 4},
+        {"max", false, 0, 64},
+    };
+    printf("run         ring_mb  packets  MB_s     publish_us_mean  publish_us_p99  read     lost     overwritten  torn  "
+        "lat_p50_us  lat_p99_us  lat_max_us\n");
+    bool ok = true;
+    const std::string name = "/capture-bench-" + std::to_string(getpid());
+    for (const Scenario &sc : scenarios) {
+        ShmPublisher pub;
+        int fds[2];
+        if (!pub.open(name, SHM_EVENTS, sc.ring_mb << 20) || pipe(fds) != 0)
+            return 1;
+        const pid_t child = fork();
+        if (child < 0) {
+            printf(" * ERROR! fork failed\n");
+            return 1;
+        }
+        if (child == 0) {
+            close(fds[0]);
+            ShmReadResult r = shmReader(name, sc.slow_us);
+            ssize_t n = write(fds[1], &r, sizeof(r));
+            _exit(n == sizeof(r) ? 0 : 1);
+        }
+        close(fds[1]);
+        // let the reader open the ring and fall asleep on it
+        std::this_thread::sleep_for(milliseconds(200));
+
+        std::vector<float> cost;
+        uint64_t n = 0;
+        const auto period = microseconds(o.dvs.packet_us);
+        auto t0 = steady_clock::now(), next = t0;
+        double dt = 0;
+        while (dt < o.seconds) {
+            if (sc.paced) {
+                next += period;
+                std::this_thread::sleep_until(next);
+            }
+            auto a = steady_clock::now();
+            packet.front().sec = packet.back().sec = (uint32_t)n;
+            uint8_t *p = pub.reserve(payload);
+            if (!p) {
+                printf(" * ERROR! a %.1f KB packet does not fit a %lu MB ring\n", payload / 1e3, sc.ring_mb);
+                ok = false;
+                break;
+            }
+            ShmEvents hd;
+            hd.count = (uint32_t)n_events;
+            hd.width = 346;
+            hd.height = 260;
+            hd.seq = (uint32_t)n;
+            memcpy(p, &hd, sizeof(hd));
+            memcpy(p + sizeof(hd), packet.data(), n_events * sizeof(ShmEvent));
+            pub.publish((int64_t)n * o.dvs.packet_us);
+            auto b = steady_clock::now();
+            cost.push_back((float)duration_cast<duration<double, std::micro> >(b - a).count());
+            dt = duration_cast<duration<double> >(b - t0).count();
+            n++;
+        }
+        pub.close();
+
+        ShmReadResult r;
+        const bool got = read(fds[0], &r, sizeof(r)) == sizeof(r);
+        close(fds[0]);
+        int status = 0;
+        waitpid(child, &status, 0);
+        if (!got) {
+            printf(" * ERROR! the subscriber of run %s reported nothing\n", sc.name);
+            ok = false;
+            continue;
+        }
+        double mean = 0;
+        for (float c : cost) mean += c;
+        mean /= std::max<size_t>(cost.size(), 1);
+        std::sort(cost.begin(), cost.end());
+        const float p99 = cost.empty() ? 0 : cost[std::min(cost.size() - 1, cost.size() * 99 / 100)];
+        printf("%-11s %7lu %8lu %8.0f %16.2f %15.2f  %-8lu %-8lu %-12lu %-5lu %10u %11u %11u\n",
+            sc.name, sc.ring_mb, n, n * payload / 1e6 / dt, mean, p99, r.read, r.lost, r.overwritten, r.torn,
+            r.lat_p50_us, r.lat_p99_us, r.lat_max_us);
+        if (r.torn > 0 || r.read + r.lost + r.overwritten + r.torn != n) ok = false;
+    }
+    if (!ok) printf(" * ERROR! torn or unaccounted packets\n");
+    return ok ? 0 : 1;
+}
+
+// --replay: like main with `replay` set, into a new recording under --out.
+// The digests are the same on every run of one recording at any speed.
+static int runReplayBench(const BenchOptions &o)
+{
+    ReplayClock clock(o.speed);
+    ReplayDvsSource dvs(o.replay, clock);
+    ReplayD435Source d435(o.replay, clock);
+    const bool with_dvs = dvs.open(), with_d435 = d435.open();
+    if (!with_dvs && !with_d435) {
+        printf(" * ERROR! no recording found for %s\n", o.replay.c_str());
+        return 1;
+    }
+    capture_cfg.d435_depth = d435.hasDepth();
+    capture_cfg.replay = o.replay;
+    char pace[32] = "full speed";
+    if (o.speed > 0) sprintf(pace, "%gx", o.speed);
+    printf("capture_bench --replay %s at %s, events -> %s\n", o.replay.c_str(), pace, capture_cfg.evt_output.c_str());
+
+    char name[64];
+    sprintf(name, "/bench-%ld-replay", (long)time(nullptr));
+    std::string folder = o.out + name;
+    if (with_d435) mkdir(folder.c_str(), ACCESSPERMS);
+    membudget::Config mb;
+    mb.budget_bytes = (size_t)std::max(o.budget_mb >= 0 ? o.budget_mb : capture_cfg.mem_budget_mb, 0) << 20;
+    mb.events = capture_cfg.shed_events;
+    mb.evt_decimate = capture_cfg.shed_evt_decimate;
+    mb.evt_roi_percent = capture_cfg.shed_evt_roi_percent;
+    if (!membudget::start(folder + "-shed.txt", mb))
+        return 1;
+    if (!live::start(o.live.empty() ? capture_cfg.shm_name : o.live, (size_t)std::max(capture_cfg.shm_mb, 4) << 20))
+        return 1;
+
+    is_shutdown = false;
+    clearRoleThreads();
+    telemetry::reset();
+    startup::begin();
+    BenchResult res;
+    int dvs_ret = EXIT_SUCCESS, d435_ret = 0;
+    std::atomic_bool dvs_done{!with_dvs}, d435_done{!with_d435};
+    std::thread t_dvs, t_d435;
+    if (with_dvs)
+        t_dvs = std::thread([&] { dvs_ret = DVSMain(folder, dvs, &res.run); dvs_done = true; });
+    if (with_d435)
+        t_d435 = std::thread([&] { d435_ret = D435Main(folder, d435); d435_done = true; });
+    auto t0 = steady_clock::now();
+    while (!(dvs_done || dvs.finished()) || !(d435_done || d435.finished()))
+        std::this_thread::sleep_for(milliseconds(20));
+    // every pipeline thread started with the replay
+    std::map<int, long> cpu = sampleThreads();
+    const double dt = duration_cast<duration<double> >(steady_clock::now() - t0).count();
+
+    is_shutdown = true;
+    if (t_dvs.joinable()) t_dvs.join();
+    if (t_d435.joinable()) t_d435.join();
+    membudget::stop();
+    membudget::printSummary();
+    live::stop();
+    live::printSummary();
+    if (!o.keep) removeRecording(folder);
+
+    printf("\n");
+    if (with_dvs) printReplayStats("DVS", dvs.path(), dvs.stats());
+    if (with_d435) printReplayStats("D435", d435.path(), d435.stats());
+    if (with_dvs) {
+        printf("=== %lu events / %lu packets accepted, %lu packets dropped, %lu IMU, %lu APS frames\n",
+            res.run.events, res.run.packets, res.run.packets_dropped, res.run.imu, res.run.frames);
+        const double mb_s = res.run.elapsed_sec > 0 ? res.run.bytes / 1e6 / res.run.elapsed_sec : 0;
+        printf("    disk: %.1f MB/s (%.1f MB in %.1f s)\n", mb_s, res.run.bytes / 1e6, res.run.elapsed_sec);
+        if (res.run.noise_dropped)
+            printf("    noise filter dropped %lu events\n", res.run.noise_dropped);
+    }
+    const double hz = sysconf(_SC_CLK_TCK);
+    for (const RoleThread &t : roleThreads()) {
+        auto it = cpu.find(t.tid);
+        if (it != cpu.end() && it->second >= 0) res.cpu[t.role] += 100.0 * it->second / hz / dt;
+    }
+    printf("    CPU per stage:");
+    for (auto &kv : res.cpu)
+        printf(" %s %.0f%%", threadRoleName(kv.first), kv.second);
+    printf("\n");
+    telemetry::printSummary();
+    if (dvs_ret != EXIT_SUCCESS || d435_ret != 0) {
+        printf(" * ERROR! capture failed\n");
+        return 1;
+    }
+    return 0;
+}
+
+static void printResult(const BenchResult &r)
+{
+    printf("\n=== %.2f Mev/s target: %.2f Mev/s generated, %lu events / %lu packets accepted, %lu packets dropped\n",
+        r.target_rate / 1e6, r.gen_rate / 1e6, r.run.events, r.run.packets, r.run.packets_dropped);
+    printf("    disk: %.1f MB/s (%.1f MB in %.1f s), %lu IMU, %lu APS frames\n",
+        r.mb_per_sec, r.run.bytes / 1e6, r.run.elapsed_sec, r.run.imu, r.run.frames);
+    if (r.run.noise_dropped)
+        printf("    noise filter dropped %lu events\n", r.run.noise_dropped);
+    printf("    CPU per stage:");
+    for (auto &kv : r.cpu)
+        printf(" %s %.0f%%", threadRoleName(kv.first), kv.second);
+    printf("\n    %s\n", r.ok ? "keeps up" : "FALLS BEHIND");
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions o;
+    if (!parseArgs(argc, argv, o)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (o.convert)
+        return runConvertBench(o);
+    if (o.aps)
+        return runApsBench(o);
+    if (o.evt_alloc)
+        return runEvtAllocBench(o);
+    if (o.queue)
+        return runQueueBench(o);
+    if (o.evb_check)
+        return runEvbCheck(o);
+    if (o.compress)
+        return runCompressBench(o);
+    if (o.sync)
+        return runSyncBench(o);
+    if (o.noise)
+        return runNoiseBench(o);
+    if (o.mask)
+        return runMaskBench(o);
+    if (o.startup)
+        return runStartupBench(o);
+    if (o.depth)
+        return runDepthBench(o);
+    if (o.shm)
+        return runShmBench(o);
+    if (!loadCaptureConfig(o.config) || !setupThreadAffinity())
+        return 1;
+    if (o.rotate_mb >= 0) capture_cfg.rotate_mb = o.rotate_mb;
+    if (o.rotate_min >= 0) capture_cfg.rotate_min = o.rotate_min;
+    if (o.journal_ms >= 0) capture_cfg.journal_ms = o.journal_ms;
+    if (!o.replay.empty())
+        return runReplayBench(o);
+    printf("capture_bench: %s events, %d µs packets, %.0f APS fps, events -> %s%s\n",
+        o.dvs.distribution.c_str(), o.dvs.packet_us, o.dvs.frame_rate,
+        capture_cfg.evt_output.c_str(), o.d435 ? ", with D435" : "");
+
+    double rate = o.dvs.event_rate;
+    double sustained = 0;
+    std::vector<BenchResult> results;
+    for (;;) {
+        BenchResult r;
+        if (!runOnce(o, rate, r)) {
+            printf(" * ERROR! capture failed at %.2f Mev/s\n", rate / 1e6);
+            return 1;
+        }
+        printResult(r);
+        telemetry::printSummary();
+        results.push_back(r);
+        if (r.ok) sustained = rate;
+        if (!r.ok || o.sweep_max <= 0 || rate >= o.sweep_max) break;
+        rate = std::min(rate * 2, o.sweep_max);
+    }
+
+    if (o.sweep_max > 0) {
+        printf("\nrate_mev_s generated_mev_s mb_s dropped_packets ok\n");
+        for (const BenchResult &r : results)
+            printf("%.2f %.2f %.1f %lu %d\n", r.target_rate / 1e6, r.gen_rate / 1e6, r.mb_per_sec,
+                r.run.packets_dropped, r.ok ? 1 : 0);
+        if (sustained > 0)
+            printf("sustained without drops: %.2f Mev/s\n", sustained / 1e6);
+        else
+            printf("drops already at %.2f Mev/s\n", o.dvs.event_rate / 1e6);
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+// Exports frames from a D435 infrared container (<folder>/D435_ir.frames)
+// as D435_Img/%05d.png plus a D435_time.txt, i.e. the layout of d435_output:
+// png. A depth container (D435_depth.frames) goes to D435_Depth/%05d.png
+// (16-bit) and D435_depth_time.txt. A rotated recording is exported from its
+// manifest (D435_ir.manifest), all segments in order.
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+
+#include "FrameContainer.h"
+#include "Segments.h"
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        printf("usage: %s <D435_ir.frames|D435_depth.frames|*.manifest> <out_dir> [first_index] [last_index]\n", argv[0]);
+        return 1;
+    }
+    const uint64_t first = argc > 3 ? strtoull(argv[3], nullptr, 10) : 0;
+    const uint64_t last = argc > 4 ? strtoull(argv[4], nullptr, 10) : UINT64_MAX;
+
+    // a manifest stands for its segments, in order
+    std::vector<std::string> inputs;
+    const std::string in = argv[1];
+    if (in.size() > 9 && in.compare(in.size() - 9, 9, ".manifest") == 0) {
+        std::vector<SegmentInfo> segments;
+        if (!readManifest(in, segments)) {
+            printf(" * ERROR! cannot open %s\n", in.c_str());
+            return 1;
+        }
+        for (const SegmentInfo &s : segments)
+            inputs.insert(inputs.end(), s.files.begin(), s.files.end());
+    } else {
+        inputs.push_back(in);
+    }
+
+    std::string out_dir = argv[2];
+    std::string img_dir;
+    mkdir(out_dir.c_str(), ACCESSPERMS);
+    FILE *time_fp = nullptr;
+
+    uint64_t n = 0, bad = 0;
+    FrameRecordHeader hd;
+    cv::Mat img;
+    for (const std::string &path : inputs) {
+        FrameContainerReader reader;
+        if (!reader.open(path)) {
+            printf(" * ERROR! cannot open %s\n", path.c_str());
+            return 1;
+        }
+        if (reader.recovered())
+            printf(" * WARNING! %s has no index (unclean shutdown?), rebuilt %lu frames\n",
+                path.c_str(), reader.size());
+
+        for (size_t i = 0; i < reader.size(); i++) {
+            const FrameIndexEntry &e = reader.index()[i];
+            if (e.index < first || e.index > last) continue;
+            if (!reader.read(i, hd, img)) {
+                printf(" * WARNING! frame %lu is corrupt, skipped\n", e.index);
+                bad++;
+                continue;
+            }
+            // the first frame tells infrared from depth
+            if (!time_fp) {
+                const bool depth = hd.bytes_per_pixel == 2;
+                img_dir = out_dir + (depth ? "/D435_Depth" : "/D435_Img");
+                mkdir(img_dir.c_str(), ACCESSPERMS);
+                time_fp = fopen((out_dir + (depth ? "/D435_depth_time.txt" : "/D435_time.txt")).c_str(), "w");
+                if (!time_fp) {
+                    printf(" * ERROR! cannot write to %s\n", out_dir.c_str());
+                    return 1;
+                }
+            }
+            char name[32] = "";
+            sprintf(name, "%05lu.png", hd.index);
+            cv::imwrite(img_dir + "/" + name, img);
+            fprintf(time_fp, "%05lu %lld %.5f\n", hd.index, (long long)hd.stamp, hd.expo);
+            n++;
+        }
+    }
+    if (time_fp) fclose(time_fp);
+    printf("%lu frames -> %s (%lu corrupt)\n", n, img_dir.c_str(), bad);
+    return 0;
+}
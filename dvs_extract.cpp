@@ -0,0 +1,130 @@
+// Cuts a time window out of a recorded <folder>-dvs.bag, using the index of
+// DvsBagReader instead of reading the bag from the start. The window goes to
+// a smaller bag (all topics) or, for a .txt output, to an event list
+// "<ts_us> <x> <y> <polarity>".
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <rosbag/bag.h>
+#include <topic_tools/shape_shifter.h>
+
+#include "DvsBagReader.h"
+
+static bool endsWith(const std::string &s, const std::string &suffix)
+{
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static ros::Time usToTime(uint64_t us)
+{
+    return ros::Time(us / 1000000, (us % 1000000) * 1000);
+}
+
+static int writeText(const EventSoA &ev, const char *out)
+{
+    FILE *fp = fopen(out, "w");
+    if (!fp) {
+        printf(" * ERROR! cannot create %s\n", out);
+        return 1;
+    }
+    for (size_t i = 0; i < ev.size(); i++)
+        fprintf(fp, "%lu %u %u %u\n", ev.ts_us[i], ev.x[i], ev.y[i], ev.p[i]);
+    fclose(fp);
+    return 0;
+}
+
+static int writeBag(const DvsBagReader &reader, const std::vector<dvs_msgs::Event> &ev,
+                    uint64_t t0, uint64_t t1, const char *out)
+{
+    rosbag::Bag bag;
+    bag.open(out, rosbag::bagmode::Write);
+
+    // events keep the average packet size of the source
+    const DvsBagReader::Topic *et = reader.eventTopic();
+    if (et && !ev.empty()) {
+        std::pair<size_t, size_t> r = reader.range(*et, t0, t1);
+        const size_t per_msg = ev.size() / std::max<size_t>(r.second - r.first, 1) + 1;
+        dvs_msgs::EventArray msg;
+        msg.width = et->width;
+        msg.height = et->height;
+        for (size_t i = 0; i < ev.size(); i += per_msg) {
+            msg.events.assign(ev.begin() + i, ev.begin() + std::min(i + per_msg, ev.size()));
+            msg.header.stamp = msg.events.back().ts;
+            bag.write(et->name, msg.header.stamp, msg);
+        }
+    }
+
+    // everything else is copied serialized
+    topic_tools::ShapeShifter ss;
+    uint64_t n_msg = 0;
+    for (const DvsBagReader::Topic &t : reader.topics()) {
+        if (t.events) continue;
+        ss.morph(t.md5, t.datatype, t.definition, "");
+        std::pair<size_t, size_t> r = reader.range(t, t0, t1);
+        for (size_t i = r.first; i < r.second; i++) {
+            uint32_t len = 0;
+            const uint8_t *p = reader.payload(t, i, len);
+            ros::serialization::IStream s(const_cast<uint8_t *>(p), len);
+            ss.read(s);
+            bag.write(t.name, usToTime(t.entries[i].first_us), ss);
+            n_msg++;
+        }
+    }
+    bag.close();
+    printf("%lu events, %lu other messages -> %s\n", ev.size(), n_msg, out);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    bool abs_time = false, no_cache = false;
+    std::vector<const char *> args;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--abs") == 0) abs_time = true;
+        else if (strcmp(argv[i], "--no-cache") == 0) no_cache = true;
+        else args.push_back(argv[i]);
+    }
+    if (args.size() < 3) {
+        printf("usage: %s [--abs] [--no-cache] <in-dvs.bag> <t0_s> <t1_s> [out.bag|out.txt]\n", argv[0]);
+        printf("  t0/t1 are seconds from the start of the recording, or device time with --abs\n");
+        return 1;
+    }
+
+    DvsBagReader reader;
+    if (!reader.open(args[0], !no_cache)) {
+        printf(" * ERROR! %s\n", reader.error().c_str());
+        return 1;
+    }
+    uint64_t start_us = UINT64_MAX, end_us = 0;
+    for (const DvsBagReader::Topic &t : reader.topics()) {
+        printf("%-20s %-26s %8lu messages%s\n", t.name.c_str(), t.datatype.c_str(), t.entries.size(),
+            t.sorted ? "" : " (out of order)");
+        for (const BagIndexEntry &e : t.entries) {
+            start_us = std::min(start_us, e.first_us);
+            end_us = std::max(end_us, e.last_us);
+        }
+    }
+    if (start_us > end_us) start_us = end_us = 0;
+    printf("Index %s in %.1f ms, recording %.3f s\n", reader.fromCache() ? "loaded" : "built",
+        reader.indexSec() * 1e3, (end_us - start_us) / 1e6);
+
+    const double s0 = atof(args[1]), s1 = atof(args[2]);
+    const uint64_t base = abs_time ? 0 : start_us;
+    const uint64_t t0 = base + (uint64_t)(std::max(s0, 0.0) * 1e6), t1 = base + (uint64_t)(std::max(s1, 0.0) * 1e6);
+
+    auto q0 = std::chrono::steady_clock::now();
+    EventSoA soa;
+    std::vector<dvs_msgs::Event> aos;
+    const bool text = args.size() > 3 && endsWith(args[3], ".txt");
+    size_t n = text || args.size() < 4 ? reader.events(t0, t1, soa) : reader.events(t0, t1, aos);
+    const double q_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - q0).count();
+    printf("%lu events in [%.6f, %.6f) s, query %.3f ms\n", n, t0 / 1e6, t1 / 1e6, q_ms);
+
+    if (args.size() < 4) return 0;
+    return text ? writeText(soa, args[3]) : writeBag(reader, aos, t0, t1, args[3]);
+}
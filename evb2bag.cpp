@@ -0,0 +1,90 @@
+// Converts a compact (<folder>-dvs.evb) or chunked (<folder>-dvs.evc) event
+// file back to /dvs/events dvs_msgs::EventArray messages in a rosbag. A
+// compressed recording (<folder>-dvs.bagz) becomes the bag it replaced, all
+// topics included. So does the journal left behind by a crash
+// (<folder>-dvs.bag.journal), up to its last commit.
+#include <cstdio>
+#include <string>
+
+#include <rosbag/bag.h>
+#include <topic_tools/shape_shifter.h>
+
+#include "EventCodec.h"
+#include "ChunkedEventFile.h"
+#include "CompressedBag.h"
+
+static bool endsWith(const std::string &s, const std::string &suffix)
+{
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static int convertBagz(const char *in, const char *out)
+{
+    CompressedBagReader reader;
+    if (!reader.open(in)) {
+        printf(" * ERROR! cannot open %s\n", in);
+        return 1;
+    }
+    if (reader.recovered())
+        printf(" * WARNING! %s has no index (unclean shutdown?), rebuilt %lu chunks\n",
+            in, reader.index().size());
+    rosbag::Bag bag;
+    bag.open(out, rosbag::bagmode::Write);
+
+    // messages are copied over serialized, typed by their connection record
+    topic_tools::ShapeShifter ss;
+    CompressedBagReader::Message m;
+    uint64_t n_msg = 0, n_bad = 0;
+    while (reader.next(m)) {
+        // a message before its connection record has nothing to be typed by
+        if (m.conn >= reader.connections().size() || reader.connections()[m.conn].topic.empty()) {
+            n_bad++;
+            continue;
+        }
+        const BagzConnection &c = reader.connections()[m.conn];
+        ss.morph(c.md5, c.datatype, c.definition, "");
+        ros::serialization::IStream s(const_cast<uint8_t *>(m.data), m.size);
+        ss.read(s);
+        bag.write(c.topic, m.stamp, ss);
+        n_msg++;
+    }
+    bag.close();
+    printf("%lu chunks, %lu messages -> %s\n", reader.index().size(), n_msg, out);
+    if (n_bad) printf(" * ERROR! skipped %lu messages without a connection record\n", n_bad);
+    return reader.error() || n_bad ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        printf("usage: %s <in.evb|in.evc|in.bagz|in.journal> <out.bag> [topic]\n", argv[0]);
+        return 1;
+    }
+    if (endsWith(argv[1], ".bagz") || endsWith(argv[1], ".journal"))
+        return convertBagz(argv[1], argv[2]);
+    std::string topic = argc > 3 ? argv[3] : "/dvs/events";
+
+    const bool chunked = endsWith(argv[1], ".evc");
+    CompactEventReader reader;
+    ChunkedEventReader chunked_reader;
+    if (chunked ? !chunked_reader.open(argv[1]) : !reader.open(argv[1])) {
+        printf(" * ERROR! cannot open %s\n", argv[1]);
+        return 1;
+    }
+    if (chunked && chunked_reader.recovered())
+        printf(" * WARNING! %s has no index (unclean shutdown?), rebuilt %lu chunks\n",
+            argv[1], chunked_reader.index().size());
+    rosbag::Bag bag;
+    bag.open(argv[2], rosbag::bagmode::Write);
+
+    dvs_msgs::EventArray msg;
+    uint64_t n_msg = 0, n_evt = 0;
+    while (chunked ? chunked_reader.next(msg) : reader.next(msg)) {
+        bag.write(topic, msg.header.stamp, msg);
+        n_msg++;
+        n_evt += msg.events.size();
+    }
+    bag.close();
+    printf("%lu blocks, %lu events -> %s\n", n_msg, n_evt, argv[2]);
+    return 0;
+}
@@ -1,33 +1,147 @@
 #include <DVSCapture.h>
 #include <D435Capture.h>
+#include <CaptureConfig.h>
+#include <ThreadAffinity.h>
+#include <Preview.h>
+#include <SeesSource.h>
+#include <RealSenseSource.h>
+#include <Telemetry.h>
+#include <SensorSync.h>
+#include <MemoryBudget.h>
+#include <Startup.h>
+#include <LiveFeed.h>
+#include <ReplaySource.h>
+#include <algorithm>
+#include <memory>
 #include <thread>
+#include <vector>
 #include <iostream>
 #include <experimental/filesystem>
 #include <sys/stat.h>
 
 using namespace std;
+
+std::atomic_bool is_shutdown;
+
 int main(void)
 {
+	startup::begin();
+	if (!loadCaptureConfig("capture_config.yaml"))
+		return EXIT_FAILURE;
+	if (!setupThreadAffinity())
+		return EXIT_FAILURE;
+
 	// create folder
 	time_t now;
 	time(&now);
 	char folder_c[100];
 	sprintf(folder_c, "Capture-%ld", now);
 	string folder(folder_c);
+
+    // sources: the devices, or a recorded session
+    unique_ptr<DvsSource> dvs;
+    unique_ptr<D435Source> d435;
+    unique_ptr<ReplayClock> replay_clock;
+    ReplayDvsSource *replay_dvs = nullptr;
+    ReplayD435Source *replay_d435 = nullptr;
+    if (!capture_cfg.replay.empty()) {
+        replay_clock.reset(new ReplayClock(capture_cfg.replay_speed));
+        replay_dvs = new ReplayDvsSource(capture_cfg.replay, *replay_clock);
+        dvs.reset(replay_dvs);
+        replay_d435 = new ReplayD435Source(capture_cfg.replay, *replay_clock);
+        d435.reset(replay_d435);
+        capture_cfg.capture_dvs = replay_dvs->open();
+        capture_cfg.capture_d435 = replay_d435->open();
+        capture_cfg.d435_depth = replay_d435->hasDepth();
+        if (!capture_cfg.capture_dvs && !capture_cfg.capture_d435) {
+            printf(" * ERROR! no recording found for replay: %s\n", capture_cfg.replay.c_str());
+            return EXIT_FAILURE;
+        }
+    } else {
+        dvs.reset(new SeesSource);
+        d435.reset(new RealSenseSource(capture_cfg.d435_depth));
+    }
     // experimental::filesystem::create_directories(folder);
-    // mkdir(folder.c_str(), ACCESSPERMS);
+    if (capture_cfg.capture_d435)
+        mkdir(folder.c_str(), ACCESSPERMS);
 
-    // multipe thread
+    if (!telemetry::start(folder + "-stats.jsonl", capture_cfg.stats_period_ms, capture_cfg.telemetry_port))
+        return EXIT_FAILURE;
+    // their threads must be joined before exit, on error paths too
+    auto stopServices = [] {
+        live::stop();
+        membudget::stop();
+        telemetry::stop();
+    };
 
-    // thread t1(DVSMain, folder);
-    // thread t2(D435Main, folder);
-    // t1.join();
-    // t2.join();
+    membudget::Config mb;
+    mb.budget_bytes = (size_t)max(capture_cfg.mem_budget_mb, 0) << 20;
+    mb.events = capture_cfg.shed_events;
+    mb.evt_decimate = capture_cfg.shed_evt_decimate;
+    mb.evt_roi_percent = capture_cfg.shed_evt_roi_percent;
+    if (!membudget::start(folder + "-shed.txt", mb) ||
+        !live::start(capture_cfg.shm_name, (size_t)max(capture_cfg.shm_mb, 4) << 20)) {
+        stopServices();
+        return EXIT_FAILURE;
+    }
 
+    // DVS/D435 pairing, needs both sensors
+    unique_ptr<SensorSync> sync;
+    if (capture_cfg.sync_output && capture_cfg.capture_dvs && capture_cfg.capture_d435) {
+        SensorSync::Options so;
+        so.max_dt_ms = capture_cfg.sync_max_dt_ms;
+        so.evt_window_ms = capture_cfg.sync_evt_window_ms;
+        so.queue_size = (size_t)max(capture_cfg.sync_queue_size, 2);
+        so.d435_offset_us = capture_cfg.sync_d435_offset_us;
+        sync.reset(new SensorSync(so));
+        if (!sync->start(folder + "-sync.txt")) {
+            stopServices();
+            return EXIT_FAILURE;
+        }
+    }
 
-    // single thread
+    // multipe thread: one per sensor, a failing sensor stops the capture
+    is_shutdown = false;
+    vector<thread> sensors;
+    if (capture_cfg.capture_dvs)
+        sensors.emplace_back([&] { if (DVSMain(folder, *dvs, nullptr, sync.get()) != EXIT_SUCCESS) is_shutdown = true; });
+    if (capture_cfg.capture_d435)
+        sensors.emplace_back([&] { if (D435Main(folder, *d435, sync.get()) != 0) is_shutdown = true; });
+    if (sensors.empty()) {
+        printf(" * ERROR! capture_dvs and capture_d435 are both off\n");
+        stopServices();
+        return EXIT_FAILURE;
+    }
 
-    DVSMain(folder);
+    // this thread only drives the preview
+    applyThreadRole(ThreadRole::Preview);
+    while (!is_shutdown)
+    {
+        if (previewSpinOnce(30) == 'q')
+            is_shutdown = true;
+        // a replay ends with the recording
+        if (replay_clock && (!capture_cfg.capture_dvs || replay_dvs->finished()) &&
+            (!capture_cfg.capture_d435 || replay_d435->finished()))
+            is_shutdown = true;
+    }
+    for (auto &t : sensors)
+        t.join();
+    if (replay_clock) {
+        if (capture_cfg.capture_dvs) printReplayStats("DVS", replay_dvs->path(), replay_dvs->stats());
+        if (capture_cfg.capture_d435) printReplayStats("D435", replay_d435->path(), replay_d435->stats());
+    }
+    if (sync) {
+        sync->stop();
+        sync->printStats();
+    }
+    previewClose();
+    membudget::stop();
+    live::stop();
+    startup::printSummary();
+    membudget::printSummary();
+    live::printSummary();
+    telemetry::stop();
+    telemetry::printSummary();
 
     cout << "Over" << endl;
     return 0;
@@ -0,0 +1,193 @@
+// Sample reader of the live output (LiveFeed.h): follows the shared memory
+// rings /dev/shm/<name>.events, .imu, .aps and .d435, one thread per stream,
+// and prints once a second what arrived, the latency from publish to read
+// and how many records were lost to overwriting. Needs nothing but
+// ShmRing.h/.cpp, so a consumer can start from a copy of this file.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ShmRing.h"
+
+static std::atomic_bool stop_flag{false};
+
+struct StreamStats {
+    std::mutex m;
+    bool connected = false;
+    uint64_t records = 0, bytes = 0, items = 0;
+    uint64_t lost = 0, overwritten = 0;
+    std::vector<uint32_t> latency_us;
+    std::string last;
+};
+
+// what a reader would do with the record; false if it is malformed
+static bool use(ShmStream s, const ShmSubscriber::Record &r, uint64_t &items, char *last, size_t last_size)
+{
+    const uint8_t *p = r.data;
+    switch (s) {
+    case SHM_EVENTS: {
+        ShmEvents hd;
+        if (r.bytes < sizeof(hd)) return false;
+        memcpy(&hd, p, sizeof(hd));
+        if (sizeof(hd) + (uint64_t)hd.count * sizeof(ShmEvent) != r.bytes) return false;
+        const ShmEvent *ev = reinterpret_cast<const ShmEvent *>(p + sizeof(hd));
+        uint64_t on = 0;
+        for (uint32_t i = 0; i < hd.count; i++)
+            on += ev[i].polarity;
+        items = hd.count;
+        snprintf(last, last_size, "packet %u: %u events (%lu on) %ux%u", hd.seq, hd.count, on, hd.width, hd.height);
+        return true;
+    }
+    case SHM_IMU: {
+        ShmImu imu;
+        if (r.bytes != sizeof(imu)) return false;
+        memcpy(&imu, p, sizeof(imu));
+        items = 1;
+        snprintf(last, last_size, "acc %.2f %.2f %.2f gyro %.3f %.3f %.3f",
+            imu.acc[0], imu.acc[1], imu.acc[2], imu.gyro[0], imu.gyro[1], imu.gyro[2]);
+        return true;
+    }
+    case SHM_APS:
+    case SHM_D435: {
+        ShmImage hd;
+        if (r.bytes < sizeof(hd)) return false;
+        memcpy(&hd, p, sizeof(hd));
+        if (sizeof(hd) + (uint64_t)hd.width * hd.height * hd.bytes_per_pixel != r.bytes) return false;
+        items = 1;
+        snprintf(last, last_size, "frame %lu %ux%u x%u, expo %.2f ms", hd.index, hd.width, hd.height,
+            hd.bytes_per_pixel, hd.expo);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+static void follow(const std::string &name, ShmStream s, StreamStats &st)
+{
+    const std::string path = "/" + name + "." + shmStreamName(s);
+    ShmSubscriber sub;
+    while (!stop_flag) {
+        if (!sub.open(path) || sub.stream() != s) {
+            sub.close();
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lck(st.m);
+            st.connected = true;
+        }
+        uint64_t lost0 = 0;
+        while (!stop_flag) {
+            ShmSubscriber::Record r;
+            if (!sub.next(r)) {
+                if (sub.alive()) {
+                    sub.wait(100);
+                    continue;
+                }
+                if (!sub.next(r)) break;
+            }
+            uint64_t items = 0;
+            char last[128];
+            const bool ok = use(s, r, items, last, sizeof(last));
+            const int64_t now = shmNowNs(), published = r.hd->publish_ns;
+            // everything read from r is only good if it was not overwritten meanwhile
+            const bool valid = sub.valid(r);
+            std::lock_guard<std::mutex> lck(st.m);
+            st.lost += sub.lost() - lost0;
+            lost0 = sub.lost();
+            if (!valid || !ok) {
+                st.overwritten++;
+                continue;
+            }
+            st.records++;
+            st.bytes += r.bytes;
+            st.items += items;
+            st.latency_us.push_back((uint32_t)std::max<int64_t>((now - published) / 1000, 0));
+            st.last = last;
+        }
+        std::lock_guard<std::mutex> lck(st.m);
+        st.connected = false;
+        sub.close();
+    }
+}
+
+static uint32_t percentile(std::vector<uint32_t> &v, double p)
+{
+    if (v.empty()) return 0;
+    const size_t k = std::min(v.size() - 1, (size_t)(p * v.size()));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+static void onSignal(int)
+{
+    stop_flag = true;
+}
+
+int main(int argc, char **argv)
+{
+    std::string name = "dvs";
+    double seconds = 0;
+    std::vector<bool> want(SHM_STREAMS, true);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--streams") == 0 && i + 1 < argc) {
+            const std::string list = std::string(",") + argv[++i] + ",";
+            for (int s = 0; s < SHM_STREAMS; s++)
+                want[s] = list.find(std::string(",") + shmStreamName((ShmStream)s) + ",") != std::string::npos;
+        } else if (argv[i][0] == '-') {
+            printf("usage: %s [--streams events,imu,aps,d435] [--seconds S] [shm_name]\n", argv[0]);
+            printf("  shm_name as in capture_config.yaml (default dvs); runs until Ctrl-C without --seconds\n");
+            return 1;
+        } else {
+            name = argv[i];
+        }
+    }
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    StreamStats stats[SHM_STREAMS];
+    std::vector<std::thread> threads;
+    for (int s = 0; s < SHM_STREAMS; s++)
+        if (want[s])
+            threads.emplace_back(follow, name, (ShmStream)s, std::ref(stats[s]));
+    printf("Following /dev/shm/%s.*\n", name.c_str());
+
+    auto t0 = std::chrono::steady_clock::now(), last = t0;
+    while (!stop_flag) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        auto now = std::chrono::steady_clock::now();
+        const double dt = std::chrono::duration<double>(now - last).count();
+        last = now;
+        for (int s = 0; s < SHM_STREAMS; s++) {
+            if (!want[s]) continue;
+            StreamStats &st = stats[s];
+            std::lock_guard<std::mutex> lck(st.m);
+            if (!st.connected && st.records == 0) {
+                printf("%-6s  waiting for the publisher\n", shmStreamName((ShmStream)s));
+                continue;
+            }
+            printf("%-6s %7.0f rec/s %9.0f items/s %7.1f MB/s  latency p50 %5u us p99 %6u us  lost %lu overwritten %lu  %s\n",
+                shmStreamName((ShmStream)s), st.records / dt, st.items / dt, st.bytes / 1e6 / dt,
+                percentile(st.latency_us, 0.5), percentile(st.latency_us, 0.99), st.lost, st.overwritten,
+                st.last.c_str());
+            st.records = st.bytes = st.items = st.lost = st.overwritten = 0;
+            st.latency_us.clear();
+        }
+        if (seconds > 0 && std::chrono::duration<double>(now - t0).count() >= seconds)
+            stop_flag = true;
+    }
+    for (auto &t : threads)
+        t.join();
+    return 0;
+}